@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include "blake3.h"
+
+enum { CHUNK_START = 1, CHUNK_END = 2, PARENT = 4, ROOT = 8 };
+
+static const uint32_t BLAKE3_IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+// Message word order of each of the 7 rounds
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static inline uint32_t load_le32(const uint8_t *p) {
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+#define LANES 1
+#define VEC vec1
+#define TARGET
+#define SUFFIX 1
+typedef uint32_t vec1 __attribute__((vector_size(4)));
+#include "blake3_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+
+#ifdef __SSE2__
+#define LANES 4
+#define VEC vec4
+#define TARGET
+#define SUFFIX 4
+typedef uint32_t vec4 __attribute__((vector_size(16)));
+#include "blake3_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+#endif
+
+// As in mbhash.c: wider lanes are compiled for their instruction set and
+// picked at run time
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BLAKE3_WIDE 1
+#define LANES 8
+#define VEC vec8
+#define TARGET __attribute__((target("avx2")))
+#define SUFFIX 8
+typedef uint32_t vec8 __attribute__((vector_size(32)));
+#include "blake3_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+
+#define LANES 16
+#define VEC vec16
+#define TARGET __attribute__((target("avx512f")))
+#define SUFFIX 16
+typedef uint32_t vec16 __attribute__((vector_size(64)));
+#include "blake3_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+#endif
+
+int blake3_lanes(void) {
+#ifdef BLAKE3_WIDE
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return 16;
+    if (__builtin_cpu_supports("avx2")) return 8;
+#endif
+#ifdef __SSE2__
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+// count is at most BLAKE3_BATCH_CHUNKS; chunks past the last full group of lanes take the one-lane path
+static void hash_chunks(const uint8_t *in, size_t count, uint64_t counter, uint32_t (*cvs)[8]) {
+    size_t wide = 0;
+    switch (blake3_lanes()) {
+#ifdef BLAKE3_WIDE
+    case 16:
+        wide = count / 16 * 16;
+        blake3_chunks_16(in, wide, counter, cvs);
+        break;
+    case 8:
+        wide = count / 8 * 8;
+        blake3_chunks_8(in, wide, counter, cvs);
+        break;
+#endif
+#ifdef __SSE2__
+    case 4:
+        wide = count / 4 * 4;
+        blake3_chunks_4(in, wide, counter, cvs);
+        break;
+#endif
+    default:
+        break;
+    }
+    blake3_chunks_1(in + wide * BLAKE3_CHUNK_LEN, count - wide, counter + wide, cvs + wide);
+}
+
+// One compression of a single block, for the final chunk and parent nodes
+static void compress(const uint32_t cv[8], const uint8_t block[64], uint64_t counter, uint32_t block_len,
+                     uint32_t flags, uint32_t out[8]) {
+    uint32_t m[16], v[16];
+    for (int i = 0; i < 16; i++) m[i] = load_le32(block + 4 * i);
+    for (int i = 0; i < 8; i++) v[i] = cv[i];
+    for (int i = 0; i < 4; i++) v[8 + i] = BLAKE3_IV[i];
+    v[12] = (uint32_t)counter;
+    v[13] = (uint32_t)(counter >> 32);
+    v[14] = block_len;
+    v[15] = flags;
+    for (int r = 0; r < 7; r++) {
+        const uint8_t *s = MSG_SCHEDULE[r];
+        // Columns, then diagonals
+        for (int half = 0; half < 2; half++) {
+            for (int i = 0; i < 4; i++) {
+                int a = i, b = 4 + (i + half) % 4, c = 8 + (i + 2 * half) % 4, d = 12 + (i + 3 * half) % 4;
+                uint32_t x = m[s[8 * half + 2 * i]], y = m[s[8 * half + 2 * i + 1]];
+                v[a] += v[b] + x;
+                v[d] = (v[d] ^ v[a]) >> 16 | (v[d] ^ v[a]) << 16;
+                v[c] += v[d];
+                v[b] = (v[b] ^ v[c]) >> 12 | (v[b] ^ v[c]) << 20;
+                v[a] += v[b] + y;
+                v[d] = (v[d] ^ v[a]) >> 8 | (v[d] ^ v[a]) << 24;
+                v[c] += v[d];
+                v[b] = (v[b] ^ v[c]) >> 7 | (v[b] ^ v[c]) << 25;
+            }
+        }
+    }
+    for (int i = 0; i < 8; i++) out[i] = v[i] ^ v[i + 8];
+}
+
+static void parent_cv(const uint32_t left[8], const uint32_t right[8], uint32_t flags, uint32_t out[8]) {
+    uint8_t block[64];
+    for (int i = 0; i < 8; i++) {
+        for (int b = 0; b < 4; b++) {
+            block[4 * i + b] = (uint8_t)(left[i] >> (8 * b));
+            block[32 + 4 * i + b] = (uint8_t)(right[i] >> (8 * b));
+        }
+    }
+    compress(BLAKE3_IV, block, 0, 64, PARENT | flags, out);
+}
+
+// Fold the chaining value of a chunk that is known not to be the last one:
+// every completed pair of subtrees is merged right away
+static void push_chunk(Blake3 *h, const uint32_t cv[8]) {
+    uint32_t merged[8];
+    memcpy(merged, cv, sizeof(merged));
+    h->chunks++;
+    for (uint64_t total = h->chunks; (total & 1) == 0; total >>= 1) {
+        h->stack_len--;
+        parent_cv(h->stack[h->stack_len], merged, 0, merged);
+    }
+    memcpy(h->stack[h->stack_len++], merged, sizeof(merged));
+}
+
+// Hash count whole chunks; the caller guarantees more input follows them
+static void add_chunks(Blake3 *h, const uint8_t *in, size_t count) {
+    uint32_t cvs[BLAKE3_BATCH_CHUNKS][8];
+    hash_chunks(in, count, h->chunks, cvs);
+    for (size_t i = 0; i < count; i++) push_chunk(h, cvs[i]);
+}
+
+void blake3_init(Blake3 *h) {
+    h->stack_len = 0;
+    h->chunks = 0;
+    h->buf_len = 0;
+}
+
+void blake3_update(Blake3 *h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        if (h->buf_len == sizeof(h->buf)) {
+            add_chunks(h, h->buf, BLAKE3_BATCH_CHUNKS);
+            h->buf_len = 0;
+        }
+        // Whole batches straight from the caller's buffer, always leaving input
+        // behind so the last chunk is finalized by blake3_final
+        while (h->buf_len == 0 && len > sizeof(h->buf)) {
+            add_chunks(h, p, BLAKE3_BATCH_CHUNKS);
+            p += sizeof(h->buf);
+            len -= sizeof(h->buf);
+        }
+        size_t n = sizeof(h->buf) - h->buf_len < len ? sizeof(h->buf) - h->buf_len : len;
+        memcpy(h->buf + h->buf_len, p, n);
+        h->buf_len += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void blake3_final(Blake3 *h, uint8_t out[BLAKE3_OUT_LEN]) {
+    // Every buffered chunk but the last is an ordinary one
+    size_t full = h->buf_len > 0 ? (h->buf_len - 1) / BLAKE3_CHUNK_LEN : 0;
+    if (full > 0) add_chunks(h, h->buf, full);
+    const uint8_t *last = h->buf + full * BLAKE3_CHUNK_LEN;
+    size_t last_len = h->buf_len - full * BLAKE3_CHUNK_LEN;
+
+    // The last chunk, block by block; it is the root when it is the only chunk
+    uint32_t cv[8];
+    memcpy(cv, BLAKE3_IV, sizeof(cv));
+    size_t blocks = last_len > 0 ? (last_len + 63) / 64 : 1;
+    for (size_t b = 0; b < blocks; b++) {
+        uint8_t block[64] = {0};
+        size_t n = last_len - b * 64 < 64 ? last_len - b * 64 : 64;
+        memcpy(block, last + b * 64, n);
+        uint32_t flags = (b == 0 ? CHUNK_START : 0);
+        if (b == blocks - 1) flags |= CHUNK_END | (h->stack_len == 0 ? ROOT : 0);
+        compress(cv, block, h->chunks, (uint32_t)n, flags, cv);
+    }
+    for (int i = h->stack_len - 1; i >= 0; i--) parent_cv(h->stack[i], cv, i == 0 ? ROOT : 0, cv);
+
+    for (int i = 0; i < 8; i++) {
+        for (int b = 0; b < 4; b++) out[4 * i + b] = (uint8_t)(cv[i] >> (8 * b));
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_BATCH_CHUNKS 16  // Chunks buffered and compressed side by side, one per SIMD lane
+#define BLAKE3_MAX_DEPTH 54  // Subtrees pending on the stack for inputs up to 2^64 bytes
+
+// Streaming BLAKE3 (unkeyed, 32-byte output). Whole chunks are compressed in
+// parallel across SIMD lanes (16 with AVX-512, 8 with AVX2, 4 with SSE2) and
+// folded into the hash tree as they complete, so updates of a few kilobytes
+// or more run at close to memory speed.
+typedef struct {
+    uint32_t stack[BLAKE3_MAX_DEPTH][8];  // Chaining values of completed subtrees
+    int stack_len;
+    uint64_t chunks;  // Chunks folded into the stack
+    uint8_t buf[BLAKE3_BATCH_CHUNKS * BLAKE3_CHUNK_LEN];
+    size_t buf_len;
+} Blake3;
+
+void blake3_init(Blake3 *h);
+void blake3_update(Blake3 *h, const void *data, size_t len);
+// Consumes the hasher; blake3_init it again to reuse it
+void blake3_final(Blake3 *h, uint8_t out[BLAKE3_OUT_LEN]);
+
+// Lanes in use, for logs
+int blake3_lanes(void);
+
+#endif
@@ -0,0 +1,72 @@
+// BLAKE3 chunk compression over LANES whole chunks at once, one chunk per
+// vector lane. Included by blake3.c once per instruction set with LANES, VEC
+// (a GCC vector of LANES uint32_t), TARGET (function attributes) and SUFFIX
+// defined; no include guard on purpose.
+
+#define LANE_FN2(name, suffix) name##_##suffix
+#define LANE_FN1(name, suffix) LANE_FN2(name, suffix)
+#define LANE_FN(name) LANE_FN1(name, SUFFIX)
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define G(a, b, c, d, x, y)            \
+    do {                               \
+        v[a] = v[a] + v[b] + (x);      \
+        v[d] = ROTR(v[d] ^ v[a], 16);  \
+        v[c] = v[c] + v[d];            \
+        v[b] = ROTR(v[b] ^ v[c], 12);  \
+        v[a] = v[a] + v[b] + (y);      \
+        v[d] = ROTR(v[d] ^ v[a], 8);   \
+        v[c] = v[c] + v[d];            \
+        v[b] = ROTR(v[b] ^ v[c], 7);   \
+    } while (0)
+
+// Chaining values of count whole chunks starting at in, numbered from counter;
+// count must be a multiple of LANES
+TARGET static void LANE_FN(blake3_chunks)(const uint8_t *in, size_t count, uint64_t counter, uint32_t (*cvs)[8]) {
+    for (size_t first = 0; first < count; first += LANES) {
+        VEC h[8], m[16], v[16], counter_lo, counter_hi;
+        for (int l = 0; l < LANES; l++) {
+            uint64_t c = counter + first + (size_t)l;
+            counter_lo[l] = (uint32_t)c;
+            counter_hi[l] = (uint32_t)(c >> 32);
+        }
+        for (int i = 0; i < 8; i++) h[i] = (VEC){0} + BLAKE3_IV[i];
+
+        for (int block = 0; block < BLAKE3_CHUNK_LEN / 64; block++) {
+            for (int l = 0; l < LANES; l++) {
+                const uint8_t *b = in + (first + (size_t)l) * BLAKE3_CHUNK_LEN + block * 64;
+                for (int i = 0; i < 16; i++) m[i][l] = load_le32(b + 4 * i);
+            }
+            uint32_t flags = (block == 0 ? CHUNK_START : 0) | (block == BLAKE3_CHUNK_LEN / 64 - 1 ? CHUNK_END : 0);
+            for (int i = 0; i < 8; i++) v[i] = h[i];
+            for (int i = 0; i < 4; i++) v[8 + i] = (VEC){0} + BLAKE3_IV[i];
+            v[12] = counter_lo;
+            v[13] = counter_hi;
+            v[14] = (VEC){0} + 64;
+            v[15] = (VEC){0} + flags;
+            // Unrolled so the schedule indexes constant message registers
+#pragma GCC unroll 7
+            for (int r = 0; r < 7; r++) {
+                const uint8_t *s = MSG_SCHEDULE[r];
+                G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+                G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+                G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+                G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+                G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+                G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+                G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+                G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+            }
+            for (int i = 0; i < 8; i++) h[i] = v[i] ^ v[i + 8];
+        }
+        for (int l = 0; l < LANES; l++) {
+            for (int i = 0; i < 8; i++) cvs[first + (size_t)l][i] = h[i][l];
+        }
+    }
+}
+
+#undef ROTR
+#undef G
+#undef LANE_FN
+#undef LANE_FN1
+#undef LANE_FN2
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "charset.h"
+
+// Code points of bytes 0x80-0xFF; undefined bytes map to U+FFFD
+static const uint16_t CP1251_HIGH[128] = {
+    0x0402, 0x0403, 0x201a, 0x0453, 0x201e, 0x2026, 0x2020, 0x2021,
+    0x20ac, 0x2030, 0x0409, 0x2039, 0x040a, 0x040c, 0x040b, 0x040f,
+    0x0452, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+    0xfffd, 0x2122, 0x0459, 0x203a, 0x045a, 0x045c, 0x045b, 0x045f,
+    0x00a0, 0x040e, 0x045e, 0x0408, 0x00a4, 0x0490, 0x00a6, 0x00a7,
+    0x0401, 0x00a9, 0x0404, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x0407,
+    0x00b0, 0x00b1, 0x0406, 0x0456, 0x0491, 0x00b5, 0x00b6, 0x00b7,
+    0x0451, 0x2116, 0x0454, 0x00bb, 0x0458, 0x0405, 0x0455, 0x0457,
+    0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+    0x0418, 0x0419, 0x041a, 0x041b, 0x041c, 0x041d, 0x041e, 0x041f,
+    0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+    0x0428, 0x0429, 0x042a, 0x042b, 0x042c, 0x042d, 0x042e, 0x042f,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    0x0438, 0x0439, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e, 0x043f,
+    0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    0x0448, 0x0449, 0x044a, 0x044b, 0x044c, 0x044d, 0x044e, 0x044f,
+};
+
+static const uint16_t CP1252_HIGH[128] = {
+    0x20ac, 0xfffd, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+    0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0xfffd, 0x017d, 0xfffd,
+    0xfffd, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+    0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0xfffd, 0x017e, 0x0178,
+    0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7,
+    0x00a8, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+    0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+    0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+    0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+    0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+    0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff,
+};
+
+static int is_text_byte(uint8_t c) {
+    return (c >= 0x20 && c < 0x7f) || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Strict UTF-8 check; a sequence cut off by the end of the sample is accepted
+static int valid_utf8(const uint8_t *s, size_t len) {
+    for (size_t i = 0; i < len;) {
+        uint8_t c = s[i];
+        size_t n;
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if (c >= 0xc2 && c <= 0xdf) {
+            n = 1;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            n = 2;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 3;
+        } else {
+            return 0;
+        }
+        for (size_t k = 1; k <= n; k++) {
+            if (i + k >= len) return 1;
+            if ((s[i + k] & 0xc0) != 0x80) return 0;
+        }
+        i += n + 1;
+    }
+    return 1;
+}
+
+Charset charset_detect(const void *data, size_t len, size_t *bom_len) {
+    const uint8_t *s = data;
+    *bom_len = 0;
+    if (len >= 3 && s[0] == 0xef && s[1] == 0xbb && s[2] == 0xbf) {
+        *bom_len = 3;
+        return CHARSET_UTF8;
+    }
+    if (len >= 2 && s[0] == 0xff && s[1] == 0xfe) {
+        *bom_len = 2;
+        return CHARSET_UTF16LE;
+    }
+    if (len >= 2 && s[0] == 0xfe && s[1] == 0xff) {
+        *bom_len = 2;
+        return CHARSET_UTF16BE;
+    }
+
+    size_t n = len < CHARSET_SNIFF_BYTES ? len : CHARSET_SNIFF_BYTES;
+    // UTF-16 without a mark: ASCII characters leave a zero in every other byte.
+    // Their other byte must be text too, or 16-bit binary tables would match.
+    size_t pairs = n / 2, zero_even = 0, zero_odd = 0, text_even = 0, text_odd = 0;
+    for (size_t i = 0; i + 1 < n; i += 2) {
+        if (s[i] == 0) {
+            zero_even++;
+            text_odd += is_text_byte(s[i + 1]);
+        }
+        if (s[i + 1] == 0) {
+            zero_odd++;
+            text_even += is_text_byte(s[i]);
+        }
+    }
+    if (pairs >= 4 && zero_odd * 10 >= pairs * 3 && zero_even * 20 <= pairs && text_even * 10 >= zero_odd * 9) {
+        return CHARSET_UTF16LE;
+    }
+    if (pairs >= 4 && zero_even * 10 >= pairs * 3 && zero_odd * 20 <= pairs && text_odd * 10 >= zero_even * 9) {
+        return CHARSET_UTF16BE;
+    }
+    if (memchr(s, 0, n) || valid_utf8(s, n)) return CHARSET_UTF8;
+
+    // Cyrillic words are runs of bytes from 0xC0 up; Western accents sit between ASCII letters
+    size_t high = 0, high_pairs = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] < 0x80) continue;
+        high++;
+        if (i + 1 < n && s[i] >= 0xc0 && s[i + 1] >= 0xc0) high_pairs++;
+    }
+    return high_pairs * 2 >= high ? CHARSET_CP1251 : CHARSET_CP1252;
+}
+
+const char *charset_name(Charset charset) {
+    switch (charset) {
+    case CHARSET_UTF16LE:
+        return "UTF-16LE";
+    case CHARSET_UTF16BE:
+        return "UTF-16BE";
+    case CHARSET_CP1251:
+        return "CP1251";
+    case CHARSET_CP1252:
+        return "CP1252";
+    default:
+        return "UTF-8";
+    }
+}
+
+void transcoder_begin(Transcoder *t, const void *first_block, size_t len) {
+    t->charset = charset_detect(first_block, len, &t->skip);
+    t->odd_byte = -1;
+    t->high_surrogate = 0;
+}
+
+static inline size_t put_code_point(char *o, uint32_t cp) {
+    if (cp < 0x80) {
+        o[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        o[0] = (char)(0xc0 | cp >> 6);
+        o[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        o[0] = (char)(0xe0 | cp >> 12);
+        o[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        o[2] = (char)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+    o[0] = (char)(0xf0 | cp >> 18);
+    o[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+    o[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    o[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+static inline size_t put_unit(Transcoder *t, char *o, uint32_t unit) {
+    size_t n = 0;
+    if (t->high_surrogate) {
+        if (unit >= 0xdc00 && unit <= 0xdfff) {
+            uint32_t cp = 0x10000 + ((t->high_surrogate - 0xd800) << 10) + (unit - 0xdc00);
+            t->high_surrogate = 0;
+            return put_code_point(o, cp);
+        }
+        t->high_surrogate = 0;
+        n = put_code_point(o, 0xfffd);
+    }
+    if (unit >= 0xd800 && unit <= 0xdbff) {
+        t->high_surrogate = unit;
+        return n;
+    }
+    return n + put_code_point(o + n, unit >= 0xdc00 && unit <= 0xdfff ? 0xfffd : unit);
+}
+
+static size_t from_utf16(Transcoder *t, const uint8_t *s, size_t len, char *o) {
+    int be = t->charset == CHARSET_UTF16BE;
+    size_t i = 0, used = 0;
+    if (t->odd_byte >= 0 && len > 0) {
+        uint32_t unit = be ? (uint32_t)t->odd_byte << 8 | s[0] : (uint32_t)s[0] << 8 | (uint32_t)t->odd_byte;
+        t->odd_byte = -1;
+        used += put_unit(t, o, unit);
+        i = 1;
+    }
+    while (i + 1 < len) {
+#ifdef __SSE2__
+        // 16 units below 0x80 at a time: narrow them with one pack
+        if (!t->high_surrogate && i + 32 <= len) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+            if (be) {
+                a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+                b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+            }
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xff80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xffff) {
+                _mm_storeu_si128((__m128i *)(o + used), _mm_packus_epi16(a, b));
+                used += 16;
+                i += 32;
+                continue;
+            }
+        }
+#endif
+        uint32_t unit = be ? (uint32_t)s[i] << 8 | s[i + 1] : (uint32_t)s[i + 1] << 8 | s[i];
+        used += put_unit(t, o + used, unit);
+        i += 2;
+    }
+    if (i < len) t->odd_byte = s[i];
+    return used;
+}
+
+static size_t from_codepage(const uint16_t *table, const uint8_t *s, size_t len, char *o) {
+    size_t i = 0, used = 0;
+    while (i < len) {
+#ifdef __SSE2__
+        if (i + 16 <= len) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            if (_mm_movemask_epi8(v) == 0) {
+                _mm_storeu_si128((__m128i *)(o + used), v);
+                used += 16;
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        uint8_t c = s[i++];
+        if (c < 0x80) o[used++] = (char)c;
+        else used += put_code_point(o + used, table[c - 0x80]);
+    }
+    return used;
+}
+
+const char *transcoder_feed(Transcoder *t, const void *data, size_t len, size_t *out_len) {
+    const uint8_t *s = data;
+    size_t skip = t->skip < len ? t->skip : len;
+    t->skip -= skip;
+    s += skip;
+    len -= skip;
+    if (t->charset == CHARSET_UTF8) {
+        *out_len = len;
+        return (const char *)s;
+    }
+
+    // Worst cases: 3 bytes per code page byte, 3 per UTF-16 byte pair plus a
+    // replaced surrogate carried in from the previous block
+    size_t need = 3 * len + 8;
+    if (need > t->out_cap) {
+        char *out = realloc(t->out, need);
+        if (!out) return NULL;
+        t->out = out;
+        t->out_cap = need;
+    }
+    if (t->charset == CHARSET_CP1251) *out_len = from_codepage(CP1251_HIGH, s, len, t->out);
+    else if (t->charset == CHARSET_CP1252) *out_len = from_codepage(CP1252_HIGH, s, len, t->out);
+    else *out_len = from_utf16(t, s, len, t->out);
+    return t->out;
+}
+
+void transcoder_free(Transcoder *t) {
+    free(t->out);
+    t->out = NULL;
+    t->out_cap = 0;
+}
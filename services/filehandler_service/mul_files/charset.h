@@ -0,0 +1,44 @@
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHARSET_SNIFF_BYTES 4096  // Prefix of the first block the encoding is guessed from
+
+typedef enum {
+    CHARSET_UTF8,  // Also ASCII and binary data: passed through untouched
+    CHARSET_UTF16LE,
+    CHARSET_UTF16BE,
+    CHARSET_CP1251,  // Windows Cyrillic
+    CHARSET_CP1252  // Windows Western European
+} Charset;
+
+// Guess the encoding of an entry from its first block: a byte order mark,
+// then the zero-byte pattern of UTF-16, then UTF-8 validity, and for text that
+// is not UTF-8, whether high bytes come in runs (Cyrillic words) or alone
+// (accented Latin letters). bom_len gets the length of a mark to drop.
+Charset charset_detect(const void *data, size_t len, size_t *bom_len);
+const char *charset_name(Charset charset);
+
+// Streaming conversion of one entry to UTF-8. Code units and surrogate pairs
+// split across blocks are carried over; invalid ones become U+FFFD.
+typedef struct {
+    Charset charset;
+    size_t skip;  // Byte order mark bytes still to drop
+    int odd_byte;  // UTF-16: first byte of a unit split across blocks, or -1
+    uint32_t high_surrogate;  // UTF-16: waiting for its low half, or 0
+    char *out;
+    size_t out_cap;
+} Transcoder;
+
+// Detect the encoding from the entry's first block and reset the stream state.
+// The output buffer is kept across entries: zero the Transcoder before its
+// first entry and free it after the last
+void transcoder_begin(Transcoder *t, const void *first_block, size_t len);
+// UTF-8 for the next block, valid until the next call; data itself for
+// CHARSET_UTF8. Returns NULL when the output buffer cannot grow.
+const char *transcoder_feed(Transcoder *t, const void *data, size_t len, size_t *out_len);
+void transcoder_free(Transcoder *t);
+
+#endif
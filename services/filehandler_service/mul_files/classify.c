@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "classify.h"
+#include "csv.h"
+#include "sqldump.h"
+
+typedef struct {
+    size_t nul;
+    size_t control;  // Other bytes below 0x20 except tab, CR and LF, and DEL
+    size_t high;  // 0x80 and up: UTF-8 once the pipeline has transcoded the entry
+} ByteClasses;
+
+static void count_classes(const uint8_t *s, size_t len, ByteClasses *c) {
+    size_t i = 0;
+    memset(c, 0, sizeof(*c));
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128(), space = _mm_set1_epi8(' '), del = _mm_set1_epi8(0x7f);
+    const __m128i tab = _mm_set1_epi8('\t'), lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int high = _mm_movemask_epi8(v);
+        int nul = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        // Signed compare: high bytes are negative, so they are masked back out
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        int low = _mm_movemask_epi8(_mm_andnot_si128(ws, _mm_cmplt_epi8(v, space))) & ~high;
+        int control = (low & ~nul) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, del));
+        c->high += (size_t)__builtin_popcount((unsigned)high);
+        c->nul += (size_t)__builtin_popcount((unsigned)nul);
+        c->control += (size_t)__builtin_popcount((unsigned)control);
+    }
+#endif
+    for (; i < len; i++) {
+        uint8_t b = s[i];
+        if (b == 0) c->nul++;
+        else if (b >= 0x80) c->high++;
+        else if ((b < 0x20 && b != '\t' && b != '\n' && b != '\r') || b == 0x7f) c->control++;
+    }
+}
+
+static int starts_with(const uint8_t *s, size_t len, const char *magic, size_t magic_len) {
+    return len >= magic_len && memcmp(s, magic, magic_len) == 0;
+}
+
+static EntryKind binary_kind(const uint8_t *s, size_t len) {
+    if (starts_with(s, len, "SQLite format 3", 16)) return ENTRY_SQLITE;
+
+    if (starts_with(s, len, "\x89PNG\r\n\x1a\n", 8) || starts_with(s, len, "\xff\xd8\xff", 3) ||
+        starts_with(s, len, "GIF87a", 6) || starts_with(s, len, "GIF89a", 6) || starts_with(s, len, "BM", 2) ||
+        (starts_with(s, len, "RIFF", 4) && len >= 12 && memcmp(s + 8, "WEBP", 4) == 0)) {
+        return ENTRY_IMAGE;
+    }
+
+    if (starts_with(s, len, "PK\x03\x04", 4) || starts_with(s, len, "\x1f\x8b", 2) ||
+        starts_with(s, len, "7z\xbc\xaf\x27\x1c", 6) || starts_with(s, len, "Rar!\x1a\x07", 6) ||
+        starts_with(s, len, "BZh", 3) || starts_with(s, len, "\x28\xb5\x2f\xfd", 4) ||
+        starts_with(s, len, "\xfd" "7zXZ", 6)) {
+        return ENTRY_ARCHIVE;
+    }
+
+    if (starts_with(s, len, "MZ", 2) || starts_with(s, len, "\x7f" "ELF", 4) ||
+        starts_with(s, len, "\xfe\xed\xfa\xce", 4) || starts_with(s, len, "\xfe\xed\xfa\xcf", 4) ||
+        starts_with(s, len, "\xce\xfa\xed\xfe", 4) || starts_with(s, len, "\xcf\xfa\xed\xfe", 4)) {
+        return ENTRY_EXECUTABLE;
+    }
+    return ENTRY_BINARY;
+}
+
+// Headered exports repeat the same delimiter count on their first two lines
+static int looks_like_csv(const uint8_t *s, size_t len) {
+    const uint8_t *first_end = memchr(s, '\n', len);
+    if (!first_end) return 0;
+    const uint8_t *second = first_end + 1;
+    const uint8_t *second_end = memchr(second, '\n', len - (size_t)(second - s));
+    if (!second_end) return 0;
+
+    static const char delims[] = {',', ';', '\t'};
+    for (size_t d = 0; d < sizeof(delims); d++) {
+        size_t a = 0, b = 0;
+        for (const uint8_t *p = s; p < first_end; p++) a += *p == (uint8_t)delims[d];
+        for (const uint8_t *p = second; p < second_end; p++) b += *p == (uint8_t)delims[d];
+        if (a >= 2 && a == b) return 1;
+    }
+    return 0;
+}
+
+static int looks_like_json(const uint8_t *s, size_t len) {
+    size_t i = 0;
+    while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) i++;
+    if (i == len) return 0;
+    // A bare '[' also opens "[INFO] ..." log lines; an array's next token is a value
+    if (s[i] == '[') {
+        i++;
+        while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) i++;
+        return i < len && (s[i] == '{' || s[i] == '[' || s[i] == '"' || s[i] == ']');
+    }
+    return s[i] == '{';
+}
+
+EntryKind classify_entry(const char *name, const void *data, size_t len) {
+    const uint8_t *s = data;
+    size_t n = len < CLASSIFY_SNIFF_BYTES ? len : CLASSIFY_SNIFF_BYTES;
+    if (n == 0) return ENTRY_UNKNOWN;
+
+    ByteClasses c;
+    count_classes(s, n, &c);
+    if (c.nul > 0 || c.control * 100 > n * CLASSIFY_MAX_CONTROL_PCT) return binary_kind(s, n);
+
+    if (sql_sniff(name, data, len)) return ENTRY_SQL;
+    if (csv_sniff(name) || looks_like_csv(s, n)) return ENTRY_CSV;
+    if (looks_like_json(s, n)) return ENTRY_JSON;
+    return ENTRY_TEXT;
+}
+
+const char *entry_kind_name(EntryKind kind) {
+    static const char *const names[] = {"unknown", "text", "csv", "json", "sql",
+                                        "sqlite", "image", "archive", "executable", "binary"};
+    return (size_t)kind < sizeof(names) / sizeof(names[0]) ? names[kind] : "unknown";
+}
+
+int entry_kind_is_text(EntryKind kind) {
+    return kind == ENTRY_TEXT || kind == ENTRY_CSV || kind == ENTRY_JSON || kind == ENTRY_SQL;
+}
+
+int entry_kind_is_cold(EntryKind kind) {
+    return kind == ENTRY_IMAGE || kind == ENTRY_ARCHIVE || kind == ENTRY_EXECUTABLE || kind == ENTRY_BINARY;
+}
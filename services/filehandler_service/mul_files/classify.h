@@ -0,0 +1,32 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <stddef.h>
+
+#define CLASSIFY_SNIFF_BYTES 4096  // Prefix of the first block an entry is classified from
+#define CLASSIFY_MAX_CONTROL_PCT 5  // Text may have this share of control bytes; none may be NUL
+
+typedef enum {
+    ENTRY_UNKNOWN,  // No data seen yet
+    ENTRY_TEXT,  // Combo lists, logs and other line-oriented text
+    ENTRY_CSV,
+    ENTRY_JSON,  // A document or JSON lines
+    ENTRY_SQL,  // MySQL/PostgreSQL dump
+    ENTRY_SQLITE,
+    ENTRY_IMAGE,
+    ENTRY_ARCHIVE,  // Nested archives and compressed streams
+    ENTRY_EXECUTABLE,  // PE, ELF and Mach-O
+    ENTRY_BINARY  // Anything else that is not text
+} EntryKind;
+
+// Classify an entry from its first (decoded) block. A byte histogram decides
+// text versus binary; text is then told apart by content and name, binary by
+// magic numbers.
+EntryKind classify_entry(const char *name, const void *data, size_t len);
+const char *entry_kind_name(EntryKind kind);
+int entry_kind_is_text(EntryKind kind);
+// Entries that are not worth keeping next to the text: media, nested
+// archives, executables and unrecognized binaries. SQLite databases stay.
+int entry_kind_is_cold(EntryKind kind);
+
+#endif
@@ -0,0 +1,33 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "filehandler.h"
+
+// Logging for the command-line tools: plain lines on stderr, so stdout stays
+// free for their output
+
+void log_info(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+void log_error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "ERROR: ");
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+void log_warning(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "WARNING: ");
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "colstore.h"
+#include "filehandler.h"
+
+// Query tool for .sgc column stores: prints every credential of a domain as
+// identity<TAB>secret<TAB>url<TAB>source<TAB>first_seen, with scan statistics
+// on stderr.
+//
+//   colquery corp.com extracted/records/*.sgc
+
+static void print_row(void *ctx, const ColumnRow *row) {
+    (void)ctx;
+    printf("%.*s@%.*s\t%.*s\t%.*s\t%.*s\t%llu\n", (int)row->local_len, row->local, (int)row->domain_len, row->domain,
+           (int)row->secret_len, row->secret, (int)row->url_len, row->url, (int)row->source_len, row->source,
+           (unsigned long long)row->first_seen);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <domain> <file.sgc>...\n", argv[0]);
+        return 2;
+    }
+    // Stored domains are lowercase and without the '@'
+    char *domain = argv[1][0] == '@' ? argv[1] + 1 : argv[1];
+    for (char *c = domain; *c; c++) {
+        if (*c >= 'A' && *c <= 'Z') *c += 32;
+    }
+
+    ColumnScanStats stats = {0};
+    long long matched = 0;
+    int rc = 0;
+    for (int i = 2; i < argc; i++) {
+        ColumnReader *r = colstore_open(argv[i]);
+        if (!r) {
+            rc = 1;
+            continue;
+        }
+        long long n = colstore_query_domain(r, domain, print_row, NULL, &stats);
+        if (n < 0) rc = 1;
+        else matched += n;
+        colstore_close(r);
+    }
+    log_info("%lld rows matched; %llu of %llu blocks skipped, %llu rows scanned", matched,
+             (unsigned long long)stats.blocks_skipped, (unsigned long long)stats.blocks,
+             (unsigned long long)stats.rows_scanned);
+    return rc;
+}
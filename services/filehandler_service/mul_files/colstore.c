@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include "colstore.h"
+#include "filehandler.h"
+#include "hash.h"
+
+#define STRING_COLUMNS 4  // COL_LOCAL .. COL_SOURCE
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} Buffer;
+
+struct ColumnWriter {
+    FILE *out;
+    uint64_t offset;
+    ZSTD_CCtx *cctx;
+    int failed;
+
+    // Domain dictionary: open-addressing table of id + 1 over dict_hash
+    uint32_t *slots;
+    uint32_t slot_mask;
+    uint32_t dict_count, dict_cap;
+    uint64_t *dict_hash;
+    uint32_t *dict_offset;  // Into dict_bytes
+    uint16_t *dict_len;
+    uint32_t *dict_block;  // Block sequence + 1 an id was last seen in, for the Bloom filter
+    Buffer dict_bytes;
+
+    // Block being filled
+    uint32_t rows;
+    uint32_t *domains;
+    uint64_t *first_seen;
+    uint16_t *lens[STRING_COLUMNS];
+    Buffer bytes[STRING_COLUMNS];
+    Buffer raw;  // Column assembled for compression
+    Buffer compressed;
+    uint32_t *distinct;
+
+    ColumnBlock *blocks;
+    uint32_t block_count, block_cap;
+    uint64_t total_rows;
+    char path[4096];
+};
+
+struct ColumnReader {
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    ColumnFooter footer;
+    ColumnBlock *blocks;  // Copied out of the map, where the index has no alignment
+    char *dict;
+    uint32_t *dict_offset;
+    uint16_t *dict_len;
+    ZSTD_DCtx *dctx;
+    Buffer columns[COL_COUNT];
+    uint32_t *offsets[STRING_COLUMNS];  // Row start of each string column, for the current block
+    char path[4096];
+};
+
+static int buffer_reserve(Buffer *b, size_t size) {
+    if (size <= b->cap) return 0;
+    size_t cap = b->cap ? b->cap : 65536;
+    while (cap < size) cap *= 2;
+    char *data = realloc(b->data, cap);
+    if (!data) return -1;
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+static int buffer_append(Buffer *b, const void *data, size_t len) {
+    if (len == 0) return 0;  // data may be NULL, as for an empty URL
+    if (buffer_reserve(b, b->len + len) != 0) return -1;
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint64_t bloom_bit(uint32_t id, int probe, uint32_t bits) {
+    uint64_t h = mix64(id);
+    uint64_t step = (h >> 32) | 1;
+    return (h + (uint64_t)probe * step) & (bits - 1);
+}
+
+static int domain_compare(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    return c ? c : (a_len > b_len) - (a_len < b_len);
+}
+
+static int dict_grow(ColumnWriter *w) {
+    uint32_t cap = w->dict_cap ? w->dict_cap * 2 : 4096;
+    uint64_t *hash = realloc(w->dict_hash, cap * sizeof(uint64_t));
+    if (hash) w->dict_hash = hash;
+    uint32_t *offset = realloc(w->dict_offset, cap * sizeof(uint32_t));
+    if (offset) w->dict_offset = offset;
+    uint16_t *len = realloc(w->dict_len, cap * sizeof(uint16_t));
+    if (len) w->dict_len = len;
+    uint32_t *block = realloc(w->dict_block, cap * sizeof(uint32_t));
+    if (block) w->dict_block = block;
+    if (!hash || !offset || !len || !block) return -1;
+    w->dict_cap = cap;
+
+    // Keep the table at most half full
+    uint32_t slot_count = cap * 2;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (uint32_t id = 0; id < w->dict_count; id++) {
+        uint32_t s = (uint32_t)w->dict_hash[id] & (slot_count - 1);
+        while (slots[s]) s = (s + 1) & (slot_count - 1);
+        slots[s] = id + 1;
+    }
+    free(w->slots);
+    w->slots = slots;
+    w->slot_mask = slot_count - 1;
+    return 0;
+}
+
+// Dictionary id of a domain, adding it on first use; UINT32_MAX when out of memory
+static uint32_t dict_id(ColumnWriter *w, const char *domain, size_t len) {
+    uint64_t h[2];
+    murmur3_128(domain, len, 0, h);
+    uint32_t s = (uint32_t)h[0] & w->slot_mask;
+    while (w->slots[s]) {
+        uint32_t id = w->slots[s] - 1;
+        if (w->dict_hash[id] == h[0] && w->dict_len[id] == len &&
+            (len == 0 || memcmp(w->dict_bytes.data + w->dict_offset[id], domain, len) == 0)) {
+            return id;
+        }
+        s = (s + 1) & w->slot_mask;
+    }
+
+    if (w->dict_count == w->dict_cap) {
+        if (dict_grow(w) != 0) return UINT32_MAX;
+        s = (uint32_t)h[0] & w->slot_mask;
+        while (w->slots[s]) s = (s + 1) & w->slot_mask;
+    }
+    uint32_t id = w->dict_count;
+    if (w->dict_bytes.len > UINT32_MAX - len || buffer_append(&w->dict_bytes, domain, len) != 0) return UINT32_MAX;
+    w->dict_hash[id] = h[0];
+    w->dict_offset[id] = (uint32_t)(w->dict_bytes.len - len);
+    w->dict_len[id] = (uint16_t)len;
+    w->dict_block[id] = 0;
+    w->slots[s] = id + 1;
+    w->dict_count++;
+    return id;
+}
+
+static int write_bytes(ColumnWriter *w, const void *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, w->out) != len) {
+        log_error("Failed to write column store %s: %s", w->path, strerror(errno));
+        w->failed = 1;
+        return -1;
+    }
+    w->offset += len;
+    return 0;
+}
+
+// Compress one column and append it as a zstd frame
+static int write_chunk(ColumnWriter *w, const void *raw, size_t raw_size, ColumnChunk *chunk) {
+    size_t bound = ZSTD_compressBound(raw_size);
+    if (buffer_reserve(&w->compressed, bound) != 0) {
+        log_error("Failed to allocate compression buffer for %s", w->path);
+        w->failed = 1;
+        return -1;
+    }
+    size_t size = ZSTD_compressCCtx(w->cctx, w->compressed.data, bound, raw, raw_size, COLSTORE_ZSTD_LEVEL);
+    if (ZSTD_isError(size)) {
+        log_error("Failed to compress column for %s: %s", w->path, ZSTD_getErrorName(size));
+        w->failed = 1;
+        return -1;
+    }
+    chunk->offset = w->offset;
+    chunk->size = (uint32_t)size;
+    chunk->raw_size = (uint32_t)raw_size;
+    return write_bytes(w, w->compressed.data, size);
+}
+
+static int flush_block(ColumnWriter *w) {
+    if (w->rows == 0 || w->failed) return w->failed ? -1 : 0;
+    if (w->block_count == w->block_cap) {
+        uint32_t cap = w->block_cap ? w->block_cap * 2 : 64;
+        ColumnBlock *blocks = realloc(w->blocks, cap * sizeof(ColumnBlock));
+        if (!blocks) {
+            log_error("Failed to grow column store index for %s", w->path);
+            w->failed = 1;
+            return -1;
+        }
+        w->blocks = blocks;
+        w->block_cap = cap;
+    }
+    ColumnBlock *b = &w->blocks[w->block_count];
+    memset(b, 0, sizeof(*b));
+    b->rows = w->rows;
+
+    // Distinct domains of the block size its Bloom filter and give min/max
+    uint32_t seq = w->block_count + 1, distinct = 0;
+    for (uint32_t i = 0; i < w->rows; i++) {
+        uint32_t id = w->domains[i];
+        if (w->dict_block[id] == seq) continue;
+        w->dict_block[id] = seq;
+        w->distinct[distinct++] = id;
+    }
+    b->domain_min = b->domain_max = w->distinct[0];
+    for (uint32_t i = 1; i < distinct; i++) {
+        uint32_t id = w->distinct[i];
+        const char *d = w->dict_bytes.data + w->dict_offset[id];
+        if (domain_compare(d, w->dict_len[id], w->dict_bytes.data + w->dict_offset[b->domain_min],
+                           w->dict_len[b->domain_min]) < 0) {
+            b->domain_min = id;
+        }
+        if (domain_compare(d, w->dict_len[id], w->dict_bytes.data + w->dict_offset[b->domain_max],
+                           w->dict_len[b->domain_max]) > 0) {
+            b->domain_max = id;
+        }
+    }
+    b->first_seen_min = b->first_seen_max = w->first_seen[0];
+    for (uint32_t i = 1; i < w->rows; i++) {
+        if (w->first_seen[i] < b->first_seen_min) b->first_seen_min = w->first_seen[i];
+        if (w->first_seen[i] > b->first_seen_max) b->first_seen_max = w->first_seen[i];
+    }
+
+    if (write_chunk(w, w->domains, w->rows * sizeof(uint32_t), &b->chunks[COL_DOMAIN]) != 0) return -1;
+    for (int c = 0; c < STRING_COLUMNS; c++) {
+        w->raw.len = 0;
+        if (buffer_append(&w->raw, w->lens[c], w->rows * sizeof(uint16_t)) != 0 ||
+            buffer_append(&w->raw, w->bytes[c].data, w->bytes[c].len) != 0) {
+            log_error("Failed to allocate column buffer for %s", w->path);
+            w->failed = 1;
+            return -1;
+        }
+        if (write_chunk(w, w->raw.data, w->raw.len, &b->chunks[COL_LOCAL + c]) != 0) return -1;
+        w->bytes[c].len = 0;
+    }
+    if (write_chunk(w, w->first_seen, w->rows * sizeof(uint64_t), &b->chunks[COL_FIRST_SEEN]) != 0) return -1;
+
+    uint32_t bits = 512;
+    while (bits < distinct * COLSTORE_BLOOM_BITS_PER_DOMAIN) bits *= 2;
+    uint8_t *bloom = calloc(bits / 8, 1);
+    if (!bloom) {
+        log_error("Failed to allocate Bloom filter for %s", w->path);
+        w->failed = 1;
+        return -1;
+    }
+    for (uint32_t i = 0; i < distinct; i++) {
+        for (int k = 0; k < COLSTORE_BLOOM_PROBES; k++) {
+            uint64_t bit = bloom_bit(w->distinct[i], k, bits);
+            bloom[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+        }
+    }
+    b->bloom_bits = bits;
+    b->bloom_offset = w->offset;
+    int rc = write_bytes(w, bloom, bits / 8);
+    free(bloom);
+    if (rc != 0) return -1;
+
+    w->block_count++;
+    w->rows = 0;
+    return 0;
+}
+
+ColumnWriter *colstore_writer_open(const char *path) {
+    ColumnWriter *w = calloc(1, sizeof(ColumnWriter));
+    if (!w) return NULL;
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->cctx = ZSTD_createCCtx();
+    w->domains = malloc(COLSTORE_BLOCK_ROWS * sizeof(uint32_t));
+    w->first_seen = malloc(COLSTORE_BLOCK_ROWS * sizeof(uint64_t));
+    w->distinct = malloc(COLSTORE_BLOCK_ROWS * sizeof(uint32_t));
+    int ok = w->cctx && w->domains && w->first_seen && w->distinct && dict_grow(w) == 0;
+    for (int c = 0; c < STRING_COLUMNS; c++) {
+        w->lens[c] = malloc(COLSTORE_BLOCK_ROWS * sizeof(uint16_t));
+        if (!w->lens[c]) ok = 0;
+    }
+    // Id 0 is the empty domain of identities without '@'
+    if (ok && dict_id(w, "", 0) != 0) ok = 0;
+    if (ok) w->out = fopen(path, "wb");
+    if (!ok || !w->out) {
+        log_error("Failed to open column store %s: %s", path, ok ? strerror(errno) : "out of memory");
+        w->failed = 1;
+        colstore_writer_close(w);
+        return NULL;
+    }
+    write_bytes(w, COLSTORE_MAGIC, 8);
+    return w;
+}
+
+int colstore_writer_add(ColumnWriter *w, const CredentialRecord *rec, uint64_t first_seen) {
+    if (w->failed) return -1;
+    const char *local = rec->identity, *domain = "";
+    size_t local_len = rec->identity_len, domain_len = 0;
+    const char *at = rec->identity_len ? memrchr(rec->identity, '@', rec->identity_len) : NULL;
+    if (at) {
+        local_len = (size_t)(at - rec->identity);
+        domain = at + 1;
+        domain_len = rec->identity_len - local_len - 1;
+    }
+    const char *fields[STRING_COLUMNS] = {local, rec->secret, rec->url, rec->source};
+    size_t lens[STRING_COLUMNS] = {local_len, rec->secret_len, rec->url_len, rec->source_len};
+    if (domain_len > UINT16_MAX) return 1;
+    for (int c = 0; c < STRING_COLUMNS; c++) {
+        if (lens[c] > UINT16_MAX) return 1;
+    }
+
+    uint32_t id = dict_id(w, domain, domain_len);
+    if (id == UINT32_MAX) {
+        log_error("Failed to grow domain dictionary for %s", w->path);
+        w->failed = 1;
+        return -1;
+    }
+    for (int c = 0; c < STRING_COLUMNS; c++) {
+        if (buffer_append(&w->bytes[c], fields[c], lens[c]) != 0) {
+            log_error("Failed to allocate column buffer for %s", w->path);
+            w->failed = 1;
+            return -1;
+        }
+        w->lens[c][w->rows] = (uint16_t)lens[c];
+    }
+    w->domains[w->rows] = id;
+    w->first_seen[w->rows] = first_seen;
+    w->rows++;
+    w->total_rows++;
+    if (w->rows == COLSTORE_BLOCK_ROWS) return flush_block(w);
+    return 0;
+}
+
+int colstore_writer_close(ColumnWriter *w) {
+    if (!w) return 0;
+    if (w->out && flush_block(w) == 0) {
+        ColumnFooter footer;
+        memset(&footer, 0, sizeof(footer));
+        footer.rows = w->total_rows;
+        footer.dict_count = w->dict_count;
+        footer.block_count = w->block_count;
+        memcpy(footer.magic, COLSTORE_MAGIC, 8);
+
+        ColumnChunk dict;
+        w->raw.len = 0;
+        for (uint32_t id = 0; id < w->dict_count && !w->failed; id++) {
+            if (buffer_append(&w->raw, &w->dict_len[id], sizeof(uint16_t)) != 0 ||
+                buffer_append(&w->raw, w->dict_bytes.data + w->dict_offset[id], w->dict_len[id]) != 0) {
+                log_error("Failed to allocate dictionary for %s", w->path);
+                w->failed = 1;
+            }
+        }
+        if (!w->failed && write_chunk(w, w->raw.data, w->raw.len, &dict) == 0) {
+            footer.dict_offset = dict.offset;
+            footer.dict_size = dict.size;
+            footer.dict_raw_size = dict.raw_size;
+            footer.index_offset = w->offset;
+            if (write_bytes(w, w->blocks, w->block_count * sizeof(ColumnBlock)) == 0) {
+                write_bytes(w, &footer, sizeof(footer));
+            }
+        }
+    }
+
+    int rc = w->failed ? -1 : 0;
+    if (w->out && fclose(w->out) != 0) {
+        log_error("Failed to close column store %s: %s", w->path, strerror(errno));
+        rc = -1;
+    }
+    ZSTD_freeCCtx(w->cctx);
+    free(w->slots);
+    free(w->dict_hash);
+    free(w->dict_offset);
+    free(w->dict_len);
+    free(w->dict_block);
+    free(w->dict_bytes.data);
+    free(w->domains);
+    free(w->first_seen);
+    free(w->distinct);
+    for (int c = 0; c < STRING_COLUMNS; c++) {
+        free(w->lens[c]);
+        free(w->bytes[c].data);
+    }
+    free(w->raw.data);
+    free(w->compressed.data);
+    free(w->blocks);
+    free(w);
+    return rc;
+}
+
+// Decompress a chunk into out; -1 if it lies outside the file or is corrupt
+static int read_chunk(ColumnReader *r, const ColumnChunk *chunk, Buffer *out) {
+    if (chunk->offset > r->size || chunk->size > r->size - chunk->offset) return -1;
+    if (buffer_reserve(out, chunk->raw_size ? chunk->raw_size : 1) != 0) return -1;
+    size_t n = ZSTD_decompressDCtx(r->dctx, out->data, chunk->raw_size, r->map + chunk->offset, chunk->size);
+    if (ZSTD_isError(n) || n != chunk->raw_size) return -1;
+    out->len = n;
+    return 0;
+}
+
+ColumnReader *colstore_open(const char *path) {
+    ColumnReader *r = calloc(1, sizeof(ColumnReader));
+    if (!r) return NULL;
+    snprintf(r->path, sizeof(r->path), "%s", path);
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (r->fd == -1 || fstat(r->fd, &st) != 0) {
+        log_error("Failed to open column store %s: %s", path, strerror(errno));
+        colstore_close(r);
+        return NULL;
+    }
+    r->size = (size_t)st.st_size;
+    if (r->size < 8 + sizeof(ColumnFooter)) {
+        log_error("Column store %s is truncated", path);
+        colstore_close(r);
+        return NULL;
+    }
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        log_error("Failed to map column store %s: %s", path, strerror(errno));
+        colstore_close(r);
+        return NULL;
+    }
+
+    memcpy(&r->footer, r->map + r->size - sizeof(ColumnFooter), sizeof(ColumnFooter));
+    const ColumnFooter *f = &r->footer;
+    if (memcmp(r->map, COLSTORE_MAGIC, 8) != 0 || memcmp(f->magic, COLSTORE_MAGIC, 8) != 0 ||
+        f->index_offset > r->size || (uint64_t)f->block_count * sizeof(ColumnBlock) > r->size - f->index_offset) {
+        log_error("Column store %s is corrupt or was not closed", path);
+        colstore_close(r);
+        return NULL;
+    }
+    r->blocks = malloc(f->block_count ? f->block_count * sizeof(ColumnBlock) : 1);
+    if (!r->blocks) {
+        log_error("Failed to allocate block index of %s", path);
+        colstore_close(r);
+        return NULL;
+    }
+    memcpy(r->blocks, r->map + f->index_offset, f->block_count * sizeof(ColumnBlock));
+
+    // Dictionary: the strings stay in the decompressed frame, indexed by id
+    Buffer dict = {0};
+    ColumnChunk chunk = {f->dict_offset, f->dict_size, f->dict_raw_size};
+    r->dctx = ZSTD_createDCtx();
+    r->dict_offset = malloc((f->dict_count + 1) * sizeof(uint32_t));
+    r->dict_len = malloc((f->dict_count + 1) * sizeof(uint16_t));
+    if (!r->dctx || !r->dict_offset || !r->dict_len || read_chunk(r, &chunk, &dict) != 0) {
+        log_error("Failed to load domain dictionary of %s", path);
+        free(dict.data);
+        colstore_close(r);
+        return NULL;
+    }
+    r->dict = dict.data;
+    size_t pos = 0;
+    for (uint32_t id = 0; id < f->dict_count; id++) {
+        uint16_t len;
+        if (pos + sizeof(len) > dict.len) break;
+        memcpy(&len, r->dict + pos, sizeof(len));
+        pos += sizeof(len);
+        if (pos + len > dict.len) break;
+        r->dict_offset[id] = (uint32_t)pos;
+        r->dict_len[id] = len;
+        pos += len;
+    }
+    if (pos != dict.len) {
+        log_error("Domain dictionary of %s is corrupt", path);
+        colstore_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+static int block_may_contain(ColumnReader *r, const ColumnBlock *b, uint32_t id, const char *domain, size_t len) {
+    if (b->domain_min >= r->footer.dict_count || b->domain_max >= r->footer.dict_count) return 1;
+    if (domain_compare(domain, len, r->dict + r->dict_offset[b->domain_min], r->dict_len[b->domain_min]) < 0 ||
+        domain_compare(domain, len, r->dict + r->dict_offset[b->domain_max], r->dict_len[b->domain_max]) > 0) {
+        return 0;
+    }
+    if (b->bloom_bits == 0 || b->bloom_offset > r->size || b->bloom_bits / 8 > r->size - b->bloom_offset) return 1;
+    const uint8_t *bloom = r->map + b->bloom_offset;
+    for (int k = 0; k < COLSTORE_BLOOM_PROBES; k++) {
+        uint64_t bit = bloom_bit(id, k, b->bloom_bits);
+        if (!(bloom[bit >> 3] & (1 << (bit & 7)))) return 0;
+    }
+    return 1;
+}
+
+// Decompress the non-domain columns of a block and index its string rows
+static int load_block(ColumnReader *r, const ColumnBlock *b) {
+    for (int c = 0; c < STRING_COLUMNS; c++) {
+        Buffer *col = &r->columns[COL_LOCAL + c];
+        if (read_chunk(r, &b->chunks[COL_LOCAL + c], col) != 0) return -1;
+        uint32_t *offsets = realloc(r->offsets[c], (b->rows + 1) * sizeof(uint32_t));
+        if (!offsets) return -1;
+        r->offsets[c] = offsets;
+        size_t pos = (size_t)b->rows * sizeof(uint16_t);
+        if (pos > col->len) return -1;
+        for (uint32_t i = 0; i < b->rows; i++) {
+            uint16_t len;
+            memcpy(&len, col->data + i * sizeof(uint16_t), sizeof(len));
+            offsets[i] = (uint32_t)pos;
+            pos += len;
+        }
+        offsets[b->rows] = (uint32_t)pos;
+        if (pos != col->len) return -1;
+    }
+    if (read_chunk(r, &b->chunks[COL_FIRST_SEEN], &r->columns[COL_FIRST_SEEN]) != 0) return -1;
+    return r->columns[COL_FIRST_SEEN].len == b->rows * sizeof(uint64_t) ? 0 : -1;
+}
+
+long long colstore_query_domain(ColumnReader *r, const char *domain, colstore_row_fn fn, void *ctx,
+                                ColumnScanStats *stats) {
+    size_t len = strlen(domain);
+    uint32_t id = UINT32_MAX;
+    for (uint32_t i = 0; i < r->footer.dict_count; i++) {
+        if (r->dict_len[i] == len && memcmp(r->dict + r->dict_offset[i], domain, len) == 0) {
+            id = i;
+            break;
+        }
+    }
+    stats->blocks += r->footer.block_count;
+    if (id == UINT32_MAX) {
+        stats->blocks_skipped += r->footer.block_count;  // Not in this file at all
+        return 0;
+    }
+
+    long long matched = 0;
+    for (uint32_t bi = 0; bi < r->footer.block_count; bi++) {
+        const ColumnBlock *b = &r->blocks[bi];
+        if (!block_may_contain(r, b, id, domain, len)) {
+            stats->blocks_skipped++;
+            continue;
+        }
+        Buffer *domains = &r->columns[COL_DOMAIN];
+        if (read_chunk(r, &b->chunks[COL_DOMAIN], domains) != 0 || domains->len != b->rows * sizeof(uint32_t)) {
+            log_error("Column store %s has a corrupt block %u", r->path, bi);
+            return -1;
+        }
+        stats->rows_scanned += b->rows;
+
+        const uint32_t *ids = (const uint32_t *)domains->data;
+        int loaded = 0;
+        for (uint32_t row = 0; row < b->rows; row++) {
+            if (ids[row] != id) continue;
+            if (!loaded) {
+                if (load_block(r, b) != 0) {
+                    log_error("Column store %s has a corrupt block %u", r->path, bi);
+                    return -1;
+                }
+                loaded = 1;
+            }
+            ColumnRow out;
+            const char *strings[STRING_COLUMNS];
+            size_t lens[STRING_COLUMNS];
+            for (int c = 0; c < STRING_COLUMNS; c++) {
+                strings[c] = r->columns[COL_LOCAL + c].data + r->offsets[c][row];
+                lens[c] = r->offsets[c][row + 1] - r->offsets[c][row];
+            }
+            out.local = strings[0];
+            out.local_len = lens[0];
+            out.secret = strings[1];
+            out.secret_len = lens[1];
+            out.url = strings[2];
+            out.url_len = lens[2];
+            out.source = strings[3];
+            out.source_len = lens[3];
+            out.domain = r->dict + r->dict_offset[id];
+            out.domain_len = len;
+            memcpy(&out.first_seen, r->columns[COL_FIRST_SEEN].data + row * sizeof(uint64_t), sizeof(uint64_t));
+            fn(ctx, &out);
+            matched++;
+        }
+    }
+    return matched;
+}
+
+void colstore_close(ColumnReader *r) {
+    if (!r) return;
+    if (r->map) munmap((void *)r->map, r->size);
+    if (r->fd != -1) close(r->fd);
+    ZSTD_freeDCtx(r->dctx);
+    free(r->blocks);
+    free(r->dict);
+    free(r->dict_offset);
+    free(r->dict_len);
+    for (int c = 0; c < COL_COUNT; c++) free(r->columns[c].data);
+    for (int c = 0; c < STRING_COLUMNS; c++) free(r->offsets[c]);
+    free(r);
+}
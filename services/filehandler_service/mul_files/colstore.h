@@ -0,0 +1,83 @@
+#ifndef COLSTORE_H
+#define COLSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define COLSTORE_MAGIC "SGCOL001"  // First and last 8 bytes of every .sgc file
+#define COLSTORE_BLOCK_ROWS 65536
+#define COLSTORE_ZSTD_LEVEL 3
+#define COLSTORE_BLOOM_BITS_PER_DOMAIN 10  // About 1% false positives with 6 probes
+#define COLSTORE_BLOOM_PROBES 6
+
+// Columns of a record. Emails are split at the last '@'; identities without
+// one keep an empty domain (dictionary id 0) and go whole into local.
+enum { COL_DOMAIN, COL_LOCAL, COL_SECRET, COL_URL, COL_SOURCE, COL_FIRST_SEEN, COL_COUNT };
+
+// On-disk layout, little-endian: magic, then per block one zstd frame per
+// column followed by the block's uncompressed Bloom filter, then the domain
+// dictionary (one zstd frame of u16 length + bytes per id), the block index
+// and the footer. Domain columns hold u32 dictionary ids, first_seen u64 Unix
+// times, and the string columns a u16 length per row followed by the bytes.
+typedef struct {
+    uint64_t offset;
+    uint32_t size;  // Compressed
+    uint32_t raw_size;
+} ColumnChunk;
+
+typedef struct {
+    uint32_t rows;
+    uint32_t domain_min;  // Dictionary ids of the smallest and largest domain in the block
+    uint32_t domain_max;
+    uint32_t bloom_bits;  // Power of two
+    uint64_t bloom_offset;  // Bloom filter over the block's domain ids
+    uint64_t first_seen_min;
+    uint64_t first_seen_max;
+    ColumnChunk chunks[COL_COUNT];
+} ColumnBlock;
+
+typedef struct {
+    uint64_t rows;
+    uint64_t dict_offset;
+    uint32_t dict_size;
+    uint32_t dict_raw_size;
+    uint32_t dict_count;
+    uint32_t block_count;
+    uint64_t index_offset;  // ColumnBlock[block_count]
+    char magic[8];
+} ColumnFooter;
+
+typedef struct ColumnWriter ColumnWriter;
+typedef struct ColumnReader ColumnReader;
+
+ColumnWriter *colstore_writer_open(const char *path);
+// Returns 0 when buffered, 1 if a field is too long to store (skipped), -1 on write failure
+int colstore_writer_add(ColumnWriter *w, const CredentialRecord *rec, uint64_t first_seen);
+// Flush the last block and write the dictionary, index and footer
+int colstore_writer_close(ColumnWriter *w);
+
+// A matching row; strings point into reader buffers valid for the callback only
+typedef struct {
+    const char *local, *domain, *secret, *url, *source;
+    size_t local_len, domain_len, secret_len, url_len, source_len;
+    uint64_t first_seen;
+} ColumnRow;
+
+typedef void (*colstore_row_fn)(void *ctx, const ColumnRow *row);
+
+typedef struct {
+    uint64_t blocks;
+    uint64_t blocks_skipped;  // Ruled out by the dictionary, min/max or Bloom filter
+    uint64_t rows_scanned;
+} ColumnScanStats;
+
+ColumnReader *colstore_open(const char *path);
+// Call fn for every row whose domain equals domain (lowercase, without '@');
+// returns the number of rows matched or -1 on a corrupt file
+long long colstore_query_domain(ColumnReader *r, const char *domain, colstore_row_fn fn, void *ctx,
+                                ColumnScanStats *stats);
+void colstore_close(ColumnReader *r);
+
+#endif
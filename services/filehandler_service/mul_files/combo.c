@@ -0,0 +1,219 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "combo.h"
+
+static int is_delim(unsigned char c) {
+    return c == ':' || c == ';' || c == '|' || c == '\t';
+}
+
+static int is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *last_delim(const char *start, const char *end) {
+    while (end > start) {
+        if (is_delim((unsigned char)*--end)) return end;
+    }
+    return NULL;
+}
+
+static void trim(const char **start, const char **end) {
+    while (*start < *end && is_space((unsigned char)**start)) (*start)++;
+    while (*end > *start && is_space((unsigned char)(*end)[-1])) (*end)--;
+}
+
+// Copy a lowercased identity into out. Returns -1 if it contains whitespace,
+// 1 if it contains '@' (emails are stored lowercased), 0 otherwise.
+static int scan_identity(const char *id, size_t len, char *out) {
+    int at = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), at_sign = _mm_set1_epi8('@');
+    const __m128i upper_lo = _mm_set1_epi8('A' - 1), upper_hi = _mm_set1_epi8('Z' + 1), case_bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(id + i));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)))) return -1;
+        at |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, at_sign)) != 0;
+        // Signed compares are fine: bytes >= 0x80 are negative and never in 'A'..'Z'
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, upper_lo), _mm_cmplt_epi8(v, upper_hi));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(v, _mm_and_si128(upper, case_bit)));
+    }
+#endif
+    for (; i < len; i++) {
+        char c = id[i];
+        if (c == ' ' || c == '\t') return -1;
+        if (c == '@') at = 1;
+        out[i] = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+    }
+    return at;
+}
+
+// Split one line and emit it. first is the first delimiter in the line (or NULL)
+static void parse_line(ComboParser *cp, const char *start, const char *end, const char *first) {
+    cp->lines++;
+    if (cp->first_line) {
+        cp->first_line = 0;
+        if (end - start >= 3 && memcmp(start, "\xEF\xBB\xBF", 3) == 0) start += 3;
+    }
+    while (end > start && (end[-1] == '\r' || end[-1] == ' ')) end--;
+    if (!first || first >= end) return;
+
+    CredentialRecord rec;
+    const char *id_start = start, *id_end, *secret_start, *secret_end = end;
+    rec.url = "";
+    rec.url_len = 0;
+
+    // url:login:pass - the URL itself contains ':' so split on the last two delimiters.
+    // A scheme's ':' is always the first delimiter of the line.
+    int has_scheme = *first == ':' && end - first > 3 && first[1] == '/' && first[2] == '/';
+    if (has_scheme || (end - start > 4 && memcmp(start, "www.", 4) == 0)) {
+        const char *d1 = last_delim(start, end);
+        const char *d2 = d1 ? last_delim(start, d1) : NULL;
+        if (!d2 || (has_scheme && d2 == first)) return;
+        const char *url_start = start, *url_end = d2;
+        trim(&url_start, &url_end);
+        rec.url = url_start;
+        rec.url_len = url_end - url_start;
+        id_start = d2 + 1;
+        id_end = d1;
+        secret_start = d1 + 1;
+    } else {
+        id_end = first;
+        secret_start = first + 1;
+    }
+
+    trim(&id_start, &id_end);
+    trim(&secret_start, &secret_end);
+    size_t id_len = id_end - id_start, secret_len = secret_end - secret_start;
+    if (id_len == 0 || secret_len == 0 || id_len > COMBO_MAX_FIELD || secret_len > COMBO_MAX_FIELD) return;
+
+    // Identities never contain whitespace; this drops banners like "Join our channel: t.me/..."
+    int is_email = scan_identity(id_start, id_len, cp->identity);
+    if (is_email < 0) return;
+    if (is_email) id_start = cp->identity;
+
+    rec.source = cp->source;
+    rec.source_len = cp->source_len;
+    rec.identity = id_start;
+    rec.identity_len = id_len;
+    rec.secret = secret_start;
+    rec.secret_len = secret_len;
+    cp->records++;
+    cp->emit(cp->ctx, &rec);
+}
+
+static const char *scalar_first_delim(const char *start, const char *end) {
+    for (const char *p = start; p < end; p++) {
+        if (is_delim((unsigned char)*p)) return p;
+    }
+    return NULL;
+}
+
+// Append to the carried partial line; returns 0 if it no longer fits
+static int carry_append(ComboParser *cp, const char *data, size_t len) {
+    if (cp->overflow || cp->carry_len + len > COMBO_MAX_LINE) {
+        cp->overflow = 1;
+        cp->carry_len = 0;
+        return 0;
+    }
+    memcpy(cp->carry + cp->carry_len, data, len);
+    cp->carry_len += len;
+    return 1;
+}
+
+#ifdef __SSE2__
+// Bitmask of bytes equal to '\n' and of delimiter bytes in a 64-byte chunk
+static inline void chunk_masks(const char *p, uint64_t *newlines, uint64_t *delims) {
+    const __m128i nl = _mm_set1_epi8('\n'), colon = _mm_set1_epi8(':'), semi = _mm_set1_epi8(';');
+    const __m128i pipe = _mm_set1_epi8('|'), tab = _mm_set1_epi8('\t');
+    uint64_t n = 0, d = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i dm = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, semi)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, pipe), _mm_cmpeq_epi8(v, tab)));
+        n |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+        d |= (uint64_t)(uint16_t)_mm_movemask_epi8(dm) << (16 * i);
+    }
+    *newlines = n;
+    *delims = d;
+}
+#endif
+
+void combo_begin(ComboParser *cp, const char *source, record_emit_fn emit, void *ctx) {
+    cp->source = source;
+    cp->source_len = strlen(source);
+    cp->emit = emit;
+    cp->ctx = ctx;
+    cp->first_line = 1;
+    cp->overflow = 0;
+    cp->carry_len = 0;
+    cp->lines = 0;
+    cp->records = 0;
+}
+
+void combo_feed(ComboParser *cp, const char *data, size_t len) {
+    const char *p = data, *end = data + len;
+
+    // Finish the line carried over from the previous block
+    if (cp->carry_len > 0 || cp->overflow) {
+        const char *nl = memchr(p, '\n', len);
+        if (!nl) {
+            carry_append(cp, p, len);
+            return;
+        }
+        if (carry_append(cp, p, nl - p)) {
+            parse_line(cp, cp->carry, cp->carry + cp->carry_len, scalar_first_delim(cp->carry, cp->carry + cp->carry_len));
+        }
+        cp->carry_len = 0;
+        cp->overflow = 0;
+        p = nl + 1;
+    }
+
+    const char *line = p;
+    const char *first = NULL;
+
+#ifdef __SSE2__
+    // Structural indexing: one pass builds newline and delimiter bitmaps per
+    // 64 bytes, then lines and their first delimiter fall out of bit scans
+    while (end - p >= 64) {
+        uint64_t newlines, delims;
+        chunk_masks(p, &newlines, &delims);
+        while (newlines) {
+            int pos = __builtin_ctzll(newlines);
+            uint64_t before = delims & ((1ULL << pos) - 1);
+            if (!first && before) first = p + __builtin_ctzll(before);
+            if (p + pos - line < COMBO_MAX_LINE) parse_line(cp, line, p + pos, first);
+            line = p + pos + 1;
+            first = NULL;
+            newlines &= newlines - 1;
+            delims &= pos == 63 ? 0 : ~((2ULL << pos) - 1);
+        }
+        if (!first && delims) first = p + __builtin_ctzll(delims);
+        p += 64;
+    }
+#endif
+
+    // Scalar tail (and the whole block without SSE2)
+    for (; p < end; p++) {
+        if (*p == '\n') {
+            if (p - line < COMBO_MAX_LINE) parse_line(cp, line, p, first);
+            line = p + 1;
+            first = NULL;
+        } else if (!first && is_delim((unsigned char)*p)) {
+            first = p;
+        }
+    }
+
+    if (line < end) carry_append(cp, line, end - line);
+}
+
+void combo_end(ComboParser *cp) {
+    if (cp->carry_len > 0 && !cp->overflow) {
+        parse_line(cp, cp->carry, cp->carry + cp->carry_len, scalar_first_delim(cp->carry, cp->carry + cp->carry_len));
+    }
+    cp->carry_len = 0;
+    cp->overflow = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef COMBO_H
+#define COMBO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define COMBO_MAX_LINE 4096  // Longer lines are not credentials; they are skipped
+#define COMBO_MAX_FIELD 255  // Identity/secret longer than this is rejected
+
+// Streaming parser for combo lists: email:password, user;pass, user|pass,
+// user<TAB>pass and url:login:pass lines, with CRLF, UTF-8 BOM and mixed
+// delimiters. Blocks may split lines anywhere; the tail is carried over.
+typedef struct {
+    const char *source;
+    size_t source_len;
+    record_emit_fn emit;
+    void *ctx;
+    int first_line;  // BOM is only stripped from the first line of an entry
+    int overflow;  // Current line exceeded COMBO_MAX_LINE; drop it up to the newline
+    size_t carry_len;
+    uint64_t lines;
+    uint64_t records;
+    char carry[COMBO_MAX_LINE];
+    char identity[COMBO_MAX_FIELD];  // Scratch for the lowercased email
+} ComboParser;
+
+void combo_begin(ComboParser *cp, const char *source, record_emit_fn emit, void *ctx);
+void combo_feed(ComboParser *cp, const char *data, size_t len);
+// Parse a final line that had no trailing newline
+void combo_end(ComboParser *cp);
+
+#endif
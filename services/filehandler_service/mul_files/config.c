@@ -0,0 +1,529 @@
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "filehandler.h"
+
+typedef enum {
+    OPT_INT, OPT_LONG, OPT_STRING, OPT_OUTPUT_MODE, OPT_LINE_DEDUP, OPT_BINARY_ENTRIES, OPT_RECORD_LAYOUT
+} OptionType;
+
+typedef struct {
+    const char *name;  // Key in the config file
+    const char *env;  // Environment variable
+    OptionType type;
+    size_t offset;
+    size_t size;  // Buffer size for strings
+    long long min, max;  // Range for numbers
+    int reloadable;
+} ConfigOption;
+
+#define OPT(field, env, type, min, max, reloadable) \
+    {#field, env, type, offsetof(Config, field), sizeof(((Config *)0)->field), min, max, reloadable}
+
+static const ConfigOption options[] = {
+    OPT(rabbitmq_host, "RABBITMQ_HOST", OPT_STRING, 0, 0, 0),
+    OPT(rabbitmq_port, "RABBITMQ_PORT", OPT_INT, 1, 65535, 0),
+    OPT(rabbitmq_user, "RABBITMQ_USER", OPT_STRING, 0, 0, 0),
+    OPT(rabbitmq_password, "RABBITMQ_PASSWORD", OPT_STRING, 0, 0, 0),
+    OPT(rabbitmq_vhost, "RABBITMQ_VHOST", OPT_STRING, 0, 0, 0),
+    OPT(hash_exchange, "FILEHANDLER_HASH_EXCHANGE", OPT_STRING, 0, 0, 0),
+    OPT(replica_id, "FILEHANDLER_REPLICA_ID", OPT_STRING, 0, 0, 0),
+    OPT(hash_weight, "FILEHANDLER_HASH_WEIGHT", OPT_INT, 1, 1000, 0),
+    OPT(intake, "FILEHANDLER_INTAKE", OPT_STRING, 0, 0, 0),
+    OPT(watch_dir, "FILEHANDLER_WATCH_DIR", OPT_STRING, 0, 0, 0),
+    OPT(consumer_channels, "FILEHANDLER_CONSUMER_CHANNELS", OPT_INT, 1, 64, 0),
+    OPT(channel_prefetch, "FILEHANDLER_CHANNEL_PREFETCH", OPT_INT, 0, 1000, 1),
+    OPT(dedup_store, "FILEHANDLER_DEDUP_STORE", OPT_STRING, 0, 0, 0),
+    OPT(dedup_bloom_bytes, "FILEHANDLER_DEDUP_BLOOM_BYTES", OPT_LONG, 64, 64LL << 30, 0),
+    OPT(neardup_store, "FILEHANDLER_NEARDUP_STORE", OPT_STRING, 0, 0, 0),
+    OPT(workers, "FILEHANDLER_WORKERS", OPT_INT, 1, 256, 1),
+    OPT(queue_depth, "FILEHANDLER_QUEUE_DEPTH", OPT_INT, 1, 65536, 1),
+    OPT(buffer_size, "FILEHANDLER_BUFFER_SIZE", OPT_LONG, 512, 64LL << 20, 1),
+    OPT(read_block_size, "FILEHANDLER_READ_BLOCK_SIZE", OPT_LONG, 512, 64LL << 20, 1),
+    OPT(output_dir, "FILEHANDLER_OUTPUT_DIR", OPT_STRING, 0, 0, 1),
+    OPT(output_mode, "FILEHANDLER_OUTPUT_MODE", OPT_OUTPUT_MODE, 0, 0, 1),
+    OPT(max_entry_bytes, "FILEHANDLER_MAX_ENTRY_BYTES", OPT_LONG, 0, LLONG_MAX, 1),
+    OPT(line_dedup, "FILEHANDLER_LINE_DEDUP", OPT_LINE_DEDUP, 0, 0, 1),
+    OPT(line_dedup_memory_mb, "FILEHANDLER_LINE_DEDUP_MEMORY_MB", OPT_LONG, 1, 1LL << 20, 1),
+    OPT(binary_entries, "FILEHANDLER_BINARY_ENTRIES", OPT_BINARY_ENTRIES, 0, 0, 1),
+    OPT(cold_output_dir, "FILEHANDLER_COLD_OUTPUT_DIR", OPT_STRING, 0, 0, 1),
+    OPT(entry_timeout_sec, "FILEHANDLER_ENTRY_TIMEOUT_SEC", OPT_INT, 1, 86400, 1),
+    OPT(max_retries, "FILEHANDLER_MAX_RETRIES", OPT_INT, 0, 100, 1),
+    OPT(retry_base_delay_ms, "FILEHANDLER_RETRY_BASE_DELAY_MS", OPT_LONG, 1, 86400000, 1),
+    OPT(retry_max_delay_ms, "FILEHANDLER_RETRY_MAX_DELAY_MS", OPT_LONG, 1, 86400000, 1),
+    OPT(watch_debounce_ms, "FILEHANDLER_WATCH_DEBOUNCE_MS", OPT_INT, 0, 60000, 1),
+    OPT(watch_max_delay_ms, "FILEHANDLER_WATCH_MAX_DELAY_MS", OPT_INT, 0, 600000, 1),
+    OPT(include_extensions, "FILEHANDLER_INCLUDE_EXTENSIONS", OPT_STRING, 0, 0, 1),
+    OPT(exclude_extensions, "FILEHANDLER_EXCLUDE_EXTENSIONS", OPT_STRING, 0, 0, 1),
+    OPT(parse_credentials, "FILEHANDLER_PARSE_CREDENTIALS", OPT_INT, 0, 1, 1),
+    OPT(record_dir, "FILEHANDLER_RECORD_DIR", OPT_STRING, 0, 0, 1),
+    OPT(record_layout, "FILEHANDLER_RECORD_LAYOUT", OPT_RECORD_LAYOUT, 0, 0, 1),
+    OPT(record_shard_dir, "FILEHANDLER_RECORD_SHARD_DIR", OPT_STRING, 0, 0, 1),
+    OPT(record_shards, "FILEHANDLER_RECORD_SHARDS", OPT_INT, 1, 1024, 1),
+    OPT(sqlite_db, "FILEHANDLER_SQLITE_DB", OPT_STRING, 0, 0, 1),
+    OPT(sqlite_batch_rows, "FILEHANDLER_SQLITE_BATCH_ROWS", OPT_INT, 1000, 10000000, 1),
+    OPT(sqlite_staging, "FILEHANDLER_SQLITE_STAGING", OPT_INT, -1, 1, 1),
+    OPT(sqlite_defer_indexes, "FILEHANDLER_SQLITE_DEFER_INDEXES", OPT_INT, 0, 1, 1),
+    OPT(columnar_store, "FILEHANDLER_COLUMNAR_STORE", OPT_INT, 0, 1, 1),
+    OPT(identity_index, "FILEHANDLER_IDENTITY_INDEX", OPT_INT, 0, 1, 1),
+    OPT(identity_index_merge_factor, "FILEHANDLER_IDENTITY_INDEX_MERGE_FACTOR", OPT_INT, 2, 64, 0),
+    OPT(lookup_socket, "FILEHANDLER_LOOKUP_SOCKET", OPT_STRING, 0, 0, 0),
+    OPT(domain_index, "FILEHANDLER_DOMAIN_INDEX", OPT_INT, 0, 1, 1),
+    OPT(domain_index_dir, "FILEHANDLER_DOMAIN_INDEX_DIR", OPT_STRING, 0, 0, 0),
+    OPT(domain_index_merge_factor, "FILEHANDLER_DOMAIN_INDEX_MERGE_FACTOR", OPT_INT, 2, 64, 0),
+    OPT(hash_ranges, "FILEHANDLER_HASH_RANGES", OPT_INT, 0, 1, 1),
+    OPT(range_dir, "FILEHANDLER_RANGE_DIR", OPT_STRING, 0, 0, 1),
+    OPT(content_manifest, "FILEHANDLER_CONTENT_MANIFEST", OPT_INT, 0, 1, 1),
+    OPT(transcode_text, "FILEHANDLER_TRANSCODE_TEXT", OPT_INT, 0, 1, 1),
+    OPT(detect_secrets, "FILEHANDLER_DETECT_SECRETS", OPT_INT, 0, 1, 1),
+    OPT(watchlist_dir, "FILEHANDLER_WATCHLIST_DIR", OPT_STRING, 0, 0, 1),
+    OPT(parse_sql, "FILEHANDLER_PARSE_SQL", OPT_INT, 0, 1, 1),
+    OPT(sql_tables, "FILEHANDLER_SQL_TABLES", OPT_STRING, 0, 0, 1),
+    OPT(sql_identity_columns, "FILEHANDLER_SQL_IDENTITY_COLUMNS", OPT_STRING, 0, 0, 1),
+    OPT(sql_secret_columns, "FILEHANDLER_SQL_SECRET_COLUMNS", OPT_STRING, 0, 0, 1),
+    OPT(parse_csv, "FILEHANDLER_PARSE_CSV", OPT_INT, 0, 1, 1),
+    OPT(csv_identity_columns, "FILEHANDLER_CSV_IDENTITY_COLUMNS", OPT_STRING, 0, 0, 1),
+    OPT(csv_secret_columns, "FILEHANDLER_CSV_SECRET_COLUMNS", OPT_STRING, 0, 0, 1),
+    OPT(csv_url_columns, "FILEHANDLER_CSV_URL_COLUMNS", OPT_STRING, 0, 0, 1),
+    OPT(parse_stealer_logs, "FILEHANDLER_PARSE_STEALER_LOGS", OPT_INT, 0, 1, 1),
+    OPT(stealer_threads, "FILEHANDLER_STEALER_THREADS", OPT_INT, 0, 64, 1),
+    OPT(sort_records, "FILEHANDLER_SORT_RECORDS", OPT_INT, 0, 1, 1),
+    OPT(sort_memory_mb, "FILEHANDLER_SORT_MEMORY_MB", OPT_LONG, 64, 1LL << 20, 1),
+    OPT(sort_threads, "FILEHANDLER_SORT_THREADS", OPT_INT, 1, 64, 1),
+    OPT(sort_tmp_dir, "FILEHANDLER_SORT_TMP_DIR", OPT_STRING, 0, 0, 1),
+    OPT(neardup_threshold, "FILEHANDLER_NEARDUP_THRESHOLD", OPT_INT, 0, 100, 1),
+    OPT(neardup_skip, "FILEHANDLER_NEARDUP_SKIP", OPT_INT, 0, 1, 1),
+    OPT(neardup_sample_mb, "FILEHANDLER_NEARDUP_SAMPLE_MB", OPT_LONG, 0, 1LL << 20, 1),
+};
+
+#define OPTION_COUNT (sizeof(options) / sizeof(options[0]))
+
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Config *current = NULL;
+
+// Every output and store beyond the extracted files is off (zero or empty)
+// until the deployment config turns it on
+static void config_defaults(Config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    snprintf(cfg->rabbitmq_host, sizeof(cfg->rabbitmq_host), "rabbitmq");
+    cfg->rabbitmq_port = 5672;
+    snprintf(cfg->rabbitmq_user, sizeof(cfg->rabbitmq_user), "guest");
+    snprintf(cfg->rabbitmq_password, sizeof(cfg->rabbitmq_password), "guest");
+    snprintf(cfg->rabbitmq_vhost, sizeof(cfg->rabbitmq_vhost), "/");
+    cfg->hash_weight = 10;
+    snprintf(cfg->intake, sizeof(cfg->intake), "amqp");
+    snprintf(cfg->watch_dir, sizeof(cfg->watch_dir), "extracted/inbox");
+    cfg->consumer_channels = 4;
+    cfg->channel_prefetch = 0;  // Derived from workers and queue_depth
+    cfg->dedup_bloom_bytes = 256LL << 20;
+    snprintf(cfg->neardup_store, sizeof(cfg->neardup_store), "extracted/dedup/inputs.sig");
+
+    cfg->workers = 10;
+    cfg->queue_depth = 10;
+    cfg->buffer_size = 4096;
+    cfg->read_block_size = 10240;
+    snprintf(cfg->output_dir, sizeof(cfg->output_dir), "extracted");
+    cfg->output_mode = OUTPUT_TREE;
+    cfg->line_dedup_memory_mb = 256;
+    snprintf(cfg->cold_output_dir, sizeof(cfg->cold_output_dir), "extracted/cold");
+    cfg->entry_timeout_sec = 300;
+    cfg->max_retries = 3;
+    cfg->retry_base_delay_ms = 5000;
+    cfg->retry_max_delay_ms = 600000;
+    cfg->watch_debounce_ms = 200;
+    cfg->watch_max_delay_ms = 2000;
+    snprintf(cfg->record_dir, sizeof(cfg->record_dir), "extracted/records");
+    cfg->record_layout = RECORD_LAYOUT_INPUT;
+    snprintf(cfg->record_shard_dir, sizeof(cfg->record_shard_dir), "extracted/shards");
+    cfg->record_shards = 64;
+    cfg->sqlite_batch_rows = 100000;
+    cfg->sqlite_staging = -1;  // Off when sort_records already orders the files
+    cfg->identity_index_merge_factor = 8;
+    snprintf(cfg->domain_index_dir, sizeof(cfg->domain_index_dir), "extracted/domains");
+    cfg->domain_index_merge_factor = 8;
+    snprintf(cfg->range_dir, sizeof(cfg->range_dir), "extracted/ranges");
+    snprintf(cfg->watchlist_dir, sizeof(cfg->watchlist_dir), RESOURCES_DIR "/watchlist");
+    snprintf(cfg->sql_identity_columns, sizeof(cfg->sql_identity_columns),
+             "email,username,login,user_name,user_email,phone,mobile");
+    snprintf(cfg->sql_secret_columns, sizeof(cfg->sql_secret_columns), "password,password_hash,passwd,pass,pwd,hash");
+    snprintf(cfg->csv_identity_columns, sizeof(cfg->csv_identity_columns),
+             "email,e-mail,mail,username,login,user,phone");
+    snprintf(cfg->csv_secret_columns, sizeof(cfg->csv_secret_columns), "password,pass,pwd,password_hash,hash");
+    snprintf(cfg->csv_url_columns, sizeof(cfg->csv_url_columns), "url,origin_url,host,domain,site");
+    cfg->stealer_threads = 4;
+    cfg->sort_memory_mb = 1024;
+    cfg->sort_threads = 4;
+    cfg->neardup_sample_mb = 64;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+static int set_option(Config *cfg, const ConfigOption *opt, const char *value, const char *source) {
+    char *field = (char *)cfg + opt->offset;
+
+    if (opt->type == OPT_STRING) {
+        if (strlen(value) >= opt->size) {
+            log_error("Invalid %s from %s: longer than %zu bytes", opt->name, source, opt->size - 1);
+            return -1;
+        }
+        memcpy(field, value, strlen(value) + 1);
+        return 0;
+    }
+
+    if (opt->type == OPT_OUTPUT_MODE) {
+        OutputMode mode;
+        if (strcmp(value, "tree") == 0) mode = OUTPUT_TREE;
+        else if (strcmp(value, "flat") == 0) mode = OUTPUT_FLAT;
+        else if (strcmp(value, "none") == 0) mode = OUTPUT_NONE;
+        else {
+            log_error("Invalid %s from %s: '%s' (expected tree, flat or none)", opt->name, source, value);
+            return -1;
+        }
+        memcpy(field, &mode, sizeof(mode));
+        return 0;
+    }
+
+    if (opt->type == OPT_LINE_DEDUP) {
+        LineDedupScope scope;
+        if (strcmp(value, "none") == 0) scope = LINE_DEDUP_NONE;
+        else if (strcmp(value, "entry") == 0) scope = LINE_DEDUP_ENTRY;
+        else if (strcmp(value, "input") == 0) scope = LINE_DEDUP_INPUT;
+        else {
+            log_error("Invalid %s from %s: '%s' (expected none, entry or input)", opt->name, source, value);
+            return -1;
+        }
+        memcpy(field, &scope, sizeof(scope));
+        return 0;
+    }
+
+    if (opt->type == OPT_BINARY_ENTRIES) {
+        BinaryEntries where;
+        if (strcmp(value, "keep") == 0) where = BINARY_ENTRIES_KEEP;
+        else if (strcmp(value, "cold") == 0) where = BINARY_ENTRIES_COLD;
+        else if (strcmp(value, "skip") == 0) where = BINARY_ENTRIES_SKIP;
+        else {
+            log_error("Invalid %s from %s: '%s' (expected keep, cold or skip)", opt->name, source, value);
+            return -1;
+        }
+        memcpy(field, &where, sizeof(where));
+        return 0;
+    }
+
+    if (opt->type == OPT_RECORD_LAYOUT) {
+        RecordLayout layout;
+        if (strcmp(value, "input") == 0) layout = RECORD_LAYOUT_INPUT;
+        else if (strcmp(value, "domain") == 0) layout = RECORD_LAYOUT_DOMAIN;
+        else if (strcmp(value, "both") == 0) layout = RECORD_LAYOUT_BOTH;
+        else {
+            log_error("Invalid %s from %s: '%s' (expected input, domain or both)", opt->name, source, value);
+            return -1;
+        }
+        memcpy(field, &layout, sizeof(layout));
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    long long n = strtoll(value, &end, 10);
+    // Accept K/M/G suffixes for sizes
+    if (end != value && *end && !end[1]) {
+        int shift = 0;
+        if (*end == 'K' || *end == 'k') shift = 10;
+        else if (*end == 'M' || *end == 'm') shift = 20;
+        else if (*end == 'G' || *end == 'g') shift = 30;
+        if (shift && (n > LLONG_MAX >> shift || n < LLONG_MIN >> shift)) errno = ERANGE;
+        else if (shift) {
+            n *= 1LL << shift;
+            end++;
+        }
+    }
+    if (errno != 0 || end == value || *end || n < opt->min || n > opt->max) {
+        log_error("Invalid %s from %s: '%s' (expected %lld..%lld)", opt->name, source, value, opt->min, opt->max);
+        return -1;
+    }
+    if (opt->type == OPT_INT) {
+        int v = (int)n;
+        memcpy(field, &v, sizeof(v));
+    } else {
+        memcpy(field, &n, sizeof(n));
+    }
+    return 0;
+}
+
+static const ConfigOption *find_option(const char *name) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        if (strcmp(options[i].name, name) == 0) return &options[i];
+    }
+    return NULL;
+}
+
+static int load_env(Config *cfg) {
+    int rc = 0;
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const char *value = getenv(options[i].env);
+        if (value && *value && set_option(cfg, &options[i], value, options[i].env) != 0) rc = -1;
+    }
+    return rc;
+}
+
+// Cuts a comment: '#' at the start of the line or after whitespace, so values
+// such as passwords may contain '#'
+static void strip_comment(char *line) {
+    for (char *p = line; *p; p++) {
+        if (*p == '#' && (p == line || isspace((unsigned char)p[-1]))) {
+            *p = '\0';
+            return;
+        }
+    }
+}
+
+// key = value lines. A missing file is not an error. Options set in the
+// environment are skipped: the environment takes precedence.
+static int load_file(Config *cfg, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (errno == ENOENT) return 0;
+        log_error("Failed to open config file %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char line[1024];
+    int lineno = 0, rc = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        strip_comment(line);
+        char *text = trim(line);
+        if (!*text) continue;
+
+        char *eq = strchr(text, '=');
+        if (!eq) {
+            log_error("%s:%d: expected key = value", path, lineno);
+            rc = -1;
+            continue;
+        }
+        *eq = '\0';
+        char *key = trim(text), *value = trim(eq + 1);
+        const ConfigOption *opt = find_option(key);
+        if (!opt) {
+            log_error("%s:%d: unknown option '%s'", path, lineno, key);
+            rc = -1;
+            continue;
+        }
+        const char *env = getenv(opt->env);
+        if (env && *env) {
+            log_warning("%s:%d: ignoring %s, which %s sets", path, lineno, key, opt->env);
+            continue;
+        }
+        char source[PATH_MAX + 16];
+        snprintf(source, sizeof(source), "%s:%d", path, lineno);
+        if (set_option(cfg, opt, value, source) != 0) rc = -1;
+    }
+    fclose(f);
+    return rc;
+}
+
+// Absolute form of path with ".", ".." and repeated slashes resolved, without
+// touching the filesystem: the directories need not exist yet
+static int absolute_path(const char *path, char *out, size_t size) {
+    char full[2 * PATH_MAX];
+    if (path[0] == '/') snprintf(full, sizeof(full), "%s", path);
+    else {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd))) return -1;
+        snprintf(full, sizeof(full), "%s/%s", cwd, path);
+    }
+    size_t len = 0;
+    char *save;
+    for (char *part = strtok_r(full, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (strcmp(part, ".") == 0) continue;
+        if (strcmp(part, "..") == 0) {
+            while (len > 0 && out[--len] != '/') {}
+            continue;
+        }
+        size_t part_len = strlen(part);
+        if (len + part_len + 2 > size) return -1;
+        out[len++] = '/';
+        memcpy(out + len, part, part_len);
+        len += part_len;
+    }
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return 0;
+}
+
+// Whether dir is path or one of its parents
+static int dir_contains(const char *dir, const char *path) {
+    char d[PATH_MAX], p[PATH_MAX];
+    if (absolute_path(dir, d, sizeof(d)) != 0 || absolute_path(path, p, sizeof(p)) != 0) return 0;
+    size_t len = strlen(d);
+    if (strcmp(d, "/") == 0) return 1;
+    return strncmp(d, p, len) == 0 && (p[len] == '\0' || p[len] == '/');
+}
+
+static int validate(const Config *cfg) {
+    if (strcmp(cfg->intake, "amqp") != 0 && strcmp(cfg->intake, "watch") != 0 && strcmp(cfg->intake, "both") != 0) {
+        log_error("Invalid intake '%s' (expected amqp, watch or both)", cfg->intake);
+        return -1;
+    }
+    if (!cfg->output_dir[0] || !cfg->watch_dir[0] || !cfg->rabbitmq_host[0] || !cfg->record_dir[0]) {
+        log_error("output_dir, record_dir, watch_dir and rabbitmq_host must not be empty");
+        return -1;
+    }
+    // The watcher queues everything it finds and writes .processed markers there
+    if (strcmp(cfg->intake, "amqp") != 0 &&
+        (dir_contains(cfg->watch_dir, RESOURCES_DIR) ||
+         (cfg->watchlist_dir[0] && dir_contains(cfg->watch_dir, cfg->watchlist_dir)))) {
+        log_error("watch_dir %s must not be or contain %s or watchlist_dir", cfg->watch_dir, RESOURCES_DIR);
+        return -1;
+    }
+    if (cfg->record_layout != RECORD_LAYOUT_INPUT && !cfg->record_shard_dir[0]) {
+        log_error("record_shard_dir must not be empty with record_layout = domain or both");
+        return -1;
+    }
+    if (cfg->sqlite_db[0] && cfg->record_layout == RECORD_LAYOUT_DOMAIN) {
+        log_error("sqlite_db loads <input>.rec files, which record_layout = domain does not write");
+        return -1;
+    }
+    if (cfg->consumer_channels * cfg->channel_prefetch < cfg->workers) {
+        log_error("consumer_channels x channel_prefetch (%d) must be at least workers (%d)",
+                  cfg->consumer_channels * cfg->channel_prefetch, cfg->workers);
+        return -1;
+    }
+    // A replica's queue outlives it, so a name that changes with each container would leave
+    // bound queues behind that keep their share of the hash ring
+    if (cfg->hash_exchange[0] && !cfg->replica_id[0]) {
+        log_error("replica_id (FILEHANDLER_REPLICA_ID) must be set with hash_exchange, the same across restarts");
+        return -1;
+    }
+    if (cfg->retry_max_delay_ms < cfg->retry_base_delay_ms) {
+        log_error("retry_max_delay_ms must be at least retry_base_delay_ms");
+        return -1;
+    }
+    return 0;
+}
+
+// Copies what only a restart can change from the running configuration
+static void keep_frozen(Config *cfg, const Config *running) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const ConfigOption *opt = &options[i];
+        char *field = (char *)cfg + opt->offset;
+        const char *running_field = (const char *)running + opt->offset;
+        if (!opt->reloadable && memcmp(field, running_field, opt->size) != 0) {
+            log_warning("%s changed but only takes effect after a restart", opt->name);
+            memcpy(field, running_field, opt->size);
+        }
+    }
+}
+
+// running is the configuration a reload replaces, NULL at startup. Its frozen
+// fields are restored before anything is derived or validated, so the result
+// is checked as it will run.
+static Config *config_load(const Config *running) {
+    Config *cfg = malloc(sizeof(Config));
+    if (!cfg) {
+        log_error("Failed to allocate configuration");
+        return NULL;
+    }
+    config_defaults(cfg);
+
+    const char *path = getenv("FILEHANDLER_CONFIG");
+    if (!path || !*path) path = DEFAULT_CONFIG_FILE;
+
+    int rc = load_file(cfg, path);
+    if (load_env(cfg) != 0) rc = -1;
+    if (rc == 0 && running) keep_frozen(cfg, running);
+    // Enough unacked deliveries to keep every worker busy and the queue full
+    if (cfg->channel_prefetch == 0)
+        cfg->channel_prefetch = (cfg->workers + cfg->queue_depth + cfg->consumer_channels - 1) / cfg->consumer_channels;
+    // A sorted file already loads in index order; staging would only copy it twice
+    if (cfg->sqlite_staging < 0) cfg->sqlite_staging = !cfg->sort_records;
+    if (rc != 0 || validate(cfg) != 0) {
+        free(cfg);
+        return NULL;
+    }
+    return cfg;
+}
+
+int config_init(void) {
+    Config *cfg = config_load(NULL);
+    if (!cfg) return -1;
+    cfg->refs = 1;  // Held by `current`
+    pthread_mutex_lock(&config_mutex);
+    current = cfg;
+    pthread_mutex_unlock(&config_mutex);
+    return 0;
+}
+
+int config_reload(void) {
+    Config *running = config_acquire();
+    Config *cfg = config_load(running);
+    config_release(running);
+    if (!cfg) {
+        log_error("Configuration reload rejected; keeping the running configuration");
+        return -1;
+    }
+
+    pthread_mutex_lock(&config_mutex);
+    Config *old = current;
+    cfg->refs = 1;
+    current = cfg;
+    if (--old->refs == 0) free(old);
+    pthread_mutex_unlock(&config_mutex);
+
+    log_info("Configuration reloaded: %d workers, queue depth %d, prefetch %d",
+             cfg->workers, cfg->queue_depth, cfg->channel_prefetch);
+    return 0;
+}
+
+Config *config_acquire(void) {
+    pthread_mutex_lock(&config_mutex);
+    Config *cfg = current;
+    cfg->refs++;
+    pthread_mutex_unlock(&config_mutex);
+    return cfg;
+}
+
+void config_release(Config *cfg) {
+    pthread_mutex_lock(&config_mutex);
+    if (--cfg->refs == 0) free(cfg);
+    pthread_mutex_unlock(&config_mutex);
+}
+
+static int extension_in_list(const char *ext, const char *list) {
+    size_t ext_len = strlen(ext);
+    const char *p = list;
+    while (*p) {
+        while (*p == ',' || *p == ' ') p++;
+        const char *start = p;
+        while (*p && *p != ',' && *p != ' ') p++;
+        size_t len = p - start;
+        if (len > 0 && *start == '.') {
+            start++;
+            len--;
+        }
+        if (len == ext_len && len > 0 && strncasecmp(start, ext, len) == 0) return 1;
+    }
+    return 0;
+}
+
+int config_name_allowed(const Config *cfg, const char *name) {
+    const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+    const char *dot = strrchr(base, '.');
+    const char *ext = dot ? dot + 1 : "";
+
+    if (cfg->include_extensions[0] && !extension_in_list(ext, cfg->include_extensions)) return 0;
+    if (cfg->exclude_extensions[0] && extension_in_list(ext, cfg->exclude_extensions)) return 0;
+    return 1;
+}
@@ -0,0 +1,133 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <limits.h>
+#include <stddef.h>
+
+#define DEFAULT_CONFIG_FILE "config/filehandler.conf"
+#define RESOURCES_DIR "resources"  // Seed link lists and the watchlist: reference data, never intake
+
+typedef enum {
+    OUTPUT_TREE,  // Mirror archive paths under output_dir
+    OUTPUT_FLAT,  // One file per entry directly in output_dir, named <archive>_<entry path>
+    OUTPUT_NONE  // Stream entries through the pipeline without writing them
+} OutputMode;
+
+typedef enum {
+    LINE_DEDUP_NONE,
+    LINE_DEDUP_ENTRY,  // Duplicate lines are dropped within each written file
+    LINE_DEDUP_INPUT  // ... and across all files of an archive
+} LineDedupScope;
+
+typedef enum {
+    BINARY_ENTRIES_KEEP,  // Written next to the text entries
+    BINARY_ENTRIES_COLD,  // Written under cold_output_dir instead
+    BINARY_ENTRIES_SKIP  // Streamed through the pipeline but not written
+} BinaryEntries;
+
+typedef enum {
+    RECORD_LAYOUT_INPUT,  // <record_dir>/<input>.rec per task
+    RECORD_LAYOUT_DOMAIN,  // Appended to record_shards files under record_shard_dir by domain
+    RECORD_LAYOUT_BOTH
+} RecordLayout;
+
+// Immutable snapshot of the service configuration. Values come from the
+// defaults below, then the config file (FILEHANDLER_CONFIG), which is re-read
+// on SIGHUP, then FILEHANDLER_* / RABBITMQ_* environment variables, which win.
+typedef struct {
+    // Startup only: changing these requires a restart
+    char rabbitmq_host[256];
+    int rabbitmq_port;
+    char rabbitmq_user[128];
+    char rabbitmq_password[128];
+    char rabbitmq_vhost[128];
+    char hash_exchange[128];
+    char replica_id[128];
+    int hash_weight;
+    char intake[16];  // amqp, watch or both
+    char watch_dir[PATH_MAX];  // Must not be or contain RESOURCES_DIR or watchlist_dir
+    int consumer_channels;
+    // Credential dedup table shared by all replicas, which commit under flock on <path>.lock; empty disables it
+    char dedup_store[PATH_MAX];
+    long long dedup_bloom_bytes;  // Size of the Bloom prefilter kept next to the table
+    char neardup_store[PATH_MAX];  // MinHash signatures of processed inputs; empty disables near-duplicate checks
+
+    // Reloadable
+    int workers;
+    int queue_depth;
+    int channel_prefetch;  // 0 derives ceil((workers + queue_depth) / consumer_channels); applied with basic.qos
+    long long buffer_size;  // Write chunk size
+    long long read_block_size;  // Bytes handed to libarchive per read callback
+    char output_dir[PATH_MAX];
+    OutputMode output_mode;
+    long long max_entry_bytes;  // Entries larger than this are skipped; 0 disables the limit
+    LineDedupScope line_dedup;  // Drop duplicate lines of text entries before they are written
+    long long line_dedup_memory_mb;  // Fingerprint table cap; beyond it a sorted pass over the file finishes the job
+    BinaryEntries binary_entries;  // Archive entries classified as media, archives, executables or unknown binary
+    char cold_output_dir[PATH_MAX];  // Mirrors output_dir's layout for binary_entries = cold
+    int entry_timeout_sec;  // Deadline per entry, checked between libarchive calls (not within one)
+    int max_retries;
+    long long retry_base_delay_ms;
+    long long retry_max_delay_ms;
+    int watch_debounce_ms;
+    int watch_max_delay_ms;  // Pending files are queued at most this long after the first event
+    char include_extensions[512];  // Comma-separated; empty accepts everything
+    char exclude_extensions[512];
+    int parse_credentials;  // Run the combo-list parser on text entries
+    char record_dir[PATH_MAX];  // Where <input>.rec credential record files go
+    RecordLayout record_layout;
+    char record_shard_dir[PATH_MAX];
+    int record_shards;  // Domain partitions; part of the shard file names
+    char sqlite_db[PATH_MAX];  // Database every task's .rec is loaded into; empty disables it
+    int sqlite_batch_rows;  // Rows per transaction
+    int sqlite_staging;  // Load through a temporary table merged in fingerprint order; -1 unless sort_records
+    int sqlite_defer_indexes;  // Drop the secondary indexes during a load adding a quarter of the table or more
+    int columnar_store;  // Also write records to <input>.sgc column stores for domain queries
+    int identity_index;  // Write <input>.idx lookup indexes over normalized identities
+    int identity_index_merge_factor;  // Index files in record_dir merged at once, in the background
+    char lookup_socket[108];  // Unix socket serving identity lookups; empty disables it
+    int domain_index;  // Index the registrable domains of emails and URLs in every entry
+    char domain_index_dir[PATH_MAX];  // Domain index segments; merged in the background
+    int domain_index_merge_factor;  // Segments merged at once
+    int hash_ranges;  // Append SHA-1 and NTLM hashes of secrets to k-anonymity range files
+    char range_dir[PATH_MAX];
+    int content_manifest;  // BLAKE3 of the input and every entry to <input>.manifest.jsonl
+    int transcode_text;  // Scanners and parsers see UTF-16, CP1251 and CP1252 entries as UTF-8
+    int detect_secrets;  // Write API keys, tokens and private keys to <input>.secrets.jsonl
+    char watchlist_dir[PATH_MAX];  // *.txt pattern lists scanned for in every entry
+    int parse_sql;  // Extract credential rows from SQL dumps instead of combo-parsing them
+    char sql_tables[512];  // Comma-separated table names; empty maps every table
+    char sql_identity_columns[512];  // Comma-separated, in priority order
+    char sql_secret_columns[512];
+    int parse_csv;  // Project credential columns of *.csv / *.tsv entries by header name
+    char csv_identity_columns[512];  // Comma-separated header names, in priority order
+    char csv_secret_columns[512];
+    char csv_url_columns[512];
+    int parse_stealer_logs;  // Group stealer-log entries per victim and parse Passwords.txt / System.txt
+    int stealer_threads;  // Victim groups parsed in parallel per task; 0 parses inline
+    int sort_records;  // Rewrite each task's .rec sorted by fingerprint, one record per fingerprint
+    long long sort_memory_mb;  // Buffer cap of the external sort
+    int sort_threads;  // Run generation workers
+    char sort_tmp_dir[PATH_MAX];  // Spill files; empty uses record_dir
+    int neardup_threshold;  // Percent similarity that flags an input as a repost; 0 skips the sketch pass
+    int neardup_skip;  // Skip flagged inputs whole, new lines included, instead of only logging them
+    long long neardup_sample_mb;  // Decompressed bytes sketched per input, from its start; 0 sketches all of it
+
+    int refs;
+} Config;
+
+// Load the initial configuration; returns -1 if any value is invalid
+int config_init(void);
+
+// Re-read env and config file; on any invalid value the running config is kept.
+// Returns 0 when a new snapshot was installed.
+int config_reload(void);
+
+// Pin the current snapshot; every acquire must be paired with a release
+Config *config_acquire(void);
+void config_release(Config *cfg);
+
+// Whether a file or entry name passes the include/exclude extension filters
+int config_name_allowed(const Config *cfg, const char *name);
+
+#endif
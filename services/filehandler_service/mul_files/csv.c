@@ -0,0 +1,319 @@
+#include <string.h>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csv.h"
+
+#define FIELD_OVERFLOW (CSV_MAX_FIELD + 4)
+
+static const char candidate_delimiters[] = {',', ';', '\t', '|'};
+
+// Bitmasks of '"', delimiter and '\n' bytes in a 64-byte chunk
+static inline void chunk_masks(const char *p, char delimiter, uint64_t *quotes, uint64_t *delims,
+                               uint64_t *newlines) {
+#ifdef __SSE2__
+    const __m128i q = _mm_set1_epi8('"'), d = _mm_set1_epi8(delimiter), nl = _mm_set1_epi8('\n');
+    uint64_t qm = 0, dm = 0, nm = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        qm |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, q)) << (16 * i);
+        dm |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, d)) << (16 * i);
+        nm |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+    }
+    *quotes = qm;
+    *delims = dm;
+    *newlines = nm;
+#else
+    uint64_t qm = 0, dm = 0, nm = 0;
+    for (int i = 0; i < 64; i++) {
+        qm |= (uint64_t)(p[i] == '"') << i;
+        dm |= (uint64_t)(p[i] == delimiter) << i;
+        nm |= (uint64_t)(p[i] == '\n') << i;
+    }
+    *quotes = qm;
+    *delims = dm;
+    *newlines = nm;
+#endif
+}
+
+// Bit i set when an odd number of quotes precede or are at i: the bytes
+// from an opening quote up to (not including) its closing quote
+static inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Strip a trailing CR and surrounding blanks, then undo "..." quoting with
+// doubled quotes. Returns the decoded length, written to out.
+static size_t decode_field(const char *p, size_t n, char *out, int *quoted) {
+    while (n > 0 && (p[n - 1] == '\r' || p[n - 1] == ' ')) n--;
+    while (n > 0 && *p == ' ') {
+        p++;
+        n--;
+    }
+    *quoted = n > 0 && *p == '"';
+    if (!*quoted) {
+        memcpy(out, p, n);
+        return n;
+    }
+    size_t used = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (p[i] == '"') {
+            if (i + 1 < n && p[i + 1] == '"') i++;
+            else continue;  // Closing quote
+        }
+        out[used++] = p[i];
+    }
+    return used;
+}
+
+static uint8_t header_role(const CsvParser *cp, const char *name, size_t len) {
+    int rank = record_column_rank(cp->identity_columns, name, len);
+    if (rank) return (uint8_t)(CSV_ROLE_IDENTITY | (rank < CSV_ROLE_RANK ? rank : CSV_ROLE_RANK));
+    rank = record_column_rank(cp->secret_columns, name, len);
+    if (rank) return (uint8_t)(CSV_ROLE_SECRET | (rank < CSV_ROLE_RANK ? rank : CSV_ROLE_RANK));
+    rank = record_column_rank(cp->url_columns, name, len);
+    if (rank) return (uint8_t)(CSV_ROLE_URL | (rank < CSV_ROLE_RANK ? rank : CSV_ROLE_RANK));
+    return 0;
+}
+
+// The most frequent candidate outside quotes in the header line; ',' on a tie
+static char detect_delimiter(const char *line, size_t len) {
+    size_t counts[sizeof(candidate_delimiters)] = {0};
+    int quoted = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '"') quoted = !quoted;
+        if (quoted) continue;
+        for (size_t k = 0; k < sizeof(candidate_delimiters); k++) {
+            if (line[i] == candidate_delimiters[k]) counts[k]++;
+        }
+    }
+    size_t best = 0;
+    for (size_t k = 1; k < sizeof(candidate_delimiters); k++) {
+        if (counts[k] > counts[best]) best = k;
+    }
+    return candidate_delimiters[best];
+}
+
+static void parse_header(CsvParser *cp) {
+    const char *line = cp->head;
+    size_t len = cp->head_len;
+    if (len >= 3 && memcmp(line, "\xef\xbb\xbf", 3) == 0) {
+        line += 3;
+        len -= 3;
+    }
+    cp->delimiter = detect_delimiter(line, len);
+
+    int identity = 0, secret = 0, quoted = 0;
+    unsigned column = 0;
+    size_t start = 0;
+    char name[CSV_MAX_FIELD];
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && line[i] == '"') quoted = !quoted;
+        if (i < len && (quoted || line[i] != cp->delimiter)) continue;
+        if (column < CSV_MAX_COLUMNS && i - start <= CSV_MAX_FIELD) {
+            int was_quoted;
+            size_t n = decode_field(line + start, i - start, name, &was_quoted);
+            uint8_t role = header_role(cp, name, n);
+            cp->role[column] = role;
+            if ((role & CSV_ROLE_KIND) == CSV_ROLE_IDENTITY) identity = 1;
+            if ((role & CSV_ROLE_KIND) == CSV_ROLE_SECRET) secret = 1;
+        }
+        column++;
+        start = i + 1;
+    }
+    cp->active = identity && secret;
+}
+
+static inline void start_field(CsvParser *cp) {
+    cp->field_len = 0;
+    cp->field_role = cp->active && cp->column < CSV_MAX_COLUMNS ? cp->role[cp->column] : 0;
+}
+
+static inline void field_append(CsvParser *cp, const char *p, size_t n) {
+    if (cp->field_len + n < FIELD_OVERFLOW) {
+        memcpy(cp->field + cp->field_len, p, n);
+        cp->field_len += n;
+    } else {
+        cp->field_len = FIELD_OVERFLOW;
+    }
+}
+
+static void finish_field(CsvParser *cp) {
+    if (!cp->field_role || cp->field_len == FIELD_OVERFLOW) return;
+
+    CsvSlot *slot;
+    switch (cp->field_role & CSV_ROLE_KIND) {
+    case CSV_ROLE_IDENTITY: slot = &cp->identity; break;
+    case CSV_ROLE_SECRET: slot = &cp->secret; break;
+    default: slot = &cp->url; break;
+    }
+    uint8_t rank = cp->field_role & CSV_ROLE_RANK;
+    if (slot->len && rank >= slot->rank) return;
+
+    char value[sizeof(cp->field)];
+    int quoted;
+    size_t n = decode_field(cp->field, cp->field_len, value, &quoted);
+    if (n == 0 || n > CSV_MAX_FIELD) return;
+    // SQL exports write missing values as bare NULL or \N
+    if (!quoted && ((n == 4 && strncasecmp(value, "NULL", 4) == 0) || (n == 2 && memcmp(value, "\\N", 2) == 0))) {
+        return;
+    }
+    memcpy(slot->value, value, n);
+    slot->len = n;
+    slot->rank = rank;
+}
+
+static void finish_row(CsvParser *cp) {
+    if (cp->column == 0 && cp->field_len == 0) return;  // Blank line
+    cp->rows++;
+    if (cp->active && cp->identity.len && cp->secret.len) {
+        // Emails are stored lowercased, as the combo parser does
+        if (memchr(cp->identity.value, '@', cp->identity.len)) {
+            for (size_t i = 0; i < cp->identity.len; i++) {
+                char c = cp->identity.value[i];
+                if (c >= 'A' && c <= 'Z') cp->identity.value[i] = c + 32;
+            }
+        }
+        CredentialRecord rec = {cp->source, strlen(cp->source), cp->identity.value, cp->identity.len,
+                                cp->secret.value, cp->secret.len, cp->url.value, cp->url.len};
+        cp->records++;
+        cp->emit(cp->ctx, &rec);
+    }
+    cp->identity.len = 0;
+    cp->secret.len = 0;
+    cp->url.len = 0;
+}
+
+static void feed_rows(CsvParser *cp, const char *data, size_t len) {
+    char pad[64];
+    for (size_t i = 0; i < len; i += 64) {
+        size_t n = len - i < 64 ? len - i : 64;
+        const char *chunk = data + i;
+        if (n < 64) {
+            memcpy(pad, chunk, n);
+            memset(pad + n, 0, 64 - n);
+            chunk = pad;
+        }
+
+        uint64_t quotes, delims, newlines;
+        chunk_masks(chunk, cp->delimiter, &quotes, &delims, &newlines);
+        uint64_t inside = cp->in_quote;
+        if (quotes) {
+            // Drop quotes that would open a field mid-value, lowest first: each
+            // one flips the parity of every quote after it
+            uint64_t starts = ((delims | newlines) << 1) | cp->field_start;
+            for (;;) {
+                inside = prefix_xor(quotes) ^ cp->in_quote;
+                uint64_t prev_inside = (inside << 1) | (cp->in_quote & 1);
+                uint64_t prev_quote = (quotes << 1) | cp->after_quote;  // Second quote of a doubled ""
+                uint64_t stray = quotes & inside & ~prev_inside & ~starts & ~prev_quote;
+                if (!stray) break;
+                quotes &= ~(stray & (0 - stray));
+            }
+        }
+        cp->in_quote = (uint64_t)0 - ((inside >> (n - 1)) & 1);
+        cp->after_quote = (quotes >> (n - 1)) & 1;
+        uint64_t structural = (delims | newlines) & ~inside;
+        if (n < 64) structural &= ((uint64_t)1 << n) - 1;
+        cp->field_start = (structural >> (n - 1)) & 1;
+
+        // Unmapped fields are skipped without touching their bytes
+        size_t start = 0;
+        while (structural) {
+            size_t b = (size_t)__builtin_ctzll(structural);
+            if (cp->field_role) {
+                if (b > start) field_append(cp, chunk + start, b - start);
+                finish_field(cp);
+            }
+            if ((newlines >> b) & 1) {
+                finish_row(cp);
+                cp->column = 0;
+            } else {
+                cp->column++;
+            }
+            start_field(cp);
+            start = b + 1;
+            structural &= structural - 1;
+        }
+        if (cp->field_role && n > start) field_append(cp, chunk + start, n - start);
+    }
+}
+
+void csv_begin(CsvParser *cp, const char *source, const char *identity_columns, const char *secret_columns,
+               const char *url_columns, record_emit_fn emit, void *ctx) {
+    cp->identity_columns = identity_columns;
+    cp->secret_columns = secret_columns;
+    cp->url_columns = url_columns;
+    cp->source = source;
+    cp->emit = emit;
+    cp->ctx = ctx;
+    cp->header_done = 0;
+    cp->active = 0;
+    cp->delimiter = ',';
+    cp->in_quote = 0;
+    cp->field_start = 1;
+    cp->after_quote = 0;
+    cp->head_len = 0;
+    cp->head_overflow = 0;
+    memset(cp->role, 0, sizeof(cp->role));
+    cp->column = 0;
+    cp->field_role = 0;
+    cp->field_len = 0;
+    cp->identity.len = 0;
+    cp->secret.len = 0;
+    cp->url.len = 0;
+    cp->rows = 0;
+    cp->records = 0;
+}
+
+void csv_feed(CsvParser *cp, const char *data, size_t len) {
+    if (!cp->header_done) {
+        // Buffer the header line; a quoted header name may contain a newline
+        size_t i = 0;
+        int quoted = (int)(cp->in_quote & 1);
+        while (i < len && (quoted || data[i] != '\n')) {
+            if (data[i] == '"') quoted = !quoted;
+            i++;
+        }
+        cp->in_quote = quoted ? ~(uint64_t)0 : 0;
+        size_t take = i;
+        if (cp->head_len + i > CSV_MAX_HEADER) {
+            take = CSV_MAX_HEADER - cp->head_len;
+            cp->head_overflow = 1;
+        }
+        memcpy(cp->head + cp->head_len, data, take);
+        cp->head_len += take;
+        if (i == len) return;
+
+        // A cut header could map a prefix of a column name; map none
+        if (!cp->head_overflow) parse_header(cp);
+        cp->header_done = 1;
+        cp->in_quote = 0;
+        cp->field_start = 1;
+        cp->after_quote = 0;
+        start_field(cp);
+        data += i + 1;
+        len -= i + 1;
+    }
+    // Nothing to project: rows are not worth splitting
+    if (cp->active) feed_rows(cp, data, len);
+}
+
+void csv_end(CsvParser *cp) {
+    if (!cp->active) return;
+    finish_field(cp);
+    finish_row(cp);
+}
+
+int csv_sniff(const char *name) {
+    size_t len = name ? strlen(name) : 0;
+    return len > 4 && (strcasecmp(name + len - 4, ".csv") == 0 || strcasecmp(name + len - 4, ".tsv") == 0);
+}
@@ -0,0 +1,73 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define CSV_MAX_HEADER 65536  // Header lines longer than this leave the entry unmapped
+#define CSV_MAX_COLUMNS 1024  // Columns past this index are never mapped
+#define CSV_MAX_FIELD 255  // Longer identity/secret/url values are dropped
+
+// Column roles: 0 for unmapped, otherwise a kind plus the 1-based position of
+// the header name in that kind's configured list (lower wins within a row)
+#define CSV_ROLE_IDENTITY 0x40
+#define CSV_ROLE_SECRET 0x80
+#define CSV_ROLE_URL 0xc0
+#define CSV_ROLE_KIND 0xc0
+#define CSV_ROLE_RANK 0x3f
+
+// Best value of one kind seen in the current row
+typedef struct {
+    uint8_t rank;
+    size_t len;
+    char value[CSV_MAX_FIELD];
+} CsvSlot;
+
+// Streaming CSV/TSV reader with column projection by header name. The header
+// line picks the delimiter and maps columns to identity, secret and url roles.
+// Rows are then split 64 bytes at a time: quote, delimiter and newline
+// bitmaps are built with SSE2, a prefix XOR of the quote bits masks out
+// delimiters and newlines inside quoted fields, and only the bytes of mapped
+// columns are copied. As in RFC 4180, a quote opens a quoted field only at the
+// start of a field; elsewhere outside quotes it is an ordinary byte.
+typedef struct {
+    const char *identity_columns;  // Comma-separated, case-insensitive, in priority order
+    const char *secret_columns;
+    const char *url_columns;
+    const char *source;
+    record_emit_fn emit;
+    void *ctx;
+
+    int header_done;
+    int active;  // Header maps both an identity and a secret column
+    char delimiter;
+    uint64_t in_quote;  // All ones when the previous chunk ended inside a quoted field
+    uint64_t field_start;  // 1 when the previous chunk ended on a delimiter or newline
+    uint64_t after_quote;  // 1 when the previous chunk ended on a quote that opened or closed a field
+    size_t head_len;
+    int head_overflow;  // The header line did not fit in head
+    char head[CSV_MAX_HEADER];
+
+    uint8_t role[CSV_MAX_COLUMNS];
+    unsigned column;
+    uint8_t field_role;
+    size_t field_len;
+    char field[CSV_MAX_FIELD + 4];  // Raw value with its quotes and a trailing CR; full means overflow
+    CsvSlot identity, secret, url;
+
+    uint64_t rows;
+    uint64_t records;
+} CsvParser;
+
+void csv_begin(CsvParser *cp, const char *source, const char *identity_columns, const char *secret_columns,
+               const char *url_columns, record_emit_fn emit, void *ctx);
+void csv_feed(CsvParser *cp, const char *data, size_t len);
+// Finish a last row that had no trailing newline
+void csv_end(CsvParser *cp);
+
+// Whether an entry is a CSV/TSV export, from its name
+int csv_sniff(const char *name);
+
+#endif
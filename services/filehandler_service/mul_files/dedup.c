@@ -0,0 +1,556 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dedup.h"
+#include "filehandler.h"
+
+#define TABLE_HEADER_SIZE 4096  // Slots start on a page boundary
+#define BLOOM_HEADER_SIZE 64  // Bloom blocks start on a cache line
+#define BLOOM_PROBES 6  // Bits set per fingerprint, all inside one 512-bit block
+#define BATCH_INITIAL_SLOTS 4096
+
+typedef struct {
+    uint64_t lo, hi;  // All-zero marks an empty slot
+} Fingerprint;
+
+typedef struct {
+    char magic[8];
+    uint64_t slots;  // Power of two
+    uint64_t count;
+} TableHeader;
+
+typedef struct {
+    char magic[8];
+    uint64_t blocks;
+    uint64_t count;  // Table count when the filter was last synced; a mismatch forces a rebuild
+} BloomHeader;
+
+typedef struct {
+    int fd;
+    TableHeader *header;
+    Fingerprint *slots;
+    size_t bytes;
+} Table;
+
+struct DedupBatch {
+    Fingerprint *slots;  // Open-addressing set of the task's new fingerprints
+    uint64_t slot_count;  // Power of two
+    uint64_t count;
+    FILE *spill;  // Fingerprints moved out of a full set; NULL until then
+};
+
+// Lookups share the table, and may page-fault, while commits, growth and
+// disabling hold it alone
+static pthread_rwlock_t dedup_lock = PTHREAD_RWLOCK_INITIALIZER;
+// flock on <path>.lock, taken under the write lock: replicas sharing the store
+// write it one at a time. The table itself cannot carry the lock, as growth
+// replaces its file.
+static int lock_fd = -1;
+static char table_path[PATH_MAX];
+static char bloom_path[PATH_MAX + 8];
+static Table table = {-1, NULL, NULL, 0};
+static BloomHeader *bloom_header = NULL;
+static uint64_t *bloom_bits = NULL;
+static size_t bloom_map_bytes = 0;
+static dev_t bloom_dev;  // Identity of the mapped filter file, to notice one renamed over it
+static ino_t bloom_ino;
+static uint64_t sort_mask;  // Home-slot mask used by the commit sort; guarded by the write lock
+
+static int fp_empty(const Fingerprint *f) {
+    return f->lo == 0 && f->hi == 0;
+}
+
+static int fp_equal(const Fingerprint *a, const Fingerprint *b) {
+    return a->lo == b->lo && a->hi == b->hi;
+}
+
+static uint64_t bloom_block(uint64_t hi, uint64_t blocks) {
+    return (uint64_t)(((unsigned __int128)hi * blocks) >> 64);
+}
+
+static void bloom_set(const Fingerprint *f) {
+    uint64_t *block = bloom_bits + bloom_block(f->hi, bloom_header->blocks) * 8;
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        unsigned bit = (unsigned)(f->lo >> (64 - 9 * (i + 1))) & 511;
+        block[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+static int bloom_test(const Fingerprint *f) {
+    const uint64_t *block = bloom_bits + bloom_block(f->hi, bloom_header->blocks) * 8;
+    for (int i = 0; i < BLOOM_PROBES; i++) {
+        unsigned bit = (unsigned)(f->lo >> (64 - 9 * (i + 1))) & 511;
+        if (!(block[bit >> 6] & (1ULL << (bit & 63)))) return 0;
+    }
+    return 1;
+}
+
+// Linear probe from the home slot; inserts when insert is set. Returns 1 if found.
+static int slots_lookup(Fingerprint *slots, uint64_t mask, const Fingerprint *f, int insert) {
+    for (uint64_t i = f->lo & mask;; i = (i + 1) & mask) {
+        if (fp_empty(&slots[i])) {
+            if (insert) slots[i] = *f;
+            return 0;
+        }
+        if (fp_equal(&slots[i], f)) return 1;
+    }
+}
+
+static void table_unmap(Table *t) {
+    if (t->header) munmap(t->header, t->bytes);
+    if (t->fd != -1) close(t->fd);
+    t->fd = -1;
+    t->header = NULL;
+    t->slots = NULL;
+    t->bytes = 0;
+}
+
+// Size the file with real blocks: a sparse file would turn a full disk into SIGBUS on first write
+static int reserve_file(int fd, size_t bytes, const char *path) {
+    int err = posix_fallocate(fd, 0, (off_t)bytes);
+    if (err != 0) {
+        log_error("Failed to allocate %zu bytes for %s: %s", bytes, path, strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+// Open path and map it as a table of `slots` slots; an empty file is initialized
+// with that many, an existing one must carry a valid header
+static int table_map(Table *t, const char *path, uint64_t slots, int flags) {
+    t->fd = open(path, O_RDWR | O_CREAT | flags, 0644);
+    if (t->fd == -1) {
+        log_error("Failed to open dedup store %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(t->fd, &st) != 0) {
+        log_error("Failed to stat dedup store %s: %s", path, strerror(errno));
+        table_unmap(t);
+        return -1;
+    }
+
+    int fresh = st.st_size == 0;
+    if (fresh) {
+        t->bytes = TABLE_HEADER_SIZE + slots * sizeof(Fingerprint);
+        if (reserve_file(t->fd, t->bytes, path) != 0) {
+            table_unmap(t);
+            return -1;
+        }
+    } else {
+        TableHeader h;
+        if (pread(t->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+            memcmp(h.magic, DEDUP_TABLE_MAGIC, sizeof(h.magic)) != 0 || h.slots == 0 ||
+            (h.slots & (h.slots - 1)) != 0 ||
+            (uint64_t)st.st_size != TABLE_HEADER_SIZE + h.slots * sizeof(Fingerprint)) {
+            log_error("Dedup store %s is corrupt or not a dedup store", path);
+            table_unmap(t);
+            return -1;
+        }
+        t->bytes = (size_t)st.st_size;
+    }
+
+    void *map = mmap(NULL, t->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+    if (map == MAP_FAILED) {
+        log_error("Failed to map dedup store %s: %s", path, strerror(errno));
+        table_unmap(t);
+        return -1;
+    }
+    // Probes land on random pages; read-ahead would only evict useful ones
+    madvise(map, t->bytes, MADV_RANDOM);
+    t->header = map;
+    t->slots = (Fingerprint *)((char *)map + TABLE_HEADER_SIZE);
+    if (fresh) {
+        memcpy(t->header->magic, DEDUP_TABLE_MAGIC, sizeof(t->header->magic));
+        t->header->slots = slots;
+        t->header->count = 0;
+    }
+    return 0;
+}
+
+// Map the filter file fd refers to, replacing any mapped one
+static int bloom_map(int fd, size_t bytes) {
+    struct stat st;
+    void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED || fstat(fd, &st) != 0) {
+        log_error("Failed to map Bloom filter %s: %s", bloom_path, strerror(errno));
+        if (map != MAP_FAILED) munmap(map, bytes);
+        return -1;
+    }
+    if (bloom_header) munmap(bloom_header, bloom_map_bytes);
+    bloom_header = map;
+    bloom_bits = (uint64_t *)((char *)map + BLOOM_HEADER_SIZE);
+    bloom_map_bytes = bytes;
+    bloom_dev = st.st_dev;
+    bloom_ino = st.st_ino;
+    return 0;
+}
+
+// Caller holds the store lock
+static int bloom_open(long long bytes) {
+    uint64_t blocks = (uint64_t)bytes / 64;
+    if (blocks == 0) blocks = 1;
+    size_t map_bytes = BLOOM_HEADER_SIZE + blocks * 64;
+
+    int fd = open(bloom_path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+    BloomHeader h;
+    int valid = fd != -1 && fstat(fd, &st) == 0 && (uint64_t)st.st_size == map_bytes &&
+                pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+                memcmp(h.magic, DEDUP_BLOOM_MAGIC, sizeof(h.magic)) == 0 && h.blocks == blocks &&
+                h.count == table.header->count;
+    if (valid) {
+        int rc = bloom_map(fd, map_bytes);
+        close(fd);
+        return rc;
+    }
+    if (fd != -1) close(fd);
+
+    // Missing, resized or stale (the table moved on without it): rebuild from the
+    // table into a new file renamed over the old one, which other replicas may
+    // still have mapped
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", bloom_path);
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        log_error("Failed to create Bloom filter %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+    if (reserve_file(fd, map_bytes, tmp_path) != 0 || bloom_map(fd, map_bytes) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    close(fd);
+
+    log_info("Rebuilding dedup Bloom filter %s from %llu fingerprints", bloom_path,
+             (unsigned long long)table.header->count);
+    memcpy(bloom_header->magic, DEDUP_BLOOM_MAGIC, sizeof(bloom_header->magic));
+    bloom_header->blocks = blocks;
+    madvise(table.slots, table.header->slots * sizeof(Fingerprint), MADV_SEQUENTIAL);
+    for (uint64_t i = 0; i < table.header->slots; i++) {
+        if (!fp_empty(&table.slots[i])) bloom_set(&table.slots[i]);
+    }
+    madvise(table.slots, table.header->slots * sizeof(Fingerprint), MADV_RANDOM);
+    bloom_header->count = table.header->count;
+    if (rename(tmp_path, bloom_path) != 0) {
+        log_error("Failed to install Bloom filter %s: %s", bloom_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static void dedup_disable(void) {
+    table_unmap(&table);
+    if (bloom_header) munmap(bloom_header, bloom_map_bytes);
+    bloom_header = NULL;
+    bloom_bits = NULL;
+}
+
+static int store_lock(void) {
+    while (flock(lock_fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            log_error("Failed to lock dedup store %s: %s", table_path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void store_unlock(void) {
+    flock(lock_fd, LOCK_UN);
+}
+
+// Another replica grows the table, or rebuilds the Bloom filter, by renaming a
+// new file over the old; map the current ones. Caller holds the write lock and
+// the store lock.
+static int store_refresh(void) {
+    struct stat path_st, map_st;
+    if (!table.header) return 0;
+    if (stat(table_path, &path_st) == 0 && fstat(table.fd, &map_st) == 0 &&
+        (path_st.st_dev != map_st.st_dev || path_st.st_ino != map_st.st_ino)) {
+        Table next = {-1, NULL, NULL, 0};
+        if (table_map(&next, table_path, DEDUP_INITIAL_SLOTS, 0) != 0) return -1;
+        table_unmap(&table);
+        table = next;
+    }
+    if (stat(bloom_path, &path_st) == 0 && (path_st.st_dev != bloom_dev || path_st.st_ino != bloom_ino)) {
+        int fd = open(bloom_path, O_RDWR | O_CLOEXEC);
+        BloomHeader h;
+        int rc = fd != -1 && fstat(fd, &path_st) == 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+                         memcmp(h.magic, DEDUP_BLOOM_MAGIC, sizeof(h.magic)) == 0 && h.blocks > 0 &&
+                         (uint64_t)path_st.st_size == BLOOM_HEADER_SIZE + h.blocks * 64
+                     ? bloom_map(fd, (size_t)path_st.st_size)
+                     : -1;
+        if (fd != -1) close(fd);
+        if (rc != 0) {
+            log_error("Bloom filter %s is corrupt or not a Bloom filter", bloom_path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int dedup_open(const char *path, long long bloom_bytes) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        if (mkdir_p(dir, 0777) == -1) {
+            log_error("Failed to create dedup store directory %s: %s", dir, strerror(errno));
+            return -1;
+        }
+    }
+
+    pthread_rwlock_wrlock(&dedup_lock);
+    snprintf(table_path, sizeof(table_path), "%s", path);
+    snprintf(bloom_path, sizeof(bloom_path), "%s.bloom", path);
+    char lock_path[PATH_MAX + 8];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd == -1) {
+        log_error("Failed to open dedup store lock %s: %s", lock_path, strerror(errno));
+        pthread_rwlock_unlock(&dedup_lock);
+        return -1;
+    }
+
+    if (store_lock() != 0) {
+        pthread_rwlock_unlock(&dedup_lock);
+        return -1;
+    }
+    int rc = table_map(&table, path, DEDUP_INITIAL_SLOTS, 0) == 0 ? bloom_open(bloom_bytes) : -1;
+    store_unlock();
+    if (rc != 0) {
+        dedup_disable();
+        pthread_rwlock_unlock(&dedup_lock);
+        return -1;
+    }
+    log_info("Dedup store %s: %llu fingerprints in %llu slots, %zu-byte Bloom filter", path,
+             (unsigned long long)table.header->count, (unsigned long long)table.header->slots, bloom_map_bytes);
+    pthread_rwlock_unlock(&dedup_lock);
+    return 0;
+}
+
+static int by_home_slot(const void *a, const void *b) {
+    uint64_t x = ((const Fingerprint *)a)->lo & sort_mask;
+    uint64_t y = ((const Fingerprint *)b)->lo & sort_mask;
+    return (x > y) - (x < y);
+}
+
+// Rehash into a table twice the size (or more) and swap it in with rename(2)
+static int table_grow(uint64_t needed) {
+    uint64_t slots = table.header->slots;
+    while (needed * 100 > slots * DEDUP_MAX_LOAD_PCT) slots *= 2;
+
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.grow", table_path);
+    log_info("Growing dedup store %s from %llu to %llu slots", table_path,
+             (unsigned long long)table.header->slots, (unsigned long long)slots);
+
+    Table next = {-1, NULL, NULL, 0};
+    if (table_map(&next, tmp_path, slots, O_TRUNC) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    uint64_t mask = slots - 1;
+    madvise(table.slots, table.header->slots * sizeof(Fingerprint), MADV_SEQUENTIAL);
+    for (uint64_t i = 0; i < table.header->slots; i++) {
+        if (!fp_empty(&table.slots[i])) slots_lookup(next.slots, mask, &table.slots[i], 1);
+    }
+    next.header->count = table.header->count;
+
+    if (msync(next.header, next.bytes, MS_SYNC) != 0 || rename(tmp_path, table_path) != 0) {
+        log_error("Failed to install grown dedup store %s: %s", table_path, strerror(errno));
+        table_unmap(&next);
+        unlink(tmp_path);
+        return -1;
+    }
+    table_unmap(&table);
+    table = next;
+    return 0;
+}
+
+// Insert n fingerprints in home-slot order, so a chunk walks the table file
+// front to back; caller holds the write lock and the store lock
+static int insert_locked(Fingerprint *fps, size_t n) {
+    if (!table.header) return 0;
+    uint64_t needed = table.header->count + n;
+    if (needed * 100 > table.header->slots * DEDUP_MAX_LOAD_PCT && table_grow(needed) != 0 &&
+        needed >= table.header->slots - table.header->slots / 16) {
+        log_error("Dedup store %s is full; deduplication disabled until restart", table_path);
+        dedup_disable();
+        return -1;
+    }
+    sort_mask = table.header->slots - 1;
+    qsort(fps, n, sizeof(Fingerprint), by_home_slot);
+    for (size_t i = 0; i < n; i++) {
+        // Another task may have committed the same record since it was checked
+        if (!slots_lookup(table.slots, sort_mask, &fps[i], 1)) {
+            table.header->count++;
+            bloom_set(&fps[i]);
+        }
+    }
+    bloom_header->count = table.header->count;
+    return 0;
+}
+
+static int insert_chunk(Fingerprint *fps, size_t n) {
+    pthread_rwlock_wrlock(&dedup_lock);
+    int rc = table.header ? -1 : 0;
+    if (table.header && store_lock() == 0) {
+        if (store_refresh() == 0) {
+            rc = insert_locked(fps, n);
+        } else {
+            log_error("Dedup store %s could not be remapped; deduplication disabled until restart", table_path);
+            dedup_disable();
+        }
+        store_unlock();
+    }
+    pthread_rwlock_unlock(&dedup_lock);
+    return rc;
+}
+
+static int store_contains(const Fingerprint *f) {
+    pthread_rwlock_rdlock(&dedup_lock);
+    int found = table.header && bloom_test(f) && slots_lookup(table.slots, table.header->slots - 1, f, 0);
+    pthread_rwlock_unlock(&dedup_lock);
+    return found;
+}
+
+DedupBatch *dedup_batch_open(void) {
+    // Pick up a table another replica grew, so the task's lookups see its commits
+    pthread_rwlock_wrlock(&dedup_lock);
+    if (table.header && store_lock() == 0) {
+        if (store_refresh() != 0) {
+            log_error("Dedup store %s could not be remapped; deduplication disabled until restart", table_path);
+            dedup_disable();
+        }
+        store_unlock();
+    }
+    int open = table.header != NULL;
+    pthread_rwlock_unlock(&dedup_lock);
+    if (!open) return NULL;
+
+    DedupBatch *b = calloc(1, sizeof(DedupBatch));
+    if (b) b->slots = calloc(BATCH_INITIAL_SLOTS, sizeof(Fingerprint));
+    if (!b || !b->slots) {
+        log_error("Failed to allocate dedup batch; records are not deduplicated");
+        free(b);
+        return NULL;
+    }
+    b->slot_count = BATCH_INITIAL_SLOTS;
+    return b;
+}
+
+static int batch_find(const DedupBatch *b, const Fingerprint *f, uint64_t *slot) {
+    uint64_t mask = b->slot_count - 1;
+    for (uint64_t i = f->hi & mask;; i = (i + 1) & mask) {
+        *slot = i;
+        if (fp_empty(&b->slots[i])) return 0;
+        if (fp_equal(&b->slots[i], f)) return 1;
+    }
+}
+
+// Double the set, or move its contents to the spill file once it is at
+// DEDUP_BATCH_MAX_SLOTS; later duplicates of spilled records are then only
+// caught by the store, after the commit
+static int batch_make_room(DedupBatch *b) {
+    if (b->slot_count < DEDUP_BATCH_MAX_SLOTS) {
+        Fingerprint *old = b->slots;
+        uint64_t old_count = b->slot_count;
+        b->slots = calloc(old_count * 2, sizeof(Fingerprint));
+        if (b->slots) {
+            b->slot_count = old_count * 2;
+            for (uint64_t i = 0; i < old_count; i++) {
+                uint64_t slot;
+                if (!fp_empty(&old[i]) && !batch_find(b, &old[i], &slot)) b->slots[slot] = old[i];
+            }
+            free(old);
+            return 0;
+        }
+        b->slots = old;  // Out of memory: spill what is there instead
+    }
+
+    if (!b->spill) {
+        char spill_path[PATH_MAX + 16];
+        snprintf(spill_path, sizeof(spill_path), "%s.XXXXXX", table_path);
+        int fd = mkstemp(spill_path);
+        if (fd != -1) {
+            unlink(spill_path);
+            b->spill = fdopen(fd, "w+");
+            if (!b->spill) close(fd);
+        }
+        if (!b->spill) {
+            log_error("Failed to create dedup spill file next to %s: %s", table_path, strerror(errno));
+            return -1;
+        }
+    }
+    for (uint64_t i = 0; i < b->slot_count; i++) {
+        if (!fp_empty(&b->slots[i]) && fwrite(&b->slots[i], sizeof(Fingerprint), 1, b->spill) != 1) {
+            log_error("Failed to write dedup spill file for %s: %s", table_path, strerror(errno));
+            return -1;
+        }
+    }
+    memset(b->slots, 0, b->slot_count * sizeof(Fingerprint));
+    b->count = 0;
+    return 0;
+}
+
+int dedup_batch_add(DedupBatch *b, const uint64_t fp[2]) {
+    Fingerprint f = {fp[0], fp[1]};
+    if (fp_empty(&f)) f.lo = 1;
+
+    uint64_t slot;
+    if (batch_find(b, &f, &slot)) return 0;
+    if (store_contains(&f)) return 0;
+    if ((b->count + 1) * 2 > b->slot_count) {
+        // Keeping the record uncounted is better than dropping it
+        if (batch_make_room(b) != 0) return 1;
+        batch_find(b, &f, &slot);
+    }
+    b->slots[slot] = f;
+    b->count++;
+    return 1;
+}
+
+void dedup_batch_free(DedupBatch *b) {
+    if (!b) return;
+    if (b->spill) fclose(b->spill);
+    free(b->slots);
+    free(b);
+}
+
+int dedup_batch_commit(DedupBatch *b) {
+    if (!b) return 0;
+    int rc = 0;
+    // The set is compacted in place and committed in chunks, so lookups of
+    // other tasks wait at most for one chunk
+    size_t n = 0;
+    for (uint64_t i = 0; i < b->slot_count; i++) {
+        if (!fp_empty(&b->slots[i])) b->slots[n++] = b->slots[i];
+    }
+    for (size_t at = 0; at < n && rc == 0; at += DEDUP_COMMIT_CHUNK) {
+        rc = insert_chunk(b->slots + at, n - at < DEDUP_COMMIT_CHUNK ? n - at : DEDUP_COMMIT_CHUNK);
+    }
+    if (b->spill && rc == 0) {
+        rewind(b->spill);
+        size_t chunk = b->slot_count < DEDUP_COMMIT_CHUNK ? b->slot_count : DEDUP_COMMIT_CHUNK, got;
+        while (rc == 0 && (got = fread(b->slots, sizeof(Fingerprint), chunk, b->spill)) > 0) {
+            rc = insert_chunk(b->slots, got);
+        }
+    }
+    dedup_batch_free(b);
+    return rc;
+}
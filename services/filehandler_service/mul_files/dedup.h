@@ -0,0 +1,42 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+
+#define DEDUP_TABLE_MAGIC "SGDEDUP1"
+#define DEDUP_BLOOM_MAGIC "SGBLOOM1"
+#define DEDUP_INITIAL_SLOTS (1ULL << 20)  // 16 MiB table file
+#define DEDUP_MAX_LOAD_PCT 70  // Table doubles before inserts push it past this load
+#define DEDUP_COMMIT_CHUNK 65536  // Fingerprints inserted per hold of the table's write lock
+#define DEDUP_BATCH_MAX_SLOTS (1ULL << 24)  // 256 MiB per task; fuller batches spill to a file
+
+// Process-wide persistent set of 128-bit record fingerprints. The table is a
+// file-backed, mmap'd open-addressing hash table (linear probing, 16-byte slots),
+// so RAM use is the page cache the kernel chooses to keep plus the Bloom
+// prefilter, which lives in <path>.bloom and answers most never-seen lookups
+// without touching the table.
+
+// Open or create the store. Replicas on one volume share it: commits take an
+// flock on <path>.lock, and each replica remaps the table when another has grown
+// it, at its next commit or task. Until then it may keep a record another
+// replica has just committed.
+int dedup_open(const char *path, long long bloom_bytes);
+
+// Fingerprints of one task's new records. They are checked against the store
+// as they come, but only added to it by dedup_batch_commit once the task's
+// outputs are written, so a task that fails and is retried does not find its
+// own records marked as seen. Two tasks running at once may both keep a record
+// neither had committed yet.
+typedef struct DedupBatch DedupBatch;
+
+// NULL when no store is open
+DedupBatch *dedup_batch_open(void);
+// Returns 1 if fp is new to the store and the batch (it joins the batch) and 0
+// for a duplicate
+int dedup_batch_add(DedupBatch *b, const uint64_t fp[2]);
+// Add the batch to the store and free it; returns -1 if the store had to be disabled
+int dedup_batch_commit(DedupBatch *b);
+// Drop the batch without adding it
+void dedup_batch_free(DedupBatch *b);
+
+#endif
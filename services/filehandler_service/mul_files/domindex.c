@@ -0,0 +1,1064 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "domindex.h"
+#include "filehandler.h"
+#include "hash.h"
+
+#define DOMAIN_SEED 0x444f4d4eULL
+#define DOMAIN_INITIAL_SLOTS (1 << 12)
+#define DOMAIN_MAX_LOAD_PCT 75
+#define MAX_LABEL_LEN 63
+#define ENTRY_NAME_MAX 1024
+#define WRITE_BUFFER (1 << 20)
+
+// Lowercased host characters; 0 for bytes a host name cannot contain
+static const char HOST_CHAR[256] = {
+    ['-'] = '-', ['.'] = '.',
+    ['0'] = '0', ['1'] = '1', ['2'] = '2', ['3'] = '3', ['4'] = '4', ['5'] = '5', ['6'] = '6', ['7'] = '7',
+    ['8'] = '8', ['9'] = '9',
+    ['a'] = 'a', ['b'] = 'b', ['c'] = 'c', ['d'] = 'd', ['e'] = 'e', ['f'] = 'f', ['g'] = 'g', ['h'] = 'h',
+    ['i'] = 'i', ['j'] = 'j', ['k'] = 'k', ['l'] = 'l', ['m'] = 'm', ['n'] = 'n', ['o'] = 'o', ['p'] = 'p',
+    ['q'] = 'q', ['r'] = 'r', ['s'] = 's', ['t'] = 't', ['u'] = 'u', ['v'] = 'v', ['w'] = 'w', ['x'] = 'x',
+    ['y'] = 'y', ['z'] = 'z',
+    ['A'] = 'a', ['B'] = 'b', ['C'] = 'c', ['D'] = 'd', ['E'] = 'e', ['F'] = 'f', ['G'] = 'g', ['H'] = 'h',
+    ['I'] = 'i', ['J'] = 'j', ['K'] = 'k', ['L'] = 'l', ['M'] = 'm', ['N'] = 'n', ['O'] = 'o', ['P'] = 'p',
+    ['Q'] = 'q', ['R'] = 'r', ['S'] = 's', ['T'] = 't', ['U'] = 'u', ['V'] = 'v', ['W'] = 'w', ['X'] = 'x',
+    ['Y'] = 'y', ['Z'] = 'z',
+};
+
+// Second-level public suffixes of the country domains dumps mention most;
+// the full Public Suffix List is not worth its size for grouping by domain
+static const char *const SECOND_LEVEL[] = {
+    "ac.jp", "ac.uk", "co.id", "co.il", "co.in", "co.jp", "co.kr", "co.nz", "co.th", "co.uk", "co.za",
+    "com.ar", "com.au", "com.br", "com.cn", "com.co", "com.eg", "com.hk", "com.mx", "com.my", "com.ng",
+    "com.pe", "com.ph", "com.pk", "com.pl", "com.sa", "com.sg", "com.tr", "com.tw", "com.ua", "com.vn",
+    "edu.au", "go.jp", "gov.au", "gov.br", "gov.cn", "gov.in", "gov.uk", "in.th", "ltd.uk", "me.uk",
+    "ne.jp", "net.au", "net.br", "net.cn", "net.in", "net.nz", "or.id", "or.jp", "or.kr", "org.au",
+    "org.br", "org.cn", "org.il", "org.in", "org.nz", "org.uk", "org.za", "plc.uk",
+};
+
+static int valid_label(const char *s, size_t len) {
+    return len > 0 && len <= MAX_LABEL_LEN && s[0] != '-' && s[len - 1] != '-';
+}
+
+static int valid_tld(const char *s, size_t len) {
+    if (len >= 4 && memcmp(s, "xn--", 4) == 0) return 1;
+    if (len < 2) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < 'a' || s[i] > 'z') return 0;
+    }
+    return 1;
+}
+
+static int second_level_suffix(const char *s, size_t len) {
+    for (size_t i = 0; i < sizeof(SECOND_LEVEL) / sizeof(SECOND_LEVEL[0]); i++) {
+        if (strlen(SECOND_LEVEL[i]) == len && memcmp(SECOND_LEVEL[i], s, len) == 0) return 1;
+    }
+    return 0;
+}
+
+size_t domain_registrable(const char *host, size_t len, char *out) {
+    while (len > 0 && host[len - 1] == '.') len--;
+    if (len == 0 || len > DOMAIN_MAX_LEN) return 0;
+    for (size_t i = 0; i < len; i++) {
+        out[i] = HOST_CHAR[(unsigned char)host[i]];
+        if (!out[i]) return 0;
+    }
+
+    // Label starts from the right: the TLD, the label below it and one more
+    // in case the first two are a second-level suffix
+    size_t starts[3], labels = 0, end = len;
+    while (labels < 3) {
+        size_t dot = end;
+        while (dot > 0 && out[dot - 1] != '.') dot--;
+        if (!valid_label(out + dot, end - dot)) {
+            if (labels < 2) return 0;
+            break;  // Only matters below a second-level suffix
+        }
+        starts[labels++] = dot;
+        if (dot == 0) break;
+        end = dot - 1;
+    }
+    if (labels < 2 || !valid_tld(out + starts[0], len - starts[0])) return 0;
+    size_t from = starts[1];
+    if (len - starts[0] == 2 && second_level_suffix(out + starts[1], len - starts[1])) {
+        if (labels < 3) return 0;  // A bare suffix is not registrable
+        from = starts[2];
+    }
+    memmove(out, out + from, len - from);
+    return len - from;
+}
+
+static size_t put_varint_buf(uint8_t *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p == end) return -1;
+        uint8_t b = *(*p)++;
+        value |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int grow(void **buf, size_t *cap, size_t need, size_t size) {
+    if (need <= *cap) return 0;
+    size_t grown = *cap ? *cap : 1024;
+    while (grown < need) grown *= 2;
+    void *p = realloc(*buf, grown * size);
+    if (!p) return -1;
+    *buf = p;
+    *cap = grown;
+    return 0;
+}
+
+// Domains sort by their bytes, shorter first on a common prefix
+static int compare_names(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) return c;
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+typedef struct {
+    uint64_t hash;
+    uint32_t name_offset;  // Into the collector's names
+    uint32_t len;
+    uint32_t last_entry;  // Entry id + 1 of the domain's last posting
+    uint32_t postings;
+} Domain;
+
+typedef struct {
+    uint32_t domain;
+    uint32_t entry;
+    uint64_t offset;
+} Posting;
+
+struct DomainCollector {
+    char dump[272];  // Name the dump is listed under
+    char entry[ENTRY_NAME_MAX];  // Current entry; listed once it has a domain
+    int entry_listed;
+    uint32_t entry_id, entry_count;
+    uint8_t *entries;  // The dumps section's entry list, already encoded
+    size_t entries_len, entries_cap;
+    uint32_t *slots;  // Domain index + 1; 0 marks an empty slot
+    size_t slot_count;
+    Domain *domains;
+    size_t domain_count, domain_cap;
+    char *names;
+    size_t names_len, names_cap;
+    Posting *postings;
+    size_t posting_count, posting_cap;
+    uint64_t entry_pos;  // Entry bytes scanned before the current block
+    int in_host;
+    char host[DOMAIN_MAX_LEN + 1];
+    size_t host_len;  // DOMAIN_MAX_LEN + 1 once the host is too long to be one
+    uint64_t host_at;
+    int scheme_match;  // Bytes of "://" ending the previous block
+    int failed;
+};
+
+DomainCollector *domindex_collect_open(const char *dump) {
+    DomainCollector *c = calloc(1, sizeof(DomainCollector));
+    if (c) c->slots = calloc(DOMAIN_INITIAL_SLOTS, sizeof(uint32_t));
+    if (!c || !c->slots) {
+        log_error("Failed to allocate domain index for %s", dump);
+        free(c);
+        return NULL;
+    }
+    c->slot_count = DOMAIN_INITIAL_SLOTS;
+    snprintf(c->dump, sizeof(c->dump), "%s", dump);
+    return c;
+}
+
+static int collector_grow_slots(DomainCollector *c) {
+    size_t slot_count = c->slot_count * 2;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (size_t n = 0; n < c->domain_count; n++) {
+        size_t i = c->domains[n].hash & (slot_count - 1);
+        while (slots[i]) i = (i + 1) & (slot_count - 1);
+        slots[i] = (uint32_t)(n + 1);
+    }
+    free(c->slots);
+    c->slots = slots;
+    c->slot_count = slot_count;
+    return 0;
+}
+
+static int list_entry(DomainCollector *c) {
+    size_t len = strlen(c->entry);
+    if (grow((void **)&c->entries, &c->entries_cap, c->entries_len + len + 10, 1) != 0) return -1;
+    c->entries_len += put_varint_buf(c->entries + c->entries_len, len);
+    memcpy(c->entries + c->entries_len, c->entry, len);
+    c->entries_len += len;
+    c->entry_id = c->entry_count++;
+    c->entry_listed = 1;
+    return 0;
+}
+
+// One posting per domain and entry: the first mention
+static int collect_domain(DomainCollector *c, const char *name, size_t len, uint64_t offset) {
+    if (!c->entry_listed && list_entry(c) != 0) return -1;
+
+    uint64_t h[2];
+    murmur3_128(name, len, DOMAIN_SEED, h);
+    size_t mask = c->slot_count - 1, i = h[0] & mask;
+    Domain *d = NULL;
+    for (; c->slots[i]; i = (i + 1) & mask) {
+        Domain *cand = &c->domains[c->slots[i] - 1];
+        if (cand->hash == h[0] && cand->len == len && memcmp(c->names + cand->name_offset, name, len) == 0) {
+            d = cand;
+            break;
+        }
+    }
+    if (!d) {
+        if (grow((void **)&c->domains, &c->domain_cap, c->domain_count + 1, sizeof(Domain)) != 0 ||
+            grow((void **)&c->names, &c->names_cap, c->names_len + len, 1) != 0) {
+            return -1;
+        }
+        memcpy(c->names + c->names_len, name, len);
+        d = &c->domains[c->domain_count++];
+        *d = (Domain){h[0], (uint32_t)c->names_len, (uint32_t)len, 0, 0};
+        c->names_len += len;
+        c->slots[i] = (uint32_t)c->domain_count;
+        if (c->domain_count * 100 > c->slot_count * DOMAIN_MAX_LOAD_PCT && collector_grow_slots(c) != 0) return -1;
+        d = &c->domains[c->domain_count - 1];
+    }
+    if (d->last_entry == c->entry_id + 1) return 0;
+    if (grow((void **)&c->postings, &c->posting_cap, c->posting_count + 1, sizeof(Posting)) != 0) return -1;
+    c->postings[c->posting_count++] = (Posting){(uint32_t)(d - c->domains), c->entry_id, offset};
+    d->last_entry = c->entry_id + 1;
+    d->postings++;
+    return 0;
+}
+
+static void start_host(DomainCollector *c, size_t at) {
+    c->in_host = 1;
+    c->host_len = 0;
+    c->host_at = c->entry_pos + at;
+}
+
+static void end_host(DomainCollector *c) {
+    c->in_host = 0;
+    if (c->host_len == 0 || c->host_len > DOMAIN_MAX_LEN) return;
+    char domain[DOMAIN_MAX_LEN + 1];
+    size_t len = domain_registrable(c->host, c->host_len, domain);
+    if (len > 0 && collect_domain(c, domain, len, c->host_at) != 0) c->failed = 1;
+}
+
+void domindex_collect_entry(DomainCollector *c, const char *entry) {
+    if (!c) return;
+    if (c->in_host) end_host(c);  // The previous entry ended on a host
+    snprintf(c->entry, sizeof(c->entry), "%s", entry);
+    c->entry_listed = 0;
+    c->entry_pos = 0;
+    c->in_host = 0;
+    c->scheme_match = 0;
+}
+
+// Hosts follow "@" in emails and "://" in URLs
+static size_t next_anchor(const uint8_t *s, size_t i, size_t len) {
+#ifdef __SSE2__
+    const __m128i at = _mm_set1_epi8('@'), colon = _mm_set1_epi8(':');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, at), _mm_cmpeq_epi8(v, colon)));
+        if (m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+#endif
+    for (; i < len; i++) {
+        if (s[i] == '@' || s[i] == ':') return i;
+    }
+    return len;
+}
+
+void domindex_collect_scan(DomainCollector *c, const void *data, size_t len) {
+    if (!c || c->failed) return;
+    const uint8_t *s = data;
+    size_t i = 0;
+    // A "://" split by the previous block
+    while (c->scheme_match && i < len) {
+        if (s[i] != '/') {
+            c->scheme_match = 0;
+            break;
+        }
+        i++;
+        if (++c->scheme_match == 3) {
+            c->scheme_match = 0;
+            start_host(c, i);
+        }
+    }
+
+    while (i < len) {
+        if (c->in_host) {
+            for (; i < len && HOST_CHAR[s[i]]; i++) {
+                if (c->host_len < DOMAIN_MAX_LEN) c->host[c->host_len] = (char)s[i];
+                if (c->host_len <= DOMAIN_MAX_LEN) c->host_len++;
+            }
+            if (i < len) end_host(c);
+            continue;
+        }
+        size_t j = next_anchor(s, i, len);
+        if (j == len) break;
+        if (s[j] == '@') {
+            start_host(c, j + 1);
+            i = j + 1;
+        } else if (j + 2 < len) {
+            if (s[j + 1] == '/' && s[j + 2] == '/') {
+                start_host(c, j + 3);
+                i = j + 3;
+            } else {
+                i = j + 1;
+            }
+        } else {
+            c->scheme_match = 1;
+            for (i = j + 1; i < len && c->scheme_match; i++) c->scheme_match = s[i] == '/' ? c->scheme_match + 1 : 0;
+            if (!c->scheme_match) i = j + 1;
+        }
+    }
+    c->entry_pos += len;
+}
+
+// Merged segments are named by a hex sequence number, continued from the
+// highest one in the directory. A collector's segment is in-<hash of its
+// dump>.dix, so writing a dump again replaces the file instead of adding one.
+static pthread_mutex_t seq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t next_seq;
+static int seq_loaded;
+
+// Held while a segment is renamed into place and the ones it merged are
+// unlinked, so a merge never unlinks a collector segment rewritten meanwhile
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t merge_wake = PTHREAD_COND_INITIALIZER;
+static int merge_pending;
+
+typedef struct {
+    char name[32];
+    uint64_t seq;
+    off_t size;
+} SegmentFile;
+
+static int parse_segment_name(const char *name, uint64_t *seq) {
+    const char *digits = strncmp(name, "in-", 3) == 0 ? name + 3 : name;
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(digits, &end, 16);
+    if (errno != 0 || end == digits || strcmp(end, ".dix") != 0 || strlen(name) >= sizeof(((SegmentFile *)0)->name)) {
+        return 0;
+    }
+    *seq = digits == name ? v : 0;  // Collector segments do not take part in numbering
+    return 1;
+}
+
+static int list_segments(const char *dir, SegmentFile **out, size_t *count) {
+    *out = NULL;
+    *count = 0;
+    DIR *d = opendir(dir);
+    if (!d) {
+        if (errno == ENOENT) return 0;
+        log_error("Failed to open domain index directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    size_t cap = 0;
+    int rc = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        uint64_t seq;
+        if (e->d_name[0] == '.' || !parse_segment_name(e->d_name, &seq)) continue;
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) != 0) continue;  // Merged away since readdir
+        if (grow((void **)out, &cap, *count + 1, sizeof(SegmentFile)) != 0) {
+            log_error("Failed to list domain index segments in %s", dir);
+            rc = -1;
+            break;
+        }
+        SegmentFile *f = &(*out)[(*count)++];
+        snprintf(f->name, sizeof(f->name), "%s", e->d_name);
+        f->seq = seq;
+        f->size = st.st_size;
+    }
+    closedir(d);
+    if (rc != 0) {
+        free(*out);
+        *out = NULL;
+        *count = 0;
+    }
+    return rc;
+}
+
+static int take_seq(const char *dir, uint64_t *seq) {
+    pthread_mutex_lock(&seq_mutex);
+    if (!seq_loaded) {
+        SegmentFile *files;
+        size_t count;
+        if (list_segments(dir, &files, &count) != 0) {
+            pthread_mutex_unlock(&seq_mutex);
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (files[i].seq >= next_seq) next_seq = files[i].seq + 1;
+        }
+        free(files);
+        seq_loaded = 1;
+    }
+    *seq = next_seq++;
+    pthread_mutex_unlock(&seq_mutex);
+    return 0;
+}
+
+typedef struct {
+    const char *s;
+    size_t len;
+} Name;
+
+struct DomainSegment {
+    char path[PATH_MAX];
+    dev_t dev;  // Identity of the file mapped, to notice it being replaced
+    ino_t ino;
+    void *map;
+    size_t map_size;
+    const DomainSegmentHeader *header;
+    const DomainTerm *dir;
+    const char *terms;
+    uint64_t terms_len;
+    Name *dumps;  // [dump_count]
+    uint64_t *written;  // [dump_count]
+    uint32_t *entry_base;  // [dump_count + 1], into entries
+    Name *entries;
+};
+
+// Sections are written front to back through one buffered stream; the
+// header goes in last, once their offsets are known
+typedef struct {
+    FILE *f;
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    uint64_t pos;
+    int failed;
+} SegmentWriter;
+
+// name NULL takes the next sequence number
+static int writer_open(SegmentWriter *w, const char *dir, const char *name) {
+    if (name) {
+        snprintf(w->path, sizeof(w->path), "%s/%s", dir, name);
+    } else {
+        uint64_t seq;
+        if (take_seq(dir, &seq) != 0) return -1;
+        snprintf(w->path, sizeof(w->path), "%s/%016llx.dix", dir, (unsigned long long)seq);
+    }
+    snprintf(w->tmp, sizeof(w->tmp), "%s.tmp", w->path);
+    w->f = fopen(w->tmp, "wb");
+    if (!w->f) {
+        log_error("Failed to create domain index segment %s: %s", w->tmp, strerror(errno));
+        return -1;
+    }
+    setvbuf(w->f, NULL, _IOFBF, WRITE_BUFFER);
+    w->pos = 0;
+    w->failed = 0;
+    DomainSegmentHeader blank = {{0}, 0, 0, 0, 0, 0, 0};
+    if (fwrite(&blank, sizeof(blank), 1, w->f) != 1) w->failed = 1;
+    w->pos = sizeof(blank);
+    return 0;
+}
+
+static void put(SegmentWriter *w, const void *data, size_t len) {
+    if (!w->failed && len > 0 && fwrite(data, 1, len, w->f) != len) w->failed = 1;
+    w->pos += len;
+}
+
+static void put_varint(SegmentWriter *w, uint64_t v) {
+    uint8_t buf[10];
+    put(w, buf, put_varint_buf(buf, v));
+}
+
+// Zero bytes up to the next multiple of align (at most 16)
+static void put_padding(SegmentWriter *w, size_t align) {
+    static const char zeros[16];
+    put(w, zeros, (align - w->pos % align) % align);
+}
+
+// Rename the segment into place and unlink the n segments it merged, unless
+// one of those has been replaced since it was opened
+static int writer_close(SegmentWriter *w, DomainSegmentHeader *header, DomainSegment *const *merged, size_t n) {
+    memcpy(header->magic, DOMINDEX_MAGIC, 8);
+    if (!w->failed && (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(header, sizeof(*header), 1, w->f) != 1)) {
+        w->failed = 1;
+    }
+    if (fclose(w->f) != 0) w->failed = 1;
+    int replaced = 0;
+    pthread_mutex_lock(&publish_mutex);
+    for (size_t k = 0; !w->failed && k < n; k++) {
+        struct stat st;
+        if (stat(merged[k]->path, &st) != 0 || st.st_dev != merged[k]->dev || st.st_ino != merged[k]->ino) replaced = 1;
+    }
+    if (!w->failed && !replaced && rename(w->tmp, w->path) != 0) w->failed = 1;
+    for (size_t k = 0; !w->failed && !replaced && k < n; k++) unlink(merged[k]->path);
+    pthread_mutex_unlock(&publish_mutex);
+    if (replaced) {
+        log_info("Dropped merge into %s: an input segment was rewritten meanwhile", w->path);
+        unlink(w->tmp);
+        return -1;
+    }
+    if (w->failed) {
+        log_error("Failed to write domain index segment %s: %s", w->path, strerror(errno));
+        unlink(w->tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Sequential postings of one domain; dump ids restart the entry deltas
+typedef struct {
+    SegmentWriter *w;
+    uint32_t count;
+    uint64_t dump, entry;
+} PostingEncoder;
+
+static void encode_posting(PostingEncoder *e, uint64_t dump, uint64_t entry, uint64_t offset) {
+    put_varint(e->w, dump - e->dump);
+    put_varint(e->w, e->count > 0 && dump == e->dump ? entry - e->entry : entry);
+    put_varint(e->w, offset);
+    e->dump = dump;
+    e->entry = entry;
+    e->count++;
+}
+
+static void publish(void) {
+    pthread_mutex_lock(&merge_mutex);
+    merge_pending = 1;
+    pthread_cond_signal(&merge_wake);
+    pthread_mutex_unlock(&merge_mutex);
+}
+
+typedef struct {
+    const char *s;
+    uint32_t len;
+    uint32_t id;
+} DomainName;
+
+static int compare_domain_names(const void *a, const void *b) {
+    const DomainName *x = a, *y = b;
+    return compare_names(x->s, x->len, y->s, y->len);
+}
+
+static void collector_free(DomainCollector *c) {
+    free(c->entries);
+    free(c->slots);
+    free(c->domains);
+    free(c->names);
+    free(c->postings);
+    free(c);
+}
+
+// Postings were gathered in entry order; a counting sort by domain rank
+// keeps that order within each domain
+static int collector_write(DomainCollector *c, const char *dir) {
+    size_t n = c->domain_count;
+    DomainName *order = malloc(n * sizeof(DomainName));
+    uint32_t *rank = malloc(n * sizeof(uint32_t));
+    size_t *start = malloc((n + 1) * sizeof(size_t));
+    Posting *sorted = malloc(c->posting_count * sizeof(Posting));
+    if (!order || !rank || !start || !sorted) {
+        log_error("Failed to allocate domain index segment for %s", c->dump);
+        free(order);
+        free(rank);
+        free(start);
+        free(sorted);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) order[i] = (DomainName){c->names + c->domains[i].name_offset, c->domains[i].len, (uint32_t)i};
+    qsort(order, n, sizeof(DomainName), compare_domain_names);
+    start[0] = 0;
+    for (size_t r = 0; r < n; r++) {
+        rank[order[r].id] = (uint32_t)r;
+        start[r + 1] = start[r] + c->domains[order[r].id].postings;
+    }
+    for (size_t i = 0; i < c->posting_count; i++) sorted[start[rank[c->postings[i].domain]]++] = c->postings[i];
+
+    uint64_t h[2];
+    char name[32];
+    murmur3_128(c->dump, strlen(c->dump), DOMAIN_SEED, h);
+    snprintf(name, sizeof(name), "in-%016llx.dix", (unsigned long long)h[0]);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    SegmentWriter w;
+    int rc = writer_open(&w, dir, name);
+    if (rc == 0) {
+        DomainSegmentHeader header = {{0}, 1, 0, n, 0, 0, 0};
+        DomainTerm *terms = malloc((n + 1) * sizeof(DomainTerm));
+        size_t at = 0;
+        uint32_t term_offset = 0;
+        for (size_t r = 0; terms && r < n; r++) {
+            const Domain *d = &c->domains[order[r].id];
+            terms[r] = (DomainTerm){w.pos, term_offset, d->postings};
+            PostingEncoder e = {&w, 0, 0, 0};
+            for (uint32_t k = 0; k < d->postings; k++, at++) encode_posting(&e, 0, sorted[at].entry, sorted[at].offset);
+            term_offset += d->len;
+        }
+        if (!terms) {
+            log_error("Failed to allocate domain index segment for %s", c->dump);
+            w.failed = 1;
+        } else {
+            header.dumps_offset = w.pos;
+            size_t dump_len = strlen(c->dump);
+            put_varint(&w, dump_len);
+            put(&w, c->dump, dump_len);
+            put_varint(&w, (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec);
+            put_varint(&w, c->entry_count);
+            put(&w, c->entries, c->entries_len);
+            put_padding(&w, _Alignof(DomainTerm));
+            terms[n] = (DomainTerm){header.dumps_offset, term_offset, 0};
+            header.dir_offset = w.pos;
+            put(&w, terms, (n + 1) * sizeof(DomainTerm));
+            header.terms_offset = w.pos;
+            for (size_t r = 0; r < n; r++) put(&w, order[r].s, order[r].len);
+        }
+        free(terms);
+        rc = writer_close(&w, &header, NULL, 0);
+    }
+    if (rc == 0) {
+        log_info("Indexed %zu domains in %u entries of %s into %s", n, c->entry_count, c->dump, w.path);
+    }
+    free(order);
+    free(rank);
+    free(start);
+    free(sorted);
+    return rc;
+}
+
+int domindex_collect_close(DomainCollector *c, const char *dir) {
+    if (!c) return 0;
+    if (c->in_host) end_host(c);
+    int rc = 0;
+    if (c->failed) {
+        log_error("Failed to grow domain index for %s", c->dump);
+        rc = -1;
+    } else if (dir && c->posting_count > 0) {
+        rc = collector_write(c, dir);
+        if (rc == 0) publish();
+    }
+    collector_free(c);
+    return rc;
+}
+
+static int read_name(const uint8_t **p, const uint8_t *end, Name *name) {
+    uint64_t len;
+    if (get_varint(p, end, &len) != 0 || len > (uint64_t)(end - *p)) return -1;
+    *name = (Name){(const char *)*p, (size_t)len};
+    *p += len;
+    return 0;
+}
+
+// Resolve the dumps section into per-dump entry tables
+static int read_dumps(DomainSegment *seg) {
+    const uint8_t *base = seg->map;
+    const uint8_t *p = base + seg->header->dumps_offset, *end = base + seg->header->dir_offset;
+    uint32_t dump_count = seg->header->dump_count;
+    size_t entry_cap = 0, entry_count = 0;
+    seg->dumps = malloc((dump_count ? dump_count : 1) * sizeof(Name));
+    seg->written = malloc((dump_count ? dump_count : 1) * sizeof(uint64_t));
+    seg->entry_base = malloc(((size_t)dump_count + 1) * sizeof(uint32_t));
+    if (!seg->dumps || !seg->written || !seg->entry_base) return -1;
+    for (uint32_t d = 0; d < dump_count; d++) {
+        uint64_t entries;
+        if (read_name(&p, end, &seg->dumps[d]) != 0 || get_varint(&p, end, &seg->written[d]) != 0 ||
+            get_varint(&p, end, &entries) != 0 ||
+            entries > (uint64_t)(end - p) || entry_count + entries > UINT32_MAX) {
+            return -1;
+        }
+        seg->entry_base[d] = (uint32_t)entry_count;
+        if (grow((void **)&seg->entries, &entry_cap, entry_count + entries, sizeof(Name)) != 0) return -1;
+        for (uint64_t e = 0; e < entries; e++) {
+            if (read_name(&p, end, &seg->entries[entry_count++]) != 0) return -1;
+        }
+    }
+    seg->entry_base[dump_count] = (uint32_t)entry_count;
+    // Only the zero padding that aligns the dir may follow
+    if ((size_t)(end - p) >= _Alignof(DomainTerm)) return -1;
+    while (p < end) {
+        if (*p++ != 0) return -1;
+    }
+    return 0;
+}
+
+DomainSegment *domseg_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        log_error("Failed to open domain index segment %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    DomainSegment *seg = calloc(1, sizeof(DomainSegment));
+    if (!seg || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DomainSegmentHeader)) goto corrupt;
+    seg->dev = st.st_dev;
+    seg->ino = st.st_ino;
+    seg->map_size = (size_t)st.st_size;
+    seg->map = mmap(NULL, seg->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (seg->map == MAP_FAILED) {
+        seg->map = NULL;
+        goto corrupt;
+    }
+    const DomainSegmentHeader *h = seg->map;
+    seg->header = h;
+    if (memcmp(h->magic, DOMINDEX_MAGIC, 8) != 0 || h->dumps_offset < sizeof(DomainSegmentHeader) ||
+        h->dir_offset < h->dumps_offset || h->dir_offset % _Alignof(DomainTerm) != 0 ||
+        h->terms_offset > seg->map_size || h->domain_count >= UINT32_MAX ||
+        h->terms_offset < h->dir_offset || h->terms_offset - h->dir_offset != (h->domain_count + 1) * sizeof(DomainTerm)) {
+        goto corrupt;
+    }
+    seg->dir = (const DomainTerm *)((const char *)seg->map + h->dir_offset);
+    seg->terms = (const char *)seg->map + h->terms_offset;
+    seg->terms_len = seg->map_size - h->terms_offset;
+    if (seg->dir[h->domain_count].term_offset != seg->terms_len ||
+        seg->dir[h->domain_count].postings_offset != h->dumps_offset || read_dumps(seg) != 0) {
+        goto corrupt;
+    }
+    snprintf(seg->path, sizeof(seg->path), "%s", path);
+    close(fd);
+    return seg;
+
+corrupt:
+    log_error("Domain index segment %s is unreadable or corrupt", path);
+    close(fd);
+    domseg_close(seg);
+    return NULL;
+}
+
+void domseg_close(DomainSegment *seg) {
+    if (!seg) return;
+    if (seg->map) munmap(seg->map, seg->map_size);
+    free(seg->dumps);
+    free(seg->written);
+    free(seg->entry_base);
+    free(seg->entries);
+    free(seg);
+}
+
+static int term_name(const DomainSegment *seg, uint64_t i, Name *name) {
+    uint32_t from = seg->dir[i].term_offset, to = seg->dir[i + 1].term_offset;
+    if (from > to || to > seg->terms_len) return -1;
+    *name = (Name){seg->terms + from, to - from};
+    return 0;
+}
+
+typedef void (*posting_fn)(void *ctx, uint32_t dump, uint32_t entry, uint64_t offset);
+
+// Decode the postings of term i; -1 if they run outside the postings section
+// or name a dump or entry the segment does not list
+static long long each_posting(const DomainSegment *seg, uint64_t i, posting_fn fn, void *ctx) {
+    const DomainTerm *t = &seg->dir[i];
+    if (t->postings_offset < sizeof(DomainSegmentHeader) || t->postings_offset > t[1].postings_offset ||
+        t[1].postings_offset > seg->header->dumps_offset) {
+        return -1;
+    }
+    const uint8_t *p = (const uint8_t *)seg->map + t->postings_offset;
+    const uint8_t *end = (const uint8_t *)seg->map + t[1].postings_offset;
+    uint64_t dump = 0, entry = 0;
+    for (uint32_t k = 0; k < t->posting_count; k++) {
+        uint64_t dump_delta, e, offset;
+        if (get_varint(&p, end, &dump_delta) != 0 || get_varint(&p, end, &e) != 0 ||
+            get_varint(&p, end, &offset) != 0) {
+            return -1;
+        }
+        entry = k > 0 && dump_delta == 0 ? entry + e : e;
+        dump += dump_delta;
+        if (dump >= seg->header->dump_count || entry >= seg->entry_base[dump + 1] - seg->entry_base[dump]) return -1;
+        fn(ctx, (uint32_t)dump, (uint32_t)entry, offset);
+    }
+    return p == end ? (long long)t->posting_count : -1;
+}
+
+static int find_term(const DomainSegment *seg, const char *name, size_t len, uint64_t *found) {
+    uint64_t lo = 0, hi = seg->header->domain_count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        Name term;
+        if (term_name(seg, mid, &term) != 0) return -1;
+        int c = compare_names(term.s, term.len, name, len);
+        if (c == 0) {
+            *found = mid;
+            return 1;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+typedef struct {
+    const DomainSegment *seg;
+    domindex_hit_fn fn;
+    void *ctx;
+} QueryState;
+
+static void report_hit(void *ctx, uint32_t dump, uint32_t entry, uint64_t offset) {
+    QueryState *q = ctx;
+    const Name *d = &q->seg->dumps[dump], *e = &q->seg->entries[q->seg->entry_base[dump] + entry];
+    DomainHit hit = {d->s, e->s, d->len, e->len, offset, q->seg->written[dump]};
+    q->fn(q->ctx, &hit);
+}
+
+long long domseg_query(const DomainSegment *seg, const char *domain, domindex_hit_fn fn, void *ctx) {
+    char name[DOMAIN_MAX_LEN + 1];
+    size_t len = domain_registrable(domain, strlen(domain), name);
+    if (len == 0) return 0;
+    uint64_t term;
+    int found = find_term(seg, name, len, &term);
+    if (found <= 0) return found;
+    QueryState q = {seg, fn, ctx};
+    long long hits = each_posting(seg, term, report_hit, &q);
+    if (hits < 0) log_error("Domain index segment %s is corrupt", seg->path);
+    return hits;
+}
+
+uint32_t domseg_dump_count(const DomainSegment *seg) {
+    return seg->header->dump_count;
+}
+
+void domseg_dump(const DomainSegment *seg, uint32_t i, const char **name, size_t *len, uint64_t *written) {
+    *name = seg->dumps[i].s;
+    *len = seg->dumps[i].len;
+    *written = seg->written[i];
+}
+
+#define DUMP_DROPPED UINT32_MAX
+
+typedef struct {
+    PostingEncoder *encoder;
+    const uint32_t *dump_id;  // Merged id of each of the input's dumps, DUMP_DROPPED for an older copy
+} Renumber;
+
+static void renumber_posting(void *ctx, uint32_t dump, uint32_t entry, uint64_t offset) {
+    Renumber *r = ctx;
+    if (r->dump_id[dump] != DUMP_DROPPED) encode_posting(r->encoder, r->dump_id[dump], entry, offset);
+}
+
+typedef struct {
+    const Name *name;
+    uint64_t written;
+    uint32_t at;  // Position among all the inputs' dumps
+} DumpRef;
+
+// By name, newest first; on a tie the later input wins
+static int compare_dump_refs(const void *a, const void *b) {
+    const DumpRef *x = a, *y = b;
+    int c = compare_names(x->name->s, x->name->len, y->name->s, y->name->len);
+    if (c != 0) return c;
+    if (x->written != y->written) return x->written > y->written ? -1 : 1;
+    return x->at > y->at ? -1 : x->at < y->at;
+}
+
+// Number the inputs' dumps in input order, keeping only the newest copy of
+// each dump; dump_id is indexed by dump_base[k] + dump. Returns the number
+// kept, -1 if out of memory.
+static long long number_dumps(DomainSegment *const *segs, size_t n, const uint32_t *dump_base, size_t total,
+                              uint32_t *dump_id) {
+    DumpRef *refs = malloc((total ? total : 1) * sizeof(DumpRef));
+    if (!refs) return -1;
+    for (size_t k = 0; k < n; k++) {
+        for (uint32_t d = 0; d < segs[k]->header->dump_count; d++) {
+            refs[dump_base[k] + d] = (DumpRef){&segs[k]->dumps[d], segs[k]->written[d], dump_base[k] + d};
+        }
+    }
+    qsort(refs, total, sizeof(DumpRef), compare_dump_refs);
+    for (size_t i = 0; i < total; i++) {
+        int newest = i == 0 || compare_names(refs[i].name->s, refs[i].name->len, refs[i - 1].name->s,
+                                             refs[i - 1].name->len) != 0;
+        dump_id[refs[i].at] = newest ? 0 : DUMP_DROPPED;
+    }
+    free(refs);
+    uint32_t kept = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (dump_id[i] != DUMP_DROPPED) dump_id[i] = kept++;
+    }
+    return kept;
+}
+
+static void put_dump(SegmentWriter *w, const DomainSegment *seg, uint32_t d) {
+    put_varint(w, seg->dumps[d].len);
+    put(w, seg->dumps[d].s, seg->dumps[d].len);
+    put_varint(w, seg->written[d]);
+    put_varint(w, seg->entry_base[d + 1] - seg->entry_base[d]);
+    for (uint32_t e = seg->entry_base[d]; e < seg->entry_base[d + 1]; e++) {
+        put_varint(w, seg->entries[e].len);
+        put(w, seg->entries[e].s, seg->entries[e].len);
+    }
+}
+
+static int compare_by_size(const void *a, const void *b) {
+    const SegmentFile *x = a, *y = b;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Terms are merged k-way; a domain's postings are the inputs' postings in
+// input order, with the dumps renumbered in that order. Only the newest copy
+// of a dump written more than once is kept, and terms left without postings
+// are dropped.
+static int merge_segments(const char *dir, const SegmentFile *files, size_t n) {
+    DomainSegment **segs = calloc(n, sizeof(DomainSegment *));
+    uint64_t *heads = calloc(n, sizeof(uint64_t));
+    uint32_t *dump_base = calloc(n, sizeof(uint32_t));
+    uint32_t *dump_id = NULL;
+    long long kept = 0;
+    DomainTerm *terms = NULL;
+    char *names = NULL;
+    size_t term_count = 0, term_cap = 0, names_len = 0, names_cap = 0;
+    int rc = segs && heads && dump_base ? 0 : -1;
+    uint64_t dumps = 0;
+    for (size_t k = 0; rc == 0 && k < n; k++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, files[k].name);
+        segs[k] = domseg_open(path);
+        if (!segs[k]) {
+            rc = -1;
+            break;
+        }
+        dump_base[k] = (uint32_t)dumps;
+        dumps += segs[k]->header->dump_count;
+        madvise(segs[k]->map, segs[k]->map_size, MADV_SEQUENTIAL);
+    }
+    if (rc == 0 && dumps > UINT32_MAX) rc = -1;
+    if (rc == 0) dump_id = malloc((dumps ? dumps : 1) * sizeof(uint32_t));
+    if (rc == 0 && (!dump_id || (kept = number_dumps(segs, n, dump_base, (size_t)dumps, dump_id)) < 0)) {
+        log_error("Failed to allocate domain index merge in %s", dir);
+        rc = -1;
+    }
+
+    SegmentWriter w;
+    if (rc == 0) rc = writer_open(&w, dir, NULL);
+    if (rc != 0) goto done;
+    while (!w.failed) {
+        Name min = {NULL, 0};
+        for (size_t k = 0; k < n; k++) {
+            Name t;
+            if (heads[k] == segs[k]->header->domain_count) continue;
+            if (term_name(segs[k], heads[k], &t) != 0) {
+                w.failed = 1;
+                break;
+            }
+            if (!min.s || compare_names(t.s, t.len, min.s, min.len) < 0) min = t;
+        }
+        if (!min.s || w.failed) break;
+
+        if (grow((void **)&terms, &term_cap, term_count + 2, sizeof(DomainTerm)) != 0 ||
+            grow((void **)&names, &names_cap, names_len + min.len, 1) != 0 || names_len + min.len > UINT32_MAX) {
+            w.failed = 1;
+            break;
+        }
+        PostingEncoder e = {&w, 0, 0, 0};
+        terms[term_count] = (DomainTerm){w.pos, (uint32_t)names_len, 0};
+        memcpy(names + names_len, min.s, min.len);
+        names_len += min.len;
+        for (size_t k = 0; k < n; k++) {
+            Name t;
+            if (heads[k] == segs[k]->header->domain_count || term_name(segs[k], heads[k], &t) != 0 ||
+                compare_names(t.s, t.len, min.s, min.len) != 0) {
+                continue;
+            }
+            Renumber r = {&e, dump_id + dump_base[k]};
+            if (each_posting(segs[k], heads[k], renumber_posting, &r) < 0) {
+                log_error("Domain index segment %s is corrupt", segs[k]->path);
+                w.failed = 1;
+            }
+            heads[k]++;
+        }
+        if (e.count > 0) terms[term_count++].posting_count = e.count;
+        else names_len -= min.len;  // Mentioned only by dropped copies
+    }
+
+    DomainSegmentHeader header = {{0}, (uint32_t)kept, 0, term_count, 0, 0, 0};
+    header.dumps_offset = w.pos;
+    for (size_t k = 0; k < n && !w.failed; k++) {
+        for (uint32_t d = 0; d < segs[k]->header->dump_count; d++) {
+            if (dump_id[dump_base[k] + d] != DUMP_DROPPED) put_dump(&w, segs[k], d);
+        }
+    }
+    if (!terms && !w.failed) {
+        if (grow((void **)&terms, &term_cap, 1, sizeof(DomainTerm)) != 0) w.failed = 1;
+    }
+    if (!w.failed) {
+        put_padding(&w, _Alignof(DomainTerm));
+        terms[term_count] = (DomainTerm){header.dumps_offset, (uint32_t)names_len, 0};
+        header.dir_offset = w.pos;
+        put(&w, terms, (term_count + 1) * sizeof(DomainTerm));
+        header.terms_offset = w.pos;
+        put(&w, names, names_len);
+    }
+    rc = writer_close(&w, &header, segs, n);
+    if (rc == 0) {
+        log_info("Merged %zu domain index segments into %s (%zu domains, %lld dumps)", n, w.path, term_count, kept);
+    }
+
+done:
+    for (size_t k = 0; segs && k < n; k++) domseg_close(segs[k]);
+    free(segs);
+    free(heads);
+    free(dump_base);
+    free(dump_id);
+    free(terms);
+    free(names);
+    return rc;
+}
+
+int domindex_merge(const char *dir, int factor) {
+    int merges = 0;
+    while (1) {
+        SegmentFile *files;
+        size_t count;
+        if (list_segments(dir, &files, &count) != 0) return -1;
+        if (count < (size_t)factor || factor < 2) {
+            free(files);
+            return merges;
+        }
+        // Smallest first: each posting is rewritten about log(segments) times
+        qsort(files, count, sizeof(SegmentFile), compare_by_size);
+        int rc = merge_segments(dir, files, (size_t)factor);
+        free(files);
+        if (rc != 0) return -1;
+        merges++;
+    }
+}
+
+void domindex_serve_merges(const char *dir, int factor) {
+    domindex_merge(dir, factor);  // Segments left by the previous run
+    pthread_mutex_lock(&merge_mutex);
+    while (1) {
+        while (!merge_pending) pthread_cond_wait(&merge_wake, &merge_mutex);
+        merge_pending = 0;
+        pthread_mutex_unlock(&merge_mutex);
+        domindex_merge(dir, factor);
+        pthread_mutex_lock(&merge_mutex);
+    }
+}
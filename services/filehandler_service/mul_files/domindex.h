@@ -0,0 +1,92 @@
+#ifndef DOMINDEX_H
+#define DOMINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DOMINDEX_MAGIC "SGDIX002"
+#define DOMAIN_MAX_LEN 253
+
+// Inverted index from registrable domain to the dumps that mention it, kept
+// as immutable segment files in one directory. Every processed input adds a
+// segment named after its dump, so a retried input replaces its earlier
+// segment; a background thread merges the smallest ones once there are
+// enough of them. A dump listed by several segments (a retry after its first
+// segment was merged) counts only in the newest write.
+//
+//   header    magic, u32 dump_count, u32 reserved, u64 domain_count,
+//             u64 dumps_offset, u64 dir_offset, u64 terms_offset
+//   postings  each domain's postings, back to back
+//   dumps     per dump: varint name length, name, varint write time (ns
+//             since the epoch), varint entry count, then per entry a varint
+//             length and the entry name; zero-padded to _Alignof(DomainTerm)
+//   dir       DomainTerm[domain_count + 1], sorted by domain; the last one
+//             only closes the ranges of the one before
+//   terms     the domains' names back to back
+//
+// A posting (dump, entry, offset) says the domain is first mentioned at
+// offset in that entry of that dump, counted in the entry's UTF-8 text.
+// Postings are sorted by dump and entry and stored as varints: the dump
+// delta, the entry (a delta when the dump is the same) and the offset.
+typedef struct {
+    char magic[8];
+    uint32_t dump_count;
+    uint32_t reserved;
+    uint64_t domain_count;
+    uint64_t dumps_offset;
+    uint64_t dir_offset;
+    uint64_t terms_offset;
+} DomainSegmentHeader;
+
+typedef struct {
+    uint64_t postings_offset;
+    uint32_t term_offset;  // Into terms
+    uint32_t posting_count;
+} DomainTerm;
+
+// Reduce a host name to its registrable domain (the label below the public
+// suffix) into out (DOMAIN_MAX_LEN + 1 bytes), lowercased. Returns the
+// length, 0 if host is not a usable domain name.
+size_t domain_registrable(const char *host, size_t len, char *out);
+
+// Collects the domains of one input's entries and writes them as a segment
+typedef struct DomainCollector DomainCollector;
+
+DomainCollector *domindex_collect_open(const char *dump);
+// entry is the path inside the archive, or "" when the input is the entry
+void domindex_collect_entry(DomainCollector *c, const char *entry);
+// Find the hosts of emails and URLs in the entry's next block
+void domindex_collect_scan(DomainCollector *c, const void *data, size_t len);
+// Write the segment into dir, which must exist, when any domain was found
+// and wake the merger; dir NULL discards it. Returns -1 if the segment cannot be written.
+int domindex_collect_close(DomainCollector *c, const char *dir);
+
+// A posting as resolved by a query; names point into the mapped segment
+typedef struct {
+    const char *dump, *entry;
+    size_t dump_len, entry_len;
+    uint64_t offset;
+    uint64_t written;  // Write time of the dump's segment data
+} DomainHit;
+
+typedef void (*domindex_hit_fn)(void *ctx, const DomainHit *hit);
+
+typedef struct DomainSegment DomainSegment;
+
+DomainSegment *domseg_open(const char *path);
+void domseg_close(DomainSegment *seg);
+// Call fn for every posting of domain (reduced to its registrable domain
+// first); returns the number of postings or -1 on a corrupt segment
+long long domseg_query(const DomainSegment *seg, const char *domain, domindex_hit_fn fn, void *ctx);
+// The dumps a segment lists, with the write time of each
+uint32_t domseg_dump_count(const DomainSegment *seg);
+void domseg_dump(const DomainSegment *seg, uint32_t i, const char **name, size_t *len, uint64_t *written);
+
+// Merge the `factor` smallest segments of dir into one while there are at
+// least that many. Returns the number of merges done, -1 on error.
+int domindex_merge(const char *dir, int factor);
+// Merger loop for a background thread: merges whenever a collector has
+// published a new segment. Does not return.
+void domindex_serve_merges(const char *dir, int factor);
+
+#endif
@@ -0,0 +1,122 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "domindex.h"
+#include "filehandler.h"
+
+// Domain lookup over the domain index segments: every dump entry mentioning
+// the domain, printed as DUMP<TAB>ENTRY<TAB>OFFSET.
+//
+//   domquery extracted/domains mail.example.co.uk
+//
+// Hosts are reduced to their registrable domain first, so the query above
+// finds every mention of example.co.uk. A dump listed by more than one
+// segment (a retried input whose first segment was already merged) is
+// reported from its newest write only.
+
+typedef struct {
+    const char *name;
+    size_t len;
+    uint64_t written;
+} DumpWrite;
+
+static int compare_dump_writes(const void *a, const void *b) {
+    const DumpWrite *x = a, *y = b;
+    int c = memcmp(x->name, y->name, x->len < y->len ? x->len : y->len);
+    if (c != 0) return c;
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    return x->written > y->written ? -1 : x->written < y->written;  // Newest first
+}
+
+typedef struct {
+    DumpWrite *newest;  // Sorted by name, one per dump
+    size_t count;
+} QueryState;
+
+static void print_hit(void *ctx, const DomainHit *hit) {
+    QueryState *q = ctx;
+    DumpWrite key = {hit->dump, hit->dump_len, UINT64_MAX};
+    size_t lo = 0, hi = q->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_dump_writes(&q->newest[mid], &key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < q->count && q->newest[lo].written > hit->written) return;  // Superseded copy
+    printf("%.*s\t%.*s\t%llu\n", (int)hit->dump_len, hit->dump, (int)hit->entry_len, hit->entry,
+           (unsigned long long)hit->offset);
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t n = strlen(name), s = strlen(suffix);
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+    char domain[DOMAIN_MAX_LEN + 1];
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <domain_index_dir> <domain>\n", argv[0]);
+        return 2;
+    }
+    if (domain_registrable(argv[2], strlen(argv[2]), domain) == 0) {
+        fprintf(stderr, "%s is not a domain name\n", argv[2]);
+        return 2;
+    }
+    DIR *d = opendir(argv[1]);
+    if (!d) {
+        if (errno == ENOENT) return 0;
+        log_error("Failed to open %s: %s", argv[1], strerror(errno));
+        return 1;
+    }
+
+    int rc = 0;
+    DomainSegment **segs = NULL;
+    size_t seg_count = 0, dump_count = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.' || !has_suffix(e->d_name, ".dix")) continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", argv[1], e->d_name);
+        DomainSegment *seg = domseg_open(path);
+        if (!seg) {
+            rc = 1;
+            continue;
+        }
+        DomainSegment **grown = realloc(segs, (seg_count + 1) * sizeof(DomainSegment *));
+        if (!grown) {
+            log_error("Failed to allocate segment list");
+            domseg_close(seg);
+            rc = 1;
+            break;
+        }
+        segs = grown;
+        segs[seg_count++] = seg;
+        dump_count += domseg_dump_count(seg);
+    }
+    closedir(d);
+
+    QueryState q = {malloc((dump_count ? dump_count : 1) * sizeof(DumpWrite)), 0};
+    if (!q.newest) {
+        log_error("Failed to allocate dump list");
+        rc = 1;
+    } else {
+        for (size_t k = 0; k < seg_count; k++) {
+            for (uint32_t i = 0; i < domseg_dump_count(segs[k]); i++, q.count++) {
+                DumpWrite *w = &q.newest[q.count];
+                domseg_dump(segs[k], i, &w->name, &w->len, &w->written);
+            }
+        }
+        qsort(q.newest, q.count, sizeof(DumpWrite), compare_dump_writes);
+        for (size_t k = 0; k < seg_count; k++) {
+            if (domseg_query(segs[k], argv[2], print_hit, &q) < 0) rc = 1;
+        }
+    }
+    for (size_t k = 0; k < seg_count; k++) domseg_close(segs[k]);
+    free(segs);
+    free(q.newest);
+    return rc;
+}
@@ -0,0 +1,707 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "extsort.h"
+#include "filehandler.h"
+#include "record.h"
+
+#define RADIX_BITS 11
+#define RADIX_PASSES 6  // 66 bits: covers the high fingerprint word
+#define MIN_RECORD_BYTES 32  // Run buffers hold at most data_size / MIN_RECORD_BYTES keys
+
+typedef struct {
+    uint64_t hi, lo;
+    uint64_t offset;  // Record start in the run buffer
+} SortKey;
+
+// Run generation: the reader fills jobs with whole records, workers sort and spill them
+typedef struct RunJob {
+    uint8_t *data;
+    size_t len;
+    SortKey *keys;
+    SortKey *scratch;
+    size_t key_count;
+    struct RunJob *next;
+} RunJob;
+
+typedef struct {
+    int fd;  // Unlinked spill file
+    uint64_t records;
+} Run;
+
+// One request for the I/O thread: fill or drain buf, then set *done
+typedef struct IoRequest {
+    int fd;
+    int write;
+    uint8_t *buf;
+    size_t len;  // Bytes to write, or capacity to read
+    size_t *result;  // Bytes read
+    int *done;
+    struct IoRequest *next;
+} IoRequest;
+
+typedef struct {
+    const SortOptions *opt;
+    size_t data_size;
+    size_t key_cap;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;  // Jobs queued/freed, runs added, I/O requests queued/finished
+    RunJob *free_jobs;
+    RunJob *queued, *queued_tail;
+    int closing;
+    int failed;
+
+    Run *runs;
+    unsigned run_count, run_cap;
+
+    IoRequest *io_head, *io_tail;
+    int io_closing;
+} Sorter;
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Size of the .rec record at p, or 0 if it is not complete within avail bytes
+static size_t rec_size(const uint8_t *p, size_t avail) {
+    if (avail < 8) return 0;
+    size_t size = 8 + (size_t)get_u16(p) + get_u16(p + 2) + get_u16(p + 4) + get_u16(p + 6);
+    return size <= avail ? size : 0;
+}
+
+static void rec_fingerprint(const uint8_t *p, uint64_t fp[2]) {
+    CredentialRecord rec;
+    rec.source_len = get_u16(p);
+    rec.identity_len = get_u16(p + 2);
+    rec.secret_len = get_u16(p + 4);
+    rec.url_len = get_u16(p + 6);
+    rec.source = (const char *)p + 8;
+    rec.identity = rec.source + rec.source_len;
+    rec.secret = rec.identity + rec.identity_len;
+    rec.url = rec.secret + rec.secret_len;
+    record_fingerprint(&rec, fp);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static ssize_t read_full(int fd, void *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = read(fd, (uint8_t *)buf + total, len - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+static int spill_file(const Sorter *s) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/extsort.XXXXXX", s->opt->tmp_dir);
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        log_error("Failed to create spill file in %s: %s", s->opt->tmp_dir, strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+// LSD radix sort on the high word, then insertion sort of equal-high neighbours by the low word
+static void radix_sort(SortKey *keys, SortKey *scratch, size_t n) {
+    static __thread uint32_t counts[RADIX_PASSES][1 << RADIX_BITS];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        for (int p = 0; p < RADIX_PASSES; p++) counts[p][(keys[i].hi >> (p * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)]++;
+    }
+
+    SortKey *src = keys, *dst = scratch;
+    for (int p = 0; p < RADIX_PASSES; p++) {
+        uint32_t *c = counts[p];
+        if (c[(src[0].hi >> (p * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)] == n) continue;  // One bucket: nothing moves
+        uint32_t sum = 0;
+        for (int b = 0; b < (1 << RADIX_BITS); b++) {
+            uint32_t count = c[b];
+            c[b] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; i++) dst[c[(src[i].hi >> (p * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)]++] = src[i];
+        SortKey *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != keys) memcpy(keys, src, n * sizeof(SortKey));
+
+    for (size_t i = 1; i < n; i++) {
+        if (keys[i].hi != keys[i - 1].hi) continue;
+        SortKey k = keys[i];
+        size_t j = i;
+        while (j > 0 && keys[j - 1].hi == k.hi && keys[j - 1].lo > k.lo) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = k;
+    }
+}
+
+// Sort a job and write it as a run: per record the fingerprint, then the .rec bytes
+static int write_run(Sorter *s, RunJob *job, Run *run) {
+    for (size_t i = 0; i < job->key_count; i++) {
+        uint64_t fp[2];
+        rec_fingerprint(job->data + job->keys[i].offset, fp);
+        job->keys[i].hi = fp[0];
+        job->keys[i].lo = fp[1];
+    }
+    radix_sort(job->keys, job->scratch, job->key_count);
+
+    run->fd = spill_file(s);
+    run->records = 0;
+    if (run->fd == -1) return -1;
+
+    // The scratch keys are free again: reuse them as the write buffer
+    uint8_t *out = (uint8_t *)job->scratch;
+    size_t out_cap = job->key_count * sizeof(SortKey), used = 0;
+    for (size_t i = 0; i < job->key_count; i++) {
+        const SortKey *k = &job->keys[i];
+        if (i > 0 && k->hi == k[-1].hi && k->lo == k[-1].lo) continue;
+        const uint8_t *rec = job->data + k->offset;
+        size_t size = rec_size(rec, SIZE_MAX);
+        if (used + 16 + size > out_cap) {
+            if (write_all(run->fd, out, used) != 0) goto fail;
+            used = 0;
+        }
+        if (16 + size > out_cap) {
+            if (write_all(run->fd, &k->hi, 8) != 0 || write_all(run->fd, &k->lo, 8) != 0 ||
+                write_all(run->fd, rec, size) != 0) {
+                goto fail;
+            }
+        } else {
+            memcpy(out + used, &k->hi, 8);
+            memcpy(out + used + 8, &k->lo, 8);
+            memcpy(out + used + 16, rec, size);
+            used += 16 + size;
+        }
+        run->records++;
+    }
+    if (write_all(run->fd, out, used) != 0) goto fail;
+    return 0;
+
+fail:
+    log_error("Failed to write spill file: %s", strerror(errno));
+    close(run->fd);
+    run->fd = -1;
+    return -1;
+}
+
+static void *run_worker(void *arg) {
+    Sorter *s = arg;
+    pthread_mutex_lock(&s->mutex);
+    while (1) {
+        while (!s->queued && !s->closing) pthread_cond_wait(&s->cond, &s->mutex);
+        RunJob *job = s->queued;
+        if (!job) break;
+        s->queued = job->next;
+        if (!s->queued) s->queued_tail = NULL;
+        int failed = s->failed;
+        pthread_mutex_unlock(&s->mutex);
+
+        Run run;
+        int rc = failed ? -1 : write_run(s, job, &run);
+
+        pthread_mutex_lock(&s->mutex);
+        if (rc == 0 && s->run_count == s->run_cap) {
+            unsigned cap = s->run_cap ? s->run_cap * 2 : 64;
+            Run *runs = realloc(s->runs, cap * sizeof(Run));
+            if (runs) {
+                s->runs = runs;
+                s->run_cap = cap;
+            } else {
+                close(run.fd);
+                rc = -1;
+            }
+        }
+        if (rc == 0) s->runs[s->run_count++] = run;
+        else s->failed = 1;
+        job->len = 0;
+        job->key_count = 0;
+        job->next = s->free_jobs;
+        s->free_jobs = job;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+static int sort_failed(Sorter *s) {
+    pthread_mutex_lock(&s->mutex);
+    int failed = s->failed;
+    pthread_mutex_unlock(&s->mutex);
+    return failed;
+}
+
+static void set_failed(Sorter *s) {
+    pthread_mutex_lock(&s->mutex);
+    s->failed = 1;
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static RunJob *take_free_job(Sorter *s) {
+    pthread_mutex_lock(&s->mutex);
+    while (!s->free_jobs) pthread_cond_wait(&s->cond, &s->mutex);
+    RunJob *job = s->free_jobs;
+    s->free_jobs = job->next;
+    pthread_mutex_unlock(&s->mutex);
+    return job;
+}
+
+static void submit_job(Sorter *s, RunJob *job) {
+    pthread_mutex_lock(&s->mutex);
+    job->next = NULL;
+    if (s->queued_tail) s->queued_tail->next = job;
+    else s->queued = job;
+    s->queued_tail = job;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+// Cut the inputs into jobs of whole records; a record split by a read moves to the next job
+static int generate_runs(Sorter *s, const char *const *inputs, int input_count, SortStats *stats) {
+    RunJob *job = take_free_job(s);
+    for (int i = 0; i < input_count && !sort_failed(s); i++) {
+        int fd = open(inputs[i], O_RDONLY | O_CLOEXEC);
+        char magic[6];
+        if (fd == -1 || read_full(fd, magic, 6) != 6 || memcmp(magic, RECORD_FILE_MAGIC, 6) != 0) {
+            log_error("Failed to open record file %s: %s", inputs[i], fd == -1 ? strerror(errno) : "bad header");
+            if (fd != -1) close(fd);
+            set_failed(s);
+            break;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        size_t scanned = job->len;  // Records before this offset are keyed
+        while (1) {
+            ssize_t n = read_full(fd, job->data + job->len, s->data_size - job->len);
+            if (n < 0) {
+                log_error("Failed to read record file %s: %s", inputs[i], strerror(errno));
+                set_failed(s);
+                break;
+            }
+            job->len += (size_t)n;
+
+            size_t size;
+            while (job->key_count < s->key_cap && (size = rec_size(job->data + scanned, job->len - scanned))) {
+                job->keys[job->key_count++].offset = scanned;
+                scanned += size;
+            }
+            if (n == 0) break;  // End of this input; keep filling the job from the next one
+            if (job->key_count < s->key_cap && job->len < s->data_size) continue;
+
+            // Job full: hand it over and move the partial record to a fresh one
+            RunJob *next = take_free_job(s);
+            memcpy(next->data, job->data + scanned, job->len - scanned);
+            next->len = job->len - scanned;
+            job->len = scanned;
+            stats->records_in += job->key_count;
+            submit_job(s, job);
+            job = next;
+            scanned = 0;
+        }
+        close(fd);
+        if (scanned != job->len) {
+            log_warning("Dropping %zu bytes of a truncated record at the end of %s", job->len - scanned, inputs[i]);
+            job->len = scanned;
+        }
+    }
+    if (job->key_count > 0) {
+        stats->records_in += job->key_count;
+        submit_job(s, job);
+    } else {
+        pthread_mutex_lock(&s->mutex);
+        job->next = s->free_jobs;
+        s->free_jobs = job;
+        pthread_mutex_unlock(&s->mutex);
+    }
+    return sort_failed(s) ? -1 : 0;
+}
+
+static void *io_worker(void *arg) {
+    Sorter *s = arg;
+    pthread_mutex_lock(&s->mutex);
+    while (1) {
+        while (!s->io_head && !s->io_closing) pthread_cond_wait(&s->cond, &s->mutex);
+        IoRequest *req = s->io_head;
+        if (!req) break;
+        s->io_head = req->next;
+        if (!s->io_head) s->io_tail = NULL;
+        pthread_mutex_unlock(&s->mutex);
+
+        int failed = 0;
+        if (req->write) {
+            failed = write_all(req->fd, req->buf, req->len) != 0;
+        } else {
+            ssize_t n = read_full(req->fd, req->buf, req->len);
+            if (n < 0) failed = 1;
+            else *req->result = (size_t)n;
+        }
+        if (failed) log_error("Spill file I/O failed: %s", strerror(errno));
+
+        pthread_mutex_lock(&s->mutex);
+        if (failed) s->failed = 1;
+        *req->done = 1;
+        free(req);
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+static int io_submit(Sorter *s, int fd, int write, uint8_t *buf, size_t len, size_t *result, int *done) {
+    IoRequest *req = malloc(sizeof(IoRequest));
+    if (!req) return -1;
+    *req = (IoRequest){fd, write, buf, len, result, done, NULL};
+    pthread_mutex_lock(&s->mutex);
+    *done = 0;
+    if (s->io_tail) s->io_tail->next = req;
+    else s->io_head = req;
+    s->io_tail = req;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return 0;
+}
+
+// Returns -1 if any I/O of the sort has failed
+static int io_wait(Sorter *s, int *done) {
+    pthread_mutex_lock(&s->mutex);
+    while (!*done) pthread_cond_wait(&s->cond, &s->mutex);
+    int failed = s->failed;
+    pthread_mutex_unlock(&s->mutex);
+    return failed ? -1 : 0;
+}
+
+// Merge input: two buffers, one consumed while the I/O thread refills the
+// other. Each buffer keeps EXTSORT_MAX_RECORD bytes of headroom in front so
+// a record cut by the buffer end can be moved in front of the next fill.
+typedef struct {
+    int fd;
+    uint8_t *buf[2];
+    size_t fill[2];
+    int done[2];
+    int active;
+    uint8_t *pos, *end;
+    int eof;  // No more reads will be issued
+    int exhausted;  // No current record
+    uint64_t hi, lo;
+    const uint8_t *rec;  // Current record's .rec bytes
+    size_t rec_size;
+} RunReader;
+
+// Advance to the next record; returns -1 on a corrupt run
+static int reader_next(Sorter *s, RunReader *r) {
+    while (1) {
+        size_t avail = (size_t)(r->end - r->pos);
+        if (avail >= 16) {
+            size_t size = rec_size(r->pos + 16, avail - 16);
+            if (size) {
+                memcpy(&r->hi, r->pos, 8);
+                memcpy(&r->lo, r->pos + 8, 8);
+                r->rec = r->pos + 16;
+                r->rec_size = size;
+                r->pos += 16 + size;
+                return 0;
+            }
+        }
+        if (r->eof) {
+            if (avail) {
+                log_error("Spill file ends in a truncated record");
+                return -1;
+            }
+            r->exhausted = 1;
+            return 0;
+        }
+
+        // Switch to the other buffer once its read finishes and refill this one
+        int other = !r->active;
+        if (io_wait(s, &r->done[other]) != 0) return -1;
+        uint8_t *start = r->buf[other] + EXTSORT_MAX_RECORD - avail;
+        memmove(start, r->pos, avail);
+        r->pos = start;
+        r->end = r->buf[other] + EXTSORT_MAX_RECORD + r->fill[other];
+        if (r->fill[other] < EXTSORT_IO_BUFFER) {
+            r->eof = 1;
+        } else if (io_submit(s, r->fd, 0, r->buf[r->active] + EXTSORT_MAX_RECORD, EXTSORT_IO_BUFFER,
+                             &r->fill[r->active], &r->done[r->active]) != 0) {
+            return -1;
+        }
+        r->active = other;
+    }
+}
+
+static int reader_open(Sorter *s, RunReader *r, int fd) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->done[0] = r->done[1] = 1;
+    for (int i = 0; i < 2; i++) {
+        r->buf[i] = malloc(EXTSORT_MAX_RECORD + EXTSORT_IO_BUFFER);
+        if (!r->buf[i]) return -1;
+    }
+    if (lseek(fd, 0, SEEK_SET) != 0) return -1;
+    // Buffer 1 is read first; buffer 0 starts empty and active
+    r->active = 0;
+    r->pos = r->end = r->buf[0] + EXTSORT_MAX_RECORD;
+    if (io_submit(s, fd, 0, r->buf[1] + EXTSORT_MAX_RECORD, EXTSORT_IO_BUFFER, &r->fill[1], &r->done[1]) != 0) return -1;
+    return reader_next(s, r);
+}
+
+static void reader_close(Sorter *s, RunReader *r) {
+    // A read may still be in flight into one of the buffers
+    for (int i = 0; i < 2; i++) {
+        io_wait(s, &r->done[i]);
+        free(r->buf[i]);
+    }
+    if (r->fd != -1) close(r->fd);
+}
+
+// Double-buffered output through the I/O thread
+typedef struct {
+    int fd;
+    uint8_t *buf[2];
+    size_t used;
+    int active;
+    int done[2];
+} MergeWriter;
+
+static int writer_put(Sorter *s, MergeWriter *w, const void *data, size_t len) {
+    if (w->used + len > EXTSORT_IO_BUFFER) {
+        if (io_submit(s, w->fd, 1, w->buf[w->active], w->used, NULL, &w->done[w->active]) != 0) return -1;
+        w->active = !w->active;
+        if (io_wait(s, &w->done[w->active]) != 0) return -1;
+        w->used = 0;
+    }
+    memcpy(w->buf[w->active] + w->used, data, len);
+    w->used += len;
+    return 0;
+}
+
+static int writer_finish(Sorter *s, MergeWriter *w) {
+    if (w->used && io_submit(s, w->fd, 1, w->buf[w->active], w->used, NULL, &w->done[w->active]) != 0) return -1;
+    io_wait(s, &w->done[0]);
+    return io_wait(s, &w->done[1]);
+}
+
+static inline int reader_less(const RunReader *a, const RunReader *b) {
+    if (a->exhausted || b->exhausted) return !a->exhausted && b->exhausted;
+    return a->hi < b->hi || (a->hi == b->hi && a->lo < b->lo);
+}
+
+// Loser tree over k readers: tree[0] holds the winner, tree[1..k-1] the losers
+static int build_tree(RunReader *r, int *tree, int k, int node) {
+    if (node >= k) return node - k;
+    int left = build_tree(r, tree, k, 2 * node);
+    int right = 2 * node + 1 < 2 * k ? build_tree(r, tree, k, 2 * node + 1) : left;
+    if (reader_less(&r[right], &r[left])) {
+        tree[node] = left;
+        return right;
+    }
+    tree[node] = right;
+    return left;
+}
+
+// Merge runs [first, first + k) into fd. Final output drops the fingerprints
+// and starts with the .rec magic; intermediate runs keep them.
+static int merge_runs(Sorter *s, unsigned first, int k, int fd, int final, uint64_t *written) {
+    RunReader *readers = calloc(k, sizeof(RunReader));
+    int *tree = calloc(k + 1, sizeof(int));
+    MergeWriter w = {fd, {malloc(EXTSORT_IO_BUFFER), malloc(EXTSORT_IO_BUFFER)}, 0, 0, {1, 1}};
+    int rc = readers && tree && w.buf[0] && w.buf[1] ? 0 : -1;
+    for (int i = 0; readers && i < k; i++) {
+        readers[i].fd = -1;
+        readers[i].done[0] = readers[i].done[1] = 1;
+    }
+    for (int i = 0; i < k && rc == 0; i++) {
+        rc = reader_open(s, &readers[i], s->runs[first + i].fd);
+        s->runs[first + i].fd = -1;
+    }
+    if (rc == 0 && final) rc = writer_put(s, &w, RECORD_FILE_MAGIC, 6);
+
+    uint64_t count = 0, last_hi = 0, last_lo = 0;
+    if (rc == 0) {
+        tree[0] = build_tree(readers, tree, k, 1);
+        while (!readers[tree[0]].exhausted) {
+            int win = tree[0];
+            RunReader *r = &readers[win];
+            if (count == 0 || r->hi != last_hi || r->lo != last_lo) {
+                if (!final && ((rc = writer_put(s, &w, &r->hi, 8)) != 0 || (rc = writer_put(s, &w, &r->lo, 8)) != 0)) break;
+                if ((rc = writer_put(s, &w, r->rec, r->rec_size)) != 0) break;
+                last_hi = r->hi;
+                last_lo = r->lo;
+                count++;
+            }
+            if ((rc = reader_next(s, r)) != 0) break;
+            // Replay the winner's path to the root
+            for (int node = (win + k) >> 1; node > 0; node >>= 1) {
+                if (reader_less(&readers[tree[node]], &readers[win])) {
+                    int t = tree[node];
+                    tree[node] = win;
+                    win = t;
+                }
+            }
+            tree[0] = win;
+        }
+    }
+    if (writer_finish(s, &w) != 0) rc = -1;
+
+    for (int i = 0; readers && i < k; i++) reader_close(s, &readers[i]);
+    free(readers);
+    free(tree);
+    free(w.buf[0]);
+    free(w.buf[1]);
+    *written = count;
+    return rc;
+}
+
+int extsort_records(const char *const *inputs, int input_count, const char *output, const SortOptions *opt,
+                    SortStats *stats) {
+    Sorter s;
+    memset(&s, 0, sizeof(s));
+    memset(stats, 0, sizeof(*stats));
+    s.opt = opt;
+    int threads = opt->threads > 0 ? opt->threads : 1;
+    long long memory = opt->memory_bytes > EXTSORT_MIN_MEMORY ? opt->memory_bytes : EXTSORT_MIN_MEMORY;
+
+    // Each job is its data plus keys and scratch keys for one key per MIN_RECORD_BYTES.
+    // One extra job lets the reader fill while every worker is sorting.
+    double per_data_byte = 1.0 + 2.0 * sizeof(SortKey) / MIN_RECORD_BYTES;
+    s.data_size = (size_t)(memory / (threads + 1) / per_data_byte);
+    if (s.data_size < 4 * EXTSORT_MAX_RECORD) s.data_size = 4 * EXTSORT_MAX_RECORD;
+    s.key_cap = s.data_size / MIN_RECORD_BYTES;
+    pthread_mutex_init(&s.mutex, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    RunJob *jobs = calloc(threads + 1, sizeof(RunJob));
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    int rc = jobs && workers ? 0 : -1;
+    for (int i = 0; i <= threads && rc == 0; i++) {
+        jobs[i].data = malloc(s.data_size);
+        jobs[i].keys = malloc(s.key_cap * sizeof(SortKey));
+        jobs[i].scratch = malloc(s.key_cap * sizeof(SortKey));
+        if (!jobs[i].data || !jobs[i].keys || !jobs[i].scratch) rc = -1;
+        jobs[i].next = s.free_jobs;
+        s.free_jobs = &jobs[i];
+    }
+    if (rc != 0) log_error("Failed to allocate sort buffers for %s", output);
+
+    int started = 0;
+    while (rc == 0 && started < threads) {
+        if (pthread_create(&workers[started], NULL, run_worker, &s) != 0) break;
+        started++;
+    }
+    if (rc == 0 && started == 0) {
+        log_error("Failed to start sort workers for %s", output);
+        rc = -1;
+    }
+    if (rc == 0) rc = generate_runs(&s, inputs, input_count, stats);
+
+    pthread_mutex_lock(&s.mutex);
+    s.closing = 1;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.mutex);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    if (s.failed) rc = -1;
+    for (int i = 0; jobs && i <= threads; i++) {
+        free(jobs[i].data);
+        free(jobs[i].keys);
+        free(jobs[i].scratch);
+    }
+    free(jobs);
+    free(workers);
+    stats->runs = s.run_count;
+
+    // Merge with what run generation used: two buffers per run, two for output
+    long long per_run = 2LL * (EXTSORT_MAX_RECORD + EXTSORT_IO_BUFFER);
+    int fan_in = (int)((memory - 2LL * EXTSORT_IO_BUFFER) / per_run);
+    if (fan_in < 2) fan_in = 2;
+
+    pthread_t io_thread;
+    int io_started = rc == 0 && pthread_create(&io_thread, NULL, io_worker, &s) == 0;
+    if (rc == 0 && !io_started) {
+        log_error("Failed to start sort I/O thread for %s", output);
+        rc = -1;
+    }
+
+    // Intermediate passes: merge the oldest fan_in runs into a new run until one pass remains
+    unsigned first = 0;
+    while (rc == 0 && s.run_count - first > (unsigned)fan_in) {
+        int fd = spill_file(&s);
+        uint64_t records;
+        if (fd == -1 || merge_runs(&s, first, fan_in, fd, 0, &records) != 0) {
+            if (fd != -1) close(fd);
+            rc = -1;
+            break;
+        }
+        first += fan_in;
+        stats->merge_passes++;
+        if (s.run_count == s.run_cap) {
+            // Runs before first are consumed: slide the rest down
+            memmove(s.runs, s.runs + first, (s.run_count - first) * sizeof(Run));
+            s.run_count -= first;
+            first = 0;
+        }
+        s.runs[s.run_count++] = (Run){fd, records};
+    }
+
+    char tmp_path[4096 + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output);
+    if (rc == 0) {
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd == -1) {
+            log_error("Failed to create %s: %s", tmp_path, strerror(errno));
+            rc = -1;
+        } else {
+            if (s.run_count > first) {
+                rc = merge_runs(&s, first, (int)(s.run_count - first), fd, 1, &stats->records_out);
+                stats->merge_passes++;
+            } else {
+                rc = write_all(fd, RECORD_FILE_MAGIC, 6);
+            }
+            first = s.run_count;
+            if (close(fd) != 0) rc = -1;
+            if (rc == 0 && rename(tmp_path, output) != 0) {
+                log_error("Failed to move %s into place: %s", tmp_path, strerror(errno));
+                rc = -1;
+            }
+            if (rc != 0) unlink(tmp_path);
+        }
+    }
+
+    if (io_started) {
+        pthread_mutex_lock(&s.mutex);
+        s.io_closing = 1;
+        pthread_cond_broadcast(&s.cond);
+        pthread_mutex_unlock(&s.mutex);
+        pthread_join(io_thread, NULL);
+    }
+    for (unsigned i = 0; i < s.run_count; i++) {
+        if (s.runs[i].fd != -1) close(s.runs[i].fd);
+    }
+    free(s.runs);
+    pthread_mutex_destroy(&s.mutex);
+    pthread_cond_destroy(&s.cond);
+    return rc;
+}
@@ -0,0 +1,33 @@
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXTSORT_MIN_MEMORY (64LL << 20)
+#define EXTSORT_IO_BUFFER (1 << 20)  // Per run read buffer (two per run) and output buffer in the merge
+#define EXTSORT_MAX_RECORD (16 + 8 + 4 * 65535)  // Fingerprint, four u16 lengths and the fields
+
+typedef struct {
+    long long memory_bytes;  // Cap on buffers across run generation and merge; at least EXTSORT_MIN_MEMORY
+    int threads;  // Run generation workers
+    const char *tmp_dir;  // Where spill files go; they are unlinked as soon as they are created
+} SortOptions;
+
+typedef struct {
+    uint64_t records_in;
+    uint64_t records_out;
+    unsigned runs;
+    unsigned merge_passes;
+} SortStats;
+
+// Sort the records of every .rec input by record_fingerprint() into a single
+// .rec output, keeping one record per fingerprint. Inputs are cut into
+// memory-sized runs that are radix sorted on worker threads and spilled; the
+// runs are then combined by a loser-tree merge whose reads and writes run on
+// a separate I/O thread. output may be one of the inputs: it is written under
+// <output>.tmp and renamed into place. Returns -1 on error.
+int extsort_records(const char *const *inputs, int input_count, const char *output, const SortOptions *opt,
+                    SortStats *stats);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef FILEHANDLER_H
+#define FILEHANDLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <rabbitmq-c/amqp.h>
+
+// Shared helpers implemented in main.c
+
+void log_info(const char *format, ...);
+void log_error(const char *format, ...);
+void log_warning(const char *format, ...);
+
+int mkdir_p(const char *path, mode_t mode);
+
+// Queue a file for the worker pool; channel is 0 for tasks not delivered by RabbitMQ
+int enqueue_file(const char *file_path, amqp_channel_t channel, uint64_t delivery_tag);
+
+typedef enum {
+    OUTCOME_ACK,  // Processed; acknowledge
+    OUTCOME_RETRY,  // Republish to the retry queue with a backoff TTL, then acknowledge
+    OUTCOME_DEAD  // Republish to the dead-letter queue, then acknowledge
+} DeliveryOutcome;
+
+// Hand a finished delivery back to the consumer thread, which owns the connection.
+// file_path and reason are only used for RETRY and DEAD.
+void complete_delivery(amqp_channel_t channel, uint64_t delivery_tag, const char *file_path,
+                       DeliveryOutcome outcome, int attempts, long delay_ms, const char *reason);
+
+#endif
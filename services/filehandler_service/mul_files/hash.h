@@ -0,0 +1,10 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MurmurHash3 x64 128-bit (public domain, Austin Appleby); out[0] is the low half
+void murmur3_128(const void *key, size_t len, uint64_t seed, uint64_t out[2]);
+
+#endif
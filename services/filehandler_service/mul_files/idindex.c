@@ -0,0 +1,625 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "hash.h"
+#include "idindex.h"
+
+#define RADIX_BITS 11
+#define RADIX_PASSES 6
+#define MIN_PHONE_DIGITS 7
+#define PROBE_BATCH 64  // Keys whose directory and key loads are in flight together
+#define WRITER_BUFFER 8192  // Keys (and directory slots) buffered per write
+
+struct IdIndex {
+    int refs;  // Sets holding this index
+    char path[PATH_MAX];
+    dev_t dev;  // Identity of the file mapped, to notice it being replaced
+    ino_t ino;
+    void *map;
+    size_t map_size;
+    uint32_t bucket_bits;
+    uint64_t count;
+    const uint64_t *dir;
+    const uint64_t *keys;
+};
+
+struct IdIndexSet {
+    int refs;
+    size_t count;
+    IdIndex **items;
+};
+
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+static IdIndexSet *current = NULL;
+
+// Held while an index file is renamed into place and while the files a merge
+// replaced are checked and unlinked, so a merge never unlinks a task's file
+// rewritten meanwhile
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t merge_wake = PTHREAD_COND_INITIALIZER;
+static int merge_pending;
+
+// Merged files are named by a hex sequence number, continued from the highest
+// one in the directory
+static pthread_mutex_t seq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t next_seq;
+static int seq_loaded;
+
+size_t idindex_normalize(const char *identity, size_t len, char *out) {
+    while (len > 0 && (unsigned char)identity[0] <= ' ') {
+        identity++;
+        len--;
+    }
+    while (len > 0 && (unsigned char)identity[len - 1] <= ' ') len--;
+    if (len == 0 || len > IDINDEX_MAX_IDENTITY) return 0;
+
+    // "+1 (555) 010-9999" and "15550109999" are the same phone
+    size_t digits = 0;
+    int phone = 1;
+    for (size_t i = 0; i < len && phone; i++) {
+        char c = identity[i];
+        if (c >= '0' && c <= '9') out[digits++] = c;
+        else if (!strchr(" +-().", c)) phone = 0;
+    }
+    if (phone && digits >= MIN_PHONE_DIGITS) return digits;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = identity[i];
+        out[i] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+    }
+    return len;
+}
+
+int idindex_key(const char *identity, size_t len, uint64_t *key) {
+    char norm[IDINDEX_MAX_IDENTITY];
+    size_t n = idindex_normalize(identity, len, norm);
+    if (n == 0) return 0;
+    uint64_t h[2];
+    murmur3_128(norm, n, IDINDEX_SEED, h);
+    *key = h[0];
+    return 1;
+}
+
+static void radix_sort(uint64_t *keys, uint64_t *scratch, size_t n) {
+    static __thread size_t counts[RADIX_PASSES][1 << RADIX_BITS];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        for (int p = 0; p < RADIX_PASSES; p++) counts[p][(keys[i] >> (p * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)]++;
+    }
+    uint64_t *src = keys, *dst = scratch;
+    for (int p = 0; p < RADIX_PASSES; p++) {
+        size_t *c = counts[p];
+        if (c[(src[0] >> (p * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)] == n) continue;
+        size_t sum = 0;
+        for (int b = 0; b < (1 << RADIX_BITS); b++) {
+            size_t count = c[b];
+            c[b] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; i++) dst[c[(src[i] >> (p * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)]++] = src[i];
+        uint64_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != keys) memcpy(keys, src, n * sizeof(uint64_t));
+}
+
+static inline uint64_t bucket_of(uint64_t key, uint32_t bits) {
+    return bits ? key >> (64 - bits) : 0;
+}
+
+size_t idindex_sort_keys(uint64_t *keys, size_t count) {
+    if (count < 2) return count;
+    uint64_t *scratch = malloc(count * sizeof(uint64_t));
+    if (!scratch) return 0;
+    radix_sort(keys, scratch, count);
+    free(scratch);
+    size_t unique = 1;
+    for (size_t i = 1; i < count; i++) {
+        if (keys[i] != keys[unique - 1]) keys[unique++] = keys[i];
+    }
+    return unique;
+}
+
+// The directory and the keys are two ascending streams into separate regions
+// of the file, each buffered and written at its own offset
+struct IdIndexWriter {
+    int fd;
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    IdIndexHeader header;
+    uint64_t buckets;
+    uint64_t next_bucket;  // First bucket whose directory slot is not written yet
+    uint64_t last;
+    int failed;
+    off_t dir_at, keys_at;
+    size_t dir_used, keys_used;
+    uint64_t dir_buf[WRITER_BUFFER];
+    uint64_t keys_buf[WRITER_BUFFER];
+};
+
+static void flush_region(IdIndexWriter *w, uint64_t *buf, size_t *used, off_t *at) {
+    size_t len = *used * sizeof(uint64_t);
+    if (!w->failed && pwrite(w->fd, buf, len, *at) != (ssize_t)len) w->failed = 1;
+    *at += (off_t)len;
+    *used = 0;
+}
+
+static void put_dir(IdIndexWriter *w, uint64_t v) {
+    w->dir_buf[w->dir_used++] = v;
+    if (w->dir_used == WRITER_BUFFER) flush_region(w, w->dir_buf, &w->dir_used, &w->dir_at);
+}
+
+IdIndexWriter *idindex_writer_open(const char *path, uint64_t max_keys) {
+    IdIndexWriter *w = calloc(1, sizeof(IdIndexWriter));
+    if (!w) {
+        log_error("Failed to allocate identity index writer for %s", path);
+        return NULL;
+    }
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    snprintf(w->tmp, sizeof(w->tmp), "%s.tmp", path);
+    w->fd = open(w->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (w->fd == -1) {
+        log_error("Failed to create identity index %s: %s", w->tmp, strerror(errno));
+        free(w);
+        return NULL;
+    }
+    memcpy(w->header.magic, IDINDEX_MAGIC, 8);
+    while (w->header.bucket_bits < 40 && (max_keys >> w->header.bucket_bits) > IDINDEX_BUCKET_KEYS) {
+        w->header.bucket_bits++;
+    }
+    w->buckets = (uint64_t)1 << w->header.bucket_bits;
+    w->dir_at = sizeof(IdIndexHeader);
+    w->keys_at = w->dir_at + (off_t)((w->buckets + 1) * sizeof(uint64_t));
+    return w;
+}
+
+void idindex_writer_add(IdIndexWriter *w, uint64_t key) {
+    if (w->header.count > 0 && key == w->last) return;
+    uint64_t b = bucket_of(key, w->header.bucket_bits);
+    while (w->next_bucket <= b) {
+        put_dir(w, w->header.count);
+        w->next_bucket++;
+    }
+    w->keys_buf[w->keys_used++] = key;
+    if (w->keys_used == WRITER_BUFFER) flush_region(w, w->keys_buf, &w->keys_used, &w->keys_at);
+    w->last = key;
+    w->header.count++;
+}
+
+int idindex_writer_close(IdIndexWriter *w) {
+    while (w->next_bucket <= w->buckets) {
+        put_dir(w, w->header.count);
+        w->next_bucket++;
+    }
+    flush_region(w, w->dir_buf, &w->dir_used, &w->dir_at);
+    flush_region(w, w->keys_buf, &w->keys_used, &w->keys_at);
+    if (!w->failed && pwrite(w->fd, &w->header, sizeof(w->header), 0) != sizeof(w->header)) w->failed = 1;
+    if (close(w->fd) != 0) w->failed = 1;
+    pthread_mutex_lock(&publish_mutex);
+    if (!w->failed && rename(w->tmp, w->path) != 0) w->failed = 1;
+    pthread_mutex_unlock(&publish_mutex);
+    int rc = 0;
+    if (w->failed) {
+        log_error("Failed to write identity index %s: %s", w->path, strerror(errno));
+        unlink(w->tmp);
+        rc = -1;
+    }
+    free(w);
+    return rc;
+}
+
+int idindex_write(const char *path, uint64_t *keys, size_t count) {
+    size_t unique = idindex_sort_keys(keys, count);
+    if (unique == 0 && count > 0) {
+        log_error("Failed to allocate %zu index keys for %s", count, path);
+        return -1;
+    }
+    IdIndexWriter *w = idindex_writer_open(path, unique);
+    if (!w) return -1;
+    for (size_t i = 0; i < unique; i++) idindex_writer_add(w, keys[i]);
+    return idindex_writer_close(w);
+}
+
+typedef struct {
+    const uint64_t *keys;
+    uint64_t count;
+    uint64_t pos;
+} Source;
+
+static void sift_down(Source **heap, size_t n, size_t i) {
+    while (1) {
+        size_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && heap[l]->keys[heap[l]->pos] < heap[least]->keys[heap[least]->pos]) least = l;
+        if (r < n && heap[r]->keys[heap[r]->pos] < heap[least]->keys[heap[least]->pos]) least = r;
+        if (least == i) return;
+        Source *t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+int idindex_write_merged(const char *path, IdIndex *const *inputs, size_t n, const uint64_t *extra,
+                         size_t extra_count) {
+    Source *sources = calloc(n + 1, sizeof(Source));
+    Source **heap = calloc(n + 1, sizeof(Source *));
+    if (!sources || !heap) {
+        log_error("Failed to allocate identity index merge into %s", path);
+        free(sources);
+        free(heap);
+        return -1;
+    }
+    uint64_t total = extra_count;
+    for (size_t i = 0; i < n; i++) {
+        sources[i] = (Source){inputs[i]->keys, inputs[i]->count, 0};
+        total += inputs[i]->count;
+    }
+    sources[n] = (Source){extra, extra_count, 0};
+    IdIndexWriter *w = idindex_writer_open(path, total);
+    int rc = -1;
+    if (w) {
+        size_t heap_size = 0;
+        for (size_t i = 0; i <= n; i++) {
+            if (sources[i].count > 0) heap[heap_size++] = &sources[i];
+        }
+        for (size_t i = heap_size / 2; i-- > 0;) sift_down(heap, heap_size, i);
+        while (heap_size > 0) {
+            Source *s = heap[0];
+            idindex_writer_add(w, s->keys[s->pos++]);
+            if (s->pos == s->count) heap[0] = heap[--heap_size];
+            sift_down(heap, heap_size, 0);
+        }
+        rc = idindex_writer_close(w);
+    }
+    free(sources);
+    free(heap);
+    return rc;
+}
+
+IdIndex *idindex_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        log_error("Failed to open identity index %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    IdIndex *idx = calloc(1, sizeof(IdIndex));
+    if (!idx || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IdIndexHeader)) goto corrupt;
+    idx->map_size = (size_t)st.st_size;
+    idx->map = mmap(NULL, idx->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (idx->map == MAP_FAILED) {
+        idx->map = NULL;
+        goto corrupt;
+    }
+    const IdIndexHeader *h = idx->map;
+    if (memcmp(h->magic, IDINDEX_MAGIC, 8) != 0 || h->bucket_bits > 40) goto corrupt;
+    uint64_t buckets = (uint64_t)1 << h->bucket_bits;
+    if (idx->map_size != sizeof(IdIndexHeader) + (buckets + 1 + h->count) * sizeof(uint64_t)) goto corrupt;
+    const uint64_t *dir = (const uint64_t *)(h + 1);
+    if (dir[buckets] != h->count) goto corrupt;
+    idx->bucket_bits = h->bucket_bits;
+    idx->count = h->count;
+    idx->dir = dir;
+    idx->keys = idx->dir + buckets + 1;
+    idx->dev = st.st_dev;
+    idx->ino = st.st_ino;
+    snprintf(idx->path, sizeof(idx->path), "%s", path);
+    close(fd);
+    // Probes land anywhere; readahead around them only wastes page cache
+    madvise(idx->map, idx->map_size, MADV_RANDOM);
+    return idx;
+
+corrupt:
+    log_error("Identity index %s is unreadable or corrupt", path);
+    close(fd);
+    if (idx && idx->map) munmap(idx->map, idx->map_size);
+    free(idx);
+    return NULL;
+}
+
+void idindex_close(IdIndex *idx) {
+    if (!idx) return;
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+uint64_t idindex_count(const IdIndex *idx) {
+    return idx->count;
+}
+
+const uint64_t *idindex_keys(const IdIndex *idx) {
+    return idx->keys;
+}
+
+int idindex_contains(const IdIndex *idx, uint64_t key) {
+    uint64_t b = bucket_of(key, idx->bucket_bits);
+    for (uint64_t i = idx->dir[b], end = idx->dir[b + 1]; i < end; i++) {
+        if (idx->keys[i] >= key) return idx->keys[i] == key;
+    }
+    return 0;
+}
+
+// Must hold index_mutex
+static void set_unref(IdIndexSet *set) {
+    if (--set->refs > 0) return;
+    for (size_t i = 0; i < set->count; i++) {
+        if (--set->items[i]->refs == 0) idindex_close(set->items[i]);
+    }
+    free(set->items);
+    free(set);
+}
+
+static void install(IdIndexSet *set) {
+    pthread_mutex_lock(&index_mutex);
+    IdIndexSet *old = current;
+    current = set;
+    if (old) set_unref(old);
+    pthread_mutex_unlock(&index_mutex);
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t n = strlen(name), s = strlen(suffix);
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+static int set_add(IdIndexSet *set, size_t *capacity, IdIndex *idx) {
+    if (set->count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        IdIndex **items = realloc(set->items, grown * sizeof(IdIndex *));
+        if (!items) return -1;
+        set->items = items;
+        *capacity = grown;
+    }
+    idx->refs++;
+    set->items[set->count++] = idx;
+    return 0;
+}
+
+int idindex_load(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        if (errno != ENOENT) {
+            log_error("Failed to open identity index directory %s: %s", dir, strerror(errno));
+            return -1;
+        }
+        install(NULL);
+        return 0;
+    }
+
+    IdIndexSet *set = calloc(1, sizeof(IdIndexSet));
+    size_t capacity = 0;
+    uint64_t keys = 0;
+    int rc = set ? 0 : -1;
+    if (set) set->refs = 1;  // Held by `current`
+    struct dirent *e;
+    while (rc == 0 && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.' || !has_suffix(e->d_name, ".idx")) continue;
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) != 0) continue;  // Merged away since readdir
+        IdIndex *idx = idindex_open(path);
+        if (!idx || set_add(set, &capacity, idx) != 0) {
+            idindex_close(idx);
+            rc = -1;
+            break;
+        }
+        keys += idx->count;
+    }
+    closedir(d);
+    if (rc != 0) {
+        if (set) {
+            pthread_mutex_lock(&index_mutex);
+            set_unref(set);
+            pthread_mutex_unlock(&index_mutex);
+        }
+        return -1;
+    }
+    log_info("Loaded %zu identity index files with %llu keys from %s", set->count, (unsigned long long)keys, dir);
+    install(set);
+    return 0;
+}
+
+int idindex_publish(const char *path) {
+    IdIndex *idx = idindex_open(path);
+    if (!idx) return -1;
+
+    // Copy-on-write: probes in progress keep the set they pinned
+    pthread_mutex_lock(&index_mutex);
+    IdIndexSet *set = calloc(1, sizeof(IdIndexSet));
+    size_t capacity = 0;
+    int rc = set ? 0 : -1;
+    if (set) set->refs = 1;
+    for (size_t i = 0; rc == 0 && current && i < current->count; i++) {
+        if (strcmp(current->items[i]->path, path) != 0) rc = set_add(set, &capacity, current->items[i]);
+    }
+    if (rc == 0) rc = set_add(set, &capacity, idx);
+    if (rc != 0) {
+        if (set) set_unref(set);
+        if (idx->refs == 0) idindex_close(idx);
+        pthread_mutex_unlock(&index_mutex);
+        log_error("Failed to publish identity index %s", path);
+        return -1;
+    }
+    IdIndexSet *old = current;
+    current = set;
+    if (old) set_unref(old);
+    pthread_mutex_unlock(&index_mutex);
+
+    pthread_mutex_lock(&merge_mutex);
+    merge_pending = 1;
+    pthread_cond_signal(&merge_wake);
+    pthread_mutex_unlock(&merge_mutex);
+    return 0;
+}
+
+IdIndexSet *idindex_acquire(void) {
+    pthread_mutex_lock(&index_mutex);
+    IdIndexSet *set = current;
+    if (set) set->refs++;
+    pthread_mutex_unlock(&index_mutex);
+    return set;
+}
+
+void idindex_release(IdIndexSet *set) {
+    pthread_mutex_lock(&index_mutex);
+    set_unref(set);
+    pthread_mutex_unlock(&index_mutex);
+}
+
+// Each batch goes over the keys three times: prefetch directory slots, then
+// the first key of each bucket, then compare. The cache misses of the whole
+// batch overlap instead of being paid one probe after another.
+void idindex_probe(const IdIndexSet *set, const uint64_t *keys, uint8_t *found, size_t count) {
+    memset(found, 0, count);
+    if (!set) return;
+    for (size_t i = 0; i < set->count; i++) {
+        const IdIndex *idx = set->items[i];
+        for (size_t start = 0; start < count; start += PROBE_BATCH) {
+            size_t n = count - start < PROBE_BATCH ? count - start : PROBE_BATCH;
+            const uint64_t *k = keys + start;
+            for (size_t j = 0; j < n; j++) __builtin_prefetch(&idx->dir[bucket_of(k[j], idx->bucket_bits)]);
+            for (size_t j = 0; j < n; j++) __builtin_prefetch(&idx->keys[idx->dir[bucket_of(k[j], idx->bucket_bits)]]);
+            for (size_t j = 0; j < n; j++) {
+                if (!found[start + j]) found[start + j] = (uint8_t)idindex_contains(idx, k[j]);
+            }
+        }
+    }
+}
+
+static int take_seq(const char *dir, uint64_t *seq) {
+    pthread_mutex_lock(&seq_mutex);
+    if (!seq_loaded) {
+        DIR *d = opendir(dir);
+        if (!d) {
+            log_error("Failed to open identity index directory %s: %s", dir, strerror(errno));
+            pthread_mutex_unlock(&seq_mutex);
+            return -1;
+        }
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL) {
+            char *end;
+            unsigned long long v = strtoull(e->d_name, &end, 16);
+            if (end == e->d_name + 16 && strcmp(end, ".idx") == 0 && v >= next_seq) next_seq = v + 1;
+        }
+        closedir(d);
+        seq_loaded = 1;
+    }
+    *seq = next_seq++;
+    pthread_mutex_unlock(&seq_mutex);
+    return 0;
+}
+
+static int compare_by_count(const void *a, const void *b) {
+    const IdIndex *x = *(IdIndex *const *)a, *y = *(IdIndex *const *)b;
+    return x->count < y->count ? -1 : x->count > y->count;
+}
+
+static int same_file(const IdIndex *a, const IdIndex *b) {
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+// Writes the merged file, then swaps it into the current set for the inputs
+// and unlinks them, unless a task has rewritten one since it was published
+static int merge_indexes(const char *dir, IdIndex *const *inputs, size_t n) {
+    uint64_t seq;
+    char path[PATH_MAX];
+    if (take_seq(dir, &seq) != 0) return -1;
+    snprintf(path, sizeof(path), "%s/%016llx.idx", dir, (unsigned long long)seq);
+    if (idindex_write_merged(path, inputs, n, NULL, 0) != 0) return -1;
+    IdIndex *merged = idindex_open(path);
+    if (!merged) return -1;
+
+    pthread_mutex_lock(&publish_mutex);
+    size_t kept = 0;
+    for (size_t k = 0; k < n; k++) {
+        struct stat st;
+        if (stat(inputs[k]->path, &st) == 0 && st.st_dev == inputs[k]->dev && st.st_ino == inputs[k]->ino) {
+            unlink(inputs[k]->path);
+        } else {
+            kept++;
+        }
+    }
+    pthread_mutex_lock(&index_mutex);
+    IdIndexSet *set = calloc(1, sizeof(IdIndexSet));
+    size_t capacity = 0;
+    int rc = set ? 0 : -1;
+    if (set) set->refs = 1;
+    for (size_t i = 0; rc == 0 && current && i < current->count; i++) {
+        int replaced = 0;
+        for (size_t k = 0; k < n && !replaced; k++) replaced = same_file(current->items[i], inputs[k]);
+        if (!replaced) rc = set_add(set, &capacity, current->items[i]);
+    }
+    if (rc == 0) rc = set_add(set, &capacity, merged);
+    if (rc == 0) {
+        IdIndexSet *old = current;
+        current = set;
+        if (old) set_unref(old);
+    } else {
+        if (set) set_unref(set);
+        if (merged->refs == 0) idindex_close(merged);
+    }
+    pthread_mutex_unlock(&index_mutex);
+    pthread_mutex_unlock(&publish_mutex);
+
+    if (rc != 0) {
+        // The inputs' keys stay probed through the set they are still in
+        log_error("Failed to publish merged identity index %s", path);
+        return -1;
+    }
+    log_info("Merged %zu identity index files into %s (%llu keys)", n, path, (unsigned long long)merged->count);
+    if (kept > 0) log_info("Kept %zu merged identity index files rewritten meanwhile", kept);
+    return 0;
+}
+
+int idindex_merge(const char *dir, int factor) {
+    int merges = 0;
+    size_t dir_len = strlen(dir);
+    while (factor >= 2) {
+        IdIndexSet *set = idindex_acquire();
+        IdIndex **inputs = set ? malloc((set->count + 1) * sizeof(IdIndex *)) : NULL;
+        size_t n = 0;
+        for (size_t i = 0; inputs && i < set->count; i++) {
+            // Files loaded from a record_dir changed since startup are left alone
+            const char *path = set->items[i]->path;
+            if (strncmp(path, dir, dir_len) == 0 && path[dir_len] == '/') inputs[n++] = set->items[i];
+        }
+        int rc = 0;
+        if (n >= (size_t)factor) {
+            // Smallest first: each key is rewritten about log(files) times
+            qsort(inputs, n, sizeof(IdIndex *), compare_by_count);
+            rc = merge_indexes(dir, inputs, (size_t)factor);
+        }
+        free(inputs);
+        if (set) idindex_release(set);
+        if (rc != 0) return -1;
+        if (n < (size_t)factor) return merges;
+        merges++;
+    }
+    return merges;
+}
+
+void idindex_serve_merges(const char *dir, int factor) {
+    idindex_merge(dir, factor);  // Files left by the previous run
+    pthread_mutex_lock(&merge_mutex);
+    while (1) {
+        while (!merge_pending) pthread_cond_wait(&merge_wake, &merge_mutex);
+        merge_pending = 0;
+        pthread_mutex_unlock(&merge_mutex);
+        idindex_merge(dir, factor);
+        pthread_mutex_lock(&merge_mutex);
+    }
+}
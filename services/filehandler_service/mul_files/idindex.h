@@ -0,0 +1,88 @@
+#ifndef IDINDEX_H
+#define IDINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IDINDEX_MAGIC "SGIDX001"
+#define IDINDEX_SEED 0x5349444eULL  // murmur3 seed of identity keys
+#define IDINDEX_BUCKET_KEYS 4  // Target keys per directory bucket
+#define IDINDEX_MAX_IDENTITY 512
+
+// Immutable lookup file over normalized identities, mapped read-only:
+//
+//   header   magic, u32 bucket_bits, u32 reserved, u64 count
+//   dir      u64[(1 << bucket_bits) + 1]: first key of each bucket
+//   keys     u64[count], sorted and unique
+//
+// A key is the low 64 bits of murmur3 over the normalized identity, and a
+// bucket holds the keys sharing its top bucket_bits bits, so a probe reads
+// one directory slot and a few adjacent keys however large the file is. Two
+// different identities share a key with probability about count / 2^64.
+typedef struct {
+    char magic[8];
+    uint32_t bucket_bits;
+    uint32_t reserved;
+    uint64_t count;
+} IdIndexHeader;
+
+typedef struct IdIndex IdIndex;
+
+// Lowercase and trim identity into out (IDINDEX_MAX_IDENTITY bytes); phone
+// numbers keep only their digits. Returns the length, 0 if nothing is left.
+size_t idindex_normalize(const char *identity, size_t len, char *out);
+// Key of a normalized identity; returns 0 if it normalizes to nothing
+int idindex_key(const char *identity, size_t len, uint64_t *key);
+
+// Sort keys in place and drop duplicates; returns how many are left, 0 on
+// allocation failure
+size_t idindex_sort_keys(uint64_t *keys, size_t count);
+
+// Streaming writer; keys must be added in ascending order (repeats are
+// skipped) and at most max_keys of them, which sizes the directory. The file
+// is written as <path>.tmp and renamed on close. Returns -1 on error.
+typedef struct IdIndexWriter IdIndexWriter;
+IdIndexWriter *idindex_writer_open(const char *path, uint64_t max_keys);
+void idindex_writer_add(IdIndexWriter *w, uint64_t key);
+int idindex_writer_close(IdIndexWriter *w);
+
+// Sort and deduplicate keys in place, then write them as an index file
+int idindex_write(const char *path, uint64_t *keys, size_t count);
+
+IdIndex *idindex_open(const char *path);
+void idindex_close(IdIndex *idx);
+uint64_t idindex_count(const IdIndex *idx);
+// Every key of the index in sorted order (count of them)
+const uint64_t *idindex_keys(const IdIndex *idx);
+int idindex_contains(const IdIndex *idx, uint64_t key);
+// Write the union of n indexes and of extra (sorted and unique) as one index file
+int idindex_write_merged(const char *path, IdIndex *const *inputs, size_t n, const uint64_t *extra,
+                         size_t extra_count);
+
+// The set of index files the lookup server probes, swapped as a whole
+typedef struct IdIndexSet IdIndexSet;
+
+// Map every *.idx file in dir as the current set. A missing directory clears
+// it; on an unreadable file the current set is kept.
+int idindex_load(const char *dir);
+// Add (or replace) one freshly written index file in the current set and
+// wake the merger
+int idindex_publish(const char *path);
+// Pin the current set (NULL when nothing is loaded); pair with a release
+IdIndexSet *idindex_acquire(void);
+void idindex_release(IdIndexSet *set);
+// found[i] = 1 if keys[i] is in any index of the set. Batches overlap their
+// memory accesses, so many keys per call are cheaper than one at a time.
+void idindex_probe(const IdIndexSet *set, const uint64_t *keys, uint8_t *found, size_t count);
+
+// Merge the `factor` smallest published index files under dir into one, named
+// by a hex sequence number, while the current set has at least that many;
+// the merged file replaces them in the set and on disk. Probes then touch
+// fewer than `factor` files however many tasks wrote one. Returns the number
+// of merges done, -1 on error.
+int idindex_merge(const char *dir, int factor);
+// Merger loop for a background thread: merges whenever a task has published
+// a new index file. Does not return.
+void idindex_serve_merges(const char *dir, int factor);
+
+#endif
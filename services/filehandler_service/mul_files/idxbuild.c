@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filehandler.h"
+#include "idindex.h"
+#include "record.h"
+
+// Builds one identity index from .idx files and .rec record files offline,
+// e.g. to index .rec files written before identity_index was on (the service
+// merges the files its tasks write in the background):
+//
+//   idxbuild all.idx extracted/records/*.idx
+//
+// .idx inputs are already sorted and are merged straight from their mappings;
+// the keys of .rec inputs are collected and sorted in memory first.
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t n = strlen(name), s = strlen(suffix);
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+// Append the identity keys of every record in path to *keys
+static int read_record_keys(const char *path, uint64_t **keys, size_t *count, size_t *cap) {
+    FILE *f = fopen(path, "rb");
+    char magic[6];
+    if (!f || fread(magic, 1, 6, f) != 6 || memcmp(magic, RECORD_FILE_MAGIC, 6) != 0) {
+        log_error("Failed to open record file %s: %s", path, f ? "bad header" : strerror(errno));
+        if (f) fclose(f);
+        return -1;
+    }
+    static char field[4 * 65535];
+    uint8_t lens[8];
+    while (fread(lens, 1, 8, f) == 8) {
+        size_t len[4], total = 0;
+        for (int i = 0; i < 4; i++) total += len[i] = (size_t)(lens[2 * i] | (lens[2 * i + 1] << 8));
+        if (fread(field, 1, total, f) != total) {
+            log_warning("Truncated record at the end of %s", path);
+            break;
+        }
+        uint64_t key;
+        if (!idindex_key(field + len[0], len[1], &key)) continue;
+        if (*count == *cap) {
+            size_t grown = *cap ? *cap * 2 : 1 << 20;
+            uint64_t *more = realloc(*keys, grown * sizeof(uint64_t));
+            if (!more) {
+                log_error("Failed to allocate identity keys for %s", path);
+                fclose(f);
+                return -1;
+            }
+            *keys = more;
+            *cap = grown;
+        }
+        (*keys)[(*count)++] = key;
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <out.idx> <in.idx|in.rec>...\n", argv[0]);
+        return 2;
+    }
+    int inputs = argc - 2;
+    IdIndex **indexes = calloc(inputs, sizeof(IdIndex *));
+    if (!indexes) {
+        log_error("Out of memory");
+        return 1;
+    }
+
+    uint64_t *rec_keys = NULL;
+    size_t rec_count = 0, rec_cap = 0, unique = 0;
+    int n = 0, rc = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < inputs && rc == 0; i++) {
+        const char *path = argv[i + 2];
+        if (has_suffix(path, ".rec")) {
+            if (read_record_keys(path, &rec_keys, &rec_count, &rec_cap) != 0) rc = 1;
+            continue;
+        }
+        indexes[n] = idindex_open(path);
+        if (!indexes[n]) {
+            rc = 1;
+            break;
+        }
+        total += idindex_count(indexes[n]);
+        n++;
+    }
+    if (rc == 0 && rec_count > 0) {
+        unique = idindex_sort_keys(rec_keys, rec_count);
+        if (unique == 0) {
+            log_error("Out of memory sorting %zu identity keys", rec_count);
+            rc = 1;
+        }
+        total += unique;
+    }
+    if (rc == 0 && idindex_write_merged(argv[1], indexes, (size_t)n, rec_keys, unique) != 0) rc = 1;
+
+    for (int i = 0; i < n; i++) idindex_close(indexes[i]);
+    free(indexes);
+    free(rec_keys);
+    if (rc == 0) log_info("Merged %llu keys from %d files into %s", (unsigned long long)total, inputs, argv[1]);
+    return rc;
+}
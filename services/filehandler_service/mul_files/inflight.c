@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "filehandler.h"
+#include "inflight.h"
+
+typedef struct InflightEntry {
+    char *path;
+    uint64_t content_key;  // 0 until the worker has fingerprinted the file
+    struct InflightEntry *primary;  // Task actually doing the work; NULL when this entry is it
+    InflightWaiter *waiters;
+    struct InflightEntry *next;
+} InflightEntry;
+
+// The set holds at most a few dozen entries (queue depth plus unacked deliveries),
+// so a mutex-protected list beats anything fancier
+static pthread_mutex_t inflight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static InflightEntry *inflight_head = NULL;
+
+static InflightEntry *find_path(const char *path) {
+    for (InflightEntry *e = inflight_head; e; e = e->next) {
+        if (strcmp(e->path, path) == 0) return e;
+    }
+    return NULL;
+}
+
+static int add_waiter(InflightEntry *entry, amqp_channel_t channel, uint64_t delivery_tag, const char *path) {
+    InflightWaiter *w = malloc(sizeof(InflightWaiter));
+    if (!w) return -1;
+    w->file_path = strdup(path);
+    if (!w->file_path) {
+        free(w);
+        return -1;
+    }
+    w->channel = channel;
+    w->delivery_tag = delivery_tag;
+    w->next = entry->waiters;
+    entry->waiters = w;
+    return 0;
+}
+
+int inflight_begin(const char *path, amqp_channel_t channel, uint64_t delivery_tag) {
+    pthread_mutex_lock(&inflight_mutex);
+    InflightEntry *e = find_path(path);
+    if (e) {
+        InflightEntry *owner = e->primary ? e->primary : e;
+        int rc = add_waiter(owner, channel, delivery_tag, path) == 0 ? 1 : -1;
+        pthread_mutex_unlock(&inflight_mutex);
+        if (rc == 1) log_info("%s is already in progress; attached duplicate request", path);
+        return rc;
+    }
+
+    e = calloc(1, sizeof(InflightEntry));
+    if (!e || !(e->path = strdup(path))) {
+        free(e);
+        pthread_mutex_unlock(&inflight_mutex);
+        log_error("Failed to allocate in-flight entry for %s", path);
+        return -1;
+    }
+    e->next = inflight_head;
+    inflight_head = e;
+    pthread_mutex_unlock(&inflight_mutex);
+    return 0;
+}
+
+// Compare two files byte for byte; only runs when content keys collide
+static int files_identical(const char *a, const char *b) {
+    int fa = open(a, O_RDONLY | O_CLOEXEC);
+    int fb = open(b, O_RDONLY | O_CLOEXEC);
+    int same = fa != -1 && fb != -1;
+    char *ba = malloc(FINGERPRINT_SAMPLE), *bb = malloc(FINGERPRINT_SAMPLE);
+    if (!ba || !bb) same = 0;
+
+    while (same) {
+        ssize_t na = read(fa, ba, FINGERPRINT_SAMPLE);
+        ssize_t nb = read(fb, bb, FINGERPRINT_SAMPLE);
+        if (na != nb || na < 0 || memcmp(ba, bb, na) != 0) same = 0;
+        if (na <= 0) break;
+    }
+
+    free(ba);
+    free(bb);
+    if (fa != -1) close(fa);
+    if (fb != -1) close(fb);
+    return same;
+}
+
+int inflight_bind_content(const char *path, uint64_t content_key, amqp_channel_t channel, uint64_t delivery_tag) {
+    char *candidate = NULL;
+
+    pthread_mutex_lock(&inflight_mutex);
+    InflightEntry *self = find_path(path);
+    if (!self) {
+        pthread_mutex_unlock(&inflight_mutex);
+        return 0;
+    }
+    self->content_key = content_key;
+    for (InflightEntry *e = inflight_head; e; e = e->next) {
+        if (e != self && !e->primary && e->content_key == content_key) {
+            candidate = strdup(e->path);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&inflight_mutex);
+
+    if (!candidate) return 0;
+    int identical = files_identical(path, candidate);
+
+    // Re-resolve under the lock: the candidate may have finished while we compared
+    int attached = 0;
+    pthread_mutex_lock(&inflight_mutex);
+    InflightEntry *primary = identical ? find_path(candidate) : NULL;
+    self = find_path(path);
+    if (primary && self && !primary->primary && add_waiter(primary, channel, delivery_tag, path) == 0) {
+        // Move requests already parked on this path over to the primary
+        InflightWaiter **tail = &primary->waiters;
+        while (*tail) tail = &(*tail)->next;
+        *tail = self->waiters;
+        self->waiters = NULL;
+        self->primary = primary;
+        attached = 1;
+    }
+    pthread_mutex_unlock(&inflight_mutex);
+
+    if (attached) log_info("%s has the same content as in-progress %s; attached", path, candidate);
+    free(candidate);
+    return attached;
+}
+
+InflightWaiter *inflight_finish(const char *path) {
+    InflightWaiter *waiters = NULL;
+
+    pthread_mutex_lock(&inflight_mutex);
+    InflightEntry *self = find_path(path);
+    InflightEntry **link = &inflight_head;
+    while (*link) {
+        InflightEntry *e = *link;
+        // Drop the entry itself and every alias that was attached to it by content
+        if (self && (e == self || e->primary == self)) {
+            *link = e->next;
+            if (e == self) waiters = e->waiters;
+            free(e->path);
+            free(e);
+            continue;
+        }
+        link = &e->next;
+    }
+    pthread_mutex_unlock(&inflight_mutex);
+    return waiters;
+}
+
+// 64-bit multiply-xorshift mix over 8-byte words
+static uint64_t mix64(uint64_t h, const unsigned char *data, size_t len) {
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, data, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        h = (h ^ *data++) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+int fingerprint_file(const char *path, uint64_t *key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    unsigned char *buffer = malloc(FINGERPRINT_SAMPLE);
+    if (fstat(fd, &st) == -1 || !buffer) {
+        free(buffer);
+        close(fd);
+        return -1;
+    }
+
+    uint64_t h = mix64(0xCBF29CE484222325ULL, (const unsigned char *)&st.st_size, sizeof(st.st_size));
+    ssize_t n = pread(fd, buffer, FINGERPRINT_SAMPLE, 0);
+    if (n > 0) h = mix64(h, buffer, n);
+    if (st.st_size > FINGERPRINT_SAMPLE) {
+        off_t tail = st.st_size - FINGERPRINT_SAMPLE;
+        if (tail < FINGERPRINT_SAMPLE) tail = FINGERPRINT_SAMPLE;
+        n = pread(fd, buffer, FINGERPRINT_SAMPLE, tail);
+        if (n > 0) h = mix64(h, buffer, n);
+    }
+
+    free(buffer);
+    close(fd);
+    *key = h ? h : 1;  // 0 means "not fingerprinted yet"
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <stdint.h>
+#include <rabbitmq-c/amqp.h>
+
+#define FINGERPRINT_SAMPLE 65536  // Bytes hashed from each end of a file for its content key
+
+// A duplicate request parked on an in-flight task, settled when that task finishes
+typedef struct InflightWaiter {
+    amqp_channel_t channel;  // 0 for requests that did not come from RabbitMQ
+    uint64_t delivery_tag;
+    char *file_path;  // As requested: the task's own path, or an alias attached by content
+    struct InflightWaiter *next;
+} InflightWaiter;
+
+// Start tracking path. Returns 1 if the path is already in flight (the request was
+// attached to it and must not be queued), 0 if the caller owns a new entry, -1 on error.
+int inflight_begin(const char *path, amqp_channel_t channel, uint64_t delivery_tag);
+
+// Record the content key of an in-flight path. If another in-flight task holds
+// byte-identical content, path and its waiters (including the caller's own
+// delivery) are attached to that task and 1 is returned; the caller must skip it.
+int inflight_bind_content(const char *path, uint64_t content_key, amqp_channel_t channel, uint64_t delivery_tag);
+
+// Stop tracking path and return the attached waiters, to be settled like the task itself
+InflightWaiter *inflight_finish(const char *path);
+
+// Cheap content key: file size plus the first and last FINGERPRINT_SAMPLE bytes
+int fingerprint_file(const char *path, uint64_t *key);
+
+#endif
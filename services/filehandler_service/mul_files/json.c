@@ -0,0 +1,32 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "json.h"
+
+void json_append_string(char *out, size_t size, size_t *used, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    size_t n = *used;
+    if (n < size) out[n++] = '"';
+    for (const unsigned char *c = (const unsigned char *)s; c < (const unsigned char *)s + len && n + 7 < size; c++) {
+        if (*c == '"' || *c == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)*c;
+        } else if (*c < 0x20 || *c == 0x7f) {
+            n += snprintf(out + n, size - n, "\\u00%c%c", hex[*c >> 4], hex[*c & 15]);
+        } else {
+            out[n++] = (char)*c;
+        }
+    }
+    if (n < size) out[n++] = '"';
+    *used = n;
+}
+
+void json_appendf(char *out, size_t size, size_t *used, const char *fmt, ...) {
+    if (*used + 1 >= size) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out + *used, size - *used, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    *used = (size_t)n < size - *used ? *used + (size_t)n : size - 1;
+}
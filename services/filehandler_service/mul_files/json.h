@@ -0,0 +1,12 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+
+// Append s[0..len) to out as a quoted JSON string, advancing *used. Output that
+// would not fit in size bytes is cut short (the closing quote is still added when possible).
+void json_append_string(char *out, size_t size, size_t *used, const char *s, size_t len);
+// snprintf at out + *used; *used never moves past the last byte of out
+void json_appendf(char *out, size_t size, size_t *used, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+#endif
@@ -0,0 +1,347 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "hash.h"
+#include "linededup.h"
+
+#define LINE_SEED 0x4c494e4544555031ULL
+
+typedef struct {
+    uint64_t fp;
+    uint64_t seq;  // Line number in the file
+} LineRef;
+
+typedef struct {
+    FILE *f;
+    LineRef head;
+} RunReader;
+
+static uint64_t line_fp(const char *line, size_t len) {
+    uint64_t h[2];
+    murmur3_128(line, len, LINE_SEED, h);
+    return h[0] ? h[0] : 1;
+}
+
+LineDedup *linededup_open(size_t memory_bytes) {
+    LineDedup *d = calloc(1, sizeof(LineDedup));
+    if (!d) return NULL;
+    d->max_slots = LINEDEDUP_INITIAL_SLOTS;
+    while (d->max_slots * 2 * sizeof(uint64_t) <= memory_bytes) d->max_slots *= 2;
+    d->slot_count = LINEDEDUP_INITIAL_SLOTS;
+    d->slots = calloc(d->slot_count, sizeof(uint64_t));
+    if (!d->slots) {
+        log_error("Failed to allocate line dedup table");
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+void linededup_close(LineDedup *d) {
+    if (!d) return;
+    free(d->slots);
+    free(d->line);
+    free(d);
+}
+
+void linededup_begin(LineDedup *d, FILE *out, int reset) {
+    if (reset && d->used > 0) {
+        // Back to a small table, so a huge entry does not make every later one clear it
+        uint64_t *slots = d->slot_count > LINEDEDUP_INITIAL_SLOTS ? calloc(LINEDEDUP_INITIAL_SLOTS, sizeof(uint64_t))
+                                                                  : NULL;
+        if (slots) {
+            free(d->slots);
+            d->slots = slots;
+            d->slot_count = LINEDEDUP_INITIAL_SLOTS;
+        } else {
+            memset(d->slots, 0, d->slot_count * sizeof(uint64_t));
+        }
+        d->used = 0;
+        d->overflowed = 0;
+    }
+    d->out = out;
+    d->sniffed = 0;
+    d->text = 0;
+    d->line_len = 0;
+    d->passthrough = 0;
+    d->lines = 0;
+    d->dropped = 0;
+}
+
+static int table_grow(LineDedup *d) {
+    size_t count = d->slot_count * 2;
+    uint64_t *slots = calloc(count, sizeof(uint64_t));
+    if (!slots) return -1;
+    for (size_t i = 0; i < d->slot_count; i++) {
+        uint64_t fp = d->slots[i];
+        if (fp == 0) continue;
+        size_t j = fp & (count - 1);
+        while (slots[j] != 0) j = (j + 1) & (count - 1);
+        slots[j] = fp;
+    }
+    free(d->slots);
+    d->slots = slots;
+    d->slot_count = count;
+    return 0;
+}
+
+// Whether a line is new; new lines are remembered while the table has room
+static int line_is_new(LineDedup *d, const char *line, size_t len) {
+    uint64_t fp = line_fp(line, len);
+    size_t mask = d->slot_count - 1, i = fp & mask;
+    d->lines++;
+    for (; d->slots[i] != 0; i = (i + 1) & mask) {
+        if (d->slots[i] == fp) {
+            d->dropped++;
+            return 0;
+        }
+    }
+    if ((d->used + 1) * 100 > d->slot_count * LINEDEDUP_MAX_LOAD_PCT) {
+        if (d->slot_count >= d->max_slots || table_grow(d) != 0) {
+            d->overflowed = 1;
+            return 1;
+        }
+        mask = d->slot_count - 1;
+        i = fp & mask;
+        while (d->slots[i] != 0) i = (i + 1) & mask;
+    }
+    d->slots[i] = fp;
+    d->used++;
+    return 1;
+}
+
+static int put(LineDedup *d, const char *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, d->out) != len) return -1;
+    return 0;
+}
+
+// Append to the line carried over from earlier blocks
+static int carry(LineDedup *d, const char *data, size_t len) {
+    if (d->line_len + len > LINEDEDUP_MAX_LINE) {
+        // Too long to buffer: write what we have and let the rest of the line through
+        if (put(d, d->line, d->line_len) != 0 || put(d, data, len) != 0) return -1;
+        d->line_len = 0;
+        d->passthrough = 1;
+        return 0;
+    }
+    if (d->line_len + len > d->line_cap) {
+        size_t cap = d->line_cap ? d->line_cap : 4096;
+        while (cap < d->line_len + len) cap *= 2;
+        char *line = realloc(d->line, cap);
+        if (!line) return -1;
+        d->line = line;
+        d->line_cap = cap;
+    }
+    memcpy(d->line + d->line_len, data, len);
+    d->line_len += len;
+    return 0;
+}
+
+int linededup_write(LineDedup *d, const void *data, size_t len) {
+    const char *p = data, *end = p + len;
+    if (!d->sniffed && len > 0) {
+        d->sniffed = 1;
+        d->text = memchr(p, '\0', len < LINEDEDUP_SNIFF_BYTES ? len : LINEDEDUP_SNIFF_BYTES) == NULL;
+    }
+    if (!d->text) return put(d, p, len);
+
+    // Runs of new lines are written with one call; a duplicate ends the run
+    const char *run = p;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) {
+            if (put(d, run, (size_t)(p - run)) != 0) return -1;
+            if (d->passthrough) return put(d, p, (size_t)(end - p));
+            return carry(d, p, (size_t)(end - p));
+        }
+        if (d->passthrough) {
+            d->passthrough = 0;
+            d->lines++;
+        } else if (d->line_len > 0) {
+            // The line started in an earlier block
+            if (carry(d, p, (size_t)(nl - p)) != 0) return -1;
+            if (d->passthrough) {
+                // carry wrote the line out; its newline starts the next run
+                d->passthrough = 0;
+                d->lines++;
+                run = nl;
+            } else {
+                if (line_is_new(d, d->line, d->line_len)) {
+                    if (put(d, d->line, d->line_len) != 0) return -1;
+                    run = nl;
+                } else {
+                    run = nl + 1;
+                }
+                d->line_len = 0;
+            }
+        } else if (!line_is_new(d, p, (size_t)(nl - p))) {
+            if (put(d, run, (size_t)(p - run)) != 0) return -1;
+            run = nl + 1;
+        }
+        p = nl + 1;
+    }
+    return put(d, run, (size_t)(end - run));
+}
+
+int linededup_end(LineDedup *d) {
+    int rc = 0;
+    if (d->text && d->line_len > 0 && line_is_new(d, d->line, d->line_len)) rc = put(d, d->line, d->line_len);
+    if (d->passthrough) d->lines++;
+    d->line_len = 0;
+    d->passthrough = 0;
+    return rc;
+}
+
+static int by_fp_then_seq(const void *a, const void *b) {
+    const LineRef *x = a, *y = b;
+    if (x->fp != y->fp) return x->fp < y->fp ? -1 : 1;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int spill_run(LineRef *refs, size_t count, const char *path, FILE ***runs, size_t *run_count) {
+    qsort(refs, count, sizeof(LineRef), by_fp_then_seq);
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.runXXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        log_error("Failed to create line dedup run next to %s: %s", path, strerror(errno));
+        return -1;
+    }
+    unlink(tmp);
+    FILE *f = fdopen(fd, "w+b");
+    FILE **grown = f ? realloc(*runs, (*run_count + 1) * sizeof(FILE *)) : NULL;
+    if (!grown || fwrite(refs, sizeof(LineRef), count, f) != count || fflush(f) != 0) {
+        log_error("Failed to write line dedup run for %s: %s", path, strerror(errno));
+        if (f) fclose(f);
+        else close(fd);
+        if (grown) *runs = grown;
+        return -1;
+    }
+    *runs = grown;
+    (*runs)[(*run_count)++] = f;
+    rewind(f);
+    return 0;
+}
+
+static void heap_sift(RunReader *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && by_fp_then_seq(&heap[l].head, &heap[least].head) < 0) least = l;
+        if (r < n && by_fp_then_seq(&heap[r].head, &heap[least].head) < 0) least = r;
+        if (least == i) return;
+        RunReader t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+// Merge the runs in (fingerprint, line) order; every line after the first of
+// its fingerprint is marked in drop
+static int merge_runs(FILE **runs, size_t run_count, uint8_t *drop) {
+    RunReader *heap = malloc(run_count * sizeof(RunReader));
+    if (!heap) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < run_count; i++) {
+        heap[n].f = runs[i];
+        if (fread(&heap[n].head, sizeof(LineRef), 1, runs[i]) == 1) n++;
+    }
+    for (size_t i = n; i-- > 0;) heap_sift(heap, n, i);
+    uint64_t last_fp = 0;
+    while (n > 0) {
+        LineRef r = heap[0].head;
+        if (r.fp == last_fp) drop[r.seq >> 3] |= (uint8_t)(1 << (r.seq & 7));
+        last_fp = r.fp;
+        if (fread(&heap[0].head, sizeof(LineRef), 1, heap[0].f) != 1) heap[0] = heap[--n];
+        heap_sift(heap, n, 0);
+    }
+    free(heap);
+    return 0;
+}
+
+int linededup_compact(const char *path, size_t memory_bytes) {
+    size_t cap = memory_bytes / sizeof(LineRef);
+    if (cap < 1024) cap = 1024;
+    LineRef *refs = malloc(cap * sizeof(LineRef));
+    FILE *in = fopen(path, "rb");
+    if (!refs || !in) {
+        log_error("Failed to open %s for line dedup: %s", path, strerror(errno));
+        free(refs);
+        if (in) fclose(in);
+        return -1;
+    }
+
+    // Pass 1: fingerprint every line, spilling sorted runs when the buffer fills
+    FILE **runs = NULL;
+    size_t run_count = 0, count = 0;
+    uint64_t seq = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    int rc = 0;
+    while ((n = getline(&line, &line_cap, in)) > 0) {
+        size_t len = (size_t)n - (line[n - 1] == '\n');
+        refs[count].fp = line_fp(line, len);
+        refs[count].seq = seq++;
+        if (++count == cap) {
+            if (spill_run(refs, count, path, &runs, &run_count) != 0) {
+                rc = -1;
+                break;
+            }
+            count = 0;
+        }
+    }
+
+    // Pass 2: mark later copies
+    uint8_t *drop = rc == 0 ? calloc(seq / 8 + 1, 1) : NULL;
+    if (rc == 0 && !drop) {
+        log_error("Failed to allocate line dedup bitmap for %s", path);
+        rc = -1;
+    }
+    if (rc == 0 && run_count == 0) {
+        qsort(refs, count, sizeof(LineRef), by_fp_then_seq);
+        for (size_t i = 1; i < count; i++) {
+            if (refs[i].fp == refs[i - 1].fp) drop[refs[i].seq >> 3] |= (uint8_t)(1 << (refs[i].seq & 7));
+        }
+    } else if (rc == 0) {
+        if ((count > 0 && spill_run(refs, count, path, &runs, &run_count) != 0) ||
+            merge_runs(runs, run_count, drop) != 0) {
+            rc = -1;
+        }
+    }
+    free(refs);
+    for (size_t i = 0; i < run_count; i++) fclose(runs[i]);
+    free(runs);
+
+    // Pass 3: rewrite without them
+    uint64_t dropped = 0;
+    if (rc == 0) {
+        char tmp[PATH_MAX + 16];
+        snprintf(tmp, sizeof(tmp), "%s.dedup", path);
+        FILE *out = fopen(tmp, "wb");
+        int ok = out != NULL;
+        rewind(in);
+        seq = 0;
+        while (ok && (n = getline(&line, &line_cap, in)) > 0) {
+            if (drop[seq >> 3] & (1 << (seq & 7))) dropped++;
+            else if (fwrite(line, 1, (size_t)n, out) != (size_t)n) ok = 0;
+            seq++;
+        }
+        if (out && fclose(out) != 0) ok = 0;
+        if (!ok || ferror(in) || rename(tmp, path) != 0) {
+            log_error("Failed to rewrite %s without duplicate lines: %s", path, strerror(errno));
+            unlink(tmp);
+            rc = -1;
+        }
+    }
+    if (rc == 0) log_info("Removed %llu more duplicate lines from %s", (unsigned long long)dropped, path);
+    free(drop);
+    free(line);
+    fclose(in);
+    return rc;
+}
@@ -0,0 +1,47 @@
+#ifndef LINEDEDUP_H
+#define LINEDEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LINEDEDUP_INITIAL_SLOTS (1 << 16)
+#define LINEDEDUP_MAX_LOAD_PCT 75
+#define LINEDEDUP_MAX_LINE (1 << 20)  // Longer lines are written without being deduplicated
+#define LINEDEDUP_SNIFF_BYTES 512  // Entries with a NUL byte in this prefix are written untouched
+
+// Write-path filter that drops exact duplicate lines of text entries before
+// they reach disk. Seen lines are kept as 64-bit fingerprints in an
+// open-addressing table that grows up to memory_bytes; once it is full, new
+// lines are still written and the entry is flagged so linededup_compact can
+// finish the job on the written file.
+typedef struct {
+    uint64_t *slots;  // 0 marks an empty slot
+    size_t slot_count, used;
+    size_t max_slots;  // From the memory budget
+    FILE *out;
+    int sniffed;
+    int text;
+    int overflowed;  // The table filled up while lines were still new
+    char *line;  // Line continuing from the previous block
+    size_t line_len, line_cap;
+    int passthrough;  // Current line outgrew LINEDEDUP_MAX_LINE and is being written as-is
+    uint64_t lines, dropped;  // Current entry
+} LineDedup;
+
+LineDedup *linededup_open(size_t memory_bytes);
+void linededup_close(LineDedup *d);
+
+// Start an entry written to out; reset forgets the lines of earlier entries
+void linededup_begin(LineDedup *d, FILE *out, int reset);
+// Write data minus lines already seen; returns -1 on a write error
+int linededup_write(LineDedup *d, const void *data, size_t len);
+// Settle the last line when it has no newline
+int linededup_end(LineDedup *d);
+
+// Exact external pass over a written file: later copies of a line are removed
+// in place, keeping first occurrences in order. Sorted runs of memory_bytes
+// spill next to the file.
+int linededup_compact(const char *path, size_t memory_bytes);
+
+#endif
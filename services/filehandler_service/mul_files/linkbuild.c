@@ -0,0 +1,73 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "linktab.h"
+
+// Builds the sorted link table search_service maps, from seed lists and
+// link lists harvested from dumps:
+//
+//   linkbuild links.tab resources/darkweb_links.csv resources/telegram_links.txt
+//
+// Inputs of any layout are scanned for web, onion and Telegram links, which
+// are normalized and deduplicated across all of them.
+
+static long long scan_file(LinkSet *set, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_error("Failed to map %s: %s", path, strerror(errno));
+        return -1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    long long found = linkset_scan(set, map, (size_t)st.st_size);
+    munmap(map, (size_t)st.st_size);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <out.tab> <links.csv|links.txt>...\n", argv[0]);
+        return 2;
+    }
+    LinkSet *set = linkset_open();
+    if (!set) {
+        log_error("Out of memory");
+        return 1;
+    }
+
+    long long total = 0;
+    int rc = 0;
+    for (int i = 2; i < argc && rc == 0; i++) {
+        long long found = scan_file(set, argv[i]);
+        if (found < 0) rc = 1;
+        else total += found;
+    }
+    if (rc == 0 && linkset_write(set, argv[1]) != 0) rc = 1;
+    if (rc == 0) {
+        uint64_t onion = linkset_count(set, LINK_ONION), telegram = linkset_count(set, LINK_TELEGRAM);
+        uint64_t web = linkset_count(set, LINK_WEB);
+        log_info("Wrote %llu unique links (%llu onion, %llu Telegram, %llu web) of %lld found in %d files to %s",
+                 (unsigned long long)(onion + telegram + web), (unsigned long long)onion,
+                 (unsigned long long)telegram, (unsigned long long)web, total, argc - 2, argv[1]);
+    }
+    linkset_close(set);
+    return rc;
+}
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "hash.h"
+#include "linktab.h"
+
+#define LINKSET_SEED 0x4c494e4bULL
+#define LINKSET_INITIAL_SLOTS (1 << 16)
+#define LINKSET_MAX_LOAD_PCT 75
+#define LINK_BATCH 32  // Links whose hash slot loads are in flight together
+#define MAX_HOST_LEN 253
+#define RADIX_BITS 16
+#define RADIX_PASSES 4
+#define WRITE_BUFFER (1 << 20)
+
+// Lowercased host characters; 0 for bytes a host cannot contain
+static const char HOST_CHAR[256] = {
+    ['-'] = '-', ['.'] = '.', ['_'] = '_', [':'] = ':',
+    ['0'] = '0', ['1'] = '1', ['2'] = '2', ['3'] = '3', ['4'] = '4', ['5'] = '5', ['6'] = '6', ['7'] = '7',
+    ['8'] = '8', ['9'] = '9',
+    ['a'] = 'a', ['b'] = 'b', ['c'] = 'c', ['d'] = 'd', ['e'] = 'e', ['f'] = 'f', ['g'] = 'g', ['h'] = 'h',
+    ['i'] = 'i', ['j'] = 'j', ['k'] = 'k', ['l'] = 'l', ['m'] = 'm', ['n'] = 'n', ['o'] = 'o', ['p'] = 'p',
+    ['q'] = 'q', ['r'] = 'r', ['s'] = 's', ['t'] = 't', ['u'] = 'u', ['v'] = 'v', ['w'] = 'w', ['x'] = 'x',
+    ['y'] = 'y', ['z'] = 'z',
+    ['A'] = 'a', ['B'] = 'b', ['C'] = 'c', ['D'] = 'd', ['E'] = 'e', ['F'] = 'f', ['G'] = 'g', ['H'] = 'h',
+    ['I'] = 'i', ['J'] = 'j', ['K'] = 'k', ['L'] = 'l', ['M'] = 'm', ['N'] = 'n', ['O'] = 'o', ['P'] = 'p',
+    ['Q'] = 'q', ['R'] = 'r', ['S'] = 's', ['T'] = 't', ['U'] = 'u', ['V'] = 'v', ['W'] = 'w', ['X'] = 'x',
+    ['Y'] = 'y', ['Z'] = 'z',
+};
+
+// Token boundaries: whitespace, quotes, brackets and the separators of CSV
+// and markup. Commas and parentheses inside URLs are rare enough to lose.
+static const uint8_t DELIM[256] = {
+    [0 ... ' '] = 1, ['"'] = 1, ['\''] = 1, [','] = 1, ['<'] = 1, ['>'] = 1, ['('] = 1, [')'] = 1,
+    ['['] = 1, [']'] = 1, ['{'] = 1, ['}'] = 1, ['|'] = 1, ['`'] = 1, ['\\'] = 1, [0x7f] = 1,
+};
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;  // Into the set's text
+    uint32_t len;
+    uint8_t kind;
+} Link;
+
+struct LinkSet {
+    uint64_t *slots;  // Hash tag << 32 | link index + 1; 0 marks an empty slot
+    size_t slot_count;
+    Link *links;
+    size_t count, cap;
+    char *text;
+    size_t text_len, text_cap;
+    uint64_t kinds[3];
+    char *batch;  // LINK_BATCH normalized links, LINK_MAX_LEN apart
+    size_t batch_len[LINK_BATCH];
+    uint8_t batch_kind[LINK_BATCH];
+    uint64_t batch_hash[LINK_BATCH];
+};
+
+// prefix is lowercase ASCII
+static int has_prefix_ci(const char *s, size_t len, const char *prefix) {
+    size_t i = 0;
+    for (; prefix[i]; i++) {
+        if (i == len || (s[i] | (prefix[i] >= 'a' && prefix[i] <= 'z' ? 0x20 : 0)) != prefix[i]) return 0;
+    }
+    return 1;
+}
+
+static int handle_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// t.me/<handle>, t.me/s/<handle>, t.me/<handle>/<post> -> t.me/<handle>;
+// t.me/joinchat/<hash> and t.me/+<hash> -> t.me/+<hash>
+static size_t telegram_link(const char *path, size_t len, char *out) {
+    static const char *const reserved[] = {"share", "proxy", "socks", "addstickers", "addemoji",
+                                           "setlanguage", "iv", "c", "login", NULL};
+    size_t i = 0;
+    while (i < len && path[i] == '/') i++;
+    size_t seg = i;
+    while (i < len && path[i] != '/' && path[i] != '?') i++;
+    size_t seg_len = i - seg;
+    int invite = 0;
+    if ((seg_len == 1 && path[seg] == 's') || (seg_len == 8 && strncasecmp(path + seg, "joinchat", 8) == 0)) {
+        invite = path[seg] != 's';
+        if (i < len && path[i] == '/') i++;
+        seg = i;
+        while (i < len && path[i] != '/' && path[i] != '?') i++;
+        seg_len = i - seg;
+    } else if (seg_len > 1 && path[seg] == '+') {
+        invite = 1;
+        seg++;
+        seg_len--;
+    }
+    if (seg_len == 0 || seg_len > 64) return 0;
+
+    size_t n = 5;
+    memcpy(out, "t.me/", 5);
+    if (invite) {
+        // Invite hashes are base64url and case-sensitive
+        out[n++] = '+';
+        for (size_t k = 0; k < seg_len; k++) {
+            char c = path[seg + k];
+            if (!handle_char(c) && c != '-') return 0;
+            out[n++] = c;
+        }
+        return n;
+    }
+    if (seg_len < 4 || seg_len > 32) return 0;
+    for (const char *const *r = reserved; *r; r++) {
+        if (strlen(*r) == seg_len && strncasecmp(path + seg, *r, seg_len) == 0) return 0;
+    }
+    for (size_t k = 0; k < seg_len; k++) {
+        char c = path[seg + k];
+        if (!handle_char(c)) return 0;
+        out[n++] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+    }
+    return n;
+}
+
+size_t link_normalize(const char *token, size_t len, char *out, LinkKind *kind) {
+    while (len > 0 && (unsigned char)token[0] <= ' ') {
+        token++;
+        len--;
+    }
+    // Sentence punctuation after a link in running text
+    while (len > 0 && ((unsigned char)token[len - 1] <= ' ' || strchr(".,;:!?)", token[len - 1]))) len--;
+    if (len == 0 || len > LINK_MAX_LEN) return 0;
+
+    size_t i = 0;
+    int scheme = 0;
+    char first = token[0] | 0x20;
+    if (first == 'h' && has_prefix_ci(token, len, "https://")) {
+        i = 8;
+        scheme = 1;
+    } else if (first == 'h' && has_prefix_ci(token, len, "http://")) {
+        i = 7;
+        scheme = 1;
+    } else if (first == 't' && has_prefix_ci(token, len, "tg://resolve?domain=")) {
+        const char *handle = token + 20;
+        const char *amp = memchr(handle, '&', len - 20);
+        char path[64];
+        size_t n = (amp ? (size_t)(amp - handle) : len - 20);
+        if (n >= sizeof(path)) return 0;
+        memcpy(path, handle, n);
+        *kind = LINK_TELEGRAM;
+        return telegram_link(path, n, out);
+    }
+
+    // One pass over the authority: the host is lowercased as it is copied,
+    // starting over after userinfo
+    char host[MAX_HOST_LEN + 1];
+    size_t host_len = 0;
+    int bad = 0;
+    for (; i < len; i++) {
+        uint8_t b = (uint8_t)token[i];
+        char c = HOST_CHAR[b];
+        if (c) {
+            if (host_len == MAX_HOST_LEN) return 0;
+            host[host_len++] = c;
+        } else if (b == '/' || b == '?' || b == '#') {
+            break;
+        } else if (b == '@') {
+            host_len = 0;
+            bad = 0;
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad) return 0;
+    size_t host_end = i;
+    // Keep a port only when it is not the scheme's default
+    const char *colon = memrchr(host, ':', host_len);
+    if (colon) {
+        size_t port = (size_t)(colon - host) + 1, port_len = host_len - port;
+        if (port_len == 0 || (port_len == 2 && memcmp(host + port, "80", 2) == 0) ||
+            (port_len == 3 && memcmp(host + port, "443", 3) == 0)) {
+            host_len = port - 1;
+        }
+    }
+    while (host_len > 0 && host[host_len - 1] == '.') host_len--;
+    host[host_len] = '\0';
+    char *h = host;
+    if (host_len > 4 && memcmp(h, "www.", 4) == 0) {
+        h += 4;
+        host_len -= 4;
+    }
+    if (!memchr(h, '.', host_len)) return 0;
+
+    // Path and query, without the fragment or a lone slash
+    const char *path = token + host_end;
+    size_t path_len = len - host_end;
+    const char *hash = memchr(path, '#', path_len);
+    if (hash) path_len = (size_t)(hash - path);
+    if (path_len == 1 && path[0] == '/') path_len = 0;
+
+    if (strcmp(h, "t.me") == 0 || strcmp(h, "telegram.me") == 0 || strcmp(h, "telegram.dog") == 0) {
+        *kind = LINK_TELEGRAM;
+        return telegram_link(path, path_len, out);
+    }
+
+    if (host_len > 6 && memcmp(h + host_len - 6, ".onion", 6) == 0) {
+        // Only the address label counts: v3 addresses are 56 base32 characters, v2 ones 16
+        size_t label_end = host_len - 6, label = label_end;
+        while (label > 0 && h[label - 1] != '.') label--;
+        size_t label_len = label_end - label;
+        if (label_len != 56 && label_len != 16) return 0;
+        for (size_t k = label; k < label_end; k++) {
+            if (!((h[k] >= 'a' && h[k] <= 'z') || (h[k] >= '2' && h[k] <= '7'))) return 0;
+        }
+        if (label_len + 6 + path_len > LINK_MAX_LEN) return 0;
+        memcpy(out, h + label, label_len + 6);
+        memcpy(out + label_len + 6, path, path_len);
+        *kind = LINK_ONION;
+        return label_len + 6 + path_len;
+    }
+
+    // Bare web hosts in text are mostly file names and emails
+    if (!scheme || host_len + path_len > LINK_MAX_LEN) return 0;
+    memcpy(out, h, host_len);
+    memcpy(out + host_len, path, path_len);
+    *kind = LINK_WEB;
+    return host_len + path_len;
+}
+
+LinkSet *linkset_open(void) {
+    LinkSet *set = calloc(1, sizeof(LinkSet));
+    if (!set) return NULL;
+    set->slots = calloc(LINKSET_INITIAL_SLOTS, sizeof(uint64_t));
+    set->batch = malloc(LINK_BATCH * LINK_MAX_LEN);
+    if (!set->slots || !set->batch) {
+        free(set->slots);
+        free(set->batch);
+        free(set);
+        return NULL;
+    }
+    set->slot_count = LINKSET_INITIAL_SLOTS;
+    return set;
+}
+
+void linkset_close(LinkSet *set) {
+    if (!set) return;
+    free(set->slots);
+    free(set->links);
+    free(set->text);
+    free(set->batch);
+    free(set);
+}
+
+uint64_t linkset_count(const LinkSet *set, LinkKind kind) {
+    return set->kinds[kind];
+}
+
+static int linkset_grow(LinkSet *set) {
+    size_t slot_count = set->slot_count * 2;
+    uint64_t *slots = calloc(slot_count, sizeof(uint64_t));
+    if (!slots) return -1;
+    for (size_t n = 0; n < set->count; n++) {
+        size_t i = set->links[n].hash & (slot_count - 1);
+        while (slots[i]) i = (i + 1) & (slot_count - 1);
+        slots[i] = (set->links[n].hash >> 32) << 32 | (n + 1);
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->slot_count = slot_count;
+    return 0;
+}
+
+// Returns 1 when the link is new, 0 when it was already in the set; the
+// table must have room for it
+static int linkset_add(LinkSet *set, const char *link, size_t len, LinkKind kind, uint64_t hash) {
+    size_t mask = set->slot_count - 1, i = hash & mask;
+    for (; set->slots[i]; i = (i + 1) & mask) {
+        uint64_t slot = set->slots[i];
+        if (slot >> 32 != hash >> 32) continue;
+        const Link *l = &set->links[(slot & 0xffffffff) - 1];
+        if (l->len == len && memcmp(set->text + l->offset, link, len) == 0) return 0;
+    }
+
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 1 << 16;
+        Link *links = realloc(set->links, cap * sizeof(Link));
+        if (!links) return -1;
+        set->links = links;
+        set->cap = cap;
+    }
+    if (set->text_len + len > set->text_cap) {
+        size_t cap = set->text_cap ? set->text_cap * 2 : 1 << 20;
+        while (cap < set->text_len + len) cap *= 2;
+        char *text = realloc(set->text, cap);
+        if (!text) return -1;
+        set->text = text;
+        set->text_cap = cap;
+    }
+    memcpy(set->text + set->text_len, link, len);
+    set->links[set->count] = (Link){hash, set->text_len, (uint32_t)len, (uint8_t)kind};
+    set->text_len += len;
+    set->count++;
+    set->slots[i] = (hash >> 32) << 32 | set->count;
+    set->kinds[kind]++;
+    return 1;
+}
+
+// Hash the batched links and prefetch their slots before any is inserted,
+// so the table's cache misses overlap
+static int linkset_flush(LinkSet *set, size_t n) {
+    while ((set->count + n) * 100 > set->slot_count * LINKSET_MAX_LOAD_PCT) {
+        if (linkset_grow(set) != 0) return -1;
+    }
+    for (size_t j = 0; j < n; j++) {
+        uint64_t h[2];
+        murmur3_128(set->batch + j * LINK_MAX_LEN, set->batch_len[j], LINKSET_SEED, h);
+        set->batch_hash[j] = h[0];
+        __builtin_prefetch(&set->slots[h[0] & (set->slot_count - 1)]);
+    }
+    for (size_t j = 0; j < n; j++) {
+        if (linkset_add(set, set->batch + j * LINK_MAX_LEN, set->batch_len[j], set->batch_kind[j],
+                        set->batch_hash[j]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+long long linkset_scan(LinkSet *set, const char *data, size_t len) {
+    long long found = 0;
+    size_t batched = 0, i = 0;
+    int ok = 1;
+    while (ok && i < len) {
+        while (i < len && DELIM[(uint8_t)data[i]]) i++;
+        size_t start = i;
+        while (i < len && !DELIM[(uint8_t)data[i]]) i++;
+        size_t n = i - start;
+        // Every link has a dot except tg:// ones; "t.me/abcd" is the shortest
+        if (n < 9 || n > LINK_MAX_LEN) continue;
+        if (!memchr(data + start, '.', n) && !has_prefix_ci(data + start, n, "tg://")) continue;
+        LinkKind kind;
+        size_t link_len = link_normalize(data + start, n, set->batch + batched * LINK_MAX_LEN, &kind);
+        if (link_len == 0) continue;
+        set->batch_len[batched] = link_len;
+        set->batch_kind[batched] = (uint8_t)kind;
+        found++;
+        if (++batched == LINK_BATCH) {
+            ok = linkset_flush(set, batched) == 0;
+            batched = 0;
+        }
+    }
+    if (ok && batched > 0) ok = linkset_flush(set, batched) == 0;
+    if (!ok) {
+        log_error("Failed to allocate link set of %zu links", set->count);
+        return -1;
+    }
+    return found;
+}
+
+typedef struct {
+    uint64_t prefix;  // First 8 bytes, big-endian and zero-padded, so integer order is byte order
+    const char *s;
+    uint32_t len;
+    uint8_t kind;
+} SortItem;
+
+static int compare_items(const void *a, const void *b) {
+    const SortItem *x = a, *y = b;
+    size_t n = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->s, y->s, n);
+    if (c != 0) return c;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+// Radix sort on the prefixes, then a comparison sort within each run of
+// links sharing their first 8 bytes
+static int sort_items(SortItem *items, size_t n) {
+    SortItem *scratch = malloc(n * sizeof(SortItem));
+    if (!scratch) return -1;
+    static size_t counts[RADIX_PASSES][1 << RADIX_BITS];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        for (int p = 0; p < RADIX_PASSES; p++) counts[p][(items[i].prefix >> (p * RADIX_BITS)) & 0xffff]++;
+    }
+    SortItem *src = items, *dst = scratch;
+    for (int p = 0; p < RADIX_PASSES; p++) {
+        size_t *c = counts[p];
+        if (c[(src[0].prefix >> (p * RADIX_BITS)) & 0xffff] == n) continue;
+        size_t sum = 0;
+        for (int b = 0; b < (1 << RADIX_BITS); b++) {
+            size_t count = c[b];
+            c[b] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; i++) dst[c[(src[i].prefix >> (p * RADIX_BITS)) & 0xffff]++] = src[i];
+        SortItem *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != items) memcpy(items, src, n * sizeof(SortItem));
+    free(scratch);
+
+    for (size_t run = 0; run < n;) {
+        size_t end = run + 1;
+        while (end < n && items[end].prefix == items[run].prefix) end++;
+        if (end - run > 1) qsort(items + run, end - run, sizeof(SortItem), compare_items);
+        run = end;
+    }
+    return 0;
+}
+
+int linkset_write(LinkSet *set, const char *path) {
+    if (set->text_len + set->count > UINT32_MAX) {
+        log_error("Link table %s would exceed 4 GiB of text", path);
+        return -1;
+    }
+    SortItem *items = malloc((set->count ? set->count : 1) * sizeof(SortItem));
+    LinkSlot *slots = malloc((set->count ? set->count : 1) * sizeof(LinkSlot));
+    if (!items || !slots) {
+        log_error("Failed to allocate link table for %s", path);
+        free(items);
+        free(slots);
+        return -1;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        const Link *l = &set->links[i];
+        uint8_t head[8] = {0};
+        memcpy(head, set->text + l->offset, l->len < 8 ? l->len : 8);
+        uint64_t prefix = 0;
+        for (int k = 0; k < 8; k++) prefix = prefix << 8 | head[k];
+        items[i] = (SortItem){prefix, set->text + l->offset, l->len, l->kind};
+    }
+    if (set->count > 1 && sort_items(items, set->count) != 0) {
+        log_error("Failed to allocate link sort buffer for %s", path);
+        free(items);
+        free(slots);
+        return -1;
+    }
+    uint32_t offset = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        slots[i] = (LinkSlot){offset, (uint16_t)items[i].len, items[i].kind, 0};
+        offset += items[i].len + 1;
+    }
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        log_error("Failed to create link table %s: %s", tmp_path, strerror(errno));
+        free(items);
+        free(slots);
+        return -1;
+    }
+    LinkTableHeader header = {{0}, set->count, offset};
+    memcpy(header.magic, LINKTAB_MAGIC, 8);
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(slots, sizeof(LinkSlot), set->count, f) == set->count;
+    // Links are gathered into large writes; one stdio call per link costs more than the sort
+    char *buffer = malloc(WRITE_BUFFER);
+    size_t used = 0;
+    if (!buffer) ok = 0;
+    for (size_t i = 0; ok && i < set->count; i++) {
+        if (used + items[i].len + 1 > WRITE_BUFFER) {
+            ok = fwrite(buffer, 1, used, f) == used;
+            used = 0;
+        }
+        memcpy(buffer + used, items[i].s, items[i].len);
+        used += items[i].len;
+        buffer[used++] = '\n';
+    }
+    if (ok && used > 0) ok = fwrite(buffer, 1, used, f) == used;
+    if (fclose(f) != 0) ok = 0;
+    free(buffer);
+    free(items);
+    free(slots);
+    if (!ok || rename(tmp_path, path) != 0) {
+        log_error("Failed to write link table %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
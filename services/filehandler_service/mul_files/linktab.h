@@ -0,0 +1,57 @@
+#ifndef LINKTAB_H
+#define LINKTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LINKTAB_MAGIC "SGLNK001"
+#define LINK_MAX_LEN 2048  // Longer tokens are not taken for links
+
+typedef enum {
+    LINK_WEB,  // host/path of an http(s) URL
+    LINK_ONION,  // <address>.onion[/path]
+    LINK_TELEGRAM  // t.me/<handle> or t.me/+<invite>
+} LinkKind;
+
+// Sorted link table, written for search_service to map read-only:
+//
+//   header   magic, u64 count, u64 text_bytes
+//   slots    LinkSlot[count], in the byte order of their links
+//   text     the links, each followed by '\n'
+//
+// Links are stored normalized: no scheme, lowercase host without "www." or a
+// default port, no fragment, and no lone trailing slash. Telegram links are
+// reduced to their channel, with the handle lowercased; invite hashes keep
+// their case. Binary search over the slots finds a link or a prefix range.
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t text_bytes;
+} LinkTableHeader;
+
+typedef struct {
+    uint32_t offset;  // Into text
+    uint16_t len;  // Without the newline
+    uint8_t kind;  // LinkKind
+    uint8_t reserved;
+} LinkSlot;
+
+// Normalize one token into out (LINK_MAX_LEN bytes). Returns the length, or
+// 0 if the token is not a web, onion or Telegram link. Bare hosts are only
+// taken for onion and Telegram addresses.
+size_t link_normalize(const char *token, size_t len, char *out, LinkKind *kind);
+
+// Collects normalized links in a hash set until they are written out
+typedef struct LinkSet LinkSet;
+
+LinkSet *linkset_open(void);
+void linkset_close(LinkSet *set);
+// Take every link among the whitespace-, quote- and comma-separated tokens of
+// data. Returns the number of links found (before deduplication), -1 when
+// the set cannot grow.
+long long linkset_scan(LinkSet *set, const char *data, size_t len);
+uint64_t linkset_count(const LinkSet *set, LinkKind kind);
+// Sort the unique links and write them as a table (<path>.tmp, renamed)
+int linkset_write(LinkSet *set, const char *path);
+
+#endif
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "idindex.h"
+#include "lookup.h"
+
+typedef struct {
+    int fd;
+    size_t in_len;
+    int discarding;  // Dropping the rest of an over-long line
+    int eof;  // Client shut down its side; close once the answers are sent
+    size_t out_len, out_sent;
+    char in[LOOKUP_BUFFER];
+    char out[2 * LOOKUP_BUFFER + 2];  // At most one answer per input byte, plus a discarded line
+} Client;
+
+static uint64_t keys[LOOKUP_BUFFER];
+static uint8_t valid[LOOKUP_BUFFER];
+static uint8_t found[LOOKUP_BUFFER];
+
+static void client_close(int epfd, Client *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+}
+
+// Answer every complete line in the input buffer
+static void answer_lines(Client *c) {
+    size_t lines = 0, start = 0;
+    char *nl;
+    while ((nl = memchr(c->in + start, '\n', c->in_len - start)) != NULL) {
+        size_t end = (size_t)(nl - c->in);
+        if (c->discarding) {
+            valid[lines] = 0;
+            c->discarding = 0;
+        } else {
+            valid[lines] = (uint8_t)idindex_key(c->in + start, end - start, &keys[lines]);
+            if (!valid[lines]) keys[lines] = 0;
+        }
+        lines++;
+        start = end + 1;
+    }
+    memmove(c->in, c->in + start, c->in_len - start);
+    c->in_len -= start;
+    if (c->in_len == LOOKUP_BUFFER) {
+        c->in_len = 0;
+        c->discarding = 1;
+    }
+    if (lines == 0) return;
+
+    IdIndexSet *set = idindex_acquire();
+    idindex_probe(set, keys, found, lines);
+    if (set) idindex_release(set);
+    for (size_t i = 0; i < lines; i++) {
+        c->out[c->out_len++] = found[i] && valid[i] ? '1' : '0';
+        c->out[c->out_len++] = '\n';
+    }
+}
+
+// Returns 1 when everything queued was sent, 0 if the socket is full, -1 on error
+static int flush_out(Client *c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0) return -1;
+        c->out_sent += (size_t)n;
+    }
+    c->out_len = c->out_sent = 0;
+    return 1;
+}
+
+// Read what is available, answer it and send the answers. While answers are
+// still unsent the client is only polled for writing, which bounds the output.
+static int client_event(int epfd, Client *c, uint32_t events) {
+    if (events & EPOLLIN) {
+        while (c->in_len < LOOKUP_BUFFER) {
+            ssize_t n = recv(c->fd, c->in + c->in_len, LOOKUP_BUFFER - c->in_len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0) return -1;
+            if (n == 0) {
+                // A last line without a newline is still a query
+                if (c->in_len > 0 && c->in_len < LOOKUP_BUFFER && c->in[c->in_len - 1] != '\n') {
+                    c->in[c->in_len++] = '\n';
+                }
+                c->eof = 1;
+                break;
+            }
+            c->in_len += (size_t)n;
+        }
+        answer_lines(c);
+    } else if (!(events & EPOLLOUT)) {
+        return -1;  // Hang-up or error
+    }
+
+    int sent = flush_out(c);
+    if (sent < 0 || (sent && c->eof)) return -1;
+    struct epoll_event ev = {.events = sent ? EPOLLIN : EPOLLOUT, .data.ptr = c};
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+int lookup_serve(const char *socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        log_error("Lookup socket path %s is too long", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socket_path);  // Left behind by a previous run
+    if (listener == -1 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, LOOKUP_MAX_CLIENTS) != 0) {
+        log_error("Failed to listen on lookup socket %s: %s", socket_path, strerror(errno));
+        if (listener != -1) close(listener);
+        return -1;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) != 0) {
+        log_error("Failed to set up lookup socket polling: %s", strerror(errno));
+        if (epfd != -1) close(epfd);
+        close(listener);
+        return -1;
+    }
+    log_info("Serving identity lookups on %s", socket_path);
+
+    int clients = 0;
+    struct epoll_event events[64];
+    while (1) {
+        int n = epoll_wait(epfd, events, 64, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            log_error("Lookup socket polling failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            Client *c = events[i].data.ptr;
+            if (c) {
+                if (client_event(epfd, c, events[i].events) != 0) {
+                    client_close(epfd, c);
+                    clients--;
+                }
+                continue;
+            }
+
+            int fd;
+            while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                c = clients < LOOKUP_MAX_CLIENTS ? malloc(sizeof(Client)) : NULL;
+                if (!c) {
+                    log_warning("Refusing lookup client: %d connected", clients);
+                    close(fd);
+                    continue;
+                }
+                c->fd = fd;
+                c->in_len = c->out_len = c->out_sent = 0;
+                c->discarding = c->eof = 0;
+                struct epoll_event cev = {.events = EPOLLIN, .data.ptr = c};
+                if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &cev) != 0) {
+                    close(fd);
+                    free(c);
+                    continue;
+                }
+                clients++;
+            }
+        }
+    }
+    close(epfd);
+    close(listener);
+    return -1;
+}
@@ -0,0 +1,15 @@
+#ifndef LOOKUP_H
+#define LOOKUP_H
+
+#define LOOKUP_MAX_CLIENTS 256
+#define LOOKUP_BUFFER 65536  // Per client input; a longer line is answered 0
+
+// Identity lookups over a Unix stream socket. Clients send identities one per
+// line and get one "1\n" (seen in some indexed dump) or "0\n" per line, in
+// order. Everything a client has sent is probed as one batch, so pipelining
+// many lines per write is the fast path. Answers are not buffered without
+// bound: a client that pipelines must keep reading while it writes.
+// Blocks; returns -1 on setup failure.
+int lookup_serve(const char *socket_path);
+
+#endif
@@ -8,20 +8,73 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
 #include <rabbitmq-c/amqp.h>
 #include <rabbitmq-c/framing.h>
+#include <rabbitmq-c/tcp_socket.h>
 
-#define BUFFER_SIZE 4096
-#define MAX_FILES 10  // Maximum concurrent files (adjust based on system)
+#include "classify.h"
+#include "config.h"
+#include "dedup.h"
+#include "filehandler.h"
+#include "domindex.h"
+#include "idindex.h"
+#include "inflight.h"
+#include "linededup.h"
+#include "lookup.h"
+#include "neardup.h"
+#include "pipeline.h"
+#include "retry.h"
+#include "taskqueue.h"
+#include "watcher.h"
+#include "watchlist.h"
 
+// Tuning knobs (worker count, queue depth, buffer sizes, limits...) live in config.h
+#define ACK_FLUSH_INTERVAL_US 100000  // Consumer wakes at least this often to flush acks
+#define DEAD_LETTER_QUEUE "file_queue.dead"  // Quarantined deliveries, with the failure reason in headers
+#define BROKER_HEARTBEAT_SEC 30  // A broker that stops answering fails the connection within two of these
+#define RECONNECT_MIN_DELAY_MS 1000  // Backoff between attempts to reach RabbitMQ, doubling up to the max
+#define RECONNECT_MAX_DELAY_MS 60000
+// Delivery tags are queued with their connection's generation in the top bits,
+// so a tag of a connection that has since closed is never settled on a new one
+#define DELIVERY_GENERATION_SHIFT 48
+#define DELIVERY_TAG_MASK ((1ULL << DELIVERY_GENERATION_SHIFT) - 1)
+
+typedef struct {
+    amqp_channel_t channel;
+    uint64_t delivery_tag;
+    DeliveryOutcome outcome;
+    int attempts;
+    long delay_ms;
+    char *file_path;  // Owned; set for RETRY and DEAD only
+    char *reason;
+} AckEntry;
+
+// Feeds libarchive through a read callback so an entry past its deadline can be aborted
 typedef struct {
-    char *file_path;
-} FileTask;
+    int fd;
+    time_t deadline;  // Wall-clock limit for the current entry
+    int timeout_sec;
+    size_t block_size;
+    Pipeline *pipe;  // Sees every byte read, for the input's manifest hash
+    FILE *spool;  // Current entry, when its size had to be checked first
+    char *spool_buffer;
+    char buffer[];
+} ArchiveSource;
 
-pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
-FileTask *file_queue[MAX_FILES];
-int queue_front = 0, queue_rear = 0, queue_size = 0;
+// Deliveries finished by workers, acked by the consumer thread (rabbitmq-c is not thread-safe).
+// Sized for every unacked delivery (channels x prefetch); flush swaps it with ack_spare.
+pthread_mutex_t ack_mutex = PTHREAD_MUTEX_INITIALIZER;
+AckEntry *ack_queue = NULL, *ack_spare = NULL;
+int ack_size = 0, ack_capacity = 0;
+uint64_t broker_generation = 0;  // Connections opened so far, modulo 2^16
+
+// Last error logged on this thread; used as the failure reason for dead letters
+__thread char last_error[256];
 
 // Logging functions with variable arguments
 void log_info(const char *format, ...) {
@@ -36,10 +89,9 @@ void log_info(const char *format, ...) {
 void log_error(const char *format, ...) {
     va_list args;
     va_start(args, format);
-    fprintf(stderr, "ERROR: ");
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
+    vsnprintf(last_error, sizeof(last_error), format, args);
     va_end(args);
+    fprintf(stderr, "ERROR: %s\n", last_error);
 }
 
 void log_warning(const char *format, ...) {
@@ -96,38 +148,96 @@ int is_archive(const char *filename) {
     return 0;
 }
 
-// Extract an archive to a directory, using buffered I/O for large files
-int extract_archive(const char *filename, const char *output_dir) {
-    struct archive *a;
-    struct archive_entry *entry;
-    int r;
+// Per-callback deadline: checked on every input read and every output block, so
+// a stalled read or a decompression bomb is aborted at its next block. A decoder
+// that spins inside a single libarchive call is not interrupted; that would
+// take extraction in a killable child process.
+int watchdog_expired(struct archive *a, ArchiveSource *src) {
+    if (time(NULL) <= src->deadline) return 0;
+    archive_set_error(a, ETIMEDOUT, "Entry exceeded the %d s extraction watchdog", src->timeout_sec);
+    return 1;
+}
 
-    a = archive_read_new();
-    archive_read_support_format_all(a);
-    archive_read_support_filter_all(a);
+// libarchive read callback; failing here makes the pending libarchive call return ARCHIVE_FATAL
+ssize_t archive_source_read(struct archive *a, void *client_data, const void **buff) {
+    ArchiveSource *src = client_data;
+    if (watchdog_expired(a, src)) return -1;
 
-    r = archive_read_open_filename(a, filename, 10240);
-    if (r != ARCHIVE_OK) {
-        log_error("Failed to open archive %s: %s", filename, archive_error_string(a));
-        archive_read_free(a);
+    ssize_t n;
+    do {
+        n = read(src->fd, src->buffer, src->block_size);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        archive_set_error(a, errno, "Read failed: %s", strerror(errno));
         return -1;
     }
+    pipeline_input_data(src->pipe, src->buffer, n);
+    *buff = src->buffer;
+    return n;
+}
 
-    // Create output directory if it doesn’t exist (recursively)
-    if (mkdir_p(output_dir, 0777) == -1) {
-        log_error("Failed to create output directory %s: %s", output_dir, strerror(errno));
-        archive_read_free(a);
+int archive_source_close(struct archive *a, void *client_data) {
+    (void)a;
+    ArchiveSource *src = client_data;
+    if (src->fd != -1) close(src->fd);
+    src->fd = -1;
+    return ARCHIVE_OK;
+}
+
+// libarchive stops reading after the last entry; hash the rest of the input
+// (a zip central directory, tar padding) so the manifest covers the whole file
+int archive_source_drain(ArchiveSource *src) {
+    ssize_t n;
+    while ((n = read(src->fd, src->buffer, src->block_size)) > 0) pipeline_input_data(src->pipe, src->buffer, n);
+    if (n == -1) {
+        log_error("Failed to read the rest of the input: %s", strerror(errno));
         return -1;
     }
+    pipeline_input_end(src->pipe);
+    return 0;
+}
 
-    while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
-        const char *pathname = archive_entry_pathname(entry);
-        char full_path[1024];
-        snprintf(full_path, sizeof(full_path), "%s/%s", output_dir, pathname);
-        
-        log_info("Extracting %s from %s", pathname, filename);
+void free_archive(struct archive *a, ArchiveSource *src) {
+    archive_read_free(a);
+    if (src->fd != -1) close(src->fd);
+    if (src->spool) fclose(src->spool);
+    free(src->spool_buffer);
+    free(src);
+}
+
+// Where an entry is written under root for the configured output mode
+void entry_output_path(const Config *cfg, const char *root, const char *filename, const char *pathname, char *out,
+                       size_t len) {
+    if (cfg->output_mode == OUTPUT_FLAT) {
+        const char *base_name = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+        int n = snprintf(out, len, "%s/%s_", root, base_name);
+        for (const char *p = pathname; *p && n >= 0 && (size_t)n < len - 1; p++) {
+            out[n++] = *p == '/' ? '_' : *p;
+        }
+        out[(n >= 0 && (size_t)n < len) ? (size_t)n : len - 1] = '\0';
+    } else {
+        snprintf(out, len, "%s/%s", root, pathname);
+    }
+}
 
-        // Create directories recursively for the entry path
+// Open an entry's output file once its first block has been classified.
+// Binary kinds go under cold_output_dir or are not written at all, per
+// binary_entries; *out stays NULL for the latter.
+int open_entry_output(const Config *cfg, const char *filename, const char *pathname, EntryKind kind,
+                      char *full_path, size_t len, FILE **out) {
+    const char *root = cfg->output_dir;
+    *out = NULL;
+    if (cfg->binary_entries != BINARY_ENTRIES_KEEP && entry_kind_is_cold(kind)) {
+        if (cfg->binary_entries == BINARY_ENTRIES_SKIP) {
+            log_info("Not writing %s from %s: %s entry", pathname, filename, entry_kind_name(kind));
+            return 0;
+        }
+        root = cfg->cold_output_dir;
+    }
+    entry_output_path(cfg, root, filename, pathname, full_path, len);
+
+    // Create directories recursively for the entry path; flat output only needs the root
+    if (cfg->output_mode == OUTPUT_TREE || root != cfg->output_dir) {
         char *dir_path = strdup(full_path);
         if (dir_path) {
             char *last_slash = strrchr(dir_path, '/');
@@ -136,285 +246,1047 @@ int extract_archive(const char *filename, const char *output_dir) {
                 if (mkdir_p(dir_path, 0777) == -1) {
                     log_error("Failed to create directory for %s: %s", dir_path, strerror(errno));
                     free(dir_path);
-                    archive_read_free(a);
                     return -1;
                 }
             }
             free(dir_path);
         }
+    }
+
+    *out = fopen(full_path, "wb");
+    if (!*out) {
+        log_error("Failed to create output file %s: %s", full_path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Settle an entry written through line dedup and close it; when its lines
+// outgrew the fingerprint table, the written file gets the sorted pass
+int close_deduped(LineDedup *lines, FILE *out, const char *path, const Config *cfg) {
+    int rc = linededup_end(lines);
+    if (fclose(out) != 0) rc = -1;
+    if (rc != 0) {
+        log_error("Failed to write data to %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (lines->dropped > 0) {
+        log_info("Dropped %llu of %llu lines of %s as duplicates", (unsigned long long)lines->dropped,
+                 (unsigned long long)lines->lines, path);
+    }
+    if (lines->overflowed) return linededup_compact(path, (size_t)cfg->line_dedup_memory_mb << 20);
+    return 0;
+}
+
+// An entry without a declared size is copied to a temporary file until its
+// end or max_entry_bytes, so an oversized one is skipped before any of it
+// reaches the pipeline or the output. Returns the spool rewound; NULL with
+// *over set when the entry is too large, NULL with *r <= ARCHIVE_FAILED on error.
+FILE *spool_entry(struct archive *a, ArchiveSource *src, const Config *cfg, int *r, int *over) {
+    *over = 0;
+    FILE *spool = tmpfile();
+    if (!spool) {
+        archive_set_error(a, errno, "Failed to create entry spool: %s", strerror(errno));
+        *r = ARCHIVE_FATAL;
+        return NULL;
+    }
+    const void *buff;
+    size_t size;
+    int64_t offset, total = 0;
+    while ((*r = archive_read_data_block(a, &buff, &size, &offset)) == ARCHIVE_OK) {
+        if (watchdog_expired(a, src)) {
+            *r = ARCHIVE_FATAL;
+            break;
+        }
+        total += size;
+        if (total > cfg->max_entry_bytes) {
+            *over = 1;
+            break;
+        }
+        if (fwrite(buff, 1, size, spool) != size) {
+            archive_set_error(a, errno, "Failed to write entry spool: %s", strerror(errno));
+            *r = ARCHIVE_FATAL;
+            break;
+        }
+    }
+    if (*r > ARCHIVE_FAILED && !*over && (fflush(spool) != 0 || fseek(spool, 0, SEEK_SET) != 0)) {
+        archive_set_error(a, errno, "Failed to write entry spool: %s", strerror(errno));
+        *r = ARCHIVE_FATAL;
+    }
+    if (*r <= ARCHIVE_FAILED || *over) {
+        fclose(spool);
+        return NULL;
+    }
+    return spool;
+}
+
+// The entry's next block, from the archive or replayed from its spool
+int next_block(struct archive *a, ArchiveSource *src, const void **buff, size_t *size) {
+    if (!src->spool) {
+        int64_t offset;
+        return archive_read_data_block(a, buff, size, &offset);
+    }
+    *buff = src->spool_buffer;
+    *size = fread(src->spool_buffer, 1, src->block_size, src->spool);
+    if (*size > 0) return ARCHIVE_OK;
+    if (!ferror(src->spool)) return ARCHIVE_EOF;
+    archive_set_error(a, EIO, "Failed to read entry spool");
+    return ARCHIVE_FATAL;
+}
+
+// Extract an archive to a directory, using buffered I/O for large files.
+// Each entry has an entry_timeout_sec deadline, checked between libarchive calls.
+// lines, when set, drops duplicate lines of text entries on the way to disk.
+int extract_archive(const char *filename, const Config *cfg, Pipeline *pipe, LineDedup *lines) {
+    struct archive *a;
+    struct archive_entry *entry;
+    int r;
+
+    ArchiveSource *src = malloc(sizeof(ArchiveSource) + cfg->read_block_size);
+    if (!src) {
+        log_error("Failed to allocate read buffer for %s", filename);
+        return -1;
+    }
+    src->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (src->fd == -1) {
+        log_error("Failed to open archive %s: %s", filename, strerror(errno));
+        free(src);
+        return -1;
+    }
+    src->timeout_sec = cfg->entry_timeout_sec;
+    src->block_size = cfg->read_block_size;
+    src->deadline = time(NULL) + src->timeout_sec;
+    src->pipe = pipe;
+    src->spool = NULL;
+    src->spool_buffer = NULL;
+
+    a = archive_read_new();
+    archive_read_support_format_all(a);
+    archive_read_support_filter_all(a);
+
+    r = archive_read_open(a, src, NULL, archive_source_read, archive_source_close);
+    if (r != ARCHIVE_OK) {
+        log_error("Failed to open archive %s: %s", filename, archive_error_string(a));
+        free_archive(a, src);
+        return -1;
+    }
+
+    // Create output directory if it doesn’t exist (recursively)
+    if (cfg->output_mode != OUTPUT_NONE && mkdir_p(cfg->output_dir, 0777) == -1) {
+        log_error("Failed to create output directory %s: %s", cfg->output_dir, strerror(errno));
+        free_archive(a, src);
+        return -1;
+    }
+
+    while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+        const char *pathname = archive_entry_pathname(entry);
+        src->deadline = time(NULL) + src->timeout_sec;
+        int is_dir = archive_entry_filetype(entry) == AE_IFDIR;
+
+        if (!is_dir && !config_name_allowed(cfg, pathname)) {
+            continue;  // Filtered out; libarchive skips the unread data on the next header
+        }
+        if (!is_dir && cfg->max_entry_bytes > 0 && archive_entry_size_is_set(entry) &&
+            archive_entry_size(entry) > cfg->max_entry_bytes) {
+            log_warning("Skipping %s from %s: %lld bytes exceeds max_entry_bytes",
+                        pathname, filename, (long long)archive_entry_size(entry));
+            continue;
+        }
+
+        char full_path[1024];
+        log_info("Extracting %s from %s", pathname, filename);
 
         // Handle directories or files
-        if (archive_entry_filetype(entry) == AE_IFDIR) {
-            if (mkdir_p(full_path, 0777) == -1) {
+        if (is_dir) {
+            entry_output_path(cfg, cfg->output_dir, filename, pathname, full_path, sizeof(full_path));
+            if (cfg->output_mode == OUTPUT_TREE && mkdir_p(full_path, 0777) == -1) {
                 log_error("Failed to create directory %s: %s", full_path, strerror(errno));
-                archive_read_free(a);
+                free_archive(a, src);
                 return -1;
             }
         } else {
-            FILE *out = fopen(full_path, "wb");
-            if (!out) {
-                log_error("Failed to create output file %s: %s", full_path, strerror(errno));
-                archive_read_free(a);
-                return -1;
+            // The output is opened on the first block, once the pipeline has classified the entry
+            FILE *out = NULL;
+            int routed = cfg->output_mode == OUTPUT_NONE;
+
+            if (cfg->max_entry_bytes > 0 && !archive_entry_size_is_set(entry)) {
+                int over;
+                src->spool = spool_entry(a, src, cfg, &r, &over);
+                if (over) {
+                    log_warning("Skipping %s from %s: exceeds max_entry_bytes", pathname, filename);
+                    continue;
+                }
+                if (!src->spool) break;  // Reported below
+                if (!src->spool_buffer && !(src->spool_buffer = malloc(cfg->read_block_size))) {
+                    log_error("Failed to allocate spool buffer for %s", filename);
+                    free_archive(a, src);
+                    return -1;
+                }
             }
 
             // Use buffered I/O for large files
             const void *buff;
             size_t size;
-            int64_t offset;
-            while ((r = archive_read_data_block(a, &buff, &size, &offset)) == ARCHIVE_OK) {
-                if (size > 0) {
+            int64_t total = 0;
+            pipeline_entry_begin(pipe, pathname);
+            while ((r = next_block(a, src, &buff, &size)) == ARCHIVE_OK) {
+                // Decompression bombs can emit blocks without reading input, so check here too
+                if (watchdog_expired(a, src)) {
+                    r = ARCHIVE_FATAL;
+                    break;
+                }
+                total += size;
+                if (cfg->max_entry_bytes > 0 && total > cfg->max_entry_bytes) {
+                    // Part of the entry has already been parsed, so it cannot just be skipped
+                    archive_set_error(a, EFBIG, "%s is larger than its declared size", pathname);
+                    r = ARCHIVE_FATAL;
+                    break;
+                }
+                pipeline_entry_data(pipe, buff, size);
+                if (!routed && size > 0) {
+                    routed = 1;
+                    EntryKind kind = ENTRY_UNKNOWN;
+                    if (cfg->binary_entries != BINARY_ENTRIES_KEEP) {
+                        kind = pipe ? pipeline_entry_kind(pipe) : classify_entry(pathname, buff, size);
+                    }
+                    if (open_entry_output(cfg, filename, pathname, kind, full_path, sizeof(full_path), &out) != 0) {
+                        free_archive(a, src);
+                        return -1;
+                    }
+                    if (out && lines) linededup_begin(lines, out, cfg->line_dedup == LINE_DEDUP_ENTRY);
+                }
+                if (out && lines) {
+                    if (linededup_write(lines, buff, size) != 0) {
+                        log_error("Failed to write data to %s: %s", full_path, strerror(errno));
+                        fclose(out);
+                        free_archive(a, src);
+                        return -1;
+                    }
+                } else if (out && size > 0) {
                     size_t written = 0;
                     while (written < size) {
-                        size_t to_write = size - written < BUFFER_SIZE ? size - written : BUFFER_SIZE;
+                        size_t to_write = size - written < (size_t)cfg->buffer_size ? size - written : (size_t)cfg->buffer_size;
                         if (fwrite((char*)buff + written, 1, to_write, out) != to_write) {
                             log_error("Failed to write data to %s: %s", full_path, strerror(errno));
                             fclose(out);
-                            archive_read_free(a);
+                            free_archive(a, src);
                             return -1;
                         }
                         written += to_write;
                     }
                 }
             }
-            fclose(out);
+            pipeline_entry_end(pipe);
+            if (src->spool) {
+                fclose(src->spool);
+                src->spool = NULL;
+            }
+            // Empty entries are still written
+            if (!routed && r == ARCHIVE_EOF) {
+                if (open_entry_output(cfg, filename, pathname, ENTRY_UNKNOWN, full_path, sizeof(full_path), &out) != 0) {
+                    free_archive(a, src);
+                    return -1;
+                }
+                if (lines) linededup_begin(lines, out, cfg->line_dedup == LINE_DEDUP_ENTRY);
+            }
+            if (out && lines) {
+                if (close_deduped(lines, out, full_path, cfg) != 0) {
+                    free_archive(a, src);
+                    return -1;
+                }
+            } else if (out) {
+                fclose(out);
+            }
+            if (r <= ARCHIVE_FAILED) break;  // Entry data failed (or watchdog fired); reported below
         }
     }
 
     if (r != ARCHIVE_EOF) {
         log_error("Archive read error for %s: %s", filename, archive_error_string(a));
-        archive_read_free(a);
+        free_archive(a, src);
         return -1;
     }
 
-    archive_read_free(a);
-    return 0;
+    int rc = cfg->content_manifest ? archive_source_drain(src) : 0;
+    free_archive(a, src);
+    return rc;
 }
 
-// Copy non-archive files (e.g., .txt) to output directory
-int copy_file(const char *src, const char *dest) {
+// Copy non-archive files (e.g., .txt) to output directory, streaming them
+// through the pipeline; dest may be NULL to only feed the pipeline
+int copy_file(const char *src, const char *dest, const Config *cfg, Pipeline *pipe, LineDedup *lines) {
+    size_t buffer_size = cfg->buffer_size;
     FILE *in = fopen(src, "rb");
-    FILE *out = fopen(dest, "wb");
-    if (!in || !out) {
+    FILE *out = dest ? fopen(dest, "wb") : NULL;
+    char *buffer = malloc(buffer_size);
+    if (!in || (dest && !out) || !buffer) {
         log_error("Failed to open files for copying %s to %s: %s", src, dest, strerror(errno));
         if (in) fclose(in);
         if (out) fclose(out);
+        free(buffer);
         return -1;
     }
 
-    char buffer[BUFFER_SIZE];
     size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), in)) > 0) {
-        if (fwrite(buffer, 1, bytes, out) != bytes) {
+    if (out && lines) linededup_begin(lines, out, 1);
+    pipeline_entry_begin(pipe, NULL);
+    while ((bytes = fread(buffer, 1, buffer_size, in)) > 0) {
+        pipeline_entry_data(pipe, buffer, bytes);
+        if (out && (lines ? linededup_write(lines, buffer, bytes) != 0 : fwrite(buffer, 1, bytes, out) != bytes)) {
             log_error("Failed to write during copy to %s: %s", dest, strerror(errno));
             fclose(in);
             fclose(out);
+            free(buffer);
             return -1;
         }
     }
+    pipeline_entry_end(pipe);
 
     fclose(in);
-    fclose(out);
+    free(buffer);
+    if (out && lines) return close_deduped(lines, out, dest, cfg);
+    if (out) fclose(out);
     return 0;
 }
 
-// Thread function to process a file
-void *process_file(void *arg) {
-    FileTask *task = (FileTask *)arg;
+// Hash-only pass over the start of the input for the near-duplicate check:
+// entries are decompressed and sketched under the same filters and watchdog as
+// extract_archive, but nothing is written or parsed. The pass stops after
+// neardup_sample_mb, so the decision costs a bounded read, not a second full one.
+int sketch_input(const char *filename, const Config *cfg, int archive, NearDupSketch *sketch) {
+    neardup_begin(sketch);
+    long long left = cfg->neardup_sample_mb > 0 ? cfg->neardup_sample_mb << 20 : LLONG_MAX;
+    ArchiveSource *src = malloc(sizeof(ArchiveSource) + cfg->read_block_size);
+    if (!src) return -1;
+    src->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (src->fd == -1) {
+        free(src);
+        return -1;
+    }
+    if (!archive) {
+        ssize_t n = 0;
+        size_t want;
+        while ((want = left < cfg->read_block_size ? (size_t)left : (size_t)cfg->read_block_size) > 0 &&
+               (n = read(src->fd, src->buffer, want)) > 0) {
+            neardup_feed(sketch, src->buffer, (size_t)n);
+            left -= n;
+        }
+        neardup_entry_end(sketch);
+        close(src->fd);
+        free(src);
+        return n == 0 ? 0 : -1;
+    }
+
+    src->timeout_sec = cfg->entry_timeout_sec;
+    src->block_size = cfg->read_block_size;
+    src->deadline = time(NULL) + src->timeout_sec;
+    src->pipe = NULL;
+    src->spool = NULL;
+    src->spool_buffer = NULL;
+    struct archive *a = archive_read_new();
+    archive_read_support_format_all(a);
+    archive_read_support_filter_all(a);
+    if (archive_read_open(a, src, NULL, archive_source_read, archive_source_close) != ARCHIVE_OK) {
+        free_archive(a, src);
+        return -1;
+    }
+
+    struct archive_entry *entry;
+    int r = ARCHIVE_EOF;
+    while (left > 0 && (r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+        src->deadline = time(NULL) + src->timeout_sec;
+        const char *pathname = archive_entry_pathname(entry);
+        if (archive_entry_filetype(entry) == AE_IFDIR || !config_name_allowed(cfg, pathname) ||
+            (cfg->max_entry_bytes > 0 && archive_entry_size_is_set(entry) &&
+             archive_entry_size(entry) > cfg->max_entry_bytes)) {
+            continue;
+        }
+        const void *buff;
+        size_t size;
+        int64_t offset;
+        while ((r = archive_read_data_block(a, &buff, &size, &offset)) == ARCHIVE_OK) {
+            if (watchdog_expired(a, src)) {
+                r = ARCHIVE_FATAL;
+                break;
+            }
+            neardup_feed(sketch, buff, size < (unsigned long long)left ? size : (size_t)left);
+            left -= size < (unsigned long long)left ? (long long)size : left;
+            if (left == 0) break;
+        }
+        neardup_entry_end(sketch);
+        if (r <= ARCHIVE_FAILED) break;
+    }
+    free_archive(a, src);
+    return r == ARCHIVE_EOF || left == 0 ? 0 : -1;
+}
+
+// Process a single file task (extract archive or copy plain file)
+int process_file(FileTask *task, const Config *cfg) {
     const char *file_path = task->file_path;
-    const char *output_dir = "extracted";
+    const char *output_dir = cfg->output_dir;
+    int rc = 0;
 
     log_info("Processing file: %s", file_path);
 
     if (access(file_path, F_OK) == -1) {
         log_error("File does not exist: %s", file_path);
-        free(task->file_path);
-        free(task);
-        return NULL;
+        return -1;
     }
 
-    if (is_archive(file_path)) {
+    // Reposts of an input already processed are caught before anything is parsed.
+    // An input that fails to sketch is processed normally and reports its own error.
+    int archive = is_archive(file_path);
+    NearDupSketch sketch;
+    int sketched = 0;
+    // The store opens here when a reload turned the check on
+    if (cfg->neardup_threshold > 0 && cfg->neardup_store[0] && neardup_open(cfg->neardup_store) == 0 &&
+        (archive || config_name_allowed(cfg, file_path)) && sketch_input(file_path, cfg, archive, &sketch) == 0) {
+        char match[256];
+        int similarity = neardup_match(&sketch, cfg->neardup_threshold, file_path, match, sizeof(match));
+        sketched = similarity == 0;
+        if (similarity > 0) {
+            log_warning("%s is a near-duplicate of %s: %d%% of its line sketch matches", file_path, match,
+                        similarity);
+            // The sketch cannot tell which lines are new, so skipping drops them along with the rest
+            if (cfg->neardup_skip) {
+                log_info("Skipping near-duplicate %s", file_path);
+                return 0;
+            }
+        }
+    }
+
+    Pipeline *pipe = pipeline_open(cfg, file_path, 1);
+    LineDedup *lines = NULL;
+    if (cfg->line_dedup != LINE_DEDUP_NONE && cfg->output_mode != OUTPUT_NONE) {
+        lines = linededup_open((size_t)cfg->line_dedup_memory_mb << 20);
+    }
+
+    if (archive) {
         log_info("File %s is an archive. Starting extraction...", file_path);
-        if (extract_archive(file_path, output_dir) == 0) {
+        if (extract_archive(file_path, cfg, pipe, lines) == 0) {
             log_info("Extraction completed successfully for %s to %s", file_path, output_dir);
         } else {
+            snprintf(task->failure_reason, sizeof(task->failure_reason), "%s", last_error);
             log_error("Extraction failed for %s", file_path);
+            rc = -1;
         }
+    } else if (!config_name_allowed(cfg, file_path)) {
+        log_info("Skipping %s: excluded by extension filters", file_path);
+    } else if (cfg->output_mode == OUTPUT_NONE && !pipe) {
+        log_info("Skipping copy of non-archive file %s: output_mode is none", file_path);
     } else {
         log_warning("File %s is not an archive", file_path);
-        char dest_path[1024];
+        int write_copy = cfg->output_mode != OUTPUT_NONE;
+        char dest_path[PATH_MAX + 256];
         const char *base_name = strrchr(file_path, '/') ? strrchr(file_path, '/') + 1 : file_path;
         snprintf(dest_path, sizeof(dest_path), "%s/%s", output_dir, base_name);
-        if (mkdir_p(output_dir, 0777) == -1) {
+        if (write_copy && mkdir_p(output_dir, 0777) == -1) {
             log_error("Failed to create output directory for %s: %s", file_path, strerror(errno));
-            free(task->file_path);
-            free(task);
-            return NULL;
-        }
-        if (copy_file(file_path, dest_path) != 0) {
+            rc = -1;
+        } else if (copy_file(file_path, write_copy ? dest_path : NULL, cfg, pipe, lines) != 0) {
+            snprintf(task->failure_reason, sizeof(task->failure_reason), "%s", last_error);
             log_error("Failed to copy non-archive file %s", file_path);
-        } else {
+            rc = -1;
+        } else if (write_copy) {
             log_info("Copied non-archive file %s to %s", file_path, dest_path);
         }
     }
 
-    free(task->file_path);
-    free(task);
-    return NULL;
+    linededup_close(lines);
+    if (pipeline_close(pipe, rc == 0) != 0 && rc == 0) {
+        log_error("Failed to write pipeline output for %s", file_path);
+        rc = -1;
+    }
+    // Only inputs that went through completely are worth matching later ones against
+    if (rc == 0 && sketched) neardup_add(&sketch, file_path);
+    return rc;
 }
 
-// Add a file task to the queue
-int enqueue_file(const char *file_path) {
-    pthread_mutex_lock(&queue_mutex);
-    if (queue_size >= MAX_FILES) {
-        pthread_mutex_unlock(&queue_mutex);
-        log_error("Queue full, cannot enqueue %s", file_path);
-        return -1;
-    }
+// Add a task to the queue; local tasks wait while it is full, deliveries never do.
+// A path that is already in flight is not queued again; the request waits on the running task.
+int enqueue_delivery(const char *file_path, amqp_channel_t channel, uint64_t delivery_tag, int attempts) {
+    int rc = inflight_begin(file_path, channel, delivery_tag);
+    if (rc != 0) return rc == 1 ? 0 : -1;
 
     FileTask *task = malloc(sizeof(FileTask));
     if (!task) {
-        pthread_mutex_unlock(&queue_mutex);
         log_error("Failed to allocate memory for task %s", file_path);
+        inflight_finish(file_path);
         return -1;
     }
 
     task->file_path = strdup(file_path);
     if (!task->file_path) {
         free(task);
-        pthread_mutex_unlock(&queue_mutex);
         log_error("Failed to duplicate path for %s", file_path);
+        inflight_finish(file_path);
+        return -1;
+    }
+    task->channel = channel;
+    task->delivery_tag = delivery_tag;
+    task->attempts = attempts;
+    task->failure_reason[0] = '\0';
+
+    if (taskqueue_push(task) != 0) {
+        free(task->file_path);
+        free(task);
+        inflight_finish(file_path);
         return -1;
     }
+    return 0;
+}
+
+int enqueue_file(const char *file_path, amqp_channel_t channel, uint64_t delivery_tag) {
+    return enqueue_delivery(file_path, channel, delivery_tag, 0);
+}
+
+// Hand a finished delivery back to the consumer thread, which owns the connection
+void complete_delivery(amqp_channel_t channel, uint64_t delivery_tag, const char *file_path,
+                       DeliveryOutcome outcome, int attempts, long delay_ms, const char *reason) {
+    pthread_mutex_lock(&ack_mutex);
+    // The broker requeued the deliveries of a closed connection when it closed
+    if (delivery_tag >> DELIVERY_GENERATION_SHIFT != broker_generation) {
+        pthread_mutex_unlock(&ack_mutex);
+        return;
+    }
+    AckEntry *entry = &ack_queue[ack_size++];
+    entry->channel = channel;
+    entry->delivery_tag = delivery_tag;
+    entry->outcome = outcome;
+    entry->attempts = attempts;
+    entry->delay_ms = delay_ms;
+    entry->file_path = outcome == OUTCOME_ACK ? NULL : strdup(file_path);
+    entry->reason = outcome == OUTCOME_ACK ? NULL : strdup(reason);
+    pthread_mutex_unlock(&ack_mutex);
+}
+
+// Republish a failed delivery to the retry queue (delayed by a per-message TTL
+// that dead-letters it back to the input queue) or to the dead-letter queue
+int publish_failure(amqp_connection_state_t conn, const char *queue_name, AckEntry *entry) {
+    char routing_key[320];
+    char expiration[32];
+
+    amqp_table_entry_t headers[2];
+    headers[0].key = amqp_cstring_bytes("x-retry-count");
+    headers[0].value.kind = AMQP_FIELD_KIND_I32;
+    headers[0].value.value.i32 = entry->attempts;
+    headers[1].key = amqp_cstring_bytes("x-failure-reason");
+    headers[1].value.kind = AMQP_FIELD_KIND_UTF8;
+    headers[1].value.value.bytes = amqp_cstring_bytes(entry->reason ? entry->reason : "");
+
+    amqp_basic_properties_t props;
+    memset(&props, 0, sizeof(props));
+    props._flags = AMQP_BASIC_HEADERS_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+    props.headers.num_entries = 2;
+    props.headers.entries = headers;
+    props.delivery_mode = 2;  // Persistent
+
+    if (entry->outcome == OUTCOME_RETRY) {
+        snprintf(routing_key, sizeof(routing_key), "%s.retry", queue_name);
+        snprintf(expiration, sizeof(expiration), "%ld", entry->delay_ms);
+        props._flags |= AMQP_BASIC_EXPIRATION_FLAG;
+        props.expiration = amqp_cstring_bytes(expiration);
+    } else {
+        snprintf(routing_key, sizeof(routing_key), "%s", DEAD_LETTER_QUEUE);
+    }
+
+    int status = amqp_basic_publish(conn, entry->channel, amqp_cstring_bytes(""), amqp_cstring_bytes(routing_key),
+                                    0, 0, &props, amqp_cstring_bytes(entry->file_path));
+    if (status != AMQP_STATUS_OK) {
+        log_error("Failed to publish %s to %s: %s", entry->file_path, routing_key, amqp_error_string2(status));
+        return -1;
+    }
+    return 0;
+}
+
+// Settle every delivery the workers have finished since the last call
+void flush_acks(amqp_connection_state_t conn, const char *queue_name) {
+    AckEntry *pending;
+    int count;
+
+    pthread_mutex_lock(&ack_mutex);
+    pending = ack_queue;
+    count = ack_size;
+    ack_queue = ack_spare;
+    ack_spare = pending;
+    ack_size = 0;
+    pthread_mutex_unlock(&ack_mutex);
+
+    for (int i = 0; i < count; i++) {
+        int status;
+        uint64_t tag = pending[i].delivery_tag & DELIVERY_TAG_MASK;
+        if (pending[i].outcome != OUTCOME_ACK && publish_failure(conn, queue_name, &pending[i]) != 0) {
+            // Could not park it elsewhere; let the broker redeliver it instead of losing it
+            status = amqp_basic_nack(conn, pending[i].channel, tag, 0, 1);
+        } else {
+            status = amqp_basic_ack(conn, pending[i].channel, tag, 0);
+        }
+        if (status != AMQP_STATUS_OK) {
+            log_error("Failed to settle delivery %llu on channel %d: %s",
+                      (unsigned long long)tag, pending[i].channel, amqp_error_string2(status));
+        }
+        free(pending[i].file_path);
+        free(pending[i].reason);
+    }
+}
+
+// Publish the watchlist hits reported since the last call to the hits queue
+void publish_hits(amqp_connection_state_t conn) {
+    WatchHit *hit = watchlist_take_hits();
+    if (!hit) return;
+
+    amqp_basic_properties_t props;
+    memset(&props, 0, sizeof(props));
+    props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+    props.content_type = amqp_cstring_bytes("application/json");
+    props.delivery_mode = 2;  // Persistent
+
+    while (hit) {
+        int status = amqp_basic_publish(conn, 1, amqp_cstring_bytes(""), amqp_cstring_bytes(WATCHLIST_HITS_QUEUE),
+                                        0, 0, &props, amqp_cstring_bytes(hit->body));
+        if (status != AMQP_STATUS_OK) {
+            log_error("Failed to publish watchlist hit %s: %s", hit->body, amqp_error_string2(status));
+        }
+        WatchHit *next = hit->next;
+        free(hit->body);
+        free(hit);
+        hit = next;
+    }
+}
+
+// Worker thread: pull tasks off the queue until the process exits
+void *worker_thread(void *arg) {
+    (void)arg;
+    FileTask *task;
+    while ((task = taskqueue_pop()) != NULL) {
+        DeliveryOutcome outcome;
+
+        // Identical content already being processed under another path: wait on that task
+        uint64_t content_key;
+        if (fingerprint_file(task->file_path, &content_key) == 0 &&
+            inflight_bind_content(task->file_path, content_key, task->channel, task->delivery_tag)) {
+            free(task->file_path);
+            free(task);
+            continue;
+        }
 
-    file_queue[queue_rear] = task;
-    queue_rear = (queue_rear + 1) % MAX_FILES;
-    queue_size++;
-    pthread_cond_signal(&queue_not_empty);
-    pthread_mutex_unlock(&queue_mutex);
+        Config *cfg = config_acquire();
+        if (task->attempts > cfg->max_retries) {
+            log_warning("Skipping quarantined file %s", task->file_path);
+            if (task->channel != 0) {
+                complete_delivery(task->channel, task->delivery_tag, task->file_path,
+                                  OUTCOME_DEAD, task->attempts, 0, "quarantined");
+            }
+            outcome = OUTCOME_DEAD;
+        } else if (process_file(task, cfg) == 0) {
+            failure_clear(task->file_path);
+            if (task->channel != 0) {
+                complete_delivery(task->channel, task->delivery_tag, NULL, OUTCOME_ACK, 0, 0, NULL);
+            }
+            outcome = OUTCOME_ACK;
+        } else {
+            if (!task->failure_reason[0]) snprintf(task->failure_reason, sizeof(task->failure_reason), "%s", last_error);
+            outcome = handle_failure(task, cfg);
+        }
+        // Watched files (channel 0) are not queued again by the next startup scan
+        if (task->channel == 0 && outcome != OUTCOME_RETRY) watch_mark_processed(task->file_path);
+        settle_waiters(inflight_finish(task->file_path), task, outcome, cfg);
+        config_release(cfg);
+        free(task->file_path);
+        free(task);
+    }
+    return NULL;
+}
+
+int check_rpc_reply(amqp_connection_state_t conn, const char *context) {
+    amqp_rpc_reply_t reply = amqp_get_rpc_reply(conn);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+        log_error("Failed to %s: %s", context, amqp_error_string2(reply.library_error));
+        return -1;
+    }
     return 0;
 }
 
-// Dequeue a file task from the queue
-FileTask *dequeue_file() {
-    pthread_mutex_lock(&queue_mutex);
-    while (queue_size == 0) {
-        pthread_cond_wait(&queue_not_empty, &queue_mutex);
+// Declare <queue>.retry, whose expired messages dead-letter back into the input
+// queue, and the shared dead-letter queue for quarantined files
+int declare_failure_queues(amqp_connection_state_t conn, amqp_channel_t channel, const char *queue_name) {
+    char retry_queue[320];
+    snprintf(retry_queue, sizeof(retry_queue), "%s.retry", queue_name);
+
+    amqp_table_entry_t retry_args[2];
+    retry_args[0].key = amqp_cstring_bytes("x-dead-letter-exchange");
+    retry_args[0].value.kind = AMQP_FIELD_KIND_UTF8;
+    retry_args[0].value.value.bytes = amqp_cstring_bytes("");
+    retry_args[1].key = amqp_cstring_bytes("x-dead-letter-routing-key");
+    retry_args[1].value.kind = AMQP_FIELD_KIND_UTF8;
+    retry_args[1].value.value.bytes = amqp_cstring_bytes(queue_name);
+    amqp_table_t retry_table = {2, retry_args};
+
+    amqp_queue_declare(conn, channel, amqp_cstring_bytes(retry_queue), 0, 1, 0, 0, retry_table);
+    if (check_rpc_reply(conn, "declare retry queue") != 0) return -1;
+
+    amqp_queue_declare(conn, channel, amqp_cstring_bytes(DEAD_LETTER_QUEUE), 0, 1, 0, 0, amqp_empty_table);
+    return check_rpc_reply(conn, "declare dead-letter queue");
+}
+
+// Declare the queue this replica consumes from and write its name into queue_name.
+// Without hash_exchange all replicas compete on the shared file_queue.
+// With it, each replica owns file_queue.<replica_id> bound to an x-consistent-hash
+// exchange that hashes the routing key. Publishers use the dump's content hash (or the
+// common key of a split-volume set) as the routing key, so every duplicate of a dump and
+// every volume of a split set lands on the same replica.
+int declare_input_queue(amqp_connection_state_t conn, amqp_channel_t channel, const Config *cfg,
+                        char *queue_name, size_t len) {
+    const char *exchange = cfg->hash_exchange;
+    if (!*exchange) {
+        snprintf(queue_name, len, "file_queue");
+        amqp_queue_declare(conn, channel, amqp_cstring_bytes(queue_name), 0, 0, 0, 1, amqp_empty_table);
+        if (check_rpc_reply(conn, "declare queue") != 0) return -1;
+        return declare_failure_queues(conn, channel, queue_name);
     }
 
-    FileTask *task = file_queue[queue_front];
-    queue_front = (queue_front + 1) % MAX_FILES;
-    queue_size--;
-    pthread_mutex_unlock(&queue_mutex);
-    return task;
+    snprintf(queue_name, len, "file_queue.%s", cfg->replica_id);
+
+    // No hash-header argument: the exchange hashes the routing key, which every publisher sets
+    amqp_exchange_declare(conn, channel, amqp_cstring_bytes(exchange), amqp_cstring_bytes("x-consistent-hash"),
+                          0, 1, 0, 0, amqp_empty_table);
+    if (check_rpc_reply(conn, "declare consistent-hash exchange") != 0) return -1;
+
+    // Durable and not auto-deleted: deliveries hashed to this replica wait for it across restarts,
+    // which is why replica_id must be stable (validate() requires it)
+    amqp_queue_declare(conn, channel, amqp_cstring_bytes(queue_name), 0, 1, 0, 0, amqp_empty_table);
+    if (check_rpc_reply(conn, "declare replica queue") != 0) return -1;
+
+    // For consistent-hash exchanges the binding key is this replica's weight on the ring
+    char weight[16];
+    snprintf(weight, sizeof(weight), "%d", cfg->hash_weight);
+    amqp_queue_bind(conn, channel, amqp_cstring_bytes(queue_name), amqp_cstring_bytes(exchange),
+                    amqp_cstring_bytes(weight), amqp_empty_table);
+    if (check_rpc_reply(conn, "bind replica queue") != 0) return -1;
+
+    log_info("Consuming from %s bound to consistent-hash exchange %s", queue_name, exchange);
+    return declare_failure_queues(conn, channel, queue_name);
 }
 
-// RabbitMQ connection and callback (updated for rabbitmq-c)
-void consume_messages() {
-    amqp_connection_state_t conn;
-    amqp_socket_t *socket = NULL;
-    amqp_channel_t channel = 1;
-    amqp_frame_t frame;  // Declare frame here
+// Attempts recorded by earlier consumers in the x-retry-count header
+int delivery_retry_count(amqp_envelope_t *envelope) {
+    if (!(envelope->message.properties._flags & AMQP_BASIC_HEADERS_FLAG)) return 0;
+
+    amqp_table_t *headers = &envelope->message.properties.headers;
+    for (int i = 0; i < headers->num_entries; i++) {
+        amqp_table_entry_t *entry = &headers->entries[i];
+        if (entry->key.len != 13 || memcmp(entry->key.bytes, "x-retry-count", 13) != 0) continue;
+        if (entry->value.kind == AMQP_FIELD_KIND_I32) return entry->value.value.i32;
+        if (entry->value.kind == AMQP_FIELD_KIND_I64) return (int)entry->value.value.i64;
+    }
+    return 0;
+}
 
-    conn = amqp_new_connection();
-    socket = amqp_tcp_socket_new(conn);  // Correct API for rabbitmq-c
+// Grow the ack queue to hold every delivery the prefetch lets the broker push.
+// Called on the consumer thread, which is the only one that swaps the two buffers.
+int reserve_acks(int unacked_max) {
+    if (unacked_max <= ack_capacity) return 0;
+    pthread_mutex_lock(&ack_mutex);
+    AckEntry *queue = realloc(ack_queue, unacked_max * sizeof(AckEntry));
+    if (queue) ack_queue = queue;
+    AckEntry *spare = realloc(ack_spare, unacked_max * sizeof(AckEntry));
+    if (spare) ack_spare = spare;
+    if (queue && spare) ack_capacity = unacked_max;
+    pthread_mutex_unlock(&ack_mutex);
+    if (!queue || !spare) {
+        log_error("Failed to grow ack queue to %d entries", unacked_max);
+        return -1;
+    }
+    return 0;
+}
+
+// Apply a reloaded channel_prefetch with basic.qos on every channel. The ack
+// queue grows first, so it never holds fewer entries than the broker may push.
+// Deliveries already past a lowered prefetch stay queued; the broker sends no
+// more until enough of them are acked.
+int apply_prefetch(amqp_connection_state_t conn, int channels, int *applied) {
+    Config *cfg = config_acquire();
+    int prefetch = cfg->channel_prefetch;
+    config_release(cfg);
+    if (prefetch == *applied) return 0;
+
+    if (reserve_acks(channels * prefetch) != 0) return 0;  // Keep the old prefetch
+    for (amqp_channel_t channel = 1; channel <= channels; channel++) {
+        amqp_basic_qos(conn, channel, 0, prefetch, 0);
+        if (check_rpc_reply(conn, "set channel prefetch") != 0) return -1;
+    }
+    log_info("Channel prefetch changed from %d to %d", *applied, prefetch);
+    *applied = prefetch;
+    return 0;
+}
+
+// Log in and start consuming on consumer_channels channels with bounded prefetch.
+// On failure the caller destroys the connection.
+int broker_connect(amqp_connection_state_t conn, const Config *cfg, char *queue_name, size_t queue_name_size) {
+    amqp_socket_t *socket = amqp_tcp_socket_new(conn);
     if (!socket) {
         log_error("Failed to create socket");
-        return;
+        return -1;
     }
 
-    int status = amqp_socket_open(socket, "rabbitmq", 5672);
+    int status = amqp_socket_open(socket, cfg->rabbitmq_host, cfg->rabbitmq_port);
     if (status != AMQP_STATUS_OK) {
-        log_error("Failed to open socket to rabbitmq: %s", amqp_error_string2(status));
-        amqp_destroy_connection(conn);
-        return;
+        log_error("Failed to open socket to %s: %s", cfg->rabbitmq_host, amqp_error_string2(status));
+        return -1;
     }
 
-    amqp_rpc_reply_t reply = amqp_login(conn, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, "guest", "guest");
+    amqp_rpc_reply_t reply = amqp_login(conn, cfg->rabbitmq_vhost, 0, 131072, BROKER_HEARTBEAT_SEC,
+                                        AMQP_SASL_METHOD_PLAIN, cfg->rabbitmq_user, cfg->rabbitmq_password);
     if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
         log_error("Failed to login to RabbitMQ: %s", amqp_error_string2(reply.library_error));
-        amqp_destroy_connection(conn);
-        return;
+        return -1;
     }
 
-    amqp_channel_open(conn, channel);
-    reply = amqp_get_rpc_reply(conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
-        log_error("Failed to open channel: %s", amqp_error_string2(reply.library_error));
-        amqp_channel_close(conn, channel, AMQP_REPLY_SUCCESS);
-        amqp_connection_close(conn, AMQP_REPLY_SUCCESS);
-        amqp_destroy_connection(conn);
-        return;
-    }
+    for (amqp_channel_t channel = 1; channel <= cfg->consumer_channels; channel++) {
+        amqp_channel_open(conn, channel);
+        if (check_rpc_reply(conn, "open channel") != 0) return -1;
 
-    amqp_queue_declare(conn, channel, amqp_cstring_bytes("file_queue"), 0, 0, 0, 1, amqp_empty_table);
-    reply = amqp_get_rpc_reply(conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
-        log_error("Failed to declare queue: %s", amqp_error_string2(reply.library_error));
-        goto cleanup;
+        if (channel == 1) {
+            if (declare_input_queue(conn, channel, cfg, queue_name, queue_name_size) != 0) return -1;
+            amqp_queue_declare(conn, channel, amqp_cstring_bytes(WATCHLIST_HITS_QUEUE), 0, 1, 0, 0, amqp_empty_table);
+            if (check_rpc_reply(conn, "declare watchlist hits queue") != 0) return -1;
+            watchlist_enable_publish();
+        }
+
+        amqp_basic_qos(conn, channel, 0, cfg->channel_prefetch, 0);
+        if (check_rpc_reply(conn, "set channel prefetch") != 0) return -1;
+
+        amqp_basic_consume(conn, channel, amqp_cstring_bytes(queue_name), amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
+        if (check_rpc_reply(conn, "consume from queue") != 0) return -1;
     }
 
-    amqp_basic_consume(conn, channel, amqp_cstring_bytes("file_queue"), amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
-    reply = amqp_get_rpc_reply(conn);
-    if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
-        log_error("Failed to consume from queue: %s", amqp_error_string2(reply.library_error));
-        goto cleanup;
+    log_info("Consuming %s on %d channels (prefetch %d)", queue_name, cfg->consumer_channels, cfg->channel_prefetch);
+    return 0;
+}
+
+// Start a new connection generation. Settlements still queued for the old one
+// are dropped: the broker requeued its unacked deliveries when it closed, and
+// their tags mean nothing on the next connection. Returns the new generation.
+uint64_t drop_pending_acks(void) {
+    pthread_mutex_lock(&ack_mutex);
+    if (ack_size > 0) {
+        log_warning("Dropping %d settlements of a closed RabbitMQ connection; the broker redelivers them", ack_size);
+    }
+    for (int i = 0; i < ack_size; i++) {
+        free(ack_queue[i].file_path);
+        free(ack_queue[i].reason);
     }
+    ack_size = 0;
+    broker_generation = (broker_generation + 1) & ((1ULL << (64 - DELIVERY_GENERATION_SHIFT)) - 1);
+    uint64_t generation = broker_generation;
+    pthread_mutex_unlock(&ack_mutex);
+    return generation;
+}
 
+// Hand deliveries to the workers and settle finished ones until the connection fails
+void consume_connection(amqp_connection_state_t conn, const char *queue_name, int channels, int prefetch,
+                        uint64_t generation) {
     while (1) {
+        if (apply_prefetch(conn, channels, &prefetch) != 0) return;
+        flush_acks(conn, queue_name);
+        publish_hits(conn);
         amqp_maybe_release_buffers(conn);
-        int frame_status = amqp_simple_wait_frame(conn, &frame);  // Returns int, not amqp_rpc_reply_t
-        if (frame_status != AMQP_STATUS_OK) {
-            log_error("RabbitMQ error: %s", amqp_error_string2(frame_status));
-            break;
+
+        // Short timeout so finished deliveries are acked promptly even when idle
+        amqp_envelope_t envelope;
+        struct timeval timeout = {0, ACK_FLUSH_INTERVAL_US};
+        amqp_rpc_reply_t reply = amqp_consume_message(conn, &envelope, &timeout, 0);
+        if (reply.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION && reply.library_error == AMQP_STATUS_TIMEOUT) {
+            continue;
+        }
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+            log_error("RabbitMQ error: %s", amqp_error_string2(reply.library_error));
+            return;
         }
 
-        if (frame.frame_type == AMQP_FRAME_METHOD && frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD) {
-            amqp_message_t message;
-            reply = amqp_read_message(conn, channel, &message, 0);
-            if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
-                log_error("Failed to read message: %s", amqp_error_string2(reply.library_error));
-                continue;
-            }
+        // A redelivery means the previous consumer died or hung on it; charge it an attempt
+        int attempts = delivery_retry_count(&envelope) + (envelope.redelivered ? 1 : 0);
+        uint64_t tag = envelope.delivery_tag | generation << DELIVERY_GENERATION_SHIFT;
 
-            char *file_path = strndup((char *)message.body.bytes, message.body.len);
-            if (file_path) {
-                enqueue_file(file_path);
-                free(file_path);
-            }
+        char *file_path = strndup((char *)envelope.message.body.bytes, envelope.message.body.len);
+        if (!file_path || enqueue_delivery(file_path, envelope.channel, tag, attempts) != 0) {
+            // Give the delivery back to the broker so another consumer can take it
+            amqp_basic_reject(conn, envelope.channel, envelope.delivery_tag, 1);
+        }
+        free(file_path);
+        amqp_destroy_envelope(&envelope);
+    }
+}
+
+// RabbitMQ consumer. Deliveries are acked only after a worker finishes them, so
+// the broker spreads work across replicas according to their real free capacity.
+// A lost connection is reopened with backoff while the workers carry on.
+void *consume_messages(void *arg) {
+    (void)arg;
+    char queue_name[300];
+    Config *cfg = config_acquire();  // Connection settings are startup-only
+
+    // Every unacked delivery may be waiting in the ack queue at once
+    if (reserve_acks(cfg->consumer_channels * cfg->channel_prefetch) != 0) {
+        log_error("Failed to allocate ack queue; exiting");
+        exit(1);
+    }
 
-            amqp_destroy_message(&message);
-            amqp_basic_ack(conn, channel, frame.payload.method.id, 0);
+    long delay_ms = RECONNECT_MIN_DELAY_MS;
+    while (1) {
+        uint64_t generation = drop_pending_acks();
+        amqp_connection_state_t conn = amqp_new_connection();
+        if (!conn) {
+            log_error("Failed to allocate RabbitMQ connection; exiting");
+            exit(1);
+        }
+        if (broker_connect(conn, cfg, queue_name, sizeof(queue_name)) == 0) {
+            delay_ms = RECONNECT_MIN_DELAY_MS;
+            consume_connection(conn, queue_name, cfg->consumer_channels, cfg->channel_prefetch, generation);
         }
+        // The broker may already be gone, so the connection is dropped rather than closed
+        amqp_destroy_connection(conn);
+
+        log_warning("Reconnecting to RabbitMQ at %s in %ld ms", cfg->rabbitmq_host, delay_ms);
+        struct timespec pause = {delay_ms / 1000, (delay_ms % 1000) * 1000000};
+        nanosleep(&pause, NULL);
+        delay_ms = delay_ms * 2 < RECONNECT_MAX_DELAY_MS ? delay_ms * 2 : RECONNECT_MAX_DELAY_MS;
     }
+}
 
-cleanup:
-    amqp_channel_close(conn, channel, AMQP_REPLY_SUCCESS);
-    amqp_connection_close(conn, AMQP_REPLY_SUCCESS);
-    amqp_destroy_connection(conn);
+void *watch_thread(void *arg) {
+    watch_directory((const char *)arg);
+    return NULL;
+}
+
+void *lookup_thread(void *arg) {
+    lookup_serve((const char *)arg);
+    return NULL;
+}
+
+// domain_index_dir and the merge factor only take effect on restart
+void *domain_merge_thread(void *arg) {
+    (void)arg;
+    Config *cfg = config_acquire();
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", cfg->domain_index_dir);
+    int factor = cfg->domain_index_merge_factor;
+    config_release(cfg);
+    domindex_serve_merges(dir, factor);
+    return NULL;
+}
+
+// Like the domain merger, it merges in the record_dir set at startup
+void *identity_merge_thread(void *arg) {
+    (void)arg;
+    Config *cfg = config_acquire();
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", cfg->record_dir);
+    int factor = cfg->identity_index_merge_factor;
+    config_release(cfg);
+    idindex_serve_merges(dir, factor);
+    return NULL;
+}
+
+int apply_config(void) {
+    Config *cfg = config_acquire();
+    int rc = taskqueue_resize(cfg->queue_depth);
+    if (rc == 0) rc = taskqueue_resize_workers(cfg->workers, worker_thread);
+    // A watchlist that fails to load leaves the previous one active
+    if (rc == 0) watchlist_load(cfg->watchlist_dir);
+    // Rescanning picks up index files compacted or removed by hand
+    if (rc == 0) idindex_load(cfg->record_dir);
+    config_release(cfg);
+    return rc;
 }
 
 int main() {
-    pthread_t threads[MAX_FILES];
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (pthread_create(&threads[i], NULL, process_file, NULL) != 0) {
-            log_error("Failed to create thread %d", i);
-            return 1;
-        }
+    if (config_init() != 0) {
+        log_error("Invalid configuration");
+        return 1;
+    }
+
+    // SIGHUP is only handled by sigwait below; block it before any thread inherits the mask
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+
+    if (apply_config() != 0) {
+        return 1;
+    }
+
+    // intake selects the feed: "amqp" (default), "watch" or "both"
+    Config *cfg = config_acquire();
+    int use_amqp = strcmp(cfg->intake, "watch") != 0;
+    int use_watch = strcmp(cfg->intake, "watch") == 0 || strcmp(cfg->intake, "both") == 0;
+    char *watch_dir = strdup(cfg->watch_dir);
+    char *lookup_socket = cfg->lookup_socket[0] ? strdup(cfg->lookup_socket) : NULL;
+    int merge_domains = cfg->domain_index_dir[0] != 0;
+    int merge_identities = cfg->record_dir[0] != 0;
+    // One dedup store for every replica, so a record is kept once whichever replica sees it
+    if (cfg->dedup_store[0] && dedup_open(cfg->dedup_store, cfg->dedup_bloom_bytes) != 0) {
+        log_error("Failed to open dedup store %s", cfg->dedup_store);
+        return 1;
+    }
+    // Likewise one near-duplicate store, so a repost is caught whichever replica it reaches
+    if (cfg->neardup_threshold > 0 && cfg->neardup_store[0] && neardup_open(cfg->neardup_store) != 0) {
+        log_error("Failed to open near-duplicate store %s", cfg->neardup_store);
+        return 1;
     }
+    config_release(cfg);
 
     // Start RabbitMQ consumer in a separate thread
     pthread_t consumer_thread;
-    if (pthread_create(&consumer_thread, NULL, (void *(*)(void *))consume_messages, NULL) != 0) {
+    if (use_amqp && pthread_create(&consumer_thread, NULL, consume_messages, NULL) != 0) {
         log_error("Failed to create consumer thread");
         return 1;
     }
 
-    // Wait for threads to finish (simplified; in practice, use signals or a shutdown mechanism)
-    for (int i = 0; i < MAX_FILES; i++) {
-        pthread_join(threads[i], NULL);
+    // Delayed re-enqueue of failed files that did not come from RabbitMQ
+    pthread_t retry_scheduler;
+    if (pthread_create(&retry_scheduler, NULL, retry_thread, NULL) != 0) {
+        log_error("Failed to create retry thread");
+        return 1;
+    }
+
+    // Start the directory watcher for broker-less intake
+    pthread_t watcher_thread;
+    if (use_watch && pthread_create(&watcher_thread, NULL, watch_thread, watch_dir) != 0) {
+        log_error("Failed to create watcher thread");
+        return 1;
+    }
+
+    // Identity lookups for the bot and search services
+    pthread_t lookup_server;
+    if (lookup_socket && pthread_create(&lookup_server, NULL, lookup_thread, lookup_socket) != 0) {
+        log_error("Failed to create lookup thread");
+        return 1;
+    }
+
+    // Background merging of the domain index segments written by each task
+    pthread_t domain_merger;
+    if (merge_domains && pthread_create(&domain_merger, NULL, domain_merge_thread, NULL) != 0) {
+        log_error("Failed to create domain index merge thread");
+        return 1;
+    }
+
+    // Background merging of the identity index files written by each task
+    pthread_t identity_merger;
+    if (merge_identities && pthread_create(&identity_merger, NULL, identity_merge_thread, NULL) != 0) {
+        log_error("Failed to create identity index merge thread");
+        return 1;
+    }
+
+    // Main thread handles configuration reloads for the lifetime of the process
+    while (1) {
+        int sig;
+        if (sigwait(&reload_signals, &sig) != 0) continue;
+        log_info("SIGHUP received, reloading configuration");
+        if (config_reload() == 0) {
+            apply_config();
+        }
     }
-    pthread_join(consumer_thread, NULL);
 
     return 0;
-}
\ No newline at end of file
+}
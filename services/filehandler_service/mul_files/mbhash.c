@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbhash.h"
+
+#define NTLM_BATCH 64  // Passwords converted to UTF-16LE per MD4 call
+
+static const uint32_t SHA1_IV[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+static const uint32_t MD4_IV[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint32_t load_le32(const uint8_t *p) {
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline void store_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// 64-byte blocks after padding: a 0x80 byte and the 64-bit bit length
+static inline size_t mb_block_count(size_t len) {
+    return (len + 8) / 64 + 1;
+}
+
+// Block i of the padded message: in place when it is all message bytes,
+// otherwise assembled in pad
+static inline const uint8_t *mb_block(const MbMessage *m, size_t i, uint8_t *pad, int big_endian) {
+    size_t start = i * 64;
+    if (start + 64 <= m->len) return m->data + start;
+    memset(pad, 0, 64);
+    if (start < m->len) memcpy(pad, m->data + start, m->len - start);
+    if (start <= m->len) pad[m->len - start] = 0x80;
+    if (i == mb_block_count(m->len) - 1) {
+        uint64_t bits = (uint64_t)m->len * 8;
+        for (int b = 0; b < 8; b++) pad[big_endian ? 63 - b : 56 + b] = (uint8_t)(bits >> (8 * b));
+    }
+    return pad;
+}
+
+#define LANES 1
+#define VEC vec1
+#define TARGET
+#define SUFFIX 1
+typedef uint32_t vec1 __attribute__((vector_size(4)));
+#include "mbhash_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+
+#ifdef __SSE2__
+#define LANES 4
+#define VEC vec4
+#define TARGET
+#define SUFFIX 4
+typedef uint32_t vec4 __attribute__((vector_size(16)));
+#include "mbhash_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+#endif
+
+// Wider lanes are compiled for their instruction set and picked at run time,
+// so the binary still runs on CPUs without them
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MBHASH_WIDE 1
+#define LANES 8
+#define VEC vec8
+#define TARGET __attribute__((target("avx2")))
+#define SUFFIX 8
+typedef uint32_t vec8 __attribute__((vector_size(32)));
+#include "mbhash_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+
+#define LANES 16
+#define VEC vec16
+#define TARGET __attribute__((target("avx512f")))
+#define SUFFIX 16
+typedef uint32_t vec16 __attribute__((vector_size(64)));
+#include "mbhash_lanes.h"
+#undef LANES
+#undef VEC
+#undef TARGET
+#undef SUFFIX
+#endif
+
+int mbhash_lanes(void) {
+#ifdef MBHASH_WIDE
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return 16;
+    if (__builtin_cpu_supports("avx2")) return 8;
+#endif
+#ifdef __SSE2__
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+void mbhash_sha1(const MbMessage *msgs, size_t count, uint8_t (*out)[20]) {
+    switch (mbhash_lanes()) {
+#ifdef MBHASH_WIDE
+    case 16:
+        sha1_lanes_16(msgs, count, out);
+        return;
+    case 8:
+        sha1_lanes_8(msgs, count, out);
+        return;
+#endif
+#ifdef __SSE2__
+    case 4:
+        sha1_lanes_4(msgs, count, out);
+        return;
+#endif
+    default:
+        sha1_lanes_1(msgs, count, out);
+    }
+}
+
+static void md4_many(const MbMessage *msgs, size_t count, uint8_t (*out)[16]) {
+    switch (mbhash_lanes()) {
+#ifdef MBHASH_WIDE
+    case 16:
+        md4_lanes_16(msgs, count, out);
+        return;
+    case 8:
+        md4_lanes_8(msgs, count, out);
+        return;
+#endif
+#ifdef __SSE2__
+    case 4:
+        md4_lanes_4(msgs, count, out);
+        return;
+#endif
+    default:
+        md4_lanes_1(msgs, count, out);
+    }
+}
+
+// UTF-8 to UTF-16LE; returns the bytes written to out (4 per input byte at most)
+static size_t to_utf16le(const uint8_t *s, size_t len, uint8_t *out) {
+    size_t o = 0;
+    for (size_t i = 0; i < len;) {
+        uint32_t cp = s[i];
+        size_t n = 1;
+        if (cp >= 0xc2 && cp <= 0xdf && i + 1 < len && (s[i + 1] & 0xc0) == 0x80) {
+            cp = (cp & 0x1f) << 6 | (s[i + 1] & 0x3f);
+            n = 2;
+        } else if (cp >= 0xe0 && cp <= 0xef && i + 2 < len && (s[i + 1] & 0xc0) == 0x80 &&
+                   (s[i + 2] & 0xc0) == 0x80) {
+            uint32_t v = (cp & 0x0f) << 12 | (s[i + 1] & 0x3f) << 6 | (s[i + 2] & 0x3f);
+            if (v >= 0x800 && (v < 0xd800 || v > 0xdfff)) {
+                cp = v;
+                n = 3;
+            }
+        } else if (cp >= 0xf0 && cp <= 0xf4 && i + 3 < len && (s[i + 1] & 0xc0) == 0x80 &&
+                   (s[i + 2] & 0xc0) == 0x80 && (s[i + 3] & 0xc0) == 0x80) {
+            uint32_t v = (cp & 0x07) << 18 | (s[i + 1] & 0x3f) << 12 | (s[i + 2] & 0x3f) << 6 | (s[i + 3] & 0x3f);
+            if (v >= 0x10000 && v <= 0x10ffff) {
+                cp = v;
+                n = 4;
+            }
+        }
+        i += n;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            uint32_t hi = 0xd800 | (cp >> 10), lo = 0xdc00 | (cp & 0x3ff);
+            out[o++] = (uint8_t)hi;
+            out[o++] = (uint8_t)(hi >> 8);
+            out[o++] = (uint8_t)lo;
+            out[o++] = (uint8_t)(lo >> 8);
+        } else {
+            out[o++] = (uint8_t)cp;
+            out[o++] = (uint8_t)(cp >> 8);
+        }
+    }
+    return o;
+}
+
+void mbhash_ntlm(const MbMessage *passwords, size_t count, uint8_t (*out)[16]) {
+    static __thread uint8_t wide[NTLM_BATCH][MBHASH_MAX_NTLM * 4];
+    MbMessage msgs[NTLM_BATCH];
+    for (size_t start = 0; start < count; start += NTLM_BATCH) {
+        size_t n = count - start < NTLM_BATCH ? count - start : NTLM_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            const MbMessage *p = &passwords[start + i];
+            msgs[i].data = wide[i];
+            // A cut password would hash to another password's digest
+            msgs[i].len = p->len > MBHASH_MAX_NTLM ? 0 : to_utf16le(p->data, p->len, wide[i]);
+        }
+        md4_many(msgs, n, out + start);
+        for (size_t i = 0; i < n; i++) {
+            if (passwords[start + i].len > MBHASH_MAX_NTLM) memset(out[start + i], 0, 16);
+        }
+    }
+}
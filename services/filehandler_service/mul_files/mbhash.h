@@ -0,0 +1,26 @@
+#ifndef MBHASH_H
+#define MBHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBHASH_MAX_NTLM 256  // Longest password mbhash_ntlm hashes, in bytes
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} MbMessage;
+
+// Hash count messages with as many SIMD lanes as the CPU offers (16 with
+// AVX-512, 8 with AVX2, 4 with SSE2), one message per lane. Batches of a
+// few dozen messages or more keep every lane busy.
+void mbhash_sha1(const MbMessage *msgs, size_t count, uint8_t (*out)[20]);
+// NTLM: MD4 over the UTF-16LE form of each password, taken as UTF-8 (bytes
+// that are not valid UTF-8 map to the code point of the same value). Longer
+// passwords than MBHASH_MAX_NTLM are not hashed: their digest is all zeros
+void mbhash_ntlm(const MbMessage *passwords, size_t count, uint8_t (*out)[16]);
+
+// Lanes in use, for logs
+int mbhash_lanes(void);
+
+#endif
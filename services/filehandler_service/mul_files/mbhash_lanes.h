@@ -0,0 +1,171 @@
+// Multi-buffer SHA-1 and MD4 over LANES messages at once, one message per
+// vector lane. Included by mbhash.c once per instruction set with LANES, VEC
+// (a GCC vector of LANES uint32_t), TARGET (function attributes) and SUFFIX
+// defined; no include guard on purpose.
+
+#define LANE_FN2(name, suffix) name##_##suffix
+#define LANE_FN1(name, suffix) LANE_FN2(name, suffix)
+#define LANE_FN(name) LANE_FN1(name, SUFFIX)
+
+// Message schedule kept as a 16-word ring in w
+#define SHA1_STEP(f, k)                                                               \
+    do {                                                                              \
+        VEC wi = w[i & 15];                                                           \
+        if (i >= 16) {                                                                \
+            VEC x = w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15]; \
+            wi = w[i & 15] = (x << 1) | (x >> 31);                                    \
+        }                                                                             \
+        VEC t = ((a << 5) | (a >> 27)) + (f) + e + (k) + wi;                          \
+        e = d;                                                                        \
+        d = c;                                                                        \
+        c = (b << 30) | (b >> 2);                                                     \
+        b = a;                                                                        \
+        a = t;                                                                        \
+    } while (0)
+
+// Lanes are refilled as soon as their message ends, so one long message only
+// keeps its own lane busy
+TARGET static void LANE_FN(sha1_lanes)(const MbMessage *msgs, size_t count, uint8_t (*out)[20]) {
+    VEC h[5], w[16];
+    size_t msg[LANES], block[LANES], blocks[LANES];
+    int active = 0;
+    size_t next = 0;
+    uint8_t pad[LANES][64];
+    for (int l = 0; l < LANES; l++) {
+        if (next < count) {
+            msg[l] = next++;
+            block[l] = 0;
+            blocks[l] = mb_block_count(msgs[msg[l]].len);
+            for (int i = 0; i < 5; i++) h[i][l] = SHA1_IV[i];
+            active++;
+        } else {
+            msg[l] = SIZE_MAX;
+            for (int i = 0; i < 5; i++) h[i][l] = 0;
+        }
+    }
+
+    while (active > 0) {
+        for (int l = 0; l < LANES; l++) {
+            if (msg[l] == SIZE_MAX) {
+                for (int i = 0; i < 16; i++) w[i][l] = 0;
+                continue;
+            }
+            const uint8_t *b = mb_block(&msgs[msg[l]], block[l], pad[l], 1);
+            for (int i = 0; i < 16; i++) w[i][l] = load_be32(b + 4 * i);
+        }
+
+        VEC a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 20; i++) SHA1_STEP(d ^ (b & (c ^ d)), 0x5a827999u);
+        for (int i = 20; i < 40; i++) SHA1_STEP(b ^ c ^ d, 0x6ed9eba1u);
+        for (int i = 40; i < 60; i++) SHA1_STEP((b & c) | (d & (b | c)), 0x8f1bbcdcu);
+        for (int i = 60; i < 80; i++) SHA1_STEP(b ^ c ^ d, 0xca62c1d6u);
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+
+        for (int l = 0; l < LANES; l++) {
+            if (msg[l] == SIZE_MAX || ++block[l] < blocks[l]) continue;
+            for (int i = 0; i < 5; i++) store_be32(out[msg[l]] + 4 * i, h[i][l]);
+            if (next < count) {
+                msg[l] = next++;
+                block[l] = 0;
+                blocks[l] = mb_block_count(msgs[msg[l]].len);
+                for (int i = 0; i < 5; i++) h[i][l] = SHA1_IV[i];
+            } else {
+                msg[l] = SIZE_MAX;
+                active--;
+            }
+        }
+    }
+}
+
+#define MD4_ROUND1(a, b, c, d, x, s) \
+    a += (d ^ (b & (c ^ d))) + (x);  \
+    a = (a << s) | (a >> (32 - s))
+#define MD4_ROUND2(a, b, c, d, x, s)                        \
+    a += ((b & c) | (b & d) | (c & d)) + (x) + 0x5a827999u; \
+    a = (a << s) | (a >> (32 - s))
+#define MD4_ROUND3(a, b, c, d, x, s)         \
+    a += (b ^ c ^ d) + (x) + 0x6ed9eba1u; \
+    a = (a << s) | (a >> (32 - s))
+
+TARGET static void LANE_FN(md4_lanes)(const MbMessage *msgs, size_t count, uint8_t (*out)[16]) {
+    VEC h[4], x[16];
+    size_t msg[LANES], block[LANES], blocks[LANES];
+    int active = 0;
+    size_t next = 0;
+    uint8_t pad[LANES][64];
+    for (int l = 0; l < LANES; l++) {
+        if (next < count) {
+            msg[l] = next++;
+            block[l] = 0;
+            blocks[l] = mb_block_count(msgs[msg[l]].len);
+            for (int i = 0; i < 4; i++) h[i][l] = MD4_IV[i];
+            active++;
+        } else {
+            msg[l] = SIZE_MAX;
+            for (int i = 0; i < 4; i++) h[i][l] = 0;
+        }
+    }
+
+    while (active > 0) {
+        for (int l = 0; l < LANES; l++) {
+            if (msg[l] == SIZE_MAX) {
+                for (int i = 0; i < 16; i++) x[i][l] = 0;
+                continue;
+            }
+            const uint8_t *b = mb_block(&msgs[msg[l]], block[l], pad[l], 0);
+            for (int i = 0; i < 16; i++) x[i][l] = load_le32(b + 4 * i);
+        }
+
+        VEC a = h[0], b = h[1], c = h[2], d = h[3];
+        for (int i = 0; i < 16; i += 4) {
+            MD4_ROUND1(a, b, c, d, x[i], 3);
+            MD4_ROUND1(d, a, b, c, x[i + 1], 7);
+            MD4_ROUND1(c, d, a, b, x[i + 2], 11);
+            MD4_ROUND1(b, c, d, a, x[i + 3], 19);
+        }
+        for (int i = 0; i < 4; i++) {
+            MD4_ROUND2(a, b, c, d, x[i], 3);
+            MD4_ROUND2(d, a, b, c, x[i + 4], 5);
+            MD4_ROUND2(c, d, a, b, x[i + 8], 9);
+            MD4_ROUND2(b, c, d, a, x[i + 12], 13);
+        }
+        static const int order[4] = {0, 2, 1, 3};
+        for (int j = 0; j < 4; j++) {
+            int i = order[j];
+            MD4_ROUND3(a, b, c, d, x[i], 3);
+            MD4_ROUND3(d, a, b, c, x[i + 8], 9);
+            MD4_ROUND3(c, d, a, b, x[i + 4], 11);
+            MD4_ROUND3(b, c, d, a, x[i + 12], 15);
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+
+        for (int l = 0; l < LANES; l++) {
+            if (msg[l] == SIZE_MAX || ++block[l] < blocks[l]) continue;
+            for (int i = 0; i < 4; i++) store_le32(out[msg[l]] + 4 * i, h[i][l]);
+            if (next < count) {
+                msg[l] = next++;
+                block[l] = 0;
+                blocks[l] = mb_block_count(msgs[msg[l]].len);
+                for (int i = 0; i < 4; i++) h[i][l] = MD4_IV[i];
+            } else {
+                msg[l] = SIZE_MAX;
+                active--;
+            }
+        }
+    }
+}
+
+#undef SHA1_STEP
+#undef MD4_ROUND1
+#undef MD4_ROUND2
+#undef MD4_ROUND3
+#undef LANE_FN
+#undef LANE_FN1
+#undef LANE_FN2
@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "filehandler.h"
+#include "hash.h"
+#include "neardup.h"
+
+#define ROWS (NEARDUP_HASHES / NEARDUP_BANDS)
+#define LINE_SEED 0x6e64757053474c4eULL
+#define EMPTY_BIN UINT32_MAX
+#define DENSIFY_STEP 0x9e3779b9U  // Offset per bin a borrowed value travelled
+
+typedef struct {
+    char magic[8];
+    uint32_t hashes;
+    uint32_t reserved;
+} StoreHeader;
+
+typedef struct {
+    uint32_t sig[NEARDUP_HASHES];
+    uint64_t lines;
+    uint64_t added;  // Unix time
+    char name[240];  // Input path; the base name only in stores written before paths were kept
+} StoredSignature;
+
+typedef struct {
+    uint64_t key;  // Band hash; 0 marks an empty slot
+    uint32_t entry;
+} BandSlot;
+
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char store_path[PATH_MAX];
+static int store_fd = -1;  // Shared by replicas; flock serializes appends and the reads that follow them
+static off_t store_loaded = 0;  // Bytes of the store already in memory
+static StoredSignature *entries = NULL;
+static size_t entry_count = 0, entry_cap = 0;
+static BandSlot *bands = NULL;  // Open addressing, one slot per (entry, band)
+static size_t band_slots = 0;
+
+void neardup_begin(NearDupSketch *s) {
+    for (int i = 0; i < NEARDUP_HASHES; i++) s->mins[i] = EMPTY_BIN;
+    s->lines = 0;
+    s->line_len = 0;
+}
+
+static void add_line(NearDupSketch *s, const char *line, size_t len) {
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t')) len--;
+    if (len == 0) return;
+    uint64_t h[2];
+    murmur3_128(line, len, LINE_SEED, h);
+    uint32_t bin = (uint32_t)(h[1] & (NEARDUP_HASHES - 1));
+    uint32_t value = (uint32_t)(h[0] >> 32);
+    if (value == EMPTY_BIN) value--;
+    if (value < s->mins[bin]) s->mins[bin] = value;
+    s->lines++;
+}
+
+void neardup_feed(NearDupSketch *s, const void *data, size_t len) {
+    const char *p = data, *end = p + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t n = (size_t)((nl ? nl : end) - p);
+        if (s->line_len == 0 && nl) {
+            // Whole line inside this block: hash it in place
+            add_line(s, p, n < NEARDUP_MAX_LINE ? n : NEARDUP_MAX_LINE);
+        } else {
+            size_t room = NEARDUP_MAX_LINE - s->line_len;
+            memcpy(s->line + s->line_len, p, n < room ? n : room);
+            s->line_len += n < room ? n : room;
+            if (nl) neardup_entry_end(s);
+        }
+        if (!nl) break;
+        p = nl + 1;
+    }
+}
+
+void neardup_entry_end(NearDupSketch *s) {
+    if (s->line_len > 0) add_line(s, s->line, s->line_len);
+    s->line_len = 0;
+}
+
+// Fill empty bins from the next non-empty bin to the right, offset by the
+// distance, so two sketches agree on an empty bin exactly when they agree on
+// the bin it borrowed from
+static void signature(const NearDupSketch *s, uint32_t *sig) {
+    for (int i = 0; i < NEARDUP_HASHES; i++) {
+        int j = i, dist = 0;
+        while (s->mins[j] == EMPTY_BIN && dist < NEARDUP_HASHES) {
+            j = (j + 1) & (NEARDUP_HASHES - 1);
+            dist++;
+        }
+        sig[i] = s->mins[j] + (uint32_t)dist * DENSIFY_STEP;
+    }
+}
+
+static uint64_t band_key(const uint32_t *sig, int band) {
+    uint64_t h[2];
+    murmur3_128(sig + band * ROWS, ROWS * sizeof(uint32_t), (uint64_t)band, h);
+    return h[0] ? h[0] : 1;
+}
+
+static int similarity_pct(const uint32_t *a, const uint32_t *b) {
+    int same = 0;
+    for (int i = 0; i < NEARDUP_HASHES; i++) same += a[i] == b[i];
+    return same * 100 / NEARDUP_HASHES;
+}
+
+static void band_insert(BandSlot *slots, size_t count, uint64_t key, uint32_t entry) {
+    size_t i = key & (count - 1);
+    while (slots[i].key != 0) i = (i + 1) & (count - 1);
+    slots[i].key = key;
+    slots[i].entry = entry;
+}
+
+// Room for one more entry's bands, keeping the table at most half full
+static int bands_reserve(void) {
+    size_t needed = (entry_count + 1) * NEARDUP_BANDS * 2;
+    if (needed <= band_slots) return 0;
+    size_t count = band_slots ? band_slots : 4096;
+    while (count < needed) count *= 2;
+    BandSlot *slots = calloc(count, sizeof(BandSlot));
+    if (!slots) {
+        log_error("Failed to grow near-duplicate band table");
+        return -1;
+    }
+    for (size_t i = 0; i < band_slots; i++) {
+        if (bands[i].key != 0) band_insert(slots, count, bands[i].key, bands[i].entry);
+    }
+    free(bands);
+    bands = slots;
+    band_slots = count;
+    return 0;
+}
+
+// Caller holds store_mutex
+static int remember(const StoredSignature *e) {
+    if (entry_count == entry_cap) {
+        size_t cap = entry_cap ? entry_cap * 2 : 1024;
+        StoredSignature *grown = realloc(entries, cap * sizeof(StoredSignature));
+        if (!grown) {
+            log_error("Failed to grow near-duplicate signatures");
+            return -1;
+        }
+        entries = grown;
+        entry_cap = cap;
+    }
+    if (bands_reserve() != 0) return -1;
+    entries[entry_count] = *e;
+    for (int b = 0; b < NEARDUP_BANDS; b++) band_insert(bands, band_slots, band_key(e->sig, b), (uint32_t)entry_count);
+    entry_count++;
+    return 0;
+}
+
+static int store_lock(int op) {
+    while (flock(store_fd, op) != 0) {
+        if (errno != EINTR) {
+            log_error("Failed to lock near-duplicate store %s: %s", store_path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Load the signatures other replicas appended since the last call. Caller
+// holds store_mutex and the flock, so no append is half written. With
+// truncate, which needs the exclusive lock, a partial signature left at the
+// end by a writer that crashed is dropped.
+static int store_refresh(int truncate) {
+    struct stat st;
+    if (fstat(store_fd, &st) != 0) {
+        log_error("Failed to stat near-duplicate store %s: %s", store_path, strerror(errno));
+        return -1;
+    }
+    off_t whole = sizeof(StoreHeader) + (st.st_size - (off_t)sizeof(StoreHeader)) /
+                                            (off_t)sizeof(StoredSignature) * (off_t)sizeof(StoredSignature);
+    if (truncate && whole != st.st_size) {
+        log_warning("Dropping a partial signature at the end of %s", store_path);
+        if (ftruncate(store_fd, whole) != 0) {
+            log_error("Failed to truncate near-duplicate store %s: %s", store_path, strerror(errno));
+            return -1;
+        }
+    }
+
+    StoredSignature e;
+    for (; store_loaded < whole; store_loaded += sizeof(e)) {
+        if (pread(store_fd, &e, sizeof(e), store_loaded) != (ssize_t)sizeof(e) || remember(&e) != 0) {
+            log_error("Failed to load near-duplicate store %s", store_path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int neardup_open(const char *path) {
+    pthread_mutex_lock(&store_mutex);
+    if (store_fd != -1) {
+        pthread_mutex_unlock(&store_mutex);
+        return 0;
+    }
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        if (mkdir_p(dir, 0777) == -1) {
+            log_error("Failed to create near-duplicate store directory %s: %s", dir, strerror(errno));
+            pthread_mutex_unlock(&store_mutex);
+            return -1;
+        }
+    }
+
+    store_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (store_fd == -1) {
+        log_error("Failed to open near-duplicate store %s: %s", path, strerror(errno));
+        pthread_mutex_unlock(&store_mutex);
+        return -1;
+    }
+    snprintf(store_path, sizeof(store_path), "%s", path);
+    if (store_lock(LOCK_EX) != 0) goto fail;
+
+    struct stat st;
+    StoreHeader h;
+    if (fstat(store_fd, &st) != 0) {
+        log_error("Failed to stat near-duplicate store %s: %s", path, strerror(errno));
+        goto fail_locked;
+    }
+    if (st.st_size == 0) {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, NEARDUP_MAGIC, sizeof(h.magic));
+        h.hashes = NEARDUP_HASHES;
+        if (write(store_fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) {
+            log_error("Failed to initialize near-duplicate store %s: %s", path, strerror(errno));
+            goto fail_locked;
+        }
+    } else if (pread(store_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+               memcmp(h.magic, NEARDUP_MAGIC, sizeof(h.magic)) != 0 || h.hashes != NEARDUP_HASHES) {
+        log_error("Near-duplicate store %s is corrupt or not a near-duplicate store", path);
+        goto fail_locked;
+    }
+    store_loaded = sizeof(h);
+    if (store_refresh(1) != 0) goto fail_locked;
+    flock(store_fd, LOCK_UN);
+
+    log_info("Near-duplicate store %s: %zu signatures", path, entry_count);
+    pthread_mutex_unlock(&store_mutex);
+    return 0;
+
+fail_locked:
+    flock(store_fd, LOCK_UN);
+fail:
+    close(store_fd);
+    store_fd = -1;
+    entry_count = 0;
+    for (size_t i = 0; i < band_slots; i++) bands[i].key = 0;
+    pthread_mutex_unlock(&store_mutex);
+    return -1;
+}
+
+int neardup_match(const NearDupSketch *s, int threshold_pct, const char *input, char *match, size_t match_len) {
+    if (s->lines < NEARDUP_MIN_LINES) return 0;
+    uint32_t sig[NEARDUP_HASHES];
+    signature(s, sig);
+    // The input as neardup_add would have stored it, or as older stores did
+    char stored[sizeof(((StoredSignature *)0)->name)];
+    snprintf(stored, sizeof(stored), "%s", input);
+    const char *base = strrchr(input, '/') ? strrchr(input, '/') + 1 : input;
+
+    int best = 0;
+    pthread_mutex_lock(&store_mutex);
+    // Pick up what other replicas stored since; a failed refresh matches against what is loaded
+    if (store_fd != -1 && store_lock(LOCK_SH) == 0) {
+        store_refresh(0);
+        flock(store_fd, LOCK_UN);
+    }
+    for (int b = 0; b < NEARDUP_BANDS && store_fd != -1 && entry_count > 0; b++) {
+        uint64_t key = band_key(sig, b);
+        for (size_t i = key & (band_slots - 1); bands[i].key != 0; i = (i + 1) & (band_slots - 1)) {
+            if (bands[i].key != key) continue;
+            const StoredSignature *e = &entries[bands[i].entry];
+            // Re-enqueued after a restart, an input would match itself
+            if (strcmp(e->name, stored) == 0 || strcmp(e->name, base) == 0) continue;
+            int pct = similarity_pct(sig, e->sig);
+            if (pct >= threshold_pct && pct > best) {
+                best = pct;
+                snprintf(match, match_len, "%s", e->name);
+            }
+        }
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return best;
+}
+
+int neardup_add(const NearDupSketch *s, const char *input) {
+    if (s->lines < NEARDUP_MIN_LINES) return 0;
+    StoredSignature e;
+    memset(&e, 0, sizeof(e));
+    signature(s, e.sig);
+    e.lines = s->lines;
+    e.added = (uint64_t)time(NULL);
+    snprintf(e.name, sizeof(e.name), "%s", input);
+
+    pthread_mutex_lock(&store_mutex);
+    int rc = 0;
+    if (store_fd != -1) {
+        // Catch up first, so the appended signature lands where store_loaded expects it
+        if (store_lock(LOCK_EX) != 0) {
+            rc = -1;
+        } else {
+            if (store_refresh(1) != 0) {
+                rc = -1;
+            } else if (write(store_fd, &e, sizeof(e)) != (ssize_t)sizeof(e)) {
+                log_error("Failed to append to near-duplicate store %s: %s", store_path, strerror(errno));
+                rc = -1;
+            } else {
+                store_loaded += sizeof(e);
+                rc = remember(&e);
+            }
+            flock(store_fd, LOCK_UN);
+        }
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return rc;
+}
@@ -0,0 +1,46 @@
+#ifndef NEARDUP_H
+#define NEARDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NEARDUP_MAGIC "SGNDUP01"
+#define NEARDUP_HASHES 128  // MinHash slots per signature
+#define NEARDUP_BANDS 32  // LSH bands of NEARDUP_HASHES / NEARDUP_BANDS slots each
+#define NEARDUP_MIN_LINES 256  // Smaller inputs are cheap to process and too small to sketch reliably
+#define NEARDUP_MAX_LINE 1024  // Longer lines are shingled by their first bytes
+
+// MinHash signature of an input's set of lines, built in one streaming pass.
+// Every non-empty line (trailing whitespace ignored) is hashed once and lands
+// in one of NEARDUP_HASHES bins, each keeping its smallest value (one-permutation
+// hashing), so reordered lines, an added banner file or a few edited lines
+// leave most bins unchanged.
+typedef struct {
+    uint32_t mins[NEARDUP_HASHES];
+    uint64_t lines;
+    char line[NEARDUP_MAX_LINE];  // Current line, when it spans data blocks
+    size_t line_len;
+} NearDupSketch;
+
+void neardup_begin(NearDupSketch *s);
+void neardup_feed(NearDupSketch *s, const void *data, size_t len);
+// Ends the pending line; call between entries of an archive
+void neardup_entry_end(NearDupSketch *s);
+
+// Process-wide store of the signatures of processed inputs: an append-only file
+// loaded at open, with an in-memory LSH band table for candidate lookup.
+// Replicas share one file; each picks up the others' signatures before it
+// matches or appends. Opening an open store is a no-op.
+int neardup_open(const char *path);
+
+// Estimated similarity in percent to the most similar stored input, when at
+// least threshold_pct; its name goes to match. Signatures stored under input,
+// the same input processed before, are not candidates. Returns 0 otherwise, or
+// when the sketch is too small or no store is open.
+int neardup_match(const NearDupSketch *s, int threshold_pct, const char *input, char *match, size_t match_len);
+
+// Remember the sketch under input, the path it was processed from; returns -1
+// if the store could not be written
+int neardup_add(const NearDupSketch *s, const char *input);
+
+#endif
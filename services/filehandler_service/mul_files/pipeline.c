@@ -0,0 +1,697 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blake3.h"
+#include "charset.h"
+#include "classify.h"
+#include "colstore.h"
+#include "combo.h"
+#include "csv.h"
+#include "dedup.h"
+#include "domindex.h"
+#include "extsort.h"
+#include "filehandler.h"
+#include "hash.h"
+#include "idindex.h"
+#include "json.h"
+#include "pipeline.h"
+#include "ranges.h"
+#include "secrets.h"
+#include "shards.h"
+#include "sqldump.h"
+#include "sqlload.h"
+#include "stealer.h"
+#include "watchlist.h"
+
+#define INDEX_PART_KEYS (1 << 25)  // Identity keys buffered before an index part is written
+#define MANIFEST_NAME_MAX 1024  // Longer entry names are cut in the manifest
+
+struct Pipeline {
+    const Config *cfg;
+    char input_name[256];  // Basename of the task's input file
+    char output_name[272];  // <input_name>.<hash of the input path>: names its files in record_dir
+    uint64_t task_key;  // Hash of the input path, size and mtime: the same across retries of a task
+    char source[1024];  // <input>/<entry> of the current entry
+    int in_entry;
+    int sniffed;  // First block of the entry has been classified
+    EntryKind kind;
+    int is_text;
+    int is_sql;  // Routed to the SQL dump extractor instead of the combo parser
+    int is_csv;  // Routed to the CSV column projector
+    int parse;  // parse_credentials at open time
+    int parse_sql;  // parse_sql at open time
+    int parse_csv;
+    ComboParser combo;
+    SqlParser sql;
+    CsvParser csv;
+    int parse_stealer;  // parse_stealer_logs at open time
+    int stealer_threads;
+    StealerKind stealer_kind;  // Kind of the current entry; parsers skip stealer-log files
+    StealerPool *stealer;  // Started on the first stealer-log entry
+    pthread_mutex_t emit_mutex;  // Held by emit_record while stealer workers may emit
+    FILE *victim_out;  // <record_dir>/<input>.victims.jsonl, opened on the first victim
+    uint64_t victim_count;
+    int outputs_open;  // Record outputs are opened on the first record
+    RecordLayout layout;  // record_layout at open time
+    RecordWriter *records;  // NULL with record_layout = domain
+    ShardWriter *shards;  // NULL with record_layout = input
+    int columnar;  // columnar_store at open time
+    ColumnWriter *columns;  // <record_dir>/<input>.sgc, opened with records
+    uint64_t first_seen;  // Task start; stamped on every column store row
+    int identity_index;  // identity_index at open time
+    uint64_t *id_keys;  // Keys of the current index part
+    size_t id_key_count, id_key_cap;
+    int id_parts;  // Parts written as <input>.<n>.idx.part, merged into <input>.idx on commit
+    DomainCollector *domains;  // Written as a domain index segment at close; NULL when off
+    int hash_ranges;  // hash_ranges at open time
+    RangeWriter *ranges;  // Opened on the first secret
+    DedupBatch *dedup;  // The task's new record fingerprints, committed at close
+    uint64_t duplicates;  // Records dropped because the dedup store had seen them
+    Watchlist *watchlist;  // Pinned for the whole task; NULL when none is loaded
+    WatchScanner scanner;
+    uint32_t *reported;  // Per pattern: entry_seq of the last entry it was reported in
+    uint32_t entry_seq;
+    uint64_t entry_hits;
+    int manifest;  // content_manifest at open time
+    FILE *manifest_out;  // <record_dir>/<input>.manifest.jsonl, opened on the first line
+    uint64_t manifest_entries;
+    Blake3 *input_hash;  // Every input byte, hashed as it is read
+    uint64_t input_bytes;
+    Blake3 *entry_hash;  // The current entry's bytes, hashed as they are written
+    uint64_t entry_bytes;
+    int entry_is_input;  // Single-file input: the entry is the input itself
+    int transcode;  // transcode_text at open time
+    int charset_sniffed;
+    Transcoder transcoder;  // Everything after the manifest hash sees the entry as UTF-8
+    int detect_secrets;  // detect_secrets at open time
+    SecretScanner secrets;
+    FILE *secret_out;  // <record_dir>/<input>.secrets.jsonl, opened on the first match
+    uint64_t secret_count;
+    int failed;
+};
+
+// Every occurrence is counted, but each pattern is reported once per entry:
+// a dump about a watched domain would otherwise flood the hits queue
+static void on_watch_match(void *ctx, uint32_t pattern, uint64_t offset) {
+    Pipeline *p = ctx;
+    p->entry_hits++;
+    if (p->reported[pattern] == p->entry_seq) return;
+    p->reported[pattern] = p->entry_seq;
+    watchlist_report(p->watchlist, pattern, p->source, offset);
+}
+
+static int make_record_dir(Pipeline *p) {
+    if (mkdir_p(p->cfg->record_dir, 0777) == -1) {
+        log_error("Failed to create record directory %s: %s", p->cfg->record_dir, strerror(errno));
+        p->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// One JSON object per line: rule, source, offset and the matched value
+static void emit_secret(void *ctx, const SecretMatch *m) {
+    Pipeline *p = ctx;
+    if (p->failed) return;
+
+    if (!p->secret_out) {
+        char path[PATH_MAX + 300];
+        if (make_record_dir(p) != 0) return;
+        snprintf(path, sizeof(path), "%s/%s.secrets.jsonl", p->cfg->record_dir, p->output_name);
+        p->secret_out = fopen(path, "w");
+        if (!p->secret_out) {
+            log_error("Failed to open secrets file %s: %s", path, strerror(errno));
+            p->failed = 1;
+            return;
+        }
+    }
+
+    // Escaping takes up to 6 bytes per input byte
+    char line[(SECRET_MAX_TOKEN + sizeof(p->source)) * 6 + 256];
+    size_t used = 0;
+    json_appendf(line, sizeof(line), &used, "{\"rule\":\"%s\",\"source\":", m->rule);
+    json_append_string(line, sizeof(line), &used, p->source, strlen(p->source));
+    json_appendf(line, sizeof(line), &used, ",\"offset\":%llu,\"value\":", (unsigned long long)m->offset);
+    json_append_string(line, sizeof(line), &used, m->value, m->len);
+    json_appendf(line, sizeof(line), &used, "}\n");
+    if (fwrite(line, 1, used, p->secret_out) != used) {
+        log_error("Failed to write secrets for %s: %s", p->input_name, strerror(errno));
+        p->failed = 1;
+    }
+    p->secret_count++;
+}
+
+// One JSON object per line: the entry (or, last, the input itself), its size and BLAKE3,
+// and for entries what the classifier made of them
+static void manifest_line(Pipeline *p, const char *kind, const char *name, uint64_t bytes, Blake3 *hash,
+                          EntryKind type) {
+    uint8_t digest[BLAKE3_OUT_LEN];
+    blake3_final(hash, digest);
+    blake3_init(hash);
+    if (p->failed) return;
+
+    if (!p->manifest_out) {
+        char path[PATH_MAX + 300];
+        if (make_record_dir(p) != 0) return;
+        snprintf(path, sizeof(path), "%s/%s.manifest.jsonl", p->cfg->record_dir, p->output_name);
+        p->manifest_out = fopen(path, "w");
+        if (!p->manifest_out) {
+            log_error("Failed to open manifest %s: %s", path, strerror(errno));
+            p->failed = 1;
+            return;
+        }
+    }
+
+    char line[MANIFEST_NAME_MAX * 6 + 256];
+    size_t used = 0;
+    json_appendf(line, sizeof(line), &used, "{\"%s\":", kind);
+    json_append_string(line, sizeof(line), &used, name, strnlen(name, MANIFEST_NAME_MAX));
+    json_appendf(line, sizeof(line), &used, ",\"bytes\":%llu,\"blake3\":\"", (unsigned long long)bytes);
+    for (int i = 0; i < BLAKE3_OUT_LEN; i++) json_appendf(line, sizeof(line), &used, "%02x", digest[i]);
+    json_appendf(line, sizeof(line), &used, "\"");
+    if (type != ENTRY_UNKNOWN) json_appendf(line, sizeof(line), &used, ",\"type\":\"%s\"", entry_kind_name(type));
+    json_appendf(line, sizeof(line), &used, "}\n");
+    if (fwrite(line, 1, used, p->manifest_out) != used) {
+        log_error("Failed to write manifest for %s: %s", p->input_name, strerror(errno));
+        p->failed = 1;
+    }
+    p->manifest_entries++;
+}
+
+static void index_part_path(const Pipeline *p, int part, char *out, size_t size) {
+    snprintf(out, size, "%s/%s.%d.idx.part", p->cfg->record_dir, p->output_name, part);
+}
+
+// Write the buffered identity keys as an index part; parts are not *.idx, so
+// neither the lookup server nor the merger sees them before the task commits
+static int write_identity_part(Pipeline *p) {
+    char path[PATH_MAX + 320];
+    index_part_path(p, p->id_parts++, path, sizeof(path));
+    size_t count = p->id_key_count;
+    p->id_key_count = 0;
+    return idindex_write(path, p->id_keys, count);
+}
+
+// Merge the parts and the keys still buffered into <input>.idx and hand it to
+// the lookup server
+static int publish_identity_index(Pipeline *p) {
+    char path[PATH_MAX + 320];
+    IdIndex **parts = calloc((size_t)p->id_parts + 1, sizeof(IdIndex *));
+    int rc = parts ? 0 : -1;
+    for (int i = 0; rc == 0 && i < p->id_parts; i++) {
+        index_part_path(p, i, path, sizeof(path));
+        parts[i] = idindex_open(path);
+        if (!parts[i]) rc = -1;
+    }
+    size_t unique = idindex_sort_keys(p->id_keys, p->id_key_count);
+    if (unique == 0 && p->id_key_count > 0) {
+        log_error("Failed to allocate %zu identity keys for %s", p->id_key_count, p->input_name);
+        rc = -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s.idx", p->cfg->record_dir, p->output_name);
+    if (rc == 0) rc = idindex_write_merged(path, parts, (size_t)p->id_parts, p->id_keys, unique);
+    for (int i = 0; parts && i < p->id_parts; i++) idindex_close(parts[i]);
+    free(parts);
+    return rc == 0 ? idindex_publish(path) : -1;
+}
+
+static void add_identity_key(Pipeline *p, const CredentialRecord *rec) {
+    uint64_t key;
+    if (!idindex_key(rec->identity, rec->identity_len, &key)) return;
+    if (p->id_key_count == p->id_key_cap) {
+        size_t cap = p->id_key_cap ? p->id_key_cap * 2 : 4096;
+        uint64_t *keys = realloc(p->id_keys, cap * sizeof(uint64_t));
+        if (!keys) {
+            log_error("Failed to grow identity keys for %s", p->input_name);
+            p->failed = 1;
+            return;
+        }
+        p->id_keys = keys;
+        p->id_key_cap = cap;
+    }
+    p->id_keys[p->id_key_count++] = key;
+    if (p->id_key_count == INDEX_PART_KEYS && write_identity_part(p) != 0) p->failed = 1;
+}
+
+static int open_record_outputs(Pipeline *p) {
+    char path[PATH_MAX + 300];
+    if (make_record_dir(p) != 0) return -1;
+    if (p->layout != RECORD_LAYOUT_DOMAIN) {
+        snprintf(path, sizeof(path), "%s/%s.rec", p->cfg->record_dir, p->output_name);
+        p->records = record_writer_open(path);
+        if (!p->records) return -1;
+    }
+    if (p->layout != RECORD_LAYOUT_INPUT) {
+        if (mkdir_p(p->cfg->record_shard_dir, 0777) == -1) {
+            log_error("Failed to create record shard directory %s: %s", p->cfg->record_shard_dir, strerror(errno));
+            return -1;
+        }
+        p->shards = shard_writer_open(p->cfg->record_shard_dir, (uint32_t)p->cfg->record_shards, p->task_key);
+        if (!p->shards) return -1;
+    }
+    if (p->columnar) {
+        snprintf(path, sizeof(path), "%s/%s.sgc", p->cfg->record_dir, p->output_name);
+        p->columns = colstore_writer_open(path);
+        if (!p->columns) return -1;
+    }
+    return 0;
+}
+
+static void add_record(Pipeline *p, const CredentialRecord *rec) {
+    if (p->failed) return;
+
+    if (p->dedup) {
+        uint64_t fp[2];
+        record_fingerprint(rec, fp);
+        if (!dedup_batch_add(p->dedup, fp)) {
+            p->duplicates++;
+            return;
+        }
+    }
+
+    if (!p->outputs_open) {
+        p->outputs_open = 1;
+        if (open_record_outputs(p) != 0) {
+            p->failed = 1;
+            return;
+        }
+    }
+    if (p->records && record_writer_add(p->records, rec) < 0) p->failed = 1;
+    if (p->shards && shard_writer_add(p->shards, rec) < 0) p->failed = 1;
+    if (p->columns && colstore_writer_add(p->columns, rec, p->first_seen) < 0) p->failed = 1;
+    if (p->identity_index) add_identity_key(p, rec);
+    if (p->hash_ranges && rec->secret_len > 0) {
+        if (!p->ranges) p->ranges = range_writer_open(p->cfg->range_dir, p->task_key);
+        if (!p->ranges || range_writer_add(p->ranges, rec->secret, rec->secret_len) != 0) p->failed = 1;
+    }
+}
+
+static void emit_record(void *ctx, const CredentialRecord *rec) {
+    Pipeline *p = ctx;
+    if (p->stealer) pthread_mutex_lock(&p->emit_mutex);
+    add_record(p, rec);
+    if (p->stealer) pthread_mutex_unlock(&p->emit_mutex);
+}
+
+// Runs on stealer workers, one victim at a time: its credentials, then one
+// JSON line of host details
+static void emit_victim(void *ctx, const StealerVictim *v, const CredentialRecord *recs, size_t count) {
+    Pipeline *p = ctx;
+    pthread_mutex_lock(&p->emit_mutex);
+    for (size_t i = 0; i < count; i++) add_record(p, &recs[i]);
+
+    if (!p->failed && !p->victim_out) {
+        char path[PATH_MAX + 300];
+        if (make_record_dir(p) == 0) {
+            snprintf(path, sizeof(path), "%s/%s.victims.jsonl", p->cfg->record_dir, p->output_name);
+            p->victim_out = fopen(path, "w");
+            if (!p->victim_out) {
+                log_error("Failed to open victims file %s: %s", path, strerror(errno));
+                p->failed = 1;
+            }
+        }
+    }
+    if (!p->failed) {
+        const char *names[] = {"victim", "ip", "country", "hwid", "os", "computer", "user", "date"};
+        const char *values[] = {v->victim, v->ip, v->country, v->hwid, v->os, v->computer, v->user, v->date};
+        const size_t caps[] = {sizeof(v->victim), sizeof(v->ip), sizeof(v->country), sizeof(v->hwid),
+                               sizeof(v->os), sizeof(v->computer), sizeof(v->user), sizeof(v->date)};
+        // Every field escaped in full still fits
+        char line[sizeof(StealerVictim) * 6 + 256];
+        size_t used = 0;
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            json_appendf(line, sizeof(line), &used, "%s\"%s\":", i ? "," : "{", names[i]);
+            json_append_string(line, sizeof(line), &used, values[i], strnlen(values[i], caps[i]));
+        }
+        json_appendf(line, sizeof(line), &used,
+                     ",\"credentials\":%llu,\"cookie_files\":%u,\"autofill_files\":%u}\n",
+                     (unsigned long long)v->credentials, v->cookie_files, v->autofill_files);
+        if (fwrite(line, 1, used, p->victim_out) != used) {
+            log_error("Failed to write victims for %s: %s", p->input_name, strerror(errno));
+            p->failed = 1;
+        }
+        p->victim_count++;
+    }
+    pthread_mutex_unlock(&p->emit_mutex);
+}
+
+Pipeline *pipeline_open(const Config *cfg, const char *input_path, int dedup) {
+    Watchlist *watchlist = watchlist_acquire();
+    if (!cfg->parse_credentials && !cfg->detect_secrets && !cfg->content_manifest && !cfg->domain_index &&
+        !watchlist) {
+        return NULL;
+    }
+
+    Pipeline *p = calloc(1, sizeof(Pipeline));
+    if (p && watchlist) p->reported = calloc(watchlist_size(watchlist), sizeof(uint32_t));
+    if (p && cfg->content_manifest) {
+        p->input_hash = malloc(sizeof(Blake3));
+        p->entry_hash = malloc(sizeof(Blake3));
+    }
+    if (!p || (watchlist && !p->reported) || (cfg->content_manifest && (!p->input_hash || !p->entry_hash))) {
+        log_error("Failed to allocate pipeline for %s", input_path);
+        if (watchlist) watchlist_release(watchlist);
+        if (p) {
+            free(p->reported);
+            free(p->input_hash);
+            free(p->entry_hash);
+        }
+        free(p);
+        return NULL;
+    }
+    p->cfg = cfg;
+    p->parse = cfg->parse_credentials;
+    p->columnar = cfg->columnar_store;
+    p->layout = cfg->record_layout;
+    p->first_seen = (uint64_t)time(NULL);
+    p->identity_index = cfg->identity_index;
+    p->hash_ranges = cfg->hash_ranges;
+    p->parse_sql = cfg->parse_credentials && cfg->parse_sql;
+    p->parse_csv = cfg->parse_credentials && cfg->parse_csv;
+    p->parse_stealer = cfg->parse_credentials && cfg->parse_stealer_logs;
+    p->stealer_threads = cfg->stealer_threads;
+    pthread_mutex_init(&p->emit_mutex, NULL);
+    p->manifest = cfg->content_manifest;
+    if (p->manifest) {
+        blake3_init(p->input_hash);
+        blake3_init(p->entry_hash);
+    }
+    p->transcode = cfg->transcode_text;
+    p->detect_secrets = cfg->detect_secrets;
+    p->dedup = dedup ? dedup_batch_open() : NULL;
+    p->watchlist = watchlist;
+    const char *base_name = strrchr(input_path, '/') ? strrchr(input_path, '/') + 1 : input_path;
+    snprintf(p->input_name, sizeof(p->input_name), "%s", base_name);
+    // Inputs with the same name in different directories must not share record files
+    uint64_t path_hash[2];
+    murmur3_128(input_path, strlen(input_path), 0, path_hash);
+    snprintf(p->output_name, sizeof(p->output_name), "%s.%08x", p->input_name, (unsigned)path_hash[0]);
+    struct stat st;
+    if (stat(input_path, &st) == 0) {
+        uint64_t version[3] = {(uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec};
+        murmur3_128(version, sizeof(version), path_hash[0], path_hash);
+    }
+    p->task_key = path_hash[0];
+    if (cfg->domain_index && cfg->domain_index_dir[0]) {
+        p->domains = domindex_collect_open(p->output_name);
+        if (!p->domains) p->failed = 1;
+    }
+    return p;
+}
+
+void pipeline_entry_begin(Pipeline *p, const char *entry_name) {
+    if (!p) return;
+    if (entry_name) {
+        snprintf(p->source, sizeof(p->source), "%s/%s", p->input_name, entry_name);
+    } else {
+        snprintf(p->source, sizeof(p->source), "%s", p->input_name);
+    }
+    p->in_entry = 1;
+    p->sniffed = 0;
+    p->charset_sniffed = 0;
+    p->entry_is_input = entry_name == NULL;
+    domindex_collect_entry(p->domains, entry_name ? entry_name : "");
+    p->entry_bytes = 0;
+    p->stealer_kind = STEALER_NONE;
+    if (p->parse_stealer && entry_name) {
+        size_t victim_len;
+        p->stealer_kind = stealer_classify(entry_name, &victim_len);
+        if (p->stealer_kind != STEALER_NONE && !p->stealer) {
+            p->stealer = stealer_open(p->stealer_threads, p->input_name, emit_victim, emit_record, p);
+        }
+        stealer_entry_begin(p->stealer, entry_name, p->stealer_kind, victim_len);
+    }
+    p->kind = ENTRY_UNKNOWN;
+    p->is_text = 0;
+    p->is_sql = 0;
+    p->is_csv = 0;
+    if (p->parse) combo_begin(&p->combo, p->source, emit_record, p);
+    if (p->detect_secrets) secret_begin(&p->secrets, emit_secret, p);
+    if (p->watchlist) {
+        watch_scan_begin(&p->scanner, p->watchlist);
+        p->entry_seq++;
+        p->entry_hits = 0;
+    }
+}
+
+void pipeline_input_data(Pipeline *p, const void *data, size_t len) {
+    if (!p || !p->manifest) return;
+    blake3_update(p->input_hash, data, len);
+    p->input_bytes += len;
+}
+
+void pipeline_input_end(Pipeline *p) {
+    if (!p || !p->manifest) return;
+    // A single-file input is also its only entry
+    manifest_line(p, "input", p->input_name, p->input_bytes, p->input_hash,
+                  p->entry_is_input ? p->kind : ENTRY_UNKNOWN);
+    p->input_bytes = 0;
+}
+
+// A binary file or one larger than any stealer log only had a stealer-log
+// name: what was buffered of it goes to the combo parser after all
+static void release_stealer_entry(Pipeline *p) {
+    size_t held_len;
+    char *held = stealer_entry_detach(p->stealer, &held_len);
+    p->stealer_kind = STEALER_NONE;
+    if (held && p->parse && p->is_text) combo_feed(&p->combo, held, held_len);
+    free(held);
+}
+
+void pipeline_entry_data(Pipeline *p, const void *raw, size_t len) {
+    if (!p || !p->in_entry || len == 0) return;
+    const void *data = raw;
+
+    if (p->manifest) {
+        if (p->entry_is_input) {
+            pipeline_input_data(p, raw, len);
+        } else {
+            blake3_update(p->entry_hash, raw, len);
+            p->entry_bytes += len;
+        }
+    }
+
+    if (p->transcode) {
+        if (!p->charset_sniffed) {
+            p->charset_sniffed = 1;
+            transcoder_begin(&p->transcoder, raw, len);
+            if (p->transcoder.charset != CHARSET_UTF8) {
+                log_info("Reading %s as %s", p->source, charset_name(p->transcoder.charset));
+            }
+        }
+        size_t utf8_len;
+        const char *utf8 = transcoder_feed(&p->transcoder, raw, len, &utf8_len);
+        if (utf8) {
+            data = utf8;
+            len = utf8_len;
+            if (len == 0) return;
+        } else {
+            // Scanners get the rest of the entry as it is rather than nothing
+            log_error("Failed to allocate transcoding buffer for %s", p->source);
+            p->transcoder.charset = CHARSET_UTF8;
+        }
+    }
+
+    int csv_fed = 0;
+    if (!p->sniffed) {
+        // The source ends in the entry name, or the input name for single-file inputs
+        p->kind = classify_entry(p->source, data, len);
+        p->is_text = entry_kind_is_text(p->kind);
+    }
+    if (p->stealer_kind != STEALER_NONE) {
+        // Passwords.txt, System.txt and cookie jars would only yield junk from the combo parser
+        p->sniffed = 1;
+        int counted = p->stealer_kind == STEALER_COOKIES || p->stealer_kind == STEALER_AUTOFILL;
+        if ((!counted && !p->is_text) || stealer_entry_data(p->stealer, data, len) != 0) release_stealer_entry(p);
+    } else if (!p->sniffed) {
+        p->sniffed = 1;
+        if (p->parse_sql && p->kind == ENTRY_SQL) {
+            p->is_sql = 1;
+            sql_begin(&p->sql, p->source, p->cfg->sql_identity_columns, p->cfg->sql_secret_columns,
+                      p->cfg->sql_tables, emit_record, p);
+        } else if (p->parse_csv && p->kind == ENTRY_CSV) {
+            csv_begin(&p->csv, p->source, p->cfg->csv_identity_columns, p->cfg->csv_secret_columns,
+                      p->cfg->csv_url_columns, emit_record, p);
+            csv_feed(&p->csv, data, len);
+            // Headerless exports and ones without a credential column go to the combo parser
+            p->is_csv = p->csv.active;
+            csv_fed = 1;
+        }
+    }
+    // The scanners cover binary entries too: SQLite files and executables still carry plain
+    // emails and keys. Images and compressed streams carry none and are not scanned.
+    if (p->kind == ENTRY_IMAGE || p->kind == ENTRY_ARCHIVE) return;
+    if (p->watchlist) watch_scan(&p->scanner, data, len, on_watch_match, p);
+    if (p->is_text || p->kind == ENTRY_SQLITE) domindex_collect_scan(p->domains, data, len);
+    if (p->detect_secrets) secret_feed(&p->secrets, data, len);
+    if (p->is_sql) {
+        sql_feed(&p->sql, data, len);
+    } else if (p->is_csv) {
+        if (!csv_fed) csv_feed(&p->csv, data, len);
+    } else if (p->parse && p->is_text && p->stealer_kind == STEALER_NONE) {
+        combo_feed(&p->combo, data, len);
+    }
+}
+
+EntryKind pipeline_entry_kind(const Pipeline *p) {
+    return p ? p->kind : ENTRY_UNKNOWN;
+}
+
+void pipeline_entry_end(Pipeline *p) {
+    if (!p || !p->in_entry) return;
+    if (p->manifest) {
+        if (p->entry_is_input) pipeline_input_end(p);
+        else manifest_line(p, "entry", p->source + strlen(p->input_name) + 1, p->entry_bytes, p->entry_hash, p->kind);
+    }
+    stealer_entry_end(p->stealer);
+    if (p->watchlist && p->entry_hits > 0) {
+        log_info("%llu watchlist matches in %s", (unsigned long long)p->entry_hits, p->source);
+    }
+    if (p->detect_secrets) {
+        secret_end(&p->secrets);
+        if (p->secrets.matches > 0) {
+            log_info("Found %llu secrets in %s", (unsigned long long)p->secrets.matches, p->source);
+        }
+    }
+    if (p->is_sql) {
+        sql_end(&p->sql);
+        if (p->sql.records > 0) {
+            log_info("Extracted %llu credentials from %llu rows of %s", (unsigned long long)p->sql.records,
+                     (unsigned long long)p->sql.rows, p->source);
+        }
+    } else if (p->is_csv) {
+        csv_end(&p->csv);
+        if (p->csv.records > 0) {
+            log_info("Projected %llu credentials from %llu rows of %s", (unsigned long long)p->csv.records,
+                     (unsigned long long)p->csv.rows, p->source);
+        }
+    } else if (p->parse && p->is_text && p->stealer_kind == STEALER_NONE) {
+        combo_end(&p->combo);
+        if (p->combo.records > 0) {
+            log_info("Parsed %llu credentials from %llu lines of %s", (unsigned long long)p->combo.records,
+                     (unsigned long long)p->combo.lines, p->source);
+        }
+    }
+    p->in_entry = 0;
+}
+
+// Rewrite the task's .rec in fingerprint order with one record per fingerprint
+static int sort_records(Pipeline *p) {
+    char path[PATH_MAX + 300];
+    snprintf(path, sizeof(path), "%s/%s.rec", p->cfg->record_dir, p->output_name);
+    const char *inputs[1] = {path};
+    SortOptions opt = {p->cfg->sort_memory_mb << 20, p->cfg->sort_threads,
+                       p->cfg->sort_tmp_dir[0] ? p->cfg->sort_tmp_dir : p->cfg->record_dir};
+    SortStats stats;
+    if (extsort_records(inputs, 1, path, &opt, &stats) != 0) return -1;
+    log_info("Sorted %llu credential records of %s into %llu unique (%u runs, %u merge passes)",
+             (unsigned long long)stats.records_in, p->input_name, (unsigned long long)stats.records_out, stats.runs,
+             stats.merge_passes);
+    return 0;
+}
+
+// One task loads at a time: SQLite has a single writer, and batches of two
+// tasks would only wait on each other's locks
+static pthread_mutex_t sqlite_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int load_records(Pipeline *p) {
+    char path[PATH_MAX + 300];
+    snprintf(path, sizeof(path), "%s/%s.rec", p->cfg->record_dir, p->output_name);
+    SqlLoadOptions opt = {p->cfg->sqlite_batch_rows, p->cfg->sqlite_staging, p->cfg->sqlite_defer_indexes};
+    pthread_mutex_lock(&sqlite_mutex);
+    SqlLoader *l = sqlload_open(p->cfg->sqlite_db, &opt);
+    int rc = l ? 0 : -1;
+    if (l && sqlload_file(l, path) < 0) rc = -1;
+    if (sqlload_close(l) != 0) rc = -1;
+    pthread_mutex_unlock(&sqlite_mutex);
+    return rc;
+}
+
+int pipeline_close(Pipeline *p, int task_ok) {
+    if (!p) return 0;
+    pipeline_entry_end(p);
+
+    if (p->stealer) {
+        uint64_t groups = stealer_close(p->stealer);
+        p->stealer = NULL;
+        log_info("Parsed stealer logs of %llu victims in %s", (unsigned long long)groups, p->input_name);
+    }
+
+    int rc = p->failed ? -1 : 0;
+    if (p->records) {
+        uint64_t count = p->records->count;
+        if (record_writer_close(p->records) != 0) rc = -1;
+        else log_info("Wrote %llu credential records for %s (%llu already known)", (unsigned long long)count,
+                      p->input_name, (unsigned long long)p->duplicates);
+        if (rc == 0 && p->cfg->sort_records && sort_records(p) != 0) rc = -1;
+        // Rows of a failed task would outlive its quarantine, so only a complete task is loaded
+        if (rc == 0 && task_ok && p->cfg->sqlite_db[0] && load_records(p) != 0) rc = -1;
+    }
+    if (p->shards) {
+        uint64_t count = shard_writer_count(p->shards);
+        int commit = rc == 0 && task_ok;  // A failed task leaves the shards untouched for its retry
+        if (shard_writer_close(p->shards, commit) != 0) rc = -1;
+        else if (commit)
+            log_info("Appended %llu credential records of %s to %d domain shards in %s", (unsigned long long)count,
+                     p->input_name, p->cfg->record_shards, p->cfg->record_shard_dir);
+    }
+    if (p->columns && colstore_writer_close(p->columns) != 0) rc = -1;
+    // A failed task's identities are not published: its retry writes them again
+    int identities = p->id_parts > 0 || p->id_key_count > 0;
+    if (rc == 0 && task_ok && identities && publish_identity_index(p) != 0) rc = -1;
+    for (int i = 0; i < p->id_parts; i++) {
+        char path[PATH_MAX + 320];
+        index_part_path(p, i, path, sizeof(path));
+        unlink(path);
+    }
+    free(p->id_keys);
+    if (p->domains) {
+        // Like the identities, a failed task's segment is discarded and its retry collects it again
+        const char *dir = rc == 0 && task_ok ? p->cfg->domain_index_dir : NULL;
+        if (dir && mkdir_p(dir, 0777) == -1) {
+            log_error("Failed to create domain index directory %s: %s", dir, strerror(errno));
+            dir = NULL;
+            rc = -1;
+        }
+        if (domindex_collect_close(p->domains, dir) != 0) rc = -1;
+    }
+    // Like the shards, a failed task's hashes are dropped and its retry emits them again
+    if (range_writer_close(p->ranges, rc == 0 && task_ok) != 0) rc = -1;
+    if (!p->records && !p->shards && p->duplicates > 0) {
+        log_info("All %llu credential records in %s were already known", (unsigned long long)p->duplicates,
+                 p->input_name);
+    }
+    if (p->secret_out) {
+        if (fclose(p->secret_out) != 0) rc = -1;
+        else log_info("Wrote %llu secrets for %s", (unsigned long long)p->secret_count, p->input_name);
+    }
+    if (p->victim_out) {
+        if (fclose(p->victim_out) != 0) rc = -1;
+        else log_info("Wrote %llu victim profiles for %s", (unsigned long long)p->victim_count, p->input_name);
+    }
+    if (p->manifest_out) {
+        if (fclose(p->manifest_out) != 0) rc = -1;
+        else log_info("Wrote manifest of %llu BLAKE3 hashes for %s (%d SIMD lanes)",
+                      (unsigned long long)p->manifest_entries, p->input_name, blake3_lanes());
+    }
+    free(p->input_hash);
+    free(p->entry_hash);
+    transcoder_free(&p->transcoder);
+    // A failed task is retried: its records must not be dropped as duplicates of themselves
+    if (rc == 0 && task_ok) {
+        if (dedup_batch_commit(p->dedup) != 0) log_warning("Credential dedup is off after %s", p->input_name);
+    } else {
+        dedup_batch_free(p->dedup);
+    }
+    if (p->watchlist) watchlist_release(p->watchlist);
+    free(p->reported);
+    pthread_mutex_destroy(&p->emit_mutex);
+    free(p);
+    return rc;
+}
@@ -0,0 +1,34 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+
+#include "classify.h"
+#include "config.h"
+#include "record.h"
+
+// Per-task content pipeline. extract_archive and copy_file push every entry's
+// decoded bytes through it as they are written, so content stages (parsers,
+// scanners, hashers) run on the data already in memory instead of re-reading
+// extracted/. All functions accept a NULL pipeline and do nothing.
+typedef struct Pipeline Pipeline;
+
+// With dedup set, records already in the global dedup store are dropped. The
+// task's own records are only added to the store by a successful close.
+Pipeline *pipeline_open(const Config *cfg, const char *input_path, int dedup);
+// Raw input bytes as they are read, for the input's manifest hash; a
+// single-file input is hashed as its own entry instead
+void pipeline_input_data(Pipeline *p, const void *data, size_t len);
+// Every input byte has been passed to pipeline_input_data
+void pipeline_input_end(Pipeline *p);
+// entry_name is the path inside the archive, or NULL when the input itself is the entry
+void pipeline_entry_begin(Pipeline *p, const char *entry_name);
+void pipeline_entry_data(Pipeline *p, const void *data, size_t len);
+// What the current entry's first block was classified as; ENTRY_UNKNOWN before it
+EntryKind pipeline_entry_kind(const Pipeline *p);
+void pipeline_entry_end(Pipeline *p);
+// Flush every stage; returns -1 if any output could not be written. Records
+// are committed to the dedup store only when that succeeds and task_ok is set.
+int pipeline_close(Pipeline *p, int task_ok);
+
+#endif
@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "filehandler.h"
+#include "ranges.h"
+
+// k-anonymity range lookup over the hash range files, answering like the
+// Have I Been Pwned range API: every hash starting with a 5 hex digit prefix,
+// printed as SUFFIX:COUNT. Only the run of the prefix in the file's sorted
+// part is read, and the tail appended since the last compaction.
+//
+//   rangequery extracted/ranges sha1 5BAA6
+//   rangequery extracted/ranges ntlm 8846F
+
+static size_t hash_size;
+static uint8_t *hashes;  // Those starting with the prefix
+static size_t count, cap;
+
+static int compare_hashes(const void *a, const void *b) {
+    return memcmp(a, b, hash_size);
+}
+
+// The first 5 hex digits of a hash
+static uint32_t hash_prefix(const uint8_t *hash) {
+    return (uint32_t)hash[0] << 12 | (uint32_t)hash[1] << 4 | hash[2] >> 4;
+}
+
+// Keeps the hashes starting with prefix from offset from to end, or to the end
+// of the file with -1; a sorted range ends at the first hash past the prefix
+static int scan(FILE *f, off_t from, off_t end, uint32_t prefix, int sorted) {
+    if (fseeko(f, from, SEEK_SET) != 0) return -1;
+    uint8_t hash[20];
+    for (off_t pos = from; end < 0 || pos < end; pos += (off_t)hash_size) {
+        if (fread(hash, 1, hash_size, f) != hash_size) break;
+        uint32_t p = hash_prefix(hash);
+        if (p != prefix) {
+            if (sorted && p > prefix) break;
+            continue;
+        }
+        if (count == cap) {
+            size_t grown_cap = cap ? cap * 2 : 1 << 16;
+            uint8_t *grown = realloc(hashes, grown_cap * hash_size);
+            if (!grown) return -1;
+            hashes = grown;
+            cap = grown_cap;
+        }
+        memcpy(hashes + count * hash_size, hash, hash_size);
+        count++;
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4 || (strcmp(argv[2], "sha1") != 0 && strcmp(argv[2], "ntlm") != 0) ||
+        strlen(argv[3]) != RANGE_PREFIX_HEX) {
+        fprintf(stderr, "usage: %s <range_dir> <sha1|ntlm> <%d hex digits>\n", argv[0], RANGE_PREFIX_HEX);
+        return 2;
+    }
+    RangeType type = strcmp(argv[2], "sha1") == 0 ? RANGE_SHA1 : RANGE_NTLM;
+    hash_size = RANGE_HASH_BYTES(type);
+    uint32_t prefix = 0;
+    for (int i = 0; i < RANGE_PREFIX_HEX; i++) {
+        int v = hex_value(argv[3][i]);
+        if (v < 0) {
+            fprintf(stderr, "%s is not a hex prefix\n", argv[3]);
+            return 2;
+        }
+        prefix = prefix << 4 | (uint32_t)v;
+    }
+
+    // The partition file holds every hash sharing the first 3 digits, sorted
+    // up to the length its sidecar records, which is read first: a compaction
+    // replaces the file before the sidecar
+    char path[4096];
+    unsigned partition = prefix >> (4 * RANGE_PREFIX_HEX - RANGE_PARTITION_BITS);
+    snprintf(path, sizeof(path), "%s/%s/%03X.sorted", argv[1], RANGE_TYPE_NAME(type), partition);
+    unsigned long long sorted = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%llu", &sorted) != 1) sorted = 0;
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "%s/%s/%03X.bin", argv[1], RANGE_TYPE_NAME(type), partition);
+    f = fopen(path, "rb");
+    if (!f) {
+        if (errno == ENOENT) return 0;
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || sorted > (unsigned long long)st.st_size || sorted % hash_size != 0) sorted = 0;
+
+    // First hash of the prefix in the sorted part
+    uint8_t hash[20];
+    off_t lo = 0, hi = (off_t)(sorted / hash_size);
+    while (lo < hi) {
+        off_t mid = lo + (hi - lo) / 2;
+        if (fseeko(f, mid * (off_t)hash_size, SEEK_SET) != 0 || fread(hash, 1, hash_size, f) != hash_size) break;
+        if (hash_prefix(hash) < prefix) lo = mid + 1;
+        else hi = mid;
+    }
+    // Its run in the sorted part, then every match in the unsorted tail
+    int rc = scan(f, lo * (off_t)hash_size, (off_t)sorted, prefix, 1);
+    if (rc == 0) rc = scan(f, (off_t)sorted, -1, prefix, 0);
+    fclose(f);
+    if (rc != 0) {
+        log_error("Failed to read %s", path);
+        free(hashes);
+        return 1;
+    }
+
+    if (count > 0) qsort(hashes, count, hash_size, compare_hashes);
+    for (size_t i = 0; i < count;) {
+        size_t j = i + 1;
+        while (j < count && memcmp(hashes + i * hash_size, hashes + j * hash_size, hash_size) == 0) j++;
+        // Suffix: the hex digits after the prefix
+        char hex[41];
+        for (size_t k = 0; k < hash_size; k++) sprintf(hex + 2 * k, "%02X", hashes[i * hash_size + k]);
+        printf("%s:%zu\n", hex + RANGE_PREFIX_HEX, j - i);
+        i = j;
+    }
+    free(hashes);
+    return 0;
+}
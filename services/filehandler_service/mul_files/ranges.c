@@ -0,0 +1,440 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "mbhash.h"
+#include "ranges.h"
+
+#define PARTITIONS (1 << RANGE_PARTITION_BITS)
+#define ARENA_BYTES (1 << 20)  // Secret bytes of one batch
+#define RANGE_TASK_DIR ".tasks"  // <dir>/.tasks/<task key>: partition files a task has appended to
+
+typedef struct {
+    uint32_t file;  // type * PARTITIONS + partition
+    uint64_t offset;  // In the spool
+    size_t len;
+} RangeChunk;
+
+struct RangeWriter {
+    char dir[PATH_MAX];
+    MbMessage batch[RANGE_BATCH];
+    size_t batch_count;
+    char *arena;
+    size_t arena_used;
+    uint8_t sha1[RANGE_BATCH][20];
+    MbMessage ntlm_batch[RANGE_BATCH];  // The batch's secrets short enough for NTLM
+    uint8_t ntlm[RANGE_BATCH][16];
+    uint8_t *hashes[RANGE_TYPES];  // RANGE_BUFFER_HASHES each, in arrival order
+    size_t hash_count[RANGE_TYPES];
+    uint8_t *sorted;  // One type's hashes grouped by partition
+    uint32_t ends[PARTITIONS];  // End of each partition in sorted
+    uint64_t task;
+    uint64_t written;
+    int failed;
+    int spool;  // Unlinked file in dir holding the full buffers until close; -1 until the first
+    uint64_t spool_size;
+    RangeChunk *chunks;
+    size_t chunk_count, chunk_cap;
+};
+
+// Hex digests (MD5, SHA-1, SHA-256, SHA-512) and modular crypt strings such as
+// $2y$10$... or $6$salt$... are stored hashes, not passwords
+static int looks_hashed(const char *s, size_t len) {
+    if (len >= 20 && s[0] == '$' && memchr(s + 1, '$', len - 1)) return 1;
+    if (len != 32 && len != 40 && len != 64 && len != 128) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) return 0;
+    }
+    return 1;
+}
+
+RangeWriter *range_writer_open(const char *dir, uint64_t task) {
+    RangeWriter *w = calloc(1, sizeof(RangeWriter));
+    if (!w) return NULL;
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->task = task;
+    w->spool = -1;
+    w->arena = malloc(ARENA_BYTES);
+    w->sorted = malloc((size_t)RANGE_BUFFER_HASHES * 20);
+    int ok = w->arena && w->sorted;
+    for (int t = 0; t < RANGE_TYPES && ok; t++) {
+        w->hashes[t] = malloc((size_t)RANGE_BUFFER_HASHES * RANGE_HASH_BYTES(t));
+        ok = w->hashes[t] != NULL;
+    }
+    for (int t = 0; t < RANGE_TYPES && ok; t++) {
+        char path[PATH_MAX + 8];
+        snprintf(path, sizeof(path), "%s/%s", dir, RANGE_TYPE_NAME(t));
+        if (mkdir_p(path, 0777) == -1) {
+            log_error("Failed to create range directory %s: %s", path, strerror(errno));
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        log_error("Failed to open range writer for %s", dir);
+        for (int t = 0; t < RANGE_TYPES; t++) free(w->hashes[t]);
+        free(w->arena);
+        free(w->sorted);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Moves one type's buffered hashes into sorted, grouped by partition
+static void group_type(RangeWriter *w, RangeType t) {
+    size_t size = RANGE_HASH_BYTES(t), count = w->hash_count[t];
+    w->hash_count[t] = 0;
+    memset(w->ends, 0, sizeof(w->ends));
+    const uint8_t *hashes = w->hashes[t];
+    for (size_t i = 0; i < count; i++) w->ends[hashes[i * size] << 4 | hashes[i * size + 1] >> 4]++;
+    uint32_t begin = 0;
+    for (int p = 0; p < PARTITIONS; p++) {
+        uint32_t n = w->ends[p];
+        w->ends[p] = begin;
+        begin += n;
+    }
+    // ends[p] is the start of partition p until its hashes are placed
+    for (size_t i = 0; i < count; i++) {
+        int p = hashes[i * size] << 4 | hashes[i * size + 1] >> 4;
+        memcpy(w->sorted + (size_t)w->ends[p]++ * size, hashes + i * size, size);
+    }
+}
+
+// Writes a full buffer to the spool; nothing reaches the partition files
+// before the task commits
+static void spill_type(RangeWriter *w, RangeType t) {
+    size_t size = RANGE_HASH_BYTES(t), count = w->hash_count[t];
+    if (count == 0 || w->failed) {
+        w->hash_count[t] = 0;
+        return;
+    }
+    group_type(w, t);
+    if (w->spool == -1) {
+        char path[PATH_MAX + 32];
+        snprintf(path, sizeof(path), "%s/.spool.XXXXXX", w->dir);
+        w->spool = mkstemp(path);
+        if (w->spool == -1) {
+            log_error("Failed to create range spool in %s: %s", w->dir, strerror(errno));
+            w->failed = 1;
+            return;
+        }
+        unlink(path);
+    }
+    if (w->chunk_count + PARTITIONS > w->chunk_cap) {
+        size_t cap = w->chunk_cap ? w->chunk_cap * 2 : 2 * PARTITIONS;
+        RangeChunk *chunks = realloc(w->chunks, cap * sizeof(RangeChunk));
+        if (!chunks) {
+            log_error("Failed to allocate range chunks for %s", w->dir);
+            w->failed = 1;
+            return;
+        }
+        w->chunks = chunks;
+        w->chunk_cap = cap;
+    }
+    if (write_all(w->spool, w->sorted, count * size) != 0) {
+        log_error("Failed to spool hashes in %s: %s", w->dir, strerror(errno));
+        w->failed = 1;
+        return;
+    }
+    uint32_t begin = 0;
+    for (int p = 0; p < PARTITIONS; p++) {
+        uint32_t end = w->ends[p];
+        if (end == begin) continue;
+        w->chunks[w->chunk_count++] =
+            (RangeChunk){(uint32_t)(t * PARTITIONS + p), w->spool_size + (uint64_t)begin * size, (end - begin) * size};
+        begin = end;
+    }
+    w->spool_size += count * size;
+}
+
+static void hash_batch(RangeWriter *w) {
+    size_t n = w->batch_count;
+    if (n == 0) return;
+    size_t ntlm_n = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (w->batch[i].len <= MBHASH_MAX_NTLM) w->ntlm_batch[ntlm_n++] = w->batch[i];
+    }
+    mbhash_sha1(w->batch, n, w->sha1);
+    mbhash_ntlm(w->ntlm_batch, ntlm_n, w->ntlm);
+    memcpy(w->hashes[RANGE_SHA1] + w->hash_count[RANGE_SHA1] * 20, w->sha1, n * 20);
+    memcpy(w->hashes[RANGE_NTLM] + w->hash_count[RANGE_NTLM] * 16, w->ntlm, ntlm_n * 16);
+    w->hash_count[RANGE_SHA1] += n;
+    w->hash_count[RANGE_NTLM] += ntlm_n;
+    w->written += n;
+    w->batch_count = 0;
+    w->arena_used = 0;
+    for (int t = 0; t < RANGE_TYPES; t++) {
+        if (w->hash_count[t] + RANGE_BATCH > RANGE_BUFFER_HASHES) spill_type(w, t);
+    }
+}
+
+int range_writer_add(RangeWriter *w, const char *secret, size_t len) {
+    if (len == 0 || len > ARENA_BYTES || looks_hashed(secret, len)) return 0;
+    if (w->batch_count == RANGE_BATCH || w->arena_used + len > ARENA_BYTES) hash_batch(w);
+    memcpy(w->arena + w->arena_used, secret, len);
+    w->batch[w->batch_count].data = (const uint8_t *)w->arena + w->arena_used;
+    w->batch[w->batch_count].len = len;
+    w->batch_count++;
+    w->arena_used += len;
+    return w->failed ? -1 : 0;
+}
+
+// Opens a partition file under its exclusive flock, which serializes appends
+// and compactions of every task on every replica sharing the directory. A
+// compaction renames a new file over the path, so a lock taken on the file it
+// replaced is dropped and taken again on the new one
+static int lock_partition(const char *path, int flags) {
+    for (;;) {
+        int fd = open(path, flags | O_CLOEXEC, 0666);
+        if (fd == -1) return -1;
+        int rc;
+        while ((rc = flock(fd, LOCK_EX)) != 0 && errno == EINTR) {}
+        struct stat held, named;
+        if (rc == 0 && (fstat(fd, &held) != 0 || stat(path, &named) != 0)) rc = -1;
+        if (rc == 0 && held.st_dev == named.st_dev && held.st_ino == named.st_ino) return fd;
+        int err = errno;
+        close(fd);
+        if (rc != 0) {
+            errno = err;
+            return -1;
+        }
+    }
+}
+
+// Appends a partition's spooled chunks and its part of the tail
+static int append_partition(RangeWriter *w, uint32_t file, const RangeChunk *chunks, size_t n, uint8_t *copy,
+                            const uint8_t *tail, size_t tail_len) {
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s/%03X.bin", w->dir, RANGE_TYPE_NAME(file / PARTITIONS), file % PARTITIONS);
+    int fd = lock_partition(path, O_WRONLY | O_APPEND | O_CREAT);
+    int rc = fd == -1 ? -1 : 0;
+    for (size_t i = 0; rc == 0 && i < n; i++) {
+        if (pread(w->spool, copy, chunks[i].len, (off_t)chunks[i].offset) != (ssize_t)chunks[i].len) rc = -1;
+        else rc = write_all(fd, copy, chunks[i].len);
+    }
+    if (rc == 0) rc = write_all(fd, tail, tail_len);
+    if (fd != -1 && close(fd) != 0) rc = -1;  // Also releases the lock
+    if (rc != 0) log_error("Failed to append range file %s: %s", path, strerror(errno));
+    return rc;
+}
+
+static int compare_sha1(const void *a, const void *b) {
+    return memcmp(a, b, 20);
+}
+
+static int compare_ntlm(const void *a, const void *b) {
+    return memcmp(a, b, 16);
+}
+
+// Length of the sorted prefix its sidecar records; 0 without one
+static uint64_t read_sorted_len(const char *path) {
+    FILE *f = fopen(path, "r");
+    unsigned long long len = 0;
+    if (f) {
+        if (fscanf(f, "%llu", &len) != 1) len = 0;
+        fclose(f);
+    }
+    return len;
+}
+
+// Replaces path with data through a temporary file beside it
+static int replace_file(const char *path, const void *data, size_t len, mode_t mode) {
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd == -1) return -1;
+    int rc = fchmod(fd, mode) == 0 && write_all(fd, data, len) == 0 ? 0 : -1;
+    if (close(fd) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) unlink(tmp);
+    return rc;
+}
+
+int range_compact(const char *dir, RangeType t, unsigned partition, int force) {
+    char path[PATH_MAX + 16], sorted_path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s/%03X.bin", dir, RANGE_TYPE_NAME(t), partition);
+    snprintf(sorted_path, sizeof(sorted_path), "%s/%s/%03X.sorted", dir, RANGE_TYPE_NAME(t), partition);
+    int fd = lock_partition(path, O_RDONLY);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+    size_t size = RANGE_HASH_BYTES(t);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    uint64_t total = (uint64_t)st.st_size - (uint64_t)st.st_size % size;
+    uint64_t sorted = read_sorted_len(sorted_path);
+    if (sorted > total || sorted % size != 0) sorted = 0;
+    uint64_t tail = total - sorted;
+    if (tail == 0 || (!force && (tail < RANGE_COMPACT_MIN_BYTES || tail * 4 < sorted))) {
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *data = malloc(total ? total : 1), *merged = malloc(total ? total : 1);
+    int rc = data && merged && pread(fd, data, total, 0) == (ssize_t)total ? 0 : -1;
+    if (rc == 0) {
+        qsort(data + sorted, tail / size, size, t == RANGE_SHA1 ? compare_sha1 : compare_ntlm);
+        const uint8_t *a = data, *a_end = data + sorted, *b = a_end, *b_end = data + total;
+        uint8_t *out = merged;
+        while (a < a_end || b < b_end) {
+            const uint8_t **from = b == b_end || (a < a_end && memcmp(a, b, size) <= 0) ? &a : &b;
+            memcpy(out, *from, size);
+            out += size;
+            *from += size;
+        }
+        // The sidecar is written after the file, and both only under the lock:
+        // a reader that finds a new sidecar opens the file it describes
+        char len[32];
+        int n = snprintf(len, sizeof(len), "%llu\n", (unsigned long long)total);
+        rc = replace_file(path, merged, total, st.st_mode & 0777);
+        if (rc == 0) rc = replace_file(sorted_path, len, (size_t)n, st.st_mode & 0777);
+    }
+    if (rc != 0) log_error("Failed to compact range file %s: %s", path, strerror(errno));
+    free(data);
+    free(merged);
+    close(fd);
+    return rc == 0 ? 1 : -1;
+}
+
+int range_prune_tasks(const char *dir, long max_age_sec) {
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/" RANGE_TASK_DIR, dir);
+    DIR *d = opendir(path);
+    if (!d) return 0;
+    time_t cutoff = time(NULL) - max_age_sec;
+    int removed = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        struct stat st;
+        if (e->d_name[0] == '.' || fstatat(dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISREG(st.st_mode) && st.st_mtime < cutoff && unlinkat(dirfd(d), e->d_name, 0) == 0) removed++;
+    }
+    closedir(d);
+    return removed;
+}
+
+static int compare_chunks(const void *a, const void *b) {
+    const RangeChunk *x = a, *y = b;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// Reads which partition files a previous attempt of the task already appended to
+static void read_task_marker(const char *path, uint8_t *done) {
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    unsigned file;
+    while (fscanf(f, "%u", &file) == 1) {
+        if (file < RANGE_TYPES * PARTITIONS) done[file] = 1;
+    }
+    fclose(f);
+}
+
+static int commit_ranges(RangeWriter *w) {
+    if (w->written == 0) return 0;
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/" RANGE_TASK_DIR, w->dir);
+    if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+        log_error("Failed to create range task directory %s: %s", path, strerror(errno));
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/" RANGE_TASK_DIR "/%016llx", w->dir, (unsigned long long)w->task);
+    uint8_t *done = calloc(RANGE_TYPES * PARTITIONS, 1);
+    size_t longest = 1;
+    for (size_t i = 0; i < w->chunk_count; i++) {
+        if (w->chunks[i].len > longest) longest = w->chunks[i].len;
+    }
+    uint8_t *copy = malloc(longest);
+    FILE *marker = NULL;
+    if (done && copy) {
+        read_task_marker(path, done);
+        marker = fopen(path, "a");
+    }
+    if (!marker) {
+        log_error("Failed to open range task marker %s: %s", path, strerror(errno));
+        free(done);
+        free(copy);
+        return -1;
+    }
+
+    if (w->chunk_count > 0) qsort(w->chunks, w->chunk_count, sizeof(RangeChunk), compare_chunks);
+    int rc = 0;
+    uint32_t skipped = 0, compacted = 0;
+    size_t next = 0;
+    for (int t = 0; t < RANGE_TYPES && rc == 0; t++) {
+        size_t size = RANGE_HASH_BYTES(t);
+        group_type(w, t);
+        uint32_t begin = 0;
+        for (uint32_t p = 0; p < PARTITIONS && rc == 0; p++) {
+            uint32_t file = (uint32_t)t * PARTITIONS + p, end = w->ends[p];
+            size_t first = next;
+            while (next < w->chunk_count && w->chunks[next].file == file) next++;
+            const uint8_t *tail = w->sorted + (size_t)begin * size;
+            size_t tail_len = (size_t)(end - begin) * size;
+            begin = end;
+            if (first == next && tail_len == 0) continue;
+            if (done[file]) {
+                skipped++;
+                continue;
+            }
+            rc = append_partition(w, file, w->chunks + first, next - first, copy, tail, tail_len);
+            // The marker line follows the append, so a retry never appends a partition twice
+            if (rc == 0 && (fprintf(marker, "%u\n", file) < 0 || fflush(marker) != 0)) rc = -1;
+            // A failed compaction leaves the file as appended; a later commit tries again
+            if (rc == 0 && range_compact(w->dir, (RangeType)t, p, 0) == 1) compacted++;
+        }
+    }
+    if (fclose(marker) != 0) rc = -1;
+    if (rc != 0) log_error("Failed to commit range hashes of task %016llx in %s", (unsigned long long)w->task, w->dir);
+    if (skipped > 0) {
+        log_info("Skipped %u range files already appended by an earlier attempt of task %016llx", skipped,
+                 (unsigned long long)w->task);
+    }
+    if (compacted > 0) {
+        int pruned = range_prune_tasks(w->dir, RANGE_TASK_KEEP_SEC);
+        if (pruned > 0) log_info("Pruned %d range task markers older than %d days", pruned, RANGE_TASK_KEEP_SEC / 86400);
+    }
+    free(done);
+    free(copy);
+    return rc;
+}
+
+int range_writer_close(RangeWriter *w, int commit) {
+    if (!w) return 0;
+    hash_batch(w);
+    int rc = w->failed ? -1 : commit ? commit_ranges(w) : 0;
+    if (rc == 0 && commit && w->written > 0) {
+        log_info("Hashed %llu secrets into ranges under %s (%d SIMD lanes)", (unsigned long long)w->written, w->dir,
+                 mbhash_lanes());
+    }
+    for (int t = 0; t < RANGE_TYPES; t++) free(w->hashes[t]);
+    if (w->spool != -1) close(w->spool);
+    free(w->arena);
+    free(w->sorted);
+    free(w->chunks);
+    free(w);
+    return rc;
+}
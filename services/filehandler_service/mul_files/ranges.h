@@ -0,0 +1,49 @@
+#ifndef RANGES_H
+#define RANGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RANGE_PARTITION_BITS 12  // 4096 files per hash type, named by the first 3 hex digits
+#define RANGE_PREFIX_HEX 5  // k-anonymity prefix a query reveals, as in Have I Been Pwned
+#define RANGE_BATCH 256  // Secrets hashed per multi-buffer call
+#define RANGE_BUFFER_HASHES 262144  // Hashes per type buffered before they move to the task's spool
+#define RANGE_COMPACT_MIN_BYTES 4096  // Unsorted tail a partition file reaches before it is sorted in
+#define RANGE_TASK_KEEP_SEC (7 * 86400)  // Age past any retry of a task, when its marker is pruned
+
+typedef enum { RANGE_SHA1, RANGE_NTLM, RANGE_TYPES } RangeType;
+
+#define RANGE_TYPE_NAME(t) ((t) == RANGE_SHA1 ? "sha1" : "ntlm")  // Subdirectory
+#define RANGE_HASH_BYTES(t) ((t) == RANGE_SHA1 ? 20 : 16)
+
+// Password hashes for k-anonymity range queries. <dir>/sha1/ABC.bin and
+// <dir>/ntlm/ABC.bin hold the raw 20- or 16-byte hashes starting with hex
+// digits ABC, one per credential. A task's hashes reach the files only when
+// it commits, under a flock per file, so replicas sharing the directory can
+// append concurrently; <dir>/.tasks/<task> lists the files a task has
+// appended to, and a retry of the task skips them. rangequery answers prefix
+// queries.
+//
+// Appends land unsorted after a file's sorted prefix, whose length in bytes
+// ABC.sorted holds in decimal. Once the tail reaches RANGE_COMPACT_MIN_BYTES
+// and a quarter of the prefix, the committing task sorts it in under the same
+// flock, so a query binary-searches the prefix and scans only the tail. A
+// commit that compacted also prunes the task markers older than
+// RANGE_TASK_KEEP_SEC.
+typedef struct RangeWriter RangeWriter;
+
+// task identifies the input across attempts
+RangeWriter *range_writer_open(const char *dir, uint64_t task);
+// Queue a secret; values that already look like password hashes are skipped
+int range_writer_add(RangeWriter *w, const char *secret, size_t len);
+// With commit set, appends the task's hashes to the files it has not appended
+// to yet; otherwise drops them. Returns -1 if any append failed
+int range_writer_close(RangeWriter *w, int commit);
+
+// Sorts the tail of a partition file into its prefix when it is due, or
+// whenever it is not empty with force. Returns 1 if it did, 0 if not, -1 on error.
+int range_compact(const char *dir, RangeType t, unsigned partition, int force);
+// Removes the task markers in dir not written to for max_age_sec; returns how many
+int range_prune_tasks(const char *dir, long max_age_sec);
+
+#endif
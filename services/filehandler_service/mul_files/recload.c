@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filehandler.h"
+#include "sqlload.h"
+
+// Bulk-loads .rec credential record files into the credentials table of a
+// SQLite database, for backfills and rebuilds:
+//
+//   recload [-b batch_rows] [-s staging] [-i deferred_indexes] ../db_service/data.db extracted/records/*.rec
+//
+// By default the secondary indexes are dropped for the load and rebuilt once
+// at the end, when the files add at least a quarter of the rows already in the
+// table, and all files go through one staging table merged in fingerprint order.
+// Pass -i 0 to keep the indexes usable by readers during the load.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-b batch_rows] [-s 0|1] [-i 0|1] <db> <in.rec>...\n", prog);
+}
+
+int main(int argc, char **argv) {
+    SqlLoadOptions opt = {100000, 1, 1};
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-b") == 0) opt.batch_rows = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) opt.staging = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-i") == 0) opt.defer_indexes = atoi(argv[i + 1]);
+        else break;
+    }
+    if (argc - i < 2 || opt.batch_rows < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    SqlLoader *l = sqlload_open(argv[i], &opt);
+    if (!l) return 1;
+    int rc = 0;
+    for (int j = i + 1; j < argc && rc == 0; j++) {
+        if (sqlload_file(l, argv[j]) < 0) rc = 1;
+    }
+    if (sqlload_close(l) != 0) rc = 1;
+    return rc;
+}
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "filehandler.h"
+#include "hash.h"
+#include "record.h"
+
+// Fields joined with NUL separators; anything longer than a record field can
+// hold is never written, so truncating it here loses nothing
+static __thread char fingerprint_buffer[3 * RECORD_FIELD_MAX + 2];
+
+void record_fingerprint(const CredentialRecord *rec, uint64_t out[2]) {
+    size_t identity_len = rec->identity_len < RECORD_FIELD_MAX ? rec->identity_len : RECORD_FIELD_MAX;
+    size_t secret_len = rec->secret_len < RECORD_FIELD_MAX ? rec->secret_len : RECORD_FIELD_MAX;
+    size_t url_len = rec->url_len < RECORD_FIELD_MAX ? rec->url_len : RECORD_FIELD_MAX;
+    char *p = fingerprint_buffer;
+
+    memcpy(p, rec->identity, identity_len);
+    p += identity_len;
+    *p++ = '\0';
+    memcpy(p, rec->secret, secret_len);
+    p += secret_len;
+    *p++ = '\0';
+    memcpy(p, rec->url, url_len);
+    p += url_len;
+    murmur3_128(fingerprint_buffer, (size_t)(p - fingerprint_buffer), 0, out);
+}
+
+int record_column_rank(const char *list, const char *name, size_t name_len) {
+    int position = 0;
+    const char *p = list;
+    while (*p) {
+        while (*p == ',' || *p == ' ') p++;
+        if (!*p) break;
+        const char *start = p;
+        while (*p && *p != ',' && *p != ' ') p++;
+        position++;
+        if ((size_t)(p - start) == name_len && strncasecmp(start, name, name_len) == 0) return position;
+    }
+    return 0;
+}
+
+static int writer_flush(RecordWriter *w) {
+    if (w->used && fwrite(w->buffer, 1, w->used, w->out) != w->used) {
+        log_error("Failed to write records to %s: %s", w->path, strerror(errno));
+        return -1;
+    }
+    w->used = 0;
+    return 0;
+}
+
+RecordWriter *record_writer_open(const char *path) {
+    RecordWriter *w = calloc(1, sizeof(RecordWriter));
+    if (!w) return NULL;
+    w->buffer = malloc(RECORD_WRITE_BUFFER);
+    w->out = fopen(path, "wb");
+    if (!w->buffer || !w->out) {
+        log_error("Failed to open record file %s: %s", path, strerror(errno));
+        if (w->out) fclose(w->out);
+        free(w->buffer);
+        free(w);
+        return NULL;
+    }
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    memcpy(w->buffer, RECORD_FILE_MAGIC, 6);
+    w->used = 6;
+    return w;
+}
+
+static void put_u16(char *p, size_t v) {
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)(v >> 8);
+}
+
+size_t record_encoded_size(const CredentialRecord *rec) {
+    return 8 + rec->source_len + rec->identity_len + rec->secret_len + rec->url_len;
+}
+
+void record_encode(char *p, const CredentialRecord *rec) {
+    put_u16(p, rec->source_len);
+    put_u16(p + 2, rec->identity_len);
+    put_u16(p + 4, rec->secret_len);
+    put_u16(p + 6, rec->url_len);
+    p += 8;
+    memcpy(p, rec->source, rec->source_len);
+    p += rec->source_len;
+    memcpy(p, rec->identity, rec->identity_len);
+    p += rec->identity_len;
+    memcpy(p, rec->secret, rec->secret_len);
+    p += rec->secret_len;
+    memcpy(p, rec->url, rec->url_len);
+}
+
+int record_writer_add(RecordWriter *w, const CredentialRecord *rec) {
+    if (rec->source_len > RECORD_FIELD_MAX || rec->identity_len > RECORD_FIELD_MAX ||
+        rec->secret_len > RECORD_FIELD_MAX || rec->url_len > RECORD_FIELD_MAX) {
+        return 1;
+    }
+    size_t need = record_encoded_size(rec);
+    if (w->used + need > RECORD_WRITE_BUFFER && writer_flush(w) != 0) return -1;
+
+    record_encode(w->buffer + w->used, rec);
+    w->used += need;
+    w->count++;
+    return 0;
+}
+
+int record_writer_close(RecordWriter *w) {
+    int rc = writer_flush(w);
+    if (fclose(w->out) != 0) rc = -1;
+    free(w->buffer);
+    free(w);
+    return rc;
+}
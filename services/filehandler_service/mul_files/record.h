@@ -0,0 +1,56 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RECORD_FILE_MAGIC "SGREC\001"  // 6-byte header of every .rec file
+#define RECORD_FIELD_MAX 65535  // Fields are length-prefixed with a u16
+#define RECORD_WRITE_BUFFER (1 << 20)
+
+// A normalized credential found in a dump. Fields point into parser-owned
+// memory and are only valid for the duration of the emit call.
+typedef struct {
+    const char *source;  // <input file>/<entry path>
+    size_t source_len;
+    const char *identity;  // Email, username or phone; emails are lowercased
+    size_t identity_len;
+    const char *secret;
+    size_t secret_len;
+    const char *url;  // Empty unless the line carried one
+    size_t url_len;
+} CredentialRecord;
+
+// Parsers hand every record they produce to one of these
+typedef void (*record_emit_fn)(void *ctx, const CredentialRecord *rec);
+
+// Buffered writer for .rec files: after the magic, each record is four
+// little-endian u16 lengths (source, identity, secret, url) followed by the bytes
+typedef struct {
+    FILE *out;
+    char *buffer;
+    size_t used;
+    uint64_t count;
+    char path[4096];
+} RecordWriter;
+
+// 128-bit identity of a credential over identity, secret and url. The source is
+// left out so the same credential reposted in another dump hashes the same.
+void record_fingerprint(const CredentialRecord *rec, uint64_t out[2]);
+
+// 1-based position of a column name in a comma-separated, case-insensitive
+// list such as "email,username,login"; 0 when absent. Parsers that map named
+// columns use it as a priority: the lowest-ranked non-empty column wins.
+int record_column_rank(const char *list, const char *name, size_t name_len);
+
+// Encoded size of a record, and the encoding itself; fields must fit RECORD_FIELD_MAX
+size_t record_encoded_size(const CredentialRecord *rec);
+void record_encode(char *out, const CredentialRecord *rec);
+
+RecordWriter *record_writer_open(const char *path);
+// Returns 0 when buffered, 1 if a field is too long to encode (skipped), -1 on write failure
+int record_writer_add(RecordWriter *w, const CredentialRecord *rec);
+int record_writer_close(RecordWriter *w);
+
+#endif
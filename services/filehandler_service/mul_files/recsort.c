@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extsort.h"
+#include "filehandler.h"
+
+// Merges .rec credential record files into one sorted by fingerprint, with
+// every duplicate removed, using bounded memory:
+//
+//   recsort [-m memory_mb] [-t threads] [-T tmp_dir] all.rec extracted/records/*.rec
+//
+// The output may also be one of the inputs.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-m memory_mb] [-t threads] [-T tmp_dir] <out.rec> <in.rec>...\n", prog);
+}
+
+int main(int argc, char **argv) {
+    SortOptions opt = {1024LL << 20, 4, "."};
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-m") == 0) opt.memory_bytes = atoll(argv[i + 1]) << 20;
+        else if (strcmp(argv[i], "-t") == 0) opt.threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-T") == 0) opt.tmp_dir = argv[i + 1];
+        else break;
+    }
+    if (argc - i < 2 || opt.threads < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    SortStats stats;
+    if (extsort_records((const char *const *)argv + i + 1, argc - i - 1, argv[i], &opt, &stats) != 0) return 1;
+    log_info("%llu records in, %llu unique out; %u runs, %u merge passes", (unsigned long long)stats.records_in,
+             (unsigned long long)stats.records_out, stats.runs, stats.merge_passes);
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filehandler.h"
+#include "retry.h"
+#include "watcher.h"
+
+typedef struct FailureEntry {
+    char *path;
+    int attempts;
+    struct FailureEntry *next;
+} FailureEntry;
+
+typedef struct DelayedTask {
+    char *path;
+    struct timespec due;
+    struct DelayedTask *next;
+} DelayedTask;
+
+static pthread_mutex_t failure_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FailureEntry *failure_table[FAILURE_TABLE_BUCKETS];
+
+static pthread_mutex_t delayed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delayed_changed;
+static pthread_once_t delayed_once = PTHREAD_ONCE_INIT;
+static DelayedTask *delayed_head = NULL;  // Sorted by due time
+
+// FNV-1a over the path
+static unsigned bucket_of(const char *path) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h % FAILURE_TABLE_BUCKETS;
+}
+
+// Caller holds failure_mutex
+static FailureEntry *failure_lookup(const char *path) {
+    unsigned b = bucket_of(path);
+    for (FailureEntry *e = failure_table[b]; e; e = e->next) {
+        if (strcmp(e->path, path) == 0) return e;
+    }
+
+    FailureEntry *e = calloc(1, sizeof(FailureEntry));
+    if (!e) return NULL;
+    e->path = strdup(path);
+    if (!e->path) {
+        free(e);
+        return NULL;
+    }
+    e->next = failure_table[b];
+    failure_table[b] = e;
+    return e;
+}
+
+int failure_record(const char *path) {
+    pthread_mutex_lock(&failure_mutex);
+    FailureEntry *e = failure_lookup(path);
+    int attempts = e ? ++e->attempts : 1;
+    pthread_mutex_unlock(&failure_mutex);
+    return attempts;
+}
+
+void failure_clear(const char *path) {
+    pthread_mutex_lock(&failure_mutex);
+    FailureEntry **link = &failure_table[bucket_of(path)];
+    while (*link) {
+        FailureEntry *e = *link;
+        if (strcmp(e->path, path) == 0) {
+            *link = e->next;
+            free(e->path);
+            free(e);
+            break;
+        }
+        link = &e->next;
+    }
+    pthread_mutex_unlock(&failure_mutex);
+}
+
+long retry_backoff_ms(const Config *cfg, int attempts) {
+    long long delay = cfg->retry_base_delay_ms;
+    for (int i = 1; i < attempts && delay < cfg->retry_max_delay_ms; i++) {
+        delay *= 2;
+    }
+    return delay < cfg->retry_max_delay_ms ? delay : cfg->retry_max_delay_ms;
+}
+
+DeliveryOutcome handle_failure(FileTask *task, const Config *cfg) {
+    const char *reason = task->failure_reason;
+    int attempts = failure_record(task->file_path);
+    if (attempts < task->attempts + 1) attempts = task->attempts + 1;
+
+    if (attempts > cfg->max_retries) {
+        failure_clear(task->file_path);
+        log_error("Quarantining %s after %d failed attempts: %s", task->file_path, attempts, reason);
+        if (task->channel != 0) {
+            complete_delivery(task->channel, task->delivery_tag, task->file_path, OUTCOME_DEAD, attempts, 0, reason);
+        }
+        return OUTCOME_DEAD;
+    }
+
+    long delay_ms = retry_backoff_ms(cfg, attempts);
+    log_warning("Retrying %s in %ld ms (attempt %d of %d failed: %s)",
+                task->file_path, delay_ms, attempts, cfg->max_retries + 1, reason);
+    if (task->channel != 0) {
+        complete_delivery(task->channel, task->delivery_tag, task->file_path, OUTCOME_RETRY, attempts, delay_ms, reason);
+    } else {
+        retry_schedule(task->file_path, delay_ms);
+    }
+    return OUTCOME_RETRY;
+}
+
+// Requests for task's own path are covered by it: acked unless it was
+// quarantined, and a retry of the task covers them too. A content alias,
+// another path attached for holding the same bytes, is settled like a task of
+// its own: its failure entry cleared, or counted and retried with its own
+// backoff, and a watched one marked processed, so that neither the next scan
+// nor a restart queues it again.
+void settle_waiters(InflightWaiter *waiters, const FileTask *task, DeliveryOutcome outcome, const Config *cfg) {
+    while (waiters) {
+        InflightWaiter *next = waiters->next;
+        int alias = strcmp(waiters->file_path, task->file_path) != 0;
+        DeliveryOutcome own = outcome;
+        if (alias && outcome == OUTCOME_RETRY) {
+            FileTask waiter = {waiters->file_path, waiters->channel, waiters->delivery_tag, 0, ""};
+            snprintf(waiter.failure_reason, sizeof(waiter.failure_reason), "same content as %s: %.128s",
+                     task->file_path, task->failure_reason);
+            own = handle_failure(&waiter, cfg);
+        } else {
+            if (alias) failure_clear(waiters->file_path);
+            if (waiters->channel != 0 && outcome == OUTCOME_DEAD) {
+                complete_delivery(waiters->channel, waiters->delivery_tag, waiters->file_path,
+                                  OUTCOME_DEAD, 0, 0, "duplicate of quarantined file");
+            } else if (waiters->channel != 0) {
+                complete_delivery(waiters->channel, waiters->delivery_tag, NULL, OUTCOME_ACK, 0, 0, NULL);
+            }
+        }
+        if (alias && waiters->channel == 0 && own != OUTCOME_RETRY) watch_mark_processed(waiters->file_path);
+        free(waiters->file_path);
+        free(waiters);
+        waiters = next;
+    }
+}
+
+// Waits use CLOCK_MONOTONIC so wall-clock adjustments do not stall retries
+static void delayed_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&delayed_changed, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int retry_schedule(const char *path, long delay_ms) {
+    pthread_once(&delayed_once, delayed_init);
+
+    DelayedTask *task = malloc(sizeof(DelayedTask));
+    if (!task) {
+        log_error("Failed to allocate retry for %s", path);
+        return -1;
+    }
+    task->path = strdup(path);
+    if (!task->path) {
+        free(task);
+        log_error("Failed to allocate retry for %s", path);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &task->due);
+    task->due.tv_sec += delay_ms / 1000;
+    task->due.tv_nsec += (delay_ms % 1000) * 1000000L;
+    if (task->due.tv_nsec >= 1000000000L) {
+        task->due.tv_sec++;
+        task->due.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&delayed_mutex);
+    DelayedTask **link = &delayed_head;
+    while (*link && ((*link)->due.tv_sec < task->due.tv_sec ||
+                     ((*link)->due.tv_sec == task->due.tv_sec && (*link)->due.tv_nsec <= task->due.tv_nsec))) {
+        link = &(*link)->next;
+    }
+    task->next = *link;
+    *link = task;
+    pthread_cond_signal(&delayed_changed);
+    pthread_mutex_unlock(&delayed_mutex);
+    return 0;
+}
+
+void *retry_thread(void *arg) {
+    (void)arg;
+    pthread_once(&delayed_once, delayed_init);
+
+    pthread_mutex_lock(&delayed_mutex);
+    while (1) {
+        if (!delayed_head) {
+            pthread_cond_wait(&delayed_changed, &delayed_mutex);
+            continue;
+        }
+        int rc = pthread_cond_timedwait(&delayed_changed, &delayed_mutex, &delayed_head->due);
+        if (rc != ETIMEDOUT) continue;  // Woken by a new, possibly earlier, task
+
+        DelayedTask *task = delayed_head;
+        delayed_head = task->next;
+        pthread_mutex_unlock(&delayed_mutex);
+
+        log_info("Retrying %s", task->path);
+        enqueue_file(task->path, 0, 0);
+        free(task->path);
+        free(task);
+
+        pthread_mutex_lock(&delayed_mutex);
+    }
+    return NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef RETRY_H
+#define RETRY_H
+
+#include "config.h"
+#include "filehandler.h"
+#include "inflight.h"
+#include "taskqueue.h"
+
+#define FAILURE_TABLE_BUCKETS 1024
+
+// Per-path failure accounting shared by all intake modes
+
+// Record a failed attempt and return the total number of failures for path
+int failure_record(const char *path);
+// Forget path once it is settled: acked, or dead-lettered after its last attempt.
+// A dead-lettered watched file stays skipped through its .processed marker.
+void failure_clear(const char *path);
+
+// Exponential backoff before the next attempt after `attempts` failures:
+// retry_base_delay_ms doubled per attempt, capped at retry_max_delay_ms
+long retry_backoff_ms(const Config *cfg, int attempts);
+
+// Account for a failed attempt of task, whose failure_reason is set: retry it
+// with exponential backoff until the budget is spent, then quarantine the file
+// and dead-letter the delivery
+DeliveryOutcome handle_failure(FileTask *task, const Config *cfg);
+
+// Settle the requests that waited on task once it finished with outcome, each
+// under the path it was requested under. See retry.c.
+void settle_waiters(InflightWaiter *waiters, const FileTask *task, DeliveryOutcome outcome, const Config *cfg);
+
+// Re-enqueue a locally sourced file after delay_ms (broker deliveries retry via the retry queue)
+int retry_schedule(const char *path, long delay_ms);
+void *retry_thread(void *arg);
+
+#endif
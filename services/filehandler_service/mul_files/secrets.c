@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "secrets.h"
+
+// Rules and the two-byte anchor that triggers each one (the anchor may sit
+// inside the token; rules look back up to SECRET_LOOKBEHIND bytes):
+//   aws_access_key   AKIA/ASIA + 16 [A-Z0-9]                       "AK" "AS"
+//   google_api_key   AIza + 35 [A-Za-z0-9_-]                       "AI"
+//   github_token     gh[pousr]_ + 36 [A-Za-z0-9]                   "gh"
+//   github_pat       github_pat_ + 82 [A-Za-z0-9_]                 "_p"
+//   stripe_key       [sr]k_live_ + 20-99 [A-Za-z0-9]               "_l"
+//   slack_token      xox[bpaers]- + 10-250 [A-Za-z0-9-]            "xo"
+//   slack_webhook    hooks.slack.com/services/ + 20-120 [A-Za-z0-9_/]  "k."
+//   jwt              eyJ... three base64url segments               "yJ"
+//   private_key      -----BEGIN ... PRIVATE KEY----- (whole block)  "-B"
+//   sendgrid_key     SG. + 22 . 43 [A-Za-z0-9_-]                   "G."
+//   telegram_bot     8-10 digits :AA + 33 [A-Za-z0-9_-]            ":A"
+//   generic_secret   *_key / *_token / *_secret = value, where the
+//                    value is 20-128 chars of high entropy         "_k" "_t" "_s"
+
+static inline int is_digit(uint8_t c) {
+    return (unsigned)(c - '0') < 10;
+}
+
+static inline int is_alnum(uint8_t c) {
+    return (unsigned)((c | 0x20) - 'a') < 26 || is_digit(c);
+}
+
+static inline int is_upper_digit(uint8_t c) {
+    return (unsigned)(c - 'A') < 26 || is_digit(c);
+}
+
+static inline int is_b64url(uint8_t c) {
+    return is_alnum(c) || c == '_' || c == '-';
+}
+
+static inline int is_word(uint8_t c) {
+    return is_alnum(c) || c == '_';
+}
+
+static inline int is_slack_char(uint8_t c) {
+    return is_alnum(c) || c == '-';
+}
+
+static inline int is_path_char(uint8_t c) {
+    return is_word(c) || c == '/';
+}
+
+static inline int is_value_char(uint8_t c) {
+    return is_b64url(c) || c == '+' || c == '/' || c == '.' || c == '=';
+}
+
+// Length of the run of pred characters at b[i], looking at no more than max bytes
+static size_t run(const uint8_t *b, size_t len, size_t i, int (*pred)(uint8_t), size_t max) {
+    size_t n = 0;
+    while (i + n < len && n < max && pred(b[i + n])) n++;
+    return n;
+}
+
+// Exactly n pred characters at b[i], not followed by another one
+static int exact_run(const uint8_t *b, size_t len, size_t i, int (*pred)(uint8_t), size_t n) {
+    return run(b, len, i, pred, n + 1) == n;
+}
+
+static int starts_with(const uint8_t *b, size_t len, size_t i, const char *lit) {
+    size_t n = strlen(lit);
+    return i + n <= len && memcmp(b + i, lit, n) == 0;
+}
+
+static int starts_with_nocase(const uint8_t *b, size_t len, size_t i, const char *lit) {
+    size_t n = strlen(lit);
+    if (i + n > len) return 0;
+    for (size_t k = 0; k < n; k++) {
+        if ((b[i + k] | 0x20) != lit[k]) return 0;
+    }
+    return 1;
+}
+
+static double entropy_bits(const uint8_t *s, size_t n) {
+    uint16_t counts[256] = {0};
+    for (size_t i = 0; i < n; i++) counts[s[i]]++;
+    double h = 0;
+    for (int c = 0; c < 256; c++) {
+        if (!counts[c]) continue;
+        double p = (double)counts[c] / (double)n;
+        h -= p * log2(p);
+    }
+    return h;
+}
+
+static inline int pair_candidate(uint8_t a, uint8_t b) {
+    switch (a) {
+    case 'A': return b == 'K' || b == 'S' || b == 'I';
+    case 'g': return b == 'h';
+    case '_':
+        b |= 0x20;
+        return b == 'p' || b == 'l' || b == 'k' || b == 't' || b == 's';
+    case 'x': return b == 'o';
+    case 'k': return b == '.';
+    case 'y': return b == 'J';
+    case '-': return b == 'B';
+    case 'G': return b == '.';
+    case ':': return b == 'A';
+    }
+    return 0;
+}
+
+static const char *verify(const uint8_t *b, size_t len, size_t i, size_t *start, size_t *end, int allow_generic);
+
+static const char *verify_generic(const uint8_t *b, size_t len, size_t i, size_t *start, size_t *end) {
+    size_t j = i + 1;
+    if (starts_with_nocase(b, len, j, "key")) j += 3;
+    else if (starts_with_nocase(b, len, j, "token")) j += 5;
+    else if (starts_with_nocase(b, len, j, "secret")) j += 6;
+    else return NULL;
+    if (j < len && is_word(b[j])) return NULL;  // API_KEY_ID, secret_keyring, ...
+
+    // NAME = value, "name": "value", name => 'value'
+    for (int k = 0; k < 2 && j < len && (b[j] == '"' || b[j] == '\''); k++) j++;
+    for (int k = 0; k < 3 && j < len && b[j] == ' '; k++) j++;
+    if (j >= len || (b[j] != '=' && b[j] != ':')) return NULL;
+    j++;
+    if (j < len && b[j] == '>') j++;
+    for (int k = 0; k < 3 && j < len && b[j] == ' '; k++) j++;
+    if (j < len && (b[j] == '"' || b[j] == '\'')) j++;
+
+    size_t n = run(b, len, j, is_value_char, 129);
+    if (n < 20 || n > 128) return NULL;
+
+    int letters = 0, digits = 0;
+    for (size_t k = j; k < j + n; k++) {
+        if (is_digit(b[k])) digits = 1;
+        else if (is_alnum(b[k])) letters = 1;
+    }
+    if (!letters || !digits || entropy_bits(b + j, n) < SECRET_MIN_ENTROPY) return NULL;
+
+    // A known token format inside the value is reported under its own rule
+    for (size_t k = j; k + 1 < j + n; k++) {
+        size_t s, e;
+        if (pair_candidate(b[k], b[k + 1]) && verify(b, len, k, &s, &e, 0)) return NULL;
+    }
+    *start = j;
+    *end = j + n;
+    return "generic_secret";
+}
+
+static const char *verify_private_key(const uint8_t *b, size_t len, size_t i, size_t *start, size_t *end) {
+    if (i < 4 || !starts_with(b, len, i - 4, "-----BEGIN ")) return NULL;
+    size_t label = i + 7;
+    size_t n = 0;
+    while (label + n < len && n < 40 && (is_upper_digit(b[label + n]) || b[label + n] == ' ')) n++;
+    if (!starts_with(b, len, label + n, "-----")) return NULL;
+    if (!memmem(b + label, n, "PRIVATE KEY", 11)) return NULL;
+
+    *start = i - 4;
+    *end = label + n + 5;
+    // Include the body when the END line is within reach; otherwise report the header
+    size_t limit = i + SECRET_MAX_TOKEN < len ? i + SECRET_MAX_TOKEN : len;
+    const uint8_t *footer = memmem(b + *end, limit - *end, "-----END ", 9);
+    if (footer) {
+        size_t f = (size_t)(footer - b) + 9;
+        const uint8_t *close = memmem(b + f, limit - f, "-----", 5);
+        if (close && (size_t)(close - b) - f <= 40) *end = (size_t)(close - b) + 5;
+    }
+    return "private_key";
+}
+
+static const char *verify_jwt(const uint8_t *b, size_t len, size_t i, size_t *start, size_t *end) {
+    if (i < 1 || b[i - 1] != 'e' || (i >= 2 && is_b64url(b[i - 2]))) return NULL;
+    size_t limit = i + SECRET_MAX_TOKEN < len ? i + SECRET_MAX_TOKEN : len;
+    size_t j = i - 1;
+    static const size_t min_segment[3] = {10, 10, 16};
+    for (int seg = 0; seg < 3; seg++) {
+        size_t n = run(b, limit, j, is_b64url, SECRET_MAX_TOKEN);
+        if (n < min_segment[seg]) return NULL;
+        j += n;
+        if (seg < 2) {
+            if (j >= limit || b[j] != '.') return NULL;
+            j++;
+        }
+    }
+    *start = i - 1;
+    *end = j;
+    return "jwt";
+}
+
+static const char *verify_telegram(const uint8_t *b, size_t len, size_t i, size_t *start, size_t *end) {
+    if (!starts_with(b, len, i, ":AA")) return NULL;
+    size_t d = 0;
+    while (d < 11 && d < i && is_digit(b[i - 1 - d])) d++;
+    if (d < 8 || d > 10 || (d < i && is_alnum(b[i - 1 - d]))) return NULL;
+    if (!exact_run(b, len, i + 1, is_b64url, 35)) return NULL;
+    *start = i - d;
+    *end = i + 36;
+    return "telegram_bot";
+}
+
+// b[i], b[i + 1] is an anchor pair; on a match return the rule and the value's span
+static const char *verify(const uint8_t *b, size_t len, size_t i, size_t *start, size_t *end, int allow_generic) {
+    const char *rule = NULL;
+    size_t s = i, e = i;
+
+    switch (b[i]) {
+    case 'A':
+        if ((b[i + 1] == 'K' || b[i + 1] == 'S') && starts_with(b, len, i + 2, "IA") &&
+            exact_run(b, len, i + 4, is_upper_digit, 16) && !starts_with(b, len, i + 13, "EXAMPLE")) {
+            rule = "aws_access_key";
+            e = i + 20;
+        } else if (starts_with(b, len, i, "AIza") && exact_run(b, len, i + 4, is_b64url, 35)) {
+            rule = "google_api_key";
+            e = i + 39;
+        }
+        break;
+    case 'g':
+        if (i + 3 < len && b[i + 2] && strchr("pousr", b[i + 2]) && b[i + 3] == '_' &&
+            exact_run(b, len, i + 4, is_alnum, 36)) {
+            rule = "github_token";
+            e = i + 40;
+        }
+        break;
+    case '_':
+        if (i >= 6 && starts_with(b, len, i - 6, "github_pat_") && exact_run(b, len, i + 5, is_word, 82)) {
+            rule = "github_pat";
+            s = i - 6;
+            e = i + 87;
+        } else if (i >= 2 && (b[i - 2] == 's' || b[i - 2] == 'r') && b[i - 1] == 'k' &&
+                   starts_with(b, len, i, "_live_")) {
+            size_t n = run(b, len, i + 6, is_alnum, 100);
+            if (n >= 20 && n <= 99) {
+                rule = "stripe_key";
+                s = i - 2;
+                e = i + 6 + n;
+            }
+        } else if (allow_generic) {
+            return verify_generic(b, len, i, start, end);
+        }
+        break;
+    case 'x':
+        if (starts_with(b, len, i, "xox") && i + 4 < len && b[i + 3] && strchr("bpaers", b[i + 3]) &&
+            b[i + 4] == '-') {
+            size_t n = run(b, len, i + 5, is_slack_char, 251);
+            if (n >= 10 && n <= 250) {
+                rule = "slack_token";
+                e = i + 5 + n;
+            }
+        }
+        break;
+    case 'k':
+        if (i >= 10 && starts_with(b, len, i - 10, "hooks.slack.com/services/")) {
+            size_t n = run(b, len, i + 15, is_path_char, 121);
+            if (n >= 20 && n <= 120) {
+                rule = "slack_webhook";
+                s = i - 10;
+                e = i + 15 + n;
+            }
+        }
+        break;
+    case 'y':
+        return verify_jwt(b, len, i, start, end);
+    case '-':
+        return verify_private_key(b, len, i, start, end);
+    case 'G':
+        if (i >= 1 && b[i - 1] == 'S' && exact_run(b, len, i + 2, is_b64url, 22) && i + 24 < len &&
+            b[i + 24] == '.' && exact_run(b, len, i + 25, is_b64url, 43)) {
+            rule = "sendgrid_key";
+            s = i - 1;
+            e = i + 68;
+        }
+        break;
+    case ':':
+        return verify_telegram(b, len, i, start, end);
+    }
+
+    if (!rule || (s > 0 && is_alnum(b[s - 1]))) return NULL;
+    *start = s;
+    *end = e;
+    return rule;
+}
+
+static void check_candidate(SecretScanner *sc, const uint8_t *buf, size_t len, uint64_t buf_start, size_t i) {
+    size_t s, e;
+    const char *rule = verify(buf, len, i, &s, &e, 1);
+    if (!rule || buf_start + s < sc->reported_end) return;
+
+    SecretMatch m = {rule, buf_start + s, (const char *)buf + s, e - s};
+    sc->reported_end = buf_start + e;
+    sc->matches++;
+    sc->emit(sc->ctx, &m);
+}
+
+#ifdef __SSE2__
+// Bit k set when p[k], p[k + 1] is an anchor pair; reads p[0..16]
+static inline int candidate_mask(const uint8_t *p) {
+#define EQ(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8((char)(c)))
+    __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i f1 = _mm_or_si128(v1, _mm_set1_epi8(0x20));
+
+    __m128i m = _mm_and_si128(EQ(v0, 'A'), _mm_or_si128(_mm_or_si128(EQ(v1, 'K'), EQ(v1, 'S')), EQ(v1, 'I')));
+    __m128i under = _mm_or_si128(_mm_or_si128(EQ(f1, 'p'), EQ(f1, 'l')),
+                                 _mm_or_si128(_mm_or_si128(EQ(f1, 'k'), EQ(f1, 't')), EQ(f1, 's')));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v0, '_'), under));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v0, 'g'), EQ(v1, 'h')));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v0, 'x'), EQ(v1, 'o')));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v1, '.'), _mm_or_si128(EQ(v0, 'k'), EQ(v0, 'G'))));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v0, 'y'), EQ(v1, 'J')));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v0, '-'), EQ(v1, 'B')));
+    m = _mm_or_si128(m, _mm_and_si128(EQ(v0, ':'), EQ(v1, 'A')));
+#undef EQ
+    return _mm_movemask_epi8(m);
+}
+#endif
+
+// Check the anchors at entry offsets [from, to) of buf, which holds the entry
+// bytes starting at offset buf_start
+static void scan_range(SecretScanner *sc, const uint8_t *buf, size_t len, uint64_t buf_start, uint64_t from,
+                       uint64_t to) {
+    size_t i = (size_t)(from - buf_start);
+    size_t stop = (size_t)(to - buf_start);
+#ifdef __SSE2__
+    for (; i + 16 <= stop && i + 17 <= len; i += 16) {
+        int mask = candidate_mask(buf + i);
+        while (mask) {
+            check_candidate(sc, buf, len, buf_start, i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < stop && i + 1 < len; i++) {
+        if (pair_candidate(buf[i], buf[i + 1])) check_candidate(sc, buf, len, buf_start, i);
+    }
+}
+
+void secret_begin(SecretScanner *s, secret_emit_fn emit, void *ctx) {
+    s->emit = emit;
+    s->ctx = ctx;
+    s->pos = 0;
+    s->scanned = 0;
+    s->reported_end = 0;
+    s->matches = 0;
+    s->carry_len = 0;
+}
+
+// Anchors are checked once every byte a rule may read is available: those in
+// the last SECRET_MAX_TOKEN bytes wait for the next block, and those in the
+// first SECRET_LOOKBEHIND bytes are checked against the carried tail
+void secret_feed(SecretScanner *s, const void *data, size_t len) {
+    if (len == 0) return;
+    const uint8_t *bytes = data;
+    uint64_t avail_end = s->pos + len;
+    uint64_t safe_end = avail_end > SECRET_MAX_TOKEN ? avail_end - SECRET_MAX_TOKEN : 0;
+
+    uint64_t junction_to = s->pos + SECRET_LOOKBEHIND < safe_end ? s->pos + SECRET_LOOKBEHIND : safe_end;
+    if (s->scanned < junction_to) {
+        size_t head = len < SECRET_CARRY ? len : SECRET_CARRY;
+        memcpy(s->junction, s->carry, s->carry_len);
+        memcpy(s->junction + s->carry_len, bytes, head);
+        scan_range(s, s->junction, s->carry_len + head, s->pos - s->carry_len, s->scanned, junction_to);
+    }
+    uint64_t main_from = s->scanned > s->pos + SECRET_LOOKBEHIND ? s->scanned : s->pos + SECRET_LOOKBEHIND;
+    if (main_from < safe_end) scan_range(s, bytes, len, s->pos, main_from, safe_end);
+    if (safe_end > s->scanned) s->scanned = safe_end;
+
+    if (len >= SECRET_CARRY) {
+        memcpy(s->carry, bytes + len - SECRET_CARRY, SECRET_CARRY);
+        s->carry_len = SECRET_CARRY;
+    } else {
+        size_t keep = s->carry_len < SECRET_CARRY - len ? s->carry_len : SECRET_CARRY - len;
+        memmove(s->carry, s->carry + s->carry_len - keep, keep);
+        memcpy(s->carry + keep, bytes, len);
+        s->carry_len = keep + len;
+    }
+    s->pos = avail_end;
+}
+
+void secret_end(SecretScanner *s) {
+    if (s->scanned < s->pos) scan_range(s, s->carry, s->carry_len, s->pos - s->carry_len, s->scanned, s->pos);
+    s->scanned = s->pos;
+}
@@ -0,0 +1,42 @@
+#ifndef SECRETS_H
+#define SECRETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SECRET_MAX_TOKEN 4096  // Bytes a rule may read past its anchor (a PEM private key block fits)
+#define SECRET_LOOKBEHIND 16  // Bytes a rule may read before its anchor
+#define SECRET_CARRY (SECRET_MAX_TOKEN + SECRET_LOOKBEHIND)
+#define SECRET_MIN_ENTROPY 3.5  // Bits per character required of generic key/token/secret values
+
+typedef struct {
+    const char *rule;  // e.g. aws_access_key, github_token, jwt, private_key
+    uint64_t offset;  // Entry offset of the first byte of value
+    const char *value;
+    size_t len;
+} SecretMatch;
+
+typedef void (*secret_emit_fn)(void *ctx, const SecretMatch *m);
+
+// Streaming detector for API keys, cloud credentials, JWTs, private keys and
+// bot tokens. An SSE2 pass finds two-byte literal anchors; each candidate is
+// then verified by its rule. The last SECRET_CARRY bytes of every block are
+// kept so tokens split across blocks are verified once the rest arrives.
+typedef struct {
+    secret_emit_fn emit;
+    void *ctx;
+    uint64_t pos;  // Entry bytes fed so far
+    uint64_t scanned;  // Anchors before this entry offset have been checked
+    uint64_t reported_end;  // End of the last match; overlapping matches are dropped
+    uint64_t matches;
+    size_t carry_len;
+    uint8_t carry[SECRET_CARRY];
+    uint8_t junction[2 * SECRET_CARRY];  // carry + head of the next block
+} SecretScanner;
+
+void secret_begin(SecretScanner *s, secret_emit_fn emit, void *ctx);
+void secret_feed(SecretScanner *s, const void *data, size_t len);
+// Check anchors in the final bytes of the entry
+void secret_end(SecretScanner *s);
+
+#endif
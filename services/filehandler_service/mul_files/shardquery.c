@@ -0,0 +1,90 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "filehandler.h"
+#include "shards.h"
+
+// Domain query over the record shards: reads only the shard each shard count
+// in the directory maps the domain to, and prints its credentials as
+// identity<TAB>secret<TAB>url<TAB>source.
+//
+//   shardquery extracted/shards corp.com
+
+static int query_shard(const char *path, const char *domain, size_t domain_len, long long *matched) {
+    FILE *f = fopen(path, "rb");
+    char magic[6];
+    if (!f) {
+        if (errno == ENOENT) return 0;  // No domain of this shard has had a record yet
+        log_error("Failed to open record file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (fread(magic, 1, 6, f) != 6 || memcmp(magic, RECORD_FILE_MAGIC, 6) != 0) {
+        log_error("Failed to open record file %s: bad header", path);
+        fclose(f);
+        return -1;
+    }
+    static char field[4 * RECORD_FIELD_MAX];
+    uint8_t lens[8];
+    while (fread(lens, 1, 8, f) == 8) {
+        size_t len[4], total = 0;
+        for (int i = 0; i < 4; i++) total += len[i] = (size_t)(lens[2 * i] | (lens[2 * i + 1] << 8));
+        if (fread(field, 1, total, f) != total) {
+            log_warning("Truncated record at the end of %s", path);
+            break;
+        }
+        CredentialRecord rec = {field, len[0], field + len[0], len[1], field + len[0] + len[1], len[2],
+                                field + len[0] + len[1] + len[2], len[3]};
+        char rec_domain[DOMAIN_MAX_LEN + 1];
+        if (record_domain(&rec, rec_domain) != domain_len || memcmp(rec_domain, domain, domain_len) != 0) continue;
+        printf("%.*s\t%.*s\t%.*s\t%.*s\n", (int)rec.identity_len, rec.identity, (int)rec.secret_len, rec.secret,
+               (int)rec.url_len, rec.url, (int)rec.source_len, rec.source);
+        (*matched)++;
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char domain[DOMAIN_MAX_LEN + 1];
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <record_shard_dir> <domain>\n", argv[0]);
+        return 2;
+    }
+    const char *arg = argv[2][0] == '@' ? argv[2] + 1 : argv[2];
+    size_t domain_len = domain_registrable(arg, strlen(arg), domain);
+    if (domain_len == 0) {
+        fprintf(stderr, "%s is not a domain name\n", argv[2]);
+        return 2;
+    }
+    DIR *d = opendir(argv[1]);
+    if (!d) {
+        log_error("Failed to open %s: %s", argv[1], strerror(errno));
+        return 1;
+    }
+
+    // Every shard count ever configured has its own set of files
+    unsigned counts[64];
+    int count_n = 0, rc = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned shard, shards;
+        char tail;
+        if (sscanf(e->d_name, "%5u-of-%5u.re%c", &shard, &shards, &tail) != 3 || tail != 'c' || shards == 0) continue;
+        int seen = 0;
+        for (int i = 0; i < count_n; i++) seen |= counts[i] == shards;
+        if (!seen && count_n < (int)(sizeof(counts) / sizeof(counts[0]))) counts[count_n++] = shards;
+    }
+    closedir(d);
+
+    long long matched = 0;
+    for (int i = 0; i < count_n; i++) {
+        char path[PATH_MAX + 32];
+        record_shard_path(path, sizeof(path), argv[1], record_shard_of(domain, domain_len, counts[i]), counts[i]);
+        if (query_shard(path, domain, domain_len, &matched) != 0) rc = 1;
+    }
+    log_info("%lld credentials of %.*s in %d shard sets", matched, (int)domain_len, domain, count_n);
+    return rc;
+}
@@ -0,0 +1,318 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "hash.h"
+#include "shards.h"
+
+#define SHARD_SEED 0x53484152ULL  // Fixed: changing it would move every domain to another shard
+#define SHARD_TASK_DIR ".tasks"  // <dir>/.tasks/<task key>: shards a task has appended to
+
+typedef struct {
+    uint32_t shard;
+    uint64_t offset;  // In the spool
+    size_t len;
+} ShardChunk;
+
+struct ShardWriter {
+    char dir[PATH_MAX];
+    uint32_t shards;
+    uint64_t task;
+    uint64_t count;
+    char **buffers;  // [shards + 1], allocated on a shard's first record
+    size_t *used;
+    int spool;  // Unlinked file in dir holding the full buffers until close; -1 until the first
+    uint64_t spool_size;
+    ShardChunk *chunks;
+    size_t chunk_count, chunk_cap;
+};
+
+size_t record_domain(const CredentialRecord *rec, char *out) {
+    const char *at = rec->identity_len ? memchr(rec->identity, '@', rec->identity_len) : NULL;
+    if (at) {
+        // Local parts may contain '@' when quoted; the domain follows the last one
+        const char *end = rec->identity + rec->identity_len;
+        for (const char *p = at; p < end; p++) {
+            if (*p == '@') at = p;
+        }
+        size_t len = domain_registrable(at + 1, (size_t)(end - at - 1), out);
+        if (len > 0) return len;
+    }
+
+    const char *host = rec->url, *end = rec->url + rec->url_len;
+    for (const char *p = host; p + 2 < end; p++) {
+        if (p[0] == ':' && p[1] == '/' && p[2] == '/') {
+            host = p + 3;
+            break;
+        }
+        if (*p == '/' || *p == '.') break;  // No scheme: the URL starts with its host
+    }
+    // The authority ends the host; user:password@ before it and :port after are cut off
+    const char *stop = host;
+    while (stop < end && *stop != '/' && *stop != '?' && *stop != '#') stop++;
+    for (const char *p = stop; p > host; p--) {
+        if (p[-1] == '@') {
+            host = p;
+            break;
+        }
+    }
+    const char *port = memchr(host, ':', (size_t)(stop - host));
+    if (port) stop = port;
+    return domain_registrable(host, (size_t)(stop - host), out);
+}
+
+uint32_t record_shard_of(const char *domain, size_t len, uint32_t shards) {
+    uint64_t h[2];
+    murmur3_128(domain, len, SHARD_SEED, h);
+    return (uint32_t)(h[0] % shards);
+}
+
+void record_shard_path(char *out, size_t size, const char *dir, uint32_t shard, uint32_t shards) {
+    if (shard == shards) snprintf(out, size, "%s/nodomain.rec", dir);
+    else snprintf(out, size, "%s/%05u-of-%05u.rec", dir, shard, shards);
+}
+
+ShardWriter *shard_writer_open(const char *dir, uint32_t shards, uint64_t task) {
+    ShardWriter *w = calloc(1, sizeof(ShardWriter));
+    if (w) {
+        w->buffers = calloc(shards + 1, sizeof(char *));
+        w->used = calloc(shards + 1, sizeof(size_t));
+    }
+    if (!w || !w->buffers || !w->used) {
+        log_error("Failed to allocate record shard writer for %s", dir);
+        if (w) {
+            free(w->buffers);
+            free(w->used);
+        }
+        free(w);
+        return NULL;
+    }
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->shards = shards;
+    w->task = task;
+    w->spool = -1;
+    return w;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Moves data to the spool; nothing reaches the shards before the task commits
+static int spill(ShardWriter *w, uint32_t shard, const char *data, size_t len) {
+    if (w->spool == -1) {
+        char path[PATH_MAX + 32];
+        snprintf(path, sizeof(path), "%s/.spool.XXXXXX", w->dir);
+        w->spool = mkstemp(path);
+        if (w->spool == -1) {
+            log_error("Failed to create record shard spool in %s: %s", w->dir, strerror(errno));
+            return -1;
+        }
+        unlink(path);
+    }
+    if (w->chunk_count == w->chunk_cap) {
+        size_t cap = w->chunk_cap ? w->chunk_cap * 2 : 64;
+        ShardChunk *chunks = realloc(w->chunks, cap * sizeof(ShardChunk));
+        if (!chunks) {
+            log_error("Failed to allocate record shard chunks for %s", w->dir);
+            return -1;
+        }
+        w->chunks = chunks;
+        w->chunk_cap = cap;
+    }
+    if (write_all(w->spool, data, len) != 0) {
+        log_error("Failed to spool records in %s: %s", w->dir, strerror(errno));
+        return -1;
+    }
+    w->chunks[w->chunk_count++] = (ShardChunk){shard, w->spool_size, len};
+    w->spool_size += len;
+    return 0;
+}
+
+static int flush_shard(ShardWriter *w, uint32_t shard) {
+    if (w->used[shard] == 0) return 0;
+    int rc = spill(w, shard, w->buffers[shard], w->used[shard]);
+    w->used[shard] = 0;
+    return rc;
+}
+
+int shard_writer_add(ShardWriter *w, const CredentialRecord *rec) {
+    if (rec->source_len > RECORD_FIELD_MAX || rec->identity_len > RECORD_FIELD_MAX ||
+        rec->secret_len > RECORD_FIELD_MAX || rec->url_len > RECORD_FIELD_MAX) {
+        return 1;
+    }
+    char domain[DOMAIN_MAX_LEN + 1];
+    size_t domain_len = record_domain(rec, domain);
+    uint32_t shard = domain_len ? record_shard_of(domain, domain_len, w->shards) : w->shards;
+    size_t need = record_encoded_size(rec);
+
+    if (!w->buffers[shard]) {
+        w->buffers[shard] = malloc(SHARD_BUFFER);
+        if (!w->buffers[shard]) {
+            log_error("Failed to allocate record shard buffer for %s", w->dir);
+            return -1;
+        }
+    }
+    if (w->used[shard] + need > SHARD_BUFFER && flush_shard(w, shard) != 0) return -1;
+    if (need > SHARD_BUFFER) {
+        // Larger than a whole buffer: spooled on its own
+        char *encoded = malloc(need);
+        int rc = encoded ? 0 : -1;
+        if (encoded) {
+            record_encode(encoded, rec);
+            rc = spill(w, shard, encoded, need);
+            free(encoded);
+        }
+        if (rc == 0) w->count++;
+        return rc;
+    }
+    record_encode(w->buffers[shard] + w->used[shard], rec);
+    w->used[shard] += need;
+    w->count++;
+    return 0;
+}
+
+uint64_t shard_writer_count(const ShardWriter *w) {
+    return w->count;
+}
+
+// A new shard is created with its magic already in it: the header goes to a
+// temporary file that is linked into place only if the shard is still absent,
+// so concurrent writers never write two headers or append to a file without one
+static int open_shard(const char *path) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd != -1 || errno != ENOENT) return fd;
+    char tmp[PATH_MAX + 48];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int t = mkstemp(tmp);
+    if (t == -1) return -1;
+    int rc = fchmod(t, 0644) == 0 && write_all(t, RECORD_FILE_MAGIC, 6) == 0 ? 0 : -1;
+    if (close(t) != 0) rc = -1;
+    if (rc == 0 && link(tmp, path) != 0 && errno != EEXIST) rc = -1;
+    int saved = errno;
+    unlink(tmp);
+    errno = saved;
+    return rc == 0 ? open(path, O_WRONLY | O_APPEND | O_CLOEXEC) : -1;
+}
+
+// Appends a shard's chunks and its tail buffer under an exclusive flock, which
+// serializes appends of every task on every replica sharing the directory
+static int append_shard(ShardWriter *w, uint32_t shard, const ShardChunk *chunks, size_t n, char *copy) {
+    char path[PATH_MAX + 32];
+    record_shard_path(path, sizeof(path), w->dir, shard, w->shards);
+    int fd = open_shard(path);
+    int rc = fd == -1 ? -1 : 0;
+    while (rc == 0 && flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) rc = -1;
+    }
+    for (size_t i = 0; rc == 0 && i < n; i++) {
+        if (pread(w->spool, copy, chunks[i].len, (off_t)chunks[i].offset) != (ssize_t)chunks[i].len) rc = -1;
+        else rc = write_all(fd, copy, chunks[i].len);
+    }
+    if (rc == 0) rc = write_all(fd, w->buffers[shard], w->used[shard]);
+    if (fd != -1 && close(fd) != 0) rc = -1;  // Also releases the lock
+    if (rc != 0) log_error("Failed to append records to %s: %s", path, strerror(errno));
+    return rc;
+}
+
+static int compare_chunks(const void *a, const void *b) {
+    const ShardChunk *x = a, *y = b;
+    if (x->shard != y->shard) return x->shard < y->shard ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// Reads which shards a previous attempt of the task already appended to
+static void read_task_marker(const char *path, uint8_t *done, uint32_t shards) {
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    unsigned shard;
+    while (fscanf(f, "%u", &shard) == 1) {
+        if (shard <= shards) done[shard] = 1;
+    }
+    fclose(f);
+}
+
+static int commit_shards(ShardWriter *w) {
+    if (w->count == 0) return 0;
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/" SHARD_TASK_DIR, w->dir);
+    if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+        log_error("Failed to create record shard task directory %s: %s", path, strerror(errno));
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/" SHARD_TASK_DIR "/%016llx", w->dir, (unsigned long long)w->task);
+    uint8_t *done = calloc(w->shards + 1, 1);
+    char *copy = malloc(SHARD_BUFFER);
+    size_t longest = SHARD_BUFFER;
+    for (size_t i = 0; i < w->chunk_count; i++) {
+        if (w->chunks[i].len > longest) longest = w->chunks[i].len;
+    }
+    if (copy && longest > SHARD_BUFFER) {
+        free(copy);
+        copy = malloc(longest);
+    }
+    FILE *marker = NULL;
+    if (done && copy) {
+        read_task_marker(path, done, w->shards);
+        marker = fopen(path, "a");
+    }
+    if (!marker) {
+        log_error("Failed to open record shard task marker %s: %s", path, strerror(errno));
+        free(done);
+        free(copy);
+        return -1;
+    }
+
+    if (w->chunk_count > 0) qsort(w->chunks, w->chunk_count, sizeof(ShardChunk), compare_chunks);
+    int rc = 0;
+    uint32_t skipped = 0;
+    size_t next = 0;
+    for (uint32_t shard = 0; shard <= w->shards && rc == 0; shard++) {
+        size_t first = next;
+        while (next < w->chunk_count && w->chunks[next].shard == shard) next++;
+        if (first == next && w->used[shard] == 0) continue;
+        if (done[shard]) {
+            skipped++;
+            continue;
+        }
+        rc = append_shard(w, shard, w->chunks + first, next - first, copy);
+        // The marker line follows the append, so a retry never appends a shard twice
+        if (rc == 0 && (fprintf(marker, "%u\n", shard) < 0 || fflush(marker) != 0)) rc = -1;
+    }
+    if (fclose(marker) != 0) rc = -1;
+    if (rc != 0) log_error("Failed to commit record shards of task %016llx in %s", (unsigned long long)w->task, w->dir);
+    if (skipped > 0) {
+        log_info("Skipped %u record shards already appended by an earlier attempt of task %016llx", skipped,
+                 (unsigned long long)w->task);
+    }
+    free(done);
+    free(copy);
+    return rc;
+}
+
+int shard_writer_close(ShardWriter *w, int commit) {
+    if (!w) return 0;
+    int rc = commit ? commit_shards(w) : 0;
+    for (uint32_t shard = 0; shard <= w->shards; shard++) free(w->buffers[shard]);
+    if (w->spool != -1) close(w->spool);
+    free(w->buffers);
+    free(w->used);
+    free(w->chunks);
+    free(w);
+    return rc;
+}
@@ -0,0 +1,41 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "domindex.h"
+#include "record.h"
+
+#define SHARD_BUFFER (1 << 17)  // Per shard and writer; a full buffer moves to the task's spool
+
+// Domain-partitioned record files: every record goes to
+// <dir>/<shard>-of-<shards>.rec, picked by a hash of its registrable domain,
+// or to <dir>/nodomain.rec when it has none. Shards are ordinary .rec files
+// that every task appends to, so all of a domain's credentials are in one
+// file. The shard count is part of the name: changing it starts a new set
+// instead of mixing two partitionings. A task's records reach the shards only
+// when it commits, under a flock per shard, so replicas sharing the directory
+// can append concurrently; <dir>/.tasks/<task> lists the shards a task has
+// appended to, and a retry of the task skips them.
+
+// Registrable domain of the identity's email, else of the URL's host, into
+// out (DOMAIN_MAX_LEN + 1 bytes); 0 when the record has neither
+size_t record_domain(const CredentialRecord *rec, char *out);
+uint32_t record_shard_of(const char *domain, size_t len, uint32_t shards);
+// shard == shards names the file of records without a domain
+void record_shard_path(char *out, size_t size, const char *dir, uint32_t shard, uint32_t shards);
+
+// Buffers a task's records per shard; dir must exist. task identifies the
+// input across attempts
+typedef struct ShardWriter ShardWriter;
+
+ShardWriter *shard_writer_open(const char *dir, uint32_t shards, uint64_t task);
+// Returns 0 when buffered, 1 if a field is too long to encode (skipped), -1 on write failure
+int shard_writer_add(ShardWriter *w, const CredentialRecord *rec);
+uint64_t shard_writer_count(const ShardWriter *w);
+// With commit set, appends the task's records to the shards it has not appended
+// to yet; otherwise drops them. Returns -1 if any append failed
+int shard_writer_close(ShardWriter *w, int commit);
+
+#endif
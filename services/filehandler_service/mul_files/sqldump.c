@@ -0,0 +1,617 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sqldump.h"
+
+enum {
+    S_TOP,  // Statement text, kept in head
+    S_TOP_QUOTE,
+    S_TOP_ESC,
+    S_LINE_COMMENT,
+    S_BLOCK_COMMENT,
+    S_BLOCK_COMMENT_STAR,
+    S_VALUES,  // Between INSERT tuples
+    S_FIELD_START,
+    S_STRING,
+    S_STRING_ESC,
+    S_STRING_QUOTE,  // Quote seen inside a string: end of string or a doubled quote
+    S_BARE,  // Unquoted value: number, NULL, function call
+    S_FIELD_END,
+    S_COPY_SKIP_LINE,  // Rest of the COPY ... FROM stdin; line
+    S_COPY_FIELD,
+    S_COPY_ESC,
+    S_COPY_END  // Saw \. at the start of a COPY line
+};
+
+static const char *const create_keywords[] = {"PRIMARY", "KEY", "UNIQUE", "INDEX", "CONSTRAINT", "FOREIGN",
+                                              "FULLTEXT", "SPATIAL", "CHECK", "EXCLUDE", "LIKE", "PERIOD", NULL};
+static const char *const insert_modifiers[] = {"LOW_PRIORITY", "DELAYED", "HIGH_PRIORITY", "IGNORE", "INTO", NULL};
+
+static int is_ident_char(unsigned char c) {
+    return (unsigned)((c | 0x20) - 'a') < 26u || (unsigned)(c - '0') < 10u || c == '_' || c == '$' || c >= 0x80;
+}
+
+static int in_words(const char *word, const char *const *words) {
+    for (; *words; words++) {
+        if (strcasecmp(word, *words) == 0) return 1;
+    }
+    return 0;
+}
+
+static uint8_t column_role(const SqlParser *sp, const char *name) {
+    int p = record_column_rank(sp->identity_columns, name, strlen(name));
+    if (p) return (uint8_t)(p < SQL_ROLE_RANK ? p : SQL_ROLE_RANK);
+    p = record_column_rank(sp->secret_columns, name, strlen(name));
+    if (p) return (uint8_t)(SQL_ROLE_SECRET | (p < SQL_ROLE_RANK ? p : SQL_ROLE_RANK));
+    return 0;
+}
+
+// Tokenizer over a statement head (whitespace already collapsed)
+typedef struct {
+    const char *p;
+    const char *end;
+    int backslash_literal;
+} Cursor;
+
+enum { TOK_END, TOK_WORD, TOK_QUOTED, TOK_PUNCT };
+
+// Read a word, a quoted name or string (without its quotes) or one punctuation character
+static int next_token(Cursor *c, char *out, size_t size) {
+    while (c->p < c->end && *c->p == ' ') c->p++;
+    if (c->p >= c->end) return TOK_END;
+
+    size_t n = 0;
+    char q = *c->p;
+    if (q == '\'' || q == '"' || q == '`') {
+        c->p++;
+        while (c->p < c->end) {
+            char ch = *c->p++;
+            if (ch == '\\' && q == '\'' && !c->backslash_literal && c->p < c->end) {
+                ch = *c->p++;
+            } else if (ch == q) {
+                if (c->p < c->end && *c->p == q) c->p++;  // Doubled quote
+                else break;
+            }
+            if (n + 1 < size) out[n++] = ch;
+        }
+        out[n] = '\0';
+        return TOK_QUOTED;
+    }
+    if (is_ident_char((unsigned char)q)) {
+        while (c->p < c->end && is_ident_char((unsigned char)*c->p)) {
+            if (n + 1 < size) out[n++] = *c->p;
+            c->p++;
+        }
+        out[n] = '\0';
+        return TOK_WORD;
+    }
+    out[0] = *c->p++;
+    out[1] = '\0';
+    return TOK_PUNCT;
+}
+
+// [schema.]name with any quoting; the last component is the table name
+static int read_table_name(Cursor *c, char *name) {
+    int t = next_token(c, name, SQL_MAX_NAME);
+    if (t != TOK_WORD && t != TOK_QUOTED) return -1;
+    while (c->p < c->end && *c->p == '.') {
+        c->p++;
+        t = next_token(c, name, SQL_MAX_NAME);
+        if (t != TOK_WORD && t != TOK_QUOTED) return -1;
+    }
+    return 0;
+}
+
+// "(a, b, c)" after the opening parenthesis: fill role[] by column position
+static int read_column_list(SqlParser *sp, Cursor *c, uint8_t *role) {
+    char tok[SQL_MAX_NAME];
+    unsigned column = 0;
+    memset(role, 0, SQL_MAX_COLUMNS);
+    while (1) {
+        int t = next_token(c, tok, sizeof(tok));
+        if (t != TOK_WORD && t != TOK_QUOTED) return -1;
+        if (column < SQL_MAX_COLUMNS) role[column] = column_role(sp, tok);
+        column++;
+        t = next_token(c, tok, sizeof(tok));
+        if (t == TOK_PUNCT && tok[0] == ')') return 0;
+        if (t != TOK_PUNCT || tok[0] != ',') return -1;
+    }
+}
+
+static int table_allowed(const SqlParser *sp, const char *name) {
+    return !sp->table_filter[0] || record_column_rank(sp->table_filter, name, strlen(name)) > 0;
+}
+
+static SqlTable *find_table(SqlParser *sp, const char *name) {
+    for (int i = 0; i < sp->layout_count; i++) {
+        if (strcasecmp(sp->layouts[i].name, name) == 0) return &sp->layouts[i];
+    }
+    return NULL;
+}
+
+// Make role[] the active mapping for rows of table name
+static void activate(SqlParser *sp, const char *name) {
+    int identity = 0, secret = 0;
+    for (int i = 0; i < SQL_MAX_COLUMNS; i++) {
+        if (!sp->role[i]) continue;
+        if (sp->role[i] & SQL_ROLE_SECRET) secret = 1;
+        else identity = 1;
+    }
+    sp->active = identity && secret && table_allowed(sp, name);
+    snprintf(sp->row_source, sizeof(sp->row_source), "%s#%s", sp->source, name);
+}
+
+// CREATE [TEMPORARY] TABLE [IF NOT EXISTS] name (col type ..., KEY ..., ...)
+static void parse_create(SqlParser *sp, Cursor *c) {
+    char tok[SQL_MAX_NAME], name[SQL_MAX_NAME];
+    int t;
+    while ((t = next_token(c, tok, sizeof(tok))) == TOK_WORD && strcasecmp(tok, "TABLE") != 0) {
+    }
+    if (t != TOK_WORD) return;
+
+    Cursor save = *c;
+    if (next_token(c, tok, sizeof(tok)) == TOK_WORD && strcasecmp(tok, "IF") == 0) {
+        next_token(c, tok, sizeof(tok));  // NOT
+        next_token(c, tok, sizeof(tok));  // EXISTS
+    } else {
+        *c = save;
+    }
+    if (read_table_name(c, name) != 0) return;
+    if (next_token(c, tok, sizeof(tok)) != TOK_PUNCT || tok[0] != '(') return;
+
+    SqlTable *table = find_table(sp, name);
+    if (!table) {
+        if (sp->layout_count == SQL_MAX_TABLES) return;
+        table = &sp->layouts[sp->layout_count++];
+        snprintf(table->name, sizeof(table->name), "%s", name);
+    }
+    memset(table->role, 0, sizeof(table->role));
+
+    unsigned column = 0;
+    int depth = 1, item_start = 1;
+    while (depth > 0 && (t = next_token(c, tok, sizeof(tok))) != TOK_END) {
+        if (item_start) {
+            item_start = 0;
+            if (t == TOK_QUOTED || (t == TOK_WORD && !in_words(tok, create_keywords))) {
+                if (column < SQL_MAX_COLUMNS) table->role[column] = column_role(sp, tok);
+                column++;
+            }
+        }
+        if (t != TOK_PUNCT) continue;
+        if (tok[0] == '(') depth++;
+        else if (tok[0] == ')') depth--;
+        else if (tok[0] == ',' && depth == 1) item_start = 1;
+    }
+}
+
+// INSERT|REPLACE [modifiers] [INTO] name [(columns)] VALUES
+static void parse_insert(SqlParser *sp, Cursor *c) {
+    char tok[SQL_MAX_NAME], name[SQL_MAX_NAME];
+    Cursor save;
+    int t;
+    do {
+        save = *c;
+        t = next_token(c, tok, sizeof(tok));
+    } while (t == TOK_WORD && in_words(tok, insert_modifiers));
+    *c = save;
+    if (read_table_name(c, name) != 0) return;
+
+    t = next_token(c, tok, sizeof(tok));
+    if (t == TOK_PUNCT && tok[0] == '(') {
+        if (read_column_list(sp, c, sp->role) != 0) return;
+    } else {
+        SqlTable *table = find_table(sp, name);
+        if (!table) return;
+        memcpy(sp->role, table->role, sizeof(sp->role));
+    }
+    activate(sp, name);
+}
+
+// COPY name (columns) FROM stdin
+static int parse_copy(SqlParser *sp, Cursor *c) {
+    char tok[SQL_MAX_NAME], name[SQL_MAX_NAME];
+    if (read_table_name(c, name) != 0) return -1;
+    int t = next_token(c, tok, sizeof(tok));
+    if (t == TOK_PUNCT && tok[0] == '(') {
+        if (read_column_list(sp, c, sp->role) != 0) return -1;
+        t = next_token(c, tok, sizeof(tok));
+    } else {
+        SqlTable *table = find_table(sp, name);
+        if (!table) return -1;
+        memcpy(sp->role, table->role, sizeof(sp->role));
+    }
+    if (t != TOK_WORD || strcasecmp(tok, "FROM") != 0) return -1;
+    if (next_token(c, tok, sizeof(tok)) != TOK_WORD || strcasecmp(tok, "stdin") != 0) return -1;
+    activate(sp, name);
+    return 0;
+}
+
+static void reset_head(SqlParser *sp) {
+    sp->head_len = 0;
+    sp->skip_statement = 0;
+    sp->paren_depth = 0;
+}
+
+static void head_append(SqlParser *sp, char c) {
+    if (sp->skip_statement) return;
+    if (c == '\n' || c == '\r' || c == '\t') c = ' ';
+    if (c == ' ' && (sp->head_len == 0 || sp->head[sp->head_len - 1] == ' ')) return;
+    if (sp->head_len == SQL_MAX_HEAD - 1) {
+        sp->skip_statement = 1;
+        return;
+    }
+    sp->head[sp->head_len++] = c;
+}
+
+static int head_starts_with(const SqlParser *sp, const char *word) {
+    size_t n = strlen(word);
+    return sp->head_len > n && strncasecmp(sp->head, word, n) == 0 && !is_ident_char((unsigned char)sp->head[n]);
+}
+
+// A ';' ended the statement in head
+static void end_statement(SqlParser *sp) {
+    Cursor c = {sp->head, sp->head + sp->head_len, sp->backslash_literal};
+    char tok[SQL_MAX_NAME];
+    if (sp->skip_statement || sp->head_len == 0) {
+        reset_head(sp);
+        return;
+    }
+
+    if (head_starts_with(sp, "CREATE")) {
+        parse_create(sp, &c);
+    } else if (head_starts_with(sp, "COPY")) {
+        next_token(&c, tok, sizeof(tok));
+        memset(sp->role, 0, sizeof(sp->role));
+        if (parse_copy(sp, &c) == 0) sp->state = S_COPY_SKIP_LINE;
+    } else if (head_starts_with(sp, "SET")) {
+        next_token(&c, tok, sizeof(tok));
+        if (next_token(&c, tok, sizeof(tok)) == TOK_WORD && strcasecmp(tok, "standard_conforming_strings") == 0) {
+            next_token(&c, tok, sizeof(tok));  // = or TO
+            if (next_token(&c, tok, sizeof(tok)) != TOK_END) sp->backslash_literal = strcasecmp(tok, "on") == 0;
+        }
+    }
+    reset_head(sp);
+}
+
+// head ends with the VALUES keyword of an INSERT; row data follows
+static int at_values(const SqlParser *sp) {
+    if (sp->skip_statement || sp->paren_depth != 0 || sp->head_len < 7) return 0;
+    const char *tail = sp->head + sp->head_len - 6;
+    if (strncasecmp(tail, "VALUES", 6) != 0 || (tail[-1] != ' ' && tail[-1] != ')')) return 0;
+    return head_starts_with(sp, "INSERT") || head_starts_with(sp, "REPLACE");
+}
+
+static void begin_values(SqlParser *sp) {
+    Cursor c = {sp->head, sp->head + sp->head_len, sp->backslash_literal};
+    char tok[SQL_MAX_NAME];
+    next_token(&c, tok, sizeof(tok));  // INSERT / REPLACE
+    memset(sp->role, 0, sizeof(sp->role));
+    sp->active = 0;
+    parse_insert(sp, &c);
+    reset_head(sp);
+    sp->state = S_VALUES;
+}
+
+static void start_row(SqlParser *sp) {
+    sp->column = 0;
+    sp->identity_len = 0;
+    sp->secret_len = 0;
+}
+
+static void start_field(SqlParser *sp) {
+    sp->field_len = 0;
+    sp->field_null = 0;
+    sp->field_role = sp->active && sp->column < SQL_MAX_COLUMNS ? sp->role[sp->column] : 0;
+    sp->bare_depth = 0;
+}
+
+static inline void field_append(SqlParser *sp, char c) {
+    if (!sp->field_role) return;
+    if (sp->field_len <= SQL_MAX_FIELD) sp->field[sp->field_len++] = c;  // One past the limit marks overflow
+}
+
+static void finish_field(SqlParser *sp, int bare) {
+    if (!sp->field_role || sp->field_null || sp->field_len == 0 || sp->field_len > SQL_MAX_FIELD) return;
+    if (bare && sp->field_len == 4 && strncasecmp(sp->field, "NULL", 4) == 0) return;
+
+    uint8_t rank = sp->field_role & SQL_ROLE_RANK;
+    if (sp->field_role & SQL_ROLE_SECRET) {
+        if (sp->secret_len && rank >= sp->secret_rank) return;
+        memcpy(sp->secret, sp->field, sp->field_len);
+        sp->secret_len = sp->field_len;
+        sp->secret_rank = rank;
+    } else {
+        if (sp->identity_len && rank >= sp->identity_rank) return;
+        memcpy(sp->identity, sp->field, sp->field_len);
+        sp->identity_len = sp->field_len;
+        sp->identity_rank = rank;
+    }
+}
+
+static void finish_row(SqlParser *sp) {
+    sp->rows++;
+    if (!sp->active || !sp->identity_len || !sp->secret_len) return;
+
+    // Emails are stored lowercased, as the combo parser does
+    if (memchr(sp->identity, '@', sp->identity_len)) {
+        for (size_t i = 0; i < sp->identity_len; i++) {
+            char c = sp->identity[i];
+            if (c >= 'A' && c <= 'Z') sp->identity[i] = c + 32;
+        }
+    }
+    CredentialRecord rec = {sp->row_source, strlen(sp->row_source), sp->identity, sp->identity_len,
+                            sp->secret, sp->secret_len, "", 0};
+    sp->records++;
+    sp->emit(sp->ctx, &rec);
+}
+
+static char unescape(char c) {
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case '0': return '\0';
+    case 'Z': return '\x1a';
+    }
+    return c;
+}
+
+void sql_begin(SqlParser *sp, const char *source, const char *identity_columns, const char *secret_columns,
+               const char *tables, record_emit_fn emit, void *ctx) {
+    sp->identity_columns = identity_columns;
+    sp->secret_columns = secret_columns;
+    sp->table_filter = tables;
+    sp->source = source;
+    sp->emit = emit;
+    sp->ctx = ctx;
+    sp->state = S_TOP;
+    sp->backslash_literal = 0;
+    sp->pending = 0;
+    sp->active = 0;
+    sp->layout_count = 0;
+    sp->rows = 0;
+    sp->records = 0;
+    reset_head(sp);
+}
+
+void sql_feed(SqlParser *sp, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        char c = data[i];
+        switch (sp->state) {
+        case S_TOP:
+            if (sp->pending) {
+                char prev = (char)sp->pending;
+                sp->pending = 0;
+                if (prev == '-' && c == '-') {
+                    sp->state = S_LINE_COMMENT;
+                    break;
+                }
+                if (prev == '/' && c == '*') {
+                    sp->state = S_BLOCK_COMMENT;
+                    break;
+                }
+                head_append(sp, prev);
+            }
+            if (c == '-' || c == '/') {
+                sp->pending = c;
+            } else if (c == '#' && sp->head_len == 0) {
+                sp->state = S_LINE_COMMENT;
+            } else if (c == '\'' || c == '"' || c == '`') {
+                sp->quote = c;
+                sp->state = S_TOP_QUOTE;
+                head_append(sp, c);
+            } else if (c == ';') {
+                end_statement(sp);
+            } else {
+                if (!is_ident_char((unsigned char)c) && at_values(sp)) {
+                    begin_values(sp);
+                    continue;  // c belongs to the row data
+                }
+                if (c == '(') sp->paren_depth++;
+                else if (c == ')') sp->paren_depth--;
+                head_append(sp, c);
+            }
+            break;
+        case S_TOP_QUOTE:
+            head_append(sp, c);
+            if (c == '\\' && sp->quote == '\'' && !sp->backslash_literal) sp->state = S_TOP_ESC;
+            else if (c == sp->quote) sp->state = S_TOP;
+            break;
+        case S_TOP_ESC:
+            head_append(sp, c);
+            sp->state = S_TOP_QUOTE;
+            break;
+        case S_LINE_COMMENT:
+            if (c == '\n') {
+                sp->state = S_TOP;
+                head_append(sp, ' ');
+            }
+            break;
+        case S_BLOCK_COMMENT:
+            if (c == '*') sp->state = S_BLOCK_COMMENT_STAR;
+            break;
+        case S_BLOCK_COMMENT_STAR:
+            if (c == '/') {
+                sp->state = S_TOP;
+                head_append(sp, ' ');
+            } else if (c != '*') {
+                sp->state = S_BLOCK_COMMENT;
+            }
+            break;
+
+        case S_VALUES:
+            if (c == '(') {
+                start_row(sp);
+                start_field(sp);
+                sp->state = S_FIELD_START;
+            } else if (c == ';') {
+                reset_head(sp);
+                sp->state = S_TOP;
+            } else if (c != ',' && c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                // ON DUPLICATE KEY UPDATE and the like: skip the rest of the statement
+                reset_head(sp);
+                sp->skip_statement = 1;
+                sp->state = S_TOP;
+                continue;
+            }
+            break;
+        case S_FIELD_START:
+            if (c == '\'' || c == '"') {
+                sp->quote = c;
+                sp->state = S_STRING;
+            } else if (c == ',') {
+                finish_field(sp, 0);
+                sp->column++;
+                start_field(sp);
+            } else if (c == ')') {
+                finish_field(sp, 0);
+                finish_row(sp);
+                sp->state = S_VALUES;
+            } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                sp->state = S_BARE;
+                continue;
+            }
+            break;
+        case S_STRING: {
+            // Copy the run up to the next quote or backslash in one go
+            size_t j = i;
+            while (j < len && data[j] != sp->quote && data[j] != '\\') j++;
+            if (sp->field_role) {
+                for (size_t k = i; k < j; k++) field_append(sp, data[k]);
+            }
+            i = j;
+            if (i == len) continue;
+            c = data[i];
+            if (c == '\\' && !sp->backslash_literal) sp->state = S_STRING_ESC;
+            else if (c == sp->quote) sp->state = S_STRING_QUOTE;
+            else field_append(sp, c);
+            break;
+        }
+        case S_STRING_ESC:
+            field_append(sp, unescape(c));
+            sp->state = S_STRING;
+            break;
+        case S_STRING_QUOTE:
+            if (c == sp->quote) {
+                field_append(sp, c);
+                sp->state = S_STRING;
+                break;
+            }
+            sp->state = S_FIELD_END;
+            continue;
+        case S_BARE:
+            if (c == '\'' || c == '"') {
+                // _binary 'x', X'ff': the literal is the value
+                sp->field_len = 0;
+                sp->quote = c;
+                sp->state = S_STRING;
+            } else if (c == '(') {
+                sp->bare_depth++;
+                field_append(sp, c);
+            } else if (c == ')' && sp->bare_depth > 0) {
+                sp->bare_depth--;
+                field_append(sp, c);
+            } else if ((c == ',' || c == ')') && sp->bare_depth == 0) {
+                finish_field(sp, 1);
+                sp->state = S_FIELD_END;
+                sp->field_role = 0;  // Already taken
+                continue;
+            } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                field_append(sp, c);
+            }
+            break;
+        case S_FIELD_END:
+            if (c == ',') {
+                finish_field(sp, 0);
+                sp->column++;
+                start_field(sp);
+                sp->state = S_FIELD_START;
+            } else if (c == ')') {
+                finish_field(sp, 0);
+                finish_row(sp);
+                sp->state = S_VALUES;
+            }
+            break;
+
+        case S_COPY_SKIP_LINE:
+            if (c == '\n') {
+                start_row(sp);
+                start_field(sp);
+                sp->line_start = 1;
+                sp->state = S_COPY_FIELD;
+            }
+            break;
+        case S_COPY_FIELD: {
+            size_t j = i;
+            while (j < len && data[j] != '\t' && data[j] != '\n' && data[j] != '\\') j++;
+            if (sp->field_role) {
+                for (size_t k = i; k < j; k++) field_append(sp, data[k]);
+            }
+            if (j > i) sp->line_start = 0;
+            i = j;
+            if (i == len) continue;
+            c = data[i];
+            if (c == '\\') {
+                sp->state = S_COPY_ESC;
+            } else {
+                finish_field(sp, 0);
+                sp->line_start = c == '\n';
+                if (c == '\t') {
+                    sp->column++;
+                } else {
+                    finish_row(sp);
+                    start_row(sp);
+                }
+                start_field(sp);
+            }
+            break;
+        }
+        case S_COPY_ESC:
+            // Only a whole line "\." ends the block; an unmapped column keeps no
+            // field bytes to tell its start from its middle
+            if (c == '.' && sp->line_start) {
+                sp->state = S_COPY_END;
+                break;
+            }
+            sp->line_start = 0;
+            if (c == 'N') sp->field_null = 1;
+            else field_append(sp, unescape(c));
+            sp->state = S_COPY_FIELD;
+            break;
+        case S_COPY_END:
+            if (c == '\n') {
+                reset_head(sp);
+                sp->state = S_TOP;
+            }
+            break;
+        }
+        i++;
+    }
+}
+
+void sql_end(SqlParser *sp) {
+    // A COPY block cut off without its final newline still has a complete last row
+    if (sp->state == S_COPY_FIELD && (sp->column > 0 || sp->field_len > 0)) {
+        finish_field(sp, 0);
+        finish_row(sp);
+    }
+}
+
+int sql_sniff(const char *name, const char *data, size_t len) {
+    size_t name_len = name ? strlen(name) : 0;
+    if (name_len > 4 && strcasecmp(name + name_len - 4, ".sql") == 0) return 1;
+
+    size_t n = len < 4096 ? len : 4096;
+    static const char *const markers[] = {"-- MySQL dump", "-- PostgreSQL database dump", "INSERT INTO ",
+                                          "CREATE TABLE ", NULL};
+    for (const char *const *m = markers; *m; m++) {
+        if (memmem(data, n, *m, strlen(*m))) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef SQLDUMP_H
+#define SQLDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define SQL_MAX_HEAD 65536  // Statement text kept before VALUES / for CREATE TABLE; longer statements are skipped
+#define SQL_MAX_TABLES 256  // CREATE TABLE column layouts remembered per entry
+#define SQL_MAX_COLUMNS 512  // Columns past this index are never mapped
+#define SQL_MAX_NAME 128
+#define SQL_MAX_FIELD 255  // Longer identity/secret values are dropped
+
+// Column roles: 0 for unmapped, otherwise the 1-based position of the column
+// name in its configured list (lower wins within a row), plus SQL_ROLE_SECRET
+// for secret columns
+#define SQL_ROLE_SECRET 0x80
+#define SQL_ROLE_RANK 0x7f
+
+typedef struct {
+    char name[SQL_MAX_NAME];
+    uint8_t role[SQL_MAX_COLUMNS];
+} SqlTable;
+
+// Streaming extractor for mysqldump / pg_dump output. Statement heads are
+// tokenized to find the target table and its column list (or the layout from
+// an earlier CREATE TABLE); row data of INSERT ... VALUES tuples and COPY ...
+// FROM stdin blocks is then parsed byte by byte with only the mapped fields
+// buffered, so statements of any size stream through in constant memory.
+typedef struct {
+    const char *identity_columns;  // Comma-separated, case-insensitive, in priority order
+    const char *secret_columns;
+    const char *table_filter;  // Comma-separated; empty maps every table
+    const char *source;
+    record_emit_fn emit;
+    void *ctx;
+
+    int state;
+    char quote;  // Quote character of the string being read
+    int backslash_literal;  // pg_dump with standard_conforming_strings: '\' is not an escape
+    int pending;  // '-' or '/' seen at the top level; a comment may start
+    int paren_depth;
+    int skip_statement;  // Head overflowed or statement not understood: skip to ';'
+    size_t head_len;
+    char head[SQL_MAX_HEAD];
+
+    char row_source[1024];  // <source>#<table>
+    uint8_t role[SQL_MAX_COLUMNS];  // Roles of the statement being streamed
+    int active;  // Statement maps both an identity and a secret column
+    unsigned column;
+    int line_start;  // Nothing of the current COPY line read yet, mapped or not
+    int bare_depth;  // Parentheses inside an unquoted value, e.g. NOW()
+    uint8_t field_role;
+    int field_null;
+    size_t field_len;
+    char field[SQL_MAX_FIELD + 1];
+    uint8_t identity_rank, secret_rank;
+    size_t identity_len, secret_len;
+    char identity[SQL_MAX_FIELD];
+    char secret[SQL_MAX_FIELD];
+
+    int layout_count;
+    SqlTable layouts[SQL_MAX_TABLES];
+
+    uint64_t rows;
+    uint64_t records;
+} SqlParser;
+
+void sql_begin(SqlParser *sp, const char *source, const char *identity_columns, const char *secret_columns,
+               const char *tables, record_emit_fn emit, void *ctx);
+void sql_feed(SqlParser *sp, const char *data, size_t len);
+void sql_end(SqlParser *sp);
+
+// Whether an entry looks like a SQL dump, from its name and first block
+int sql_sniff(const char *name, const char *data, size_t len);
+
+#endif
@@ -0,0 +1,262 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filehandler.h"
+#include "record.h"
+#include "shards.h"
+#include "sqlload.h"
+
+#define BUSY_TIMEOUT_MS 60000  // db_service may hold the write lock for a moment
+#define CACHE_KIB 262144
+#define DEFER_MIN_PCT 25  // Rows a load must add, relative to the table, before its indexes are dropped
+
+static const char *const CREATE_TABLE =
+    "CREATE TABLE IF NOT EXISTS credentials ("
+    "id INTEGER PRIMARY KEY, fingerprint INTEGER NOT NULL, identity TEXT NOT NULL, domain TEXT, secret TEXT NOT NULL,"
+    " url TEXT, source TEXT);"
+    // url is NULL without one, and NULLs never conflict in a unique index
+    "CREATE UNIQUE INDEX IF NOT EXISTS credentials_unique ON credentials(fingerprint, identity, secret, ifnull(url, ''))";
+static const char *const CREATE_INDEXES =
+    "CREATE INDEX IF NOT EXISTS credentials_domain ON credentials(domain);"
+    "CREATE INDEX IF NOT EXISTS credentials_identity ON credentials(identity)";
+static const char *const DROP_INDEXES =
+    "DROP INDEX IF EXISTS credentials_domain;"
+    "DROP INDEX IF EXISTS credentials_identity";
+// No key: rows are appended as they come and sorted once by the merge
+static const char *const CREATE_STAGING =
+    "CREATE TEMP TABLE IF NOT EXISTS credentials_staging ("
+    "fingerprint INTEGER, identity TEXT, domain TEXT, secret TEXT, url TEXT, source TEXT)";
+static const char *const MERGE_STAGING =
+    "INSERT OR IGNORE INTO main.credentials (fingerprint, identity, domain, secret, url, source) "
+    "SELECT * FROM temp.credentials_staging ORDER BY fingerprint";
+
+struct SqlLoader {
+    sqlite3 *db;
+    sqlite3_stmt *insert;
+    char path[4096];
+    SqlLoadOptions opt;
+    int in_transaction;
+    long long batch_used;  // Rows in the open transaction
+    uint64_t rows;  // Read from .rec files
+    uint64_t inserted;  // New to the target table
+    uint64_t batches;
+    uint64_t table_rows;  // Rows in the table at open, by its largest rowid
+    int indexes_dropped;
+    struct timespec start;
+    int failed;
+};
+
+static int exec(SqlLoader *l, const char *sql) {
+    char *error = NULL;
+    if (sqlite3_exec(l->db, sql, NULL, NULL, &error) != SQLITE_OK) {
+        log_error("SQLite error on %s: %s", l->path, error ? error : sqlite3_errmsg(l->db));
+        sqlite3_free(error);
+        l->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static int commit(SqlLoader *l) {
+    if (!l->in_transaction) return 0;
+    int rc = exec(l, "COMMIT");
+    // A failed COMMIT (SQLITE_BUSY) leaves the transaction open for the rollback at close
+    l->in_transaction = !sqlite3_get_autocommit(l->db);
+    if (rc != 0) return -1;
+    l->batch_used = 0;
+    l->batches++;
+    return 0;
+}
+
+// Drop the secondary indexes before rows reaches the table, when that adds at
+// least DEFER_MIN_PCT of the rows already there. Rebuilding them at close reads
+// the whole table, so a small load into a large one keeps them and pays per row
+// instead; each rebuild is paid for by a load a quarter of the table's size.
+static int defer_indexes(SqlLoader *l, uint64_t rows) {
+    if (!l->opt.defer_indexes || l->indexes_dropped || rows * 100 < l->table_rows * DEFER_MIN_PCT) return 0;
+    if (exec(l, DROP_INDEXES) != 0) return -1;
+    l->indexes_dropped = 1;
+    return 0;
+}
+
+static int begin(SqlLoader *l) {
+    if (l->in_transaction) return 0;
+    if (exec(l, "BEGIN IMMEDIATE") != 0) return -1;
+    l->in_transaction = 1;
+    return 0;
+}
+
+SqlLoader *sqlload_open(const char *db_path, const SqlLoadOptions *opt) {
+    SqlLoader *l = calloc(1, sizeof(SqlLoader));
+    if (!l) {
+        log_error("Failed to allocate SQLite loader for %s", db_path);
+        return NULL;
+    }
+    snprintf(l->path, sizeof(l->path), "%s", db_path);
+    l->opt = *opt;
+    clock_gettime(CLOCK_MONOTONIC, &l->start);
+    if (sqlite3_open_v2(db_path, &l->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) !=
+        SQLITE_OK) {
+        log_error("Failed to open SQLite database %s: %s", db_path, l->db ? sqlite3_errmsg(l->db) : "out of memory");
+        sqlite3_close(l->db);
+        free(l);
+        return NULL;
+    }
+    sqlite3_busy_timeout(l->db, BUSY_TIMEOUT_MS);
+
+    char pragmas[256];
+    // WAL keeps the Python readers going; NORMAL only syncs at checkpoints, which WAL makes safe
+    snprintf(pragmas, sizeof(pragmas), "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL; PRAGMA cache_size=-%d",
+             CACHE_KIB);
+    int rc = exec(l, pragmas);
+    if (rc == 0) rc = exec(l, CREATE_TABLE);
+    // Also restores indexes a load that crashed while they were dropped did not rebuild
+    if (rc == 0) rc = exec(l, CREATE_INDEXES);
+    sqlite3_stmt *count;
+    if (rc == 0 && sqlite3_prepare_v2(l->db, "SELECT max(rowid) FROM credentials", -1, &count, NULL) == SQLITE_OK) {
+        if (sqlite3_step(count) == SQLITE_ROW) l->table_rows = (uint64_t)sqlite3_column_int64(count, 0);
+        sqlite3_finalize(count);
+    }
+    if (rc == 0 && l->opt.staging) rc = exec(l, CREATE_STAGING);
+    if (rc == 0) {
+        const char *sql = l->opt.staging
+                              ? "INSERT INTO temp.credentials_staging VALUES (?, ?, ?, ?, ?, ?)"
+                              : "INSERT OR IGNORE INTO main.credentials (fingerprint, identity, domain, secret, url, "
+                                "source) VALUES (?, ?, ?, ?, ?, ?)";
+        if (sqlite3_prepare_v3(l->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &l->insert, NULL) != SQLITE_OK) {
+            log_error("SQLite error on %s: %s", db_path, sqlite3_errmsg(l->db));
+            rc = -1;
+        }
+    }
+    if (rc != 0) {
+        sqlite3_finalize(l->insert);
+        sqlite3_close(l->db);
+        free(l);
+        return NULL;
+    }
+    return l;
+}
+
+static int insert_record(SqlLoader *l, const CredentialRecord *rec) {
+    uint64_t fp[2];
+    char domain[DOMAIN_MAX_LEN + 1];
+    record_fingerprint(rec, fp);
+    size_t domain_len = record_domain(rec, domain);
+
+    sqlite3_stmt *s = l->insert;
+    // Fields stay valid until the step: the file is mapped for the whole load
+    sqlite3_bind_int64(s, 1, (sqlite3_int64)(fp[0] ^ (1ULL << 63)));
+    sqlite3_bind_text(s, 2, rec->identity, (int)rec->identity_len, SQLITE_STATIC);
+    if (domain_len) sqlite3_bind_text(s, 3, domain, (int)domain_len, SQLITE_STATIC);
+    else sqlite3_bind_null(s, 3);
+    sqlite3_bind_text(s, 4, rec->secret, (int)rec->secret_len, SQLITE_STATIC);
+    if (rec->url_len) sqlite3_bind_text(s, 5, rec->url, (int)rec->url_len, SQLITE_STATIC);
+    else sqlite3_bind_null(s, 5);
+    sqlite3_bind_text(s, 6, rec->source, (int)rec->source_len, SQLITE_STATIC);
+    int rc = sqlite3_step(s);
+    sqlite3_reset(s);
+    if (rc != SQLITE_DONE) {
+        log_error("SQLite error on %s: %s", l->path, sqlite3_errmsg(l->db));
+        l->failed = 1;
+        return -1;
+    }
+    if (!l->opt.staging) l->inserted += (uint64_t)sqlite3_changes(l->db);
+    if (++l->batch_used >= l->opt.batch_rows && (commit(l) != 0 || begin(l) != 0)) return -1;
+    return 0;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+long long sqlload_file(SqlLoader *l, const char *rec_path) {
+    int fd = open(rec_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        log_error("Failed to open record file %s: %s", rec_path, strerror(errno));
+        if (fd != -1) close(fd);
+        l->failed = 1;
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *map = size >= 6 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (!map || map == MAP_FAILED || memcmp(map, RECORD_FILE_MAGIC, 6) != 0) {
+        log_error("Failed to open record file %s: %s", rec_path, map == MAP_FAILED ? strerror(errno) : "bad header");
+        if (map && map != MAP_FAILED) munmap((void *)map, size);
+        l->failed = 1;
+        return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    // A staged load reaches the table at close
+    long long rows = 0;
+    int rc = 0;
+    if (!l->opt.staging) {
+        uint64_t records = 0;
+        for (size_t at = 6; at + 8 <= size; records++) {
+            at += 8 + get_u16(map + at) + get_u16(map + at + 2) + get_u16(map + at + 4) + get_u16(map + at + 6);
+        }
+        rc = defer_indexes(l, l->rows + records);
+    }
+    if (rc == 0) rc = begin(l);
+    size_t at = 6;
+    while (rc == 0 && at + 8 <= size) {
+        size_t len[4], total = 0;
+        for (int i = 0; i < 4; i++) total += len[i] = get_u16(map + at + 2 * i);
+        if (total > size - at - 8) {
+            log_warning("Truncated record at the end of %s", rec_path);
+            break;
+        }
+        const char *p = (const char *)map + at + 8;
+        CredentialRecord rec = {p, len[0], p + len[0], len[1], p + len[0] + len[1], len[2],
+                                p + len[0] + len[1] + len[2], len[3]};
+        rc = insert_record(l, &rec);
+        at += 8 + total;
+        rows++;
+    }
+    munmap((void *)map, size);
+    l->rows += (uint64_t)rows;
+    return rc == 0 ? rows : -1;
+}
+
+int sqlload_close(SqlLoader *l) {
+    if (!l) return 0;
+    if (!l->failed) commit(l);
+    if (l->failed && l->in_transaction) sqlite3_exec(l->db, "ROLLBACK", NULL, NULL, NULL);
+    sqlite3_finalize(l->insert);
+
+    if (!l->failed && l->opt.staging) {
+        // One ordered pass: the table and its indexes are filled front to back
+        if (defer_indexes(l, l->rows) == 0 && begin(l) == 0 && exec(l, MERGE_STAGING) == 0) {
+            l->inserted += (uint64_t)sqlite3_changes(l->db);
+            if (exec(l, "DELETE FROM temp.credentials_staging") == 0) commit(l);
+        }
+        if (l->failed && l->in_transaction) sqlite3_exec(l->db, "ROLLBACK", NULL, NULL, NULL);
+    }
+    // Rebuilt even after a failure: the committed batches must stay queryable
+    if (l->indexes_dropped) exec(l, CREATE_INDEXES);
+    if (!l->failed) exec(l, "PRAGMA optimize");
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - l->start.tv_sec) + (double)(end.tv_nsec - l->start.tv_nsec) / 1e9;
+    int rc = l->failed ? -1 : 0;
+    if (rc == 0) {
+        log_info("Loaded %llu of %llu credential records into %s in %.1fs (%llu batches%s)",
+                 (unsigned long long)l->inserted, (unsigned long long)l->rows, l->path, seconds,
+                 (unsigned long long)l->batches, l->opt.staging ? ", staged" : "");
+    }
+    if (sqlite3_close(l->db) != SQLITE_OK) rc = -1;
+    free(l);
+    return rc;
+}
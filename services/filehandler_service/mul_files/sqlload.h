@@ -0,0 +1,36 @@
+#ifndef SQLLOAD_H
+#define SQLLOAD_H
+
+// Bulk loader of .rec files into the SQLite database the Python services
+// read, as one table:
+//
+//   credentials(id INTEGER PRIMARY KEY, fingerprint, identity, domain, secret, url, source)
+//
+// A credential already in the table is skipped by the unique index on
+// (fingerprint, identity, secret, url), so two credentials whose
+// fingerprints collide are both kept. fingerprint is the record fingerprint
+// with its top bit flipped, so the index order is the order of .rec files
+// sorted by sort_records: loading a sorted file appends to the index, as
+// the rowids append to the table, instead of splitting pages all over it.
+// domain is the registrable domain of the email or URL, NULL without one;
+// it and identity carry the secondary indexes.
+//
+// The database is in WAL mode, so readers keep going during a load. Rows go
+// through one prepared statement in transactions of batch_rows.
+typedef struct {
+    int batch_rows;
+    int staging;  // Load into a temporary table, then merge it in fingerprint order at close
+    int defer_indexes;  // Drop the secondary indexes for a load large next to the table, rebuild them at close
+} SqlLoadOptions;
+
+typedef struct SqlLoader SqlLoader;
+
+SqlLoader *sqlload_open(const char *db_path, const SqlLoadOptions *opt);
+// Returns the number of records read from the file, -1 on error
+long long sqlload_file(SqlLoader *l, const char *rec_path);
+// Commit, merge the staging table and build deferred indexes; returns -1 if
+// any of it or an earlier load failed, leaving the database at the last
+// committed batch
+int sqlload_close(SqlLoader *l);
+
+#endif
@@ -0,0 +1,468 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "combo.h"
+#include "filehandler.h"
+#include "stealer.h"
+
+// Folders that only appear directly inside a victim folder
+static const char *const victim_folders[] = {"Cookies", "Autofills", "Autofill", "Browsers", "Wallets",
+                                             "FileGrabber", "CreditCards", NULL};
+static const char *const password_files[] = {"Passwords.txt", "All Passwords.txt", "AllPasswords.txt",
+                                             "_AllPasswords_list.txt", NULL};
+static const char *const system_files[] = {"System.txt", "Information.txt", "UserInformation.txt",
+                                           "System Info.txt", "SystemInfo.txt", NULL};
+
+typedef struct StealerFile {
+    StealerKind kind;
+    char *path;
+    size_t len, cap;
+    char *data;
+    struct StealerFile *next;
+} StealerFile;
+
+typedef struct StealerGroup {
+    char victim[1024];
+    StealerFile *files;
+    StealerFile **files_tail;
+    unsigned cookie_files, autofill_files;
+    struct StealerGroup *next;
+} StealerGroup;
+
+struct StealerPool {
+    char source[1024];
+    stealer_sink_fn sink;
+    record_emit_fn fallback;
+    void *ctx;
+    pthread_mutex_t sink_mutex;  // Serializes sink calls and groups
+
+    pthread_mutex_t mutex;  // Guards the group queue
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    StealerGroup *head, *tail;
+    int pending;
+    int closing;
+    uint64_t groups;
+
+    StealerGroup *current;  // Victim whose entries are being extracted
+    StealerKind entry_kind;
+    StealerFile *file;  // Entry being buffered, NULL when the entry is only counted
+    StealerFile **file_link;  // Link to file from the group's list
+    int thread_count;
+    pthread_t threads[];
+};
+
+static int name_in(const char *name, size_t len, const char *const *names) {
+    for (; *names; names++) {
+        if (strlen(*names) == len && strncasecmp(name, *names, len) == 0) return 1;
+    }
+    return 0;
+}
+
+StealerKind stealer_classify(const char *path, size_t *victim_len) {
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    // <victim>/Cookies/..., <victim>/Browsers/Chrome/Default/Passwords.txt, ...
+    for (const char *c = path; c < base;) {
+        const char *slash = strchr(c, '/');
+        size_t len = (size_t)(slash - c);
+        if (name_in(c, len, victim_folders)) {
+            *victim_len = c > path ? (size_t)(c - path - 1) : 0;
+            if (strncasecmp(c, "Cookies", len) == 0) return STEALER_COOKIES;
+            if (strncasecmp(c, "Autofill", 8) == 0) return STEALER_AUTOFILL;
+            // FileGrabber/ and the like hold the victim's own files, whatever their names
+            if (strncasecmp(c, "Browsers", len) != 0) return STEALER_NONE;
+            return name_in(base, strlen(base), password_files) ? STEALER_BROWSER_PASSWORDS : STEALER_NONE;
+        }
+        c = slash + 1;
+    }
+
+    // <victim>/Passwords.txt, <victim>/System.txt
+    *victim_len = base > path ? (size_t)(base - path - 1) : 0;
+    if (name_in(base, strlen(base), password_files)) return STEALER_PASSWORDS;
+    if (name_in(base, strlen(base), system_files)) return STEALER_SYSTEM;
+    return STEALER_NONE;
+}
+
+static void free_group(StealerGroup *g) {
+    StealerFile *f = g->files;
+    while (f) {
+        StealerFile *next = f->next;
+        free(f->path);
+        free(f->data);
+        free(f);
+        f = next;
+    }
+    free(g);
+}
+
+// Next line of [*p, end) with the CR and surrounding blanks trimmed; NULL at the end
+static char *next_line(char **p, char *end, size_t *len) {
+    if (*p >= end) return NULL;
+    char *line = *p;
+    char *nl = memchr(line, '\n', (size_t)(end - line));
+    char *line_end = nl ? nl : end;
+    *p = nl ? nl + 1 : end;
+    while (line < line_end && (*line == ' ' || *line == '\t')) line++;
+    while (line_end > line && (line_end[-1] == '\r' || line_end[-1] == ' ' || line_end[-1] == '\t')) line_end--;
+    *len = (size_t)(line_end - line);
+    return line;
+}
+
+// Split "Key: value"; the key loses a leading "- " list marker
+static int split_field(char *line, size_t len, char **key, size_t *key_len, char **value, size_t *value_len) {
+    char *colon = memchr(line, ':', len);
+    if (!colon) return 0;
+    char *k = line, *k_end = colon;
+    while (k < k_end && (*k == '-' || *k == ' ')) k++;
+    while (k_end > k && k_end[-1] == ' ') k_end--;
+    char *v = colon + 1, *v_end = line + len;
+    while (v < v_end && (*v == ' ' || *v == '\t')) v++;
+    *key = k;
+    *key_len = (size_t)(k_end - k);
+    *value = v;
+    *value_len = (size_t)(v_end - v);
+    return 1;
+}
+
+typedef struct {
+    CredentialRecord *items;
+    size_t count, cap;
+} RecordList;
+
+typedef struct {
+    char *url, *identity, *secret;
+    size_t url_len, identity_len, secret_len;
+} Entry;
+
+static void push_entry(RecordList *list, Entry *e, const char *source, size_t source_len) {
+    if (e->identity_len && e->secret_len && e->identity_len <= STEALER_MAX_FIELD &&
+        e->secret_len <= STEALER_MAX_FIELD && e->url_len <= RECORD_FIELD_MAX) {
+        if (list->count == list->cap) {
+            size_t cap = list->cap ? list->cap * 2 : 64;
+            CredentialRecord *items = realloc(list->items, cap * sizeof(CredentialRecord));
+            if (!items) {
+                memset(e, 0, sizeof(*e));
+                return;
+            }
+            list->items = items;
+            list->cap = cap;
+        }
+        // Emails are stored lowercased, as the combo parser does
+        if (memchr(e->identity, '@', e->identity_len)) {
+            for (size_t i = 0; i < e->identity_len; i++) {
+                if (e->identity[i] >= 'A' && e->identity[i] <= 'Z') e->identity[i] += 32;
+            }
+        }
+        list->items[list->count++] = (CredentialRecord){source, source_len, e->identity, e->identity_len,
+                                                        e->secret, e->secret_len, e->url ? e->url : "", e->url_len};
+    }
+    memset(e, 0, sizeof(*e));
+}
+
+// RedLine / Lumma "URL: / Username: / Password:" and Raccoon "URL: / USER: /
+// PASS:" blocks, separated by blank or ===== lines. A repeated field also
+// starts a new block, for logs that drop the separators.
+static void parse_passwords(StealerFile *f, RecordList *list, const char *source, size_t source_len) {
+    static const char *const url_keys[] = {"URL", "Host", "Hostname", "Site", "Origin", NULL};
+    static const char *const identity_keys[] = {"Username", "User", "Login", "User Name", "Email", NULL};
+    static const char *const secret_keys[] = {"Password", "Pass", "PWD", NULL};
+
+    Entry e = {0};
+    char *p = f->data, *end = f->data + f->len, *line, *key, *value;
+    size_t len, key_len, value_len;
+    while ((line = next_line(&p, end, &len))) {
+        if (len == 0 || line[0] == '=' || (len >= 3 && memcmp(line, "---", 3) == 0) || line[0] == '*') {
+            push_entry(list, &e, source, source_len);
+            continue;
+        }
+        if (!split_field(line, len, &key, &key_len, &value, &value_len)) continue;
+        if (name_in(key, key_len, url_keys)) {
+            if (e.url_len || e.identity_len || e.secret_len) push_entry(list, &e, source, source_len);
+            e.url = value;
+            e.url_len = value_len;
+        } else if (name_in(key, key_len, identity_keys)) {
+            if (e.identity_len) push_entry(list, &e, source, source_len);
+            e.identity = value;
+            e.identity_len = value_len;
+        } else if (name_in(key, key_len, secret_keys)) {
+            if (e.secret_len) push_entry(list, &e, source, source_len);
+            e.secret = value;
+            e.secret_len = value_len;
+        }
+    }
+    push_entry(list, &e, source, source_len);
+}
+
+static void set_field(char *out, size_t size, const char *value, size_t len) {
+    if (out[0] || len == 0) return;  // The first system file to carry a field wins
+    if (len >= size) len = size - 1;
+    memcpy(out, value, len);
+    out[len] = '\0';
+}
+
+static void parse_system(StealerFile *f, StealerVictim *v) {
+    static const char *const ip_keys[] = {"IP", "IP Address", "IPAddress", NULL};
+    static const char *const country_keys[] = {"Country", "Country Code", "Location", NULL};
+    static const char *const hwid_keys[] = {"HWID", "MachineID", "Machine ID", "UID", NULL};
+    static const char *const os_keys[] = {"OS", "Windows", "OS Version", "Operation System", "Operating System",
+                                          NULL};
+    static const char *const computer_keys[] = {"Computer", "Computer Name", "ComputerName", "MachineName",
+                                                "Machine Name", "PC Name", NULL};
+    static const char *const user_keys[] = {"User", "UserName", "User Name", "Current User", NULL};
+    static const char *const date_keys[] = {"Log date", "Date", "Local Date", "Local Time", NULL};
+
+    char *p = f->data, *end = f->data + f->len, *line, *key, *value;
+    size_t len, key_len, value_len;
+    while ((line = next_line(&p, end, &len))) {
+        if (!split_field(line, len, &key, &key_len, &value, &value_len)) continue;
+        if (name_in(key, key_len, ip_keys)) set_field(v->ip, sizeof(v->ip), value, value_len);
+        else if (name_in(key, key_len, country_keys)) set_field(v->country, sizeof(v->country), value, value_len);
+        else if (name_in(key, key_len, hwid_keys)) set_field(v->hwid, sizeof(v->hwid), value, value_len);
+        else if (name_in(key, key_len, os_keys)) set_field(v->os, sizeof(v->os), value, value_len);
+        else if (name_in(key, key_len, computer_keys)) set_field(v->computer, sizeof(v->computer), value, value_len);
+        else if (name_in(key, key_len, user_keys)) set_field(v->user, sizeof(v->user), value, value_len);
+        else if (name_in(key, key_len, date_keys)) set_field(v->date, sizeof(v->date), value, value_len);
+    }
+}
+
+static int group_confirmed(const StealerGroup *g) {
+    int passwords = 0, system = 0;
+    for (const StealerFile *f = g->files; f; f = f->next) {
+        if (f->kind == STEALER_BROWSER_PASSWORDS) return 1;
+        if (f->kind == STEALER_PASSWORDS) passwords = 1;
+        else system = 1;
+    }
+    return passwords + system + (g->cookie_files > 0) + (g->autofill_files > 0) >= 2;
+}
+
+// A combo list that only looked like a stealer log by its name
+static void parse_combo(StealerPool *sp, StealerFile *f) {
+    char source[2048];
+    snprintf(source, sizeof(source), "%s/%s", sp->source, f->path);
+    ComboParser *cp = malloc(sizeof(ComboParser));
+    if (!cp) {
+        log_error("Failed to allocate combo parser for %s", source);
+        return;
+    }
+    combo_begin(cp, source, sp->fallback, sp->ctx);
+    combo_feed(cp, f->data, f->len);
+    combo_end(cp);
+    if (cp->records > 0) {
+        log_info("Parsed %llu credentials from %llu lines of %s", (unsigned long long)cp->records,
+                 (unsigned long long)cp->lines, source);
+    }
+    free(cp);
+}
+
+static void parse_group(StealerPool *sp, StealerGroup *g) {
+    if (!group_confirmed(g)) {
+        for (StealerFile *f = g->files; f; f = f->next) parse_combo(sp, f);
+        return;
+    }
+
+    StealerVictim v;
+    memset(&v, 0, sizeof(v));
+    snprintf(v.victim, sizeof(v.victim), "%s", g->victim);
+    v.cookie_files = g->cookie_files;
+    v.autofill_files = g->autofill_files;
+
+    char source[2048];
+    int source_len = g->victim[0] ? snprintf(source, sizeof(source), "%s/%s", sp->source, g->victim)
+                                  : snprintf(source, sizeof(source), "%s", sp->source);
+    if (source_len >= (int)sizeof(source)) source_len = sizeof(source) - 1;
+
+    RecordList list = {0};
+    for (StealerFile *f = g->files; f; f = f->next) {
+        if (f->kind == STEALER_SYSTEM) {
+            parse_system(f, &v);
+            continue;
+        }
+        size_t before = list.count;
+        parse_passwords(f, &list, source, (size_t)source_len);
+        if (list.count == before) parse_combo(sp, f);
+    }
+    v.credentials = list.count;
+
+    pthread_mutex_lock(&sp->sink_mutex);
+    sp->groups++;
+    sp->sink(sp->ctx, &v, list.items, list.count);
+    pthread_mutex_unlock(&sp->sink_mutex);
+    free(list.items);
+}
+
+static void *stealer_worker(void *arg) {
+    StealerPool *sp = arg;
+    while (1) {
+        pthread_mutex_lock(&sp->mutex);
+        while (!sp->head && !sp->closing) pthread_cond_wait(&sp->not_empty, &sp->mutex);
+        StealerGroup *g = sp->head;
+        if (!g) {
+            pthread_mutex_unlock(&sp->mutex);
+            return NULL;
+        }
+        sp->head = g->next;
+        if (!sp->head) sp->tail = NULL;
+        sp->pending--;
+        pthread_cond_signal(&sp->not_full);
+        pthread_mutex_unlock(&sp->mutex);
+
+        parse_group(sp, g);
+        free_group(g);
+    }
+}
+
+// Hand the current group to the workers, waiting while too many are queued
+static void dispatch(StealerPool *sp) {
+    StealerGroup *g = sp->current;
+    sp->current = NULL;
+    sp->file = NULL;
+    if (!g) return;
+    if (!g->files) {
+        // Cookies and autofills only, or files that were detached: nothing to parse
+        pthread_mutex_lock(&sp->sink_mutex);
+        if (g->cookie_files || g->autofill_files) sp->groups++;
+        pthread_mutex_unlock(&sp->sink_mutex);
+        free_group(g);
+        return;
+    }
+    if (sp->thread_count == 0) {
+        parse_group(sp, g);
+        free_group(g);
+        return;
+    }
+
+    pthread_mutex_lock(&sp->mutex);
+    while (sp->pending >= STEALER_MAX_PENDING) pthread_cond_wait(&sp->not_full, &sp->mutex);
+    g->next = NULL;
+    if (sp->tail) sp->tail->next = g;
+    else sp->head = g;
+    sp->tail = g;
+    sp->pending++;
+    pthread_cond_signal(&sp->not_empty);
+    pthread_mutex_unlock(&sp->mutex);
+}
+
+StealerPool *stealer_open(int threads, const char *source, stealer_sink_fn sink, record_emit_fn fallback,
+                          void *ctx) {
+    StealerPool *sp = calloc(1, sizeof(StealerPool) + threads * sizeof(pthread_t));
+    if (!sp) {
+        log_error("Failed to allocate stealer-log pool for %s", source);
+        return NULL;
+    }
+    snprintf(sp->source, sizeof(sp->source), "%s", source);
+    sp->sink = sink;
+    sp->fallback = fallback;
+    sp->ctx = ctx;
+    pthread_mutex_init(&sp->sink_mutex, NULL);
+    pthread_mutex_init(&sp->mutex, NULL);
+    pthread_cond_init(&sp->not_empty, NULL);
+    pthread_cond_init(&sp->not_full, NULL);
+    // Without workers, groups are parsed inline by the extracting thread
+    while (sp->thread_count < threads) {
+        if (pthread_create(&sp->threads[sp->thread_count], NULL, stealer_worker, sp) != 0) {
+            log_warning("Started only %d of %d stealer-log workers", sp->thread_count, threads);
+            break;
+        }
+        sp->thread_count++;
+    }
+    return sp;
+}
+
+void stealer_entry_begin(StealerPool *sp, const char *path, StealerKind kind, size_t victim_len) {
+    if (!sp || kind == STEALER_NONE) return;
+    sp->entry_kind = kind;
+    if (sp->current && (strlen(sp->current->victim) != victim_len || strncmp(sp->current->victim, path, victim_len) != 0)) {
+        dispatch(sp);
+    }
+    if (!sp->current) {
+        sp->current = calloc(1, sizeof(StealerGroup));
+        if (!sp->current) {
+            log_error("Failed to allocate stealer-log group for %s", path);
+            return;
+        }
+        snprintf(sp->current->victim, sizeof(sp->current->victim), "%.*s", (int)victim_len, path);
+        sp->current->files_tail = &sp->current->files;
+    }
+
+    if (kind == STEALER_COOKIES) {
+        sp->current->cookie_files++;
+    } else if (kind == STEALER_AUTOFILL) {
+        sp->current->autofill_files++;
+    } else {
+        StealerFile *f = calloc(1, sizeof(StealerFile));
+        if (f) f->path = strdup(path);
+        if (!f || !f->path) {
+            log_error("Failed to allocate stealer-log buffer for %s", path);
+            free(f);
+            return;
+        }
+        f->kind = kind;
+        sp->file_link = sp->current->files_tail;
+        *sp->current->files_tail = f;
+        sp->current->files_tail = &f->next;
+        sp->file = f;
+    }
+}
+
+int stealer_entry_data(StealerPool *sp, const void *data, size_t len) {
+    if (!sp) return -1;
+    if (!sp->file) return sp->entry_kind == STEALER_COOKIES || sp->entry_kind == STEALER_AUTOFILL ? 0 : -1;
+    StealerFile *f = sp->file;
+    if (f->len + len > STEALER_MAX_FILE) return -1;
+    if (f->len + len > f->cap) {
+        size_t cap = f->cap ? f->cap : 16384;
+        while (cap < f->len + len) cap *= 2;
+        char *grown = realloc(f->data, cap);
+        if (!grown) {
+            log_error("Failed to grow stealer-log buffer to %zu bytes", cap);
+            return -1;
+        }
+        f->data = grown;
+        f->cap = cap;
+    }
+    memcpy(f->data + f->len, data, len);
+    f->len += len;
+    return 0;
+}
+
+char *stealer_entry_detach(StealerPool *sp, size_t *len) {
+    *len = 0;
+    if (!sp || !sp->file) return NULL;
+    // Entries arrive one at a time, so the file is the last of its group
+    StealerFile *f = sp->file;
+    *sp->file_link = NULL;
+    sp->current->files_tail = sp->file_link;
+    sp->file = NULL;
+    char *data = f->data;
+    *len = f->len;
+    free(f->path);
+    free(f);
+    return data;
+}
+
+void stealer_entry_end(StealerPool *sp) {
+    if (sp) sp->file = NULL;
+}
+
+uint64_t stealer_close(StealerPool *sp) {
+    if (!sp) return 0;
+    dispatch(sp);
+
+    pthread_mutex_lock(&sp->mutex);
+    sp->closing = 1;
+    pthread_cond_broadcast(&sp->not_empty);
+    pthread_mutex_unlock(&sp->mutex);
+    for (int i = 0; i < sp->thread_count; i++) pthread_join(sp->threads[i], NULL);
+
+    uint64_t groups = sp->groups;
+    pthread_mutex_destroy(&sp->sink_mutex);
+    pthread_mutex_destroy(&sp->mutex);
+    pthread_cond_destroy(&sp->not_empty);
+    pthread_cond_destroy(&sp->not_full);
+    free(sp);
+    return groups;
+}
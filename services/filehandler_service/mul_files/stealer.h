@@ -0,0 +1,73 @@
+#ifndef STEALER_H
+#define STEALER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define STEALER_MAX_FILE (16 << 20)  // Larger Passwords.txt / System.txt entries are no stealer logs
+#define STEALER_MAX_PENDING 64  // Victim groups queued for parsing before extraction waits
+#define STEALER_MAX_FIELD 255
+
+// What an archive entry is within a stealer-log victim folder
+typedef enum {
+    STEALER_NONE,  // Not part of a recognised layout
+    STEALER_PASSWORDS,  // Passwords.txt, All Passwords.txt, ...
+    STEALER_BROWSER_PASSWORDS,  // A password file under Browsers/, which alone confirms the layout
+    STEALER_SYSTEM,  // System.txt, UserInformation.txt, Information.txt, ...
+    STEALER_COOKIES,  // Anything under Cookies/
+    STEALER_AUTOFILL  // Anything under Autofills/ or Autofill/
+} StealerKind;
+
+// Host details parsed from a victim's system file; fields are NUL-terminated
+// and empty when the log did not carry them
+typedef struct {
+    char victim[1024];  // Victim folder path inside the archive
+    char ip[64];
+    char country[64];
+    char hwid[128];
+    char os[STEALER_MAX_FIELD + 1];
+    char computer[STEALER_MAX_FIELD + 1];
+    char user[STEALER_MAX_FIELD + 1];
+    char date[64];
+    uint64_t credentials;
+    unsigned cookie_files;
+    unsigned autofill_files;
+} StealerVictim;
+
+// Called once per victim group with every credential parsed from its password
+// files. Calls are serialized, so the sink needs no locking of its own.
+typedef void (*stealer_sink_fn)(void *ctx, const StealerVictim *v, const CredentialRecord *recs, size_t count);
+
+typedef struct StealerPool StealerPool;
+
+// Classify an entry by its path. For anything but STEALER_NONE, *victim_len
+// is the length of the victim folder prefix of path. Names alone only make an
+// entry a candidate; see stealer_open.
+StealerKind stealer_classify(const char *path, size_t *victim_len);
+
+// Entries of one victim are buffered until an entry of another victim shows
+// up; the finished group is then parsed on one of threads pool workers while
+// extraction continues. source is the prefix of every record's source.
+//
+// A group is only parsed as a stealer log when its folder layout confirms it:
+// two of password file, system file, cookies and autofills, or a password
+// file under Browsers/. Files of other groups, and password files without a
+// single URL/Username/Password block, go through the combo parser instead,
+// which hands its records to fallback from the worker.
+StealerPool *stealer_open(int threads, const char *source, stealer_sink_fn sink, record_emit_fn fallback,
+                          void *ctx);
+void stealer_entry_begin(StealerPool *sp, const char *path, StealerKind kind, size_t victim_len);
+// Returns -1, without taking data, when the entry is not being buffered: it
+// outgrew STEALER_MAX_FILE or a buffer could not be allocated
+int stealer_entry_data(StealerPool *sp, const void *data, size_t len);
+// Take the current entry out of its group, returning what was buffered of it
+// (malloc'd, NULL when nothing was)
+char *stealer_entry_detach(StealerPool *sp, size_t *len);
+void stealer_entry_end(StealerPool *sp);
+// Parse the last group, wait for the workers and free the pool; returns the
+// number of victim groups processed
+uint64_t stealer_close(StealerPool *sp);
+
+#endif
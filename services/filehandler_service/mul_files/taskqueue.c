@@ -0,0 +1,102 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "filehandler.h"
+#include "taskqueue.h"
+
+// A ring that grows when queue_depth is raised or deliveries overrun it;
+// queue_limit is the configured depth
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static FileTask **file_queue = NULL;
+static int queue_capacity = 0, queue_limit = 0;
+static int queue_front = 0, queue_rear = 0, queue_size = 0;
+
+// Worker pool size, adjusted live on reload (guarded by queue_mutex)
+static int live_workers = 0, target_workers = 0;
+
+// Caller holds queue_mutex
+static int grow_locked(int capacity) {
+    FileTask **grown = malloc(capacity * sizeof(FileTask *));
+    if (!grown) {
+        log_error("Failed to grow task queue to %d", capacity);
+        return -1;
+    }
+    for (int i = 0; i < queue_size; i++) {
+        grown[i] = file_queue[(queue_front + i) % queue_capacity];
+    }
+    free(file_queue);
+    file_queue = grown;
+    queue_capacity = capacity;
+    queue_front = 0;
+    queue_rear = queue_size % queue_capacity;
+    return 0;
+}
+
+int taskqueue_push(FileTask *task) {
+    pthread_mutex_lock(&queue_mutex);
+    while (task->channel == 0 && queue_size >= queue_limit) {
+        pthread_cond_wait(&queue_not_full, &queue_mutex);
+    }
+    if (queue_size == queue_capacity && grow_locked(queue_capacity ? queue_capacity * 2 : 16) != 0) {
+        pthread_mutex_unlock(&queue_mutex);
+        return -1;
+    }
+
+    file_queue[queue_rear] = task;
+    queue_rear = (queue_rear + 1) % queue_capacity;
+    queue_size++;
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
+
+FileTask *taskqueue_pop(void) {
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_size == 0 && live_workers <= target_workers) {
+        pthread_cond_wait(&queue_not_empty, &queue_mutex);
+    }
+    if (live_workers > target_workers) {
+        live_workers--;
+        pthread_mutex_unlock(&queue_mutex);
+        return NULL;
+    }
+
+    FileTask *task = file_queue[queue_front];
+    queue_front = (queue_front + 1) % queue_capacity;
+    queue_size--;
+    if (queue_size < queue_limit) pthread_cond_signal(&queue_not_full);
+    pthread_mutex_unlock(&queue_mutex);
+    return task;
+}
+
+int taskqueue_resize(int depth) {
+    pthread_mutex_lock(&queue_mutex);
+    if (depth > queue_capacity && grow_locked(depth) != 0) {
+        pthread_mutex_unlock(&queue_mutex);
+        return -1;
+    }
+    queue_limit = depth;
+    pthread_cond_broadcast(&queue_not_full);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
+
+int taskqueue_resize_workers(int count, void *(*worker)(void *)) {
+    pthread_mutex_lock(&queue_mutex);
+    target_workers = count;
+    while (live_workers < target_workers) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+            pthread_mutex_unlock(&queue_mutex);
+            log_error("Failed to create worker thread %d", live_workers);
+            return -1;
+        }
+        pthread_detach(thread);
+        live_workers++;
+    }
+    pthread_cond_broadcast(&queue_not_empty);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include <stdint.h>
+#include <rabbitmq-c/amqp.h>
+
+// Tasks waiting for the worker pool, and the pool itself.
+// A RabbitMQ delivery is always admitted, past queue_depth if need be: the
+// broker already bounds them by consumer_channels x channel_prefetch, and the
+// consumer thread that queues them owns the connection, so it must never stop
+// sending heartbeats and acks. Local tasks (watcher, retries) wait for room.
+
+typedef struct {
+    char *file_path;
+    amqp_channel_t channel;  // 0 when the task did not come from RabbitMQ
+    uint64_t delivery_tag;
+    int attempts;  // Failures already spent on this file (x-retry-count, plus one if redelivered)
+    char failure_reason[256];  // Root cause of the last failure, before wrapper messages were logged
+} FileTask;
+
+// Queue a task. Returns -1 only if the ring could not grow for a delivery.
+int taskqueue_push(FileTask *task);
+
+// Next task for a worker; NULL when the calling worker should exit because the pool was shrunk
+FileTask *taskqueue_pop(void);
+
+// Make depth the limit for local tasks, growing the ring as needed
+int taskqueue_resize(int depth);
+
+// Start or retire workers running worker until the pool matches count;
+// surplus workers exit after their current task
+int taskqueue_resize_workers(int count, void *(*worker)(void *));
+
+#endif
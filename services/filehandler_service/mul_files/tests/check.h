@@ -0,0 +1,59 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Assertions for the module tests, which define _GNU_SOURCE before any include
+// for nftw and mkdtemp. A failed check prints its line and the test goes on,
+// so one run reports every failure; check_done() sets the exit code
+
+static int check_failures;
+
+#define CHECK(cond)                                                                                 \
+    do {                                                                                            \
+        if (!(cond)) {                                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                \
+            check_failures++;                                                                       \
+        }                                                                                           \
+    } while (0)
+
+#define CHECK_STR(got, want)                                                                        \
+    do {                                                                                            \
+        const char *got_ = (got), *want_ = (want);                                                  \
+        if (strcmp(got_, want_) != 0) {                                                             \
+            fprintf(stderr, "%s:%d: got \"%s\", want \"%s\"\n", __FILE__, __LINE__, got_, want_);   \
+            check_failures++;                                                                       \
+        }                                                                                           \
+    } while (0)
+
+static inline int check_done(const char *name) {
+    if (check_failures) fprintf(stderr, "%s: %d checks failed\n", name, check_failures);
+    else printf("%s: ok\n", name);
+    return check_failures ? 1 : 0;
+}
+
+// Scratch directory under $TMPDIR; removed by check_rmdir
+static inline char *check_tmpdir(char *out, size_t size) {
+    const char *tmp = getenv("TMPDIR");
+    snprintf(out, size, "%s/filehandler-test.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!mkdtemp(out)) {
+        perror("mkdtemp");
+        exit(2);
+    }
+    return out;
+}
+
+static inline int check_remove(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st, (void)flag, (void)ftw;
+    return remove(path);
+}
+
+static inline void check_rmdir(const char *dir) {
+    nftw(dir, check_remove, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+#endif
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../blake3.h"
+#include "check.h"
+
+// Digests of bytes i % 251, as in the official BLAKE3 test vectors; lengths
+// sit on both sides of chunk and SIMD batch boundaries
+static const struct {
+    size_t len;
+    const char *hex;
+} vectors[] = {
+    {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+    {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+    {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+    {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+    {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+    {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    {2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+    {3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+    {3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+    {16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4"},
+    {16385, "1dabe216be2578830263b049de1639f39f05a4da616b9b78c7a5e4e41662fd1f"},
+    {31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+    {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+    {1000000, "5e82c663d164c54e4fcdfcd70e3ca464662228bdbad45cce2e0c2bff999064ef"},
+};
+
+static void digest_hex(const uint8_t *data, size_t len, size_t step, char out[2 * BLAKE3_OUT_LEN + 1]) {
+    Blake3 h;
+    uint8_t digest[BLAKE3_OUT_LEN];
+    blake3_init(&h);
+    for (size_t i = 0; i < len; i += step) blake3_update(&h, data + i, len - i < step ? len - i : step);
+    blake3_final(&h, digest);
+    for (int i = 0; i < BLAKE3_OUT_LEN; i++) sprintf(out + 2 * i, "%02x", digest[i]);
+}
+
+// Whole inputs, then the same inputs fed in pieces that split chunks and batches
+static void test_vectors(void) {
+    static const size_t steps[] = {(size_t)-1, 1, 7, 1000, BLAKE3_CHUNK_LEN * BLAKE3_BATCH_CHUNKS + 1};
+    uint8_t *data = malloc(1000000);
+    CHECK(data != NULL);
+    if (!data) return;
+    for (size_t i = 0; i < 1000000; i++) data[i] = (uint8_t)(i % 251);
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+        for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+            // Byte-at-a-time on the largest input adds nothing but run time
+            if (steps[s] == 1 && vectors[v].len > 20000) continue;
+            char hex[2 * BLAKE3_OUT_LEN + 1];
+            digest_hex(data, vectors[v].len, steps[s], hex);
+            CHECK_STR(hex, vectors[v].hex);
+        }
+    }
+    free(data);
+}
+
+static void test_reuse(void) {
+    char hex[2 * BLAKE3_OUT_LEN + 1];
+    digest_hex((const uint8_t *)"abc", 3, 3, hex);
+    CHECK_STR(hex, "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+    // An empty update changes nothing
+    Blake3 h;
+    uint8_t digest[BLAKE3_OUT_LEN];
+    blake3_init(&h);
+    blake3_update(&h, "", 0);
+    blake3_final(&h, digest);
+    for (int i = 0; i < BLAKE3_OUT_LEN; i++) sprintf(hex + 2 * i, "%02x", digest[i]);
+    CHECK_STR(hex, vectors[0].hex);
+    CHECK(blake3_lanes() >= 1);
+}
+
+int main(void) {
+    test_vectors();
+    test_reuse();
+    return check_done("blake3");
+}
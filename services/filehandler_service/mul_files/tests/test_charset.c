@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "../charset.h"
+#include "check.h"
+
+// Transcodes in pieces of step bytes, so code units and surrogate pairs are
+// split at every offset for small steps
+static size_t transcode(const void *in, size_t len, size_t step, char *out) {
+    Transcoder t = {0};
+    transcoder_begin(&t, in, len);
+    size_t used = 0;
+    for (size_t i = 0; i < len; i += step) {
+        size_t n;
+        const char *utf8 = transcoder_feed(&t, (const char *)in + i, len - i < step ? len - i : step, &n);
+        CHECK(utf8 != NULL);
+        if (!utf8) break;
+        memcpy(out + used, utf8, n);
+        used += n;
+    }
+    transcoder_free(&t);
+    out[used] = '\0';
+    return used;
+}
+
+// UTF-8 to UTF-16, the inverse of the transcoder, for round trips
+static size_t to_utf16(const char *s, int big_endian, uint8_t *out) {
+    const uint8_t *p = (const uint8_t *)s;
+    size_t o = 0;
+    while (*p) {
+        int more = *p < 0x80 ? 0 : *p < 0xe0 ? 1 : *p < 0xf0 ? 2 : 3;
+        uint32_t cp = *p++ & (0x7f >> more);
+        while (more--) cp = cp << 6 | (*p++ & 0x3f);
+        uint16_t units[2] = {(uint16_t)cp, 0};
+        int n = 1;
+        if (cp >= 0x10000) {
+            units[0] = (uint16_t)(0xd800 | (cp - 0x10000) >> 10);
+            units[1] = (uint16_t)(0xdc00 | ((cp - 0x10000) & 0x3ff));
+            n = 2;
+        }
+        for (int k = 0; k < n; k++) {
+            out[o++] = (uint8_t)(big_endian ? units[k] >> 8 : units[k]);
+            out[o++] = (uint8_t)(big_endian ? units[k] : units[k] >> 8);
+        }
+    }
+    return o;
+}
+
+static const char sample[] = "user@mail.ru:\xd0\xbf\xd0\xb0\xd1\x80\xd0\xbe\xd0\xbb\xd1\x8c caf\xc3\xa9 \xe2\x82\xac "
+                             "\xf0\x9f\x94\x91 end\n";
+
+static void test_detect(void) {
+    size_t bom;
+    CHECK(charset_detect("\xef\xbb\xbfuser:pass", 12, &bom) == CHARSET_UTF8 && bom == 3);
+    CHECK(charset_detect("\xff\xfeu\0s\0", 6, &bom) == CHARSET_UTF16LE && bom == 2);
+    CHECK(charset_detect("\xfe\xff\0u\0s", 6, &bom) == CHARSET_UTF16BE && bom == 2);
+    CHECK(charset_detect("user:pass\n", 10, &bom) == CHARSET_UTF8 && bom == 0);
+    CHECK(charset_detect(sample, sizeof(sample) - 1, &bom) == CHARSET_UTF8);
+
+    uint8_t wide[256];
+    size_t n = to_utf16("user@mail.ru:password\n", 0, wide);
+    CHECK(charset_detect(wide, n, &bom) == CHARSET_UTF16LE && bom == 0);
+    n = to_utf16("user@mail.ru:password\n", 1, wide);
+    CHECK(charset_detect(wide, n, &bom) == CHARSET_UTF16BE && bom == 0);
+    // 16-bit binary tables have zero bytes too, but not text between them
+    static const uint8_t table[] = {1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7, 0, 8, 0};
+    CHECK(charset_detect(table, sizeof(table), &bom) == CHARSET_UTF8);
+
+    // "user:пароль" in CP1251, "user:café résumé" in CP1252
+    CHECK(charset_detect("user:\xef\xe0\xf0\xee\xeb\xfc\n", 12, &bom) == CHARSET_CP1251);
+    CHECK(charset_detect("user:caf\xe9 r\xe9sum\xe9\n", 17, &bom) == CHARSET_CP1252);
+    CHECK(strcmp(charset_name(CHARSET_CP1251), "CP1251") == 0);
+}
+
+static void test_utf16_round_trip(void) {
+    static const size_t steps[] = {1, 2, 3, 5, 64, 4096};
+    uint8_t wide[512];
+    char out[512];
+    for (int big = 0; big <= 1; big++) {
+        wide[0] = big ? 0xfe : 0xff;
+        wide[1] = big ? 0xff : 0xfe;
+        size_t n = 2 + to_utf16(sample, big, wide + 2);
+        for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+            size_t len = transcode(wide, n, steps[i], out);
+            CHECK(len == sizeof(sample) - 1);
+            CHECK_STR(out, sample);
+        }
+    }
+}
+
+static void test_invalid_utf16(void) {
+    // A lone high surrogate, a lone low surrogate and a trailing odd byte
+    static const uint8_t in[] = {0xff, 0xfe, 'a', 0, 0x3d, 0xd8, 'b', 0, 0x11, 0xdd, 'c', 0, 'd'};
+    char out[64];
+    static const size_t steps[] = {1, 3, 64};
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        transcode(in, sizeof(in), steps[i], out);
+        CHECK(strncmp(out, "a\xef\xbf\xbd" "b\xef\xbf\xbd" "c", 9) == 0);
+    }
+}
+
+static void test_single_byte(void) {
+    char out[256];
+    static const char cp1251[] = "user:\xef\xe0\xf0\xee\xeb\xfc \xa8\xb8 \x88\n";
+    transcode(cp1251, sizeof(cp1251) - 1, 4, out);
+    CHECK_STR(out, "user:\xd0\xbf\xd0\xb0\xd1\x80\xd0\xbe\xd0\xbb\xd1\x8c \xd0\x81\xd1\x91 \xe2\x82\xac\n");
+
+    static const char cp1252[] = "user:caf\xe9 r\xe9sum\xe9 \x80 \x81\n";
+    transcode(cp1252, sizeof(cp1252) - 1, 3, out);
+    CHECK_STR(out, "user:caf\xc3\xa9 r\xc3\xa9sum\xc3\xa9 \xe2\x82\xac \xef\xbf\xbd\n");
+
+    // UTF-8 passes through untouched, minus its byte order mark
+    transcode("\xef\xbb\xbfok\n", 6, 1, out);
+    CHECK_STR(out, "ok\n");
+}
+
+int main(void) {
+    test_detect();
+    test_utf16_round_trip();
+    test_invalid_utf16();
+    test_single_byte();
+    return check_done("charset");
+}
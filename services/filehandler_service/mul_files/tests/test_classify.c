@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "../classify.h"
+#include "check.h"
+
+static void check_kind(const char *name, const char *data, size_t len, EntryKind want) {
+    EntryKind got = classify_entry(name, data, len);
+    if (got != want) fprintf(stderr, "%s\n", name);
+    CHECK_STR(entry_kind_name(got), entry_kind_name(want));
+}
+
+#define KIND(name, literal, want) check_kind(name, literal, sizeof(literal) - 1, want)
+
+static void test_text(void) {
+    KIND("a.txt", "", ENTRY_UNKNOWN);
+    KIND("combo.txt", "alice@example.com:hunter2\r\nbob:pw\tx\n", ENTRY_TEXT);
+    KIND("log.txt", "[INFO] started\n[WARN] slow\n", ENTRY_TEXT);
+    KIND("utf8.txt", "p\xc3\xa4ssw\xc3\xb6rd:\xe5\xaf\x86\xe7\xa0\x81\n", ENTRY_TEXT);
+    KIND("users.csv", "email:password\n", ENTRY_CSV);
+    KIND("export.dat", "id,email,password\n1,a@b.c,pw\n", ENTRY_CSV);
+    KIND("export.dat", "id;email\n1;a@b.c\n", ENTRY_TEXT);  // One delimiter is not enough
+    KIND("dump.json", "  \n{\"email\": \"a@b.c\"}\n", ENTRY_JSON);
+    KIND("dump.json", "[ {\"email\": \"a@b.c\"} ]", ENTRY_JSON);
+    KIND("dump.txt", "-- MySQL dump 10.13\nCREATE TABLE users (id int);\n", ENTRY_SQL);
+    KIND("users.SQL", "whatever\n", ENTRY_SQL);
+}
+
+static void test_binary(void) {
+    KIND("db", "SQLite format 3\0\x10\0", ENTRY_SQLITE);
+    KIND("a.png", "\x89PNG\r\n\x1a\n\0\0\0\rIHDR", ENTRY_IMAGE);
+    KIND("a.jpg", "\xff\xd8\xff\xe0\0\x10JFIF", ENTRY_IMAGE);
+    KIND("a.webp", "RIFF\x10\0\0\0WEBPVP8 ", ENTRY_IMAGE);
+    KIND("a.wav", "RIFF\x10\0\0\0WAVEfmt ", ENTRY_BINARY);
+    KIND("a.zip", "PK\x03\x04\x14\0\0\0", ENTRY_ARCHIVE);
+    KIND("a.gz", "\x1f\x8b\x08\0\0\0\0\0", ENTRY_ARCHIVE);
+    KIND("a.zst", "\x28\xb5\x2f\xfd\x04\0", ENTRY_ARCHIVE);
+    KIND("a.exe", "MZ\x90\0\x03\0\0\0", ENTRY_EXECUTABLE);
+    KIND("a.elf", "\x7f" "ELF\x02\x01\x01\0", ENTRY_EXECUTABLE);
+    KIND("a.bin", "\x01\x02\x03\x04", ENTRY_BINARY);
+    // A text-looking magic is still text
+    KIND("bm.txt", "BMW owners\n", ENTRY_TEXT);
+
+    CHECK(entry_kind_is_text(ENTRY_SQL) && !entry_kind_is_text(ENTRY_SQLITE));
+    CHECK(!entry_kind_is_cold(ENTRY_SQLITE) && !entry_kind_is_cold(ENTRY_TEXT) && entry_kind_is_cold(ENTRY_ARCHIVE));
+    CHECK_STR(entry_kind_name((EntryKind)99), "unknown");
+}
+
+// Control bytes up to CLASSIFY_MAX_CONTROL_PCT of the sniffed prefix are
+// tolerated wherever they sit, in 16-byte vector blocks or the scalar tail;
+// one NUL is not, and nothing past the prefix counts
+static void test_histogram(void) {
+    static char buf[2 * CLASSIFY_SNIFF_BYTES];
+    static const size_t lens[] = {CLASSIFY_SNIFF_BYTES, 1007, 100, 15};
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t len = lens[l], allowed = len * CLASSIFY_MAX_CONTROL_PCT / 100;
+        for (size_t at = 0; at < 2; at++) {
+            memset(buf, 'a', len);
+            for (size_t i = 0; i < allowed; i++) buf[(i * 7 + at) % len] = i % 2 ? '\x1b' : '\x7f';
+            check_kind("controls", buf, len, ENTRY_TEXT);
+            // Tabs, line ends and high bytes are not control bytes
+            for (size_t i = 0; i < len; i++) {
+                if (buf[i] == 'a' && i % 3 == 0) buf[i] = "\t\r\n\xe9"[i % 4];
+            }
+            check_kind("whitespace", buf, len, ENTRY_TEXT);
+            buf[len - 1 - at] = '\x01';
+            check_kind("one more", buf, len, ENTRY_BINARY);
+
+            memset(buf, 'a', len);
+            buf[len - 1 - at] = '\0';
+            check_kind("nul", buf, len, ENTRY_BINARY);
+        }
+    }
+    memset(buf, 'a', sizeof(buf));
+    memset(buf + CLASSIFY_SNIFF_BYTES, 0, CLASSIFY_SNIFF_BYTES);
+    check_kind("past the prefix", buf, sizeof(buf), ENTRY_TEXT);
+}
+
+int main(void) {
+    test_text();
+    test_binary();
+    test_histogram();
+    return check_done("classify");
+}
@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../colstore.h"
+#include "check.h"
+
+#define ROWS (2 * COLSTORE_BLOCK_ROWS + 1000)  // Three blocks, the last one partial
+
+static char dir[256], path[512];
+
+// Row i has identity user<i>@d<i % 100>.com, except every 10th, which has a
+// bare username; rows of d7.com only appear in the first block
+static int make_row(int i, CredentialRecord *rec, char *identity, char *secret) {
+    int domain = i % 100;
+    if (domain == 7 && i >= COLSTORE_BLOCK_ROWS) domain = 8;
+    int n = i % 10 == 0 ? snprintf(identity, 64, "user%d", i) : snprintf(identity, 64, "user%d@d%d.com", i, domain);
+    int s = snprintf(secret, 64, "pw%d", i);
+    *rec = (CredentialRecord){"leak.zip/users.txt", 18, identity, (size_t)n, secret, (size_t)s,
+                              i % 3 ? "" : "https://login.example", i % 3 ? 0 : 21};
+    return domain;
+}
+
+typedef struct {
+    long long rows;
+    int bad;
+} Matches;
+
+static void check_row(void *ctx, const ColumnRow *row) {
+    Matches *m = ctx;
+    m->rows++;
+    int i;
+    char identity[64], secret[64];
+    CredentialRecord rec;
+    if (sscanf(row->local, "user%d", &i) != 1) {
+        m->bad++;
+        return;
+    }
+    make_row(i, &rec, identity, secret);
+    size_t local_len = (size_t)(strchr(identity, '@') - identity);
+    const char *domain = identity + local_len + 1;
+    size_t domain_len = rec.identity_len - local_len - 1;
+    if (row->local_len != local_len || memcmp(row->local, identity, local_len) != 0 ||
+        row->domain_len != domain_len || memcmp(row->domain, domain, domain_len) != 0 ||
+        row->secret_len != rec.secret_len || memcmp(row->secret, secret, rec.secret_len) != 0 ||
+        row->url_len != rec.url_len || memcmp(row->url, rec.url, rec.url_len) != 0 || row->source_len != 18 ||
+        memcmp(row->source, rec.source, 18) != 0 || row->first_seen != 1700000000u + (uint64_t)i) {
+        m->bad++;
+    }
+}
+
+static void test_round_trip(void) {
+    ColumnWriter *w = colstore_writer_open(path);
+    CHECK(w != NULL);
+    if (!w) return;
+    long long per_domain[101] = {0};
+    for (int i = 0; i < ROWS; i++) {
+        char identity[64], secret[64];
+        CredentialRecord rec;
+        int domain = make_row(i, &rec, identity, secret);
+        if (i % 10 != 0) per_domain[domain]++;
+        CHECK(colstore_writer_add(w, &rec, 1700000000u + (uint64_t)i) == 0);
+    }
+    static char huge[RECORD_FIELD_MAX + 2];
+    memset(huge, 'x', sizeof(huge));
+    CredentialRecord too_long = {"s", 1, "a@b.com", 7, huge, sizeof(huge), "", 0};
+    CHECK(colstore_writer_add(w, &too_long, 0) == 1);
+    CHECK(colstore_writer_close(w) == 0);
+
+    ColumnReader *r = colstore_open(path);
+    CHECK(r != NULL);
+    if (!r) return;
+    static const int domains[] = {1, 7, 8, 99};
+    for (size_t k = 0; k < sizeof(domains) / sizeof(domains[0]); k++) {
+        char name[16];
+        snprintf(name, sizeof(name), "d%d.com", domains[k]);
+        Matches m = {0};
+        ColumnScanStats stats = {0};
+        CHECK(colstore_query_domain(r, name, check_row, &m, &stats) == per_domain[domains[k]]);
+        CHECK(m.rows == per_domain[domains[k]] && m.bad == 0);
+        CHECK(stats.blocks == 3);
+        // d7.com is only in the first block; the others reach every block
+        if (domains[k] == 7) CHECK(stats.blocks_skipped == 2 && stats.rows_scanned == COLSTORE_BLOCK_ROWS);
+    }
+    Matches m = {0};
+    ColumnScanStats stats = {0};
+    CHECK(colstore_query_domain(r, "absent.org", check_row, &m, &stats) == 0);
+    CHECK(stats.rows_scanned == 0);  // Not in the dictionary: no block is read
+    colstore_close(r);
+}
+
+static void test_empty(void) {
+    char empty[600];
+    snprintf(empty, sizeof(empty), "%s/empty.sgc", dir);
+    ColumnWriter *w = colstore_writer_open(empty);
+    CHECK(w != NULL && colstore_writer_close(w) == 0);
+    ColumnReader *r = colstore_open(empty);
+    CHECK(r != NULL);
+    Matches m = {0};
+    ColumnScanStats stats = {0};
+    if (r) CHECK(colstore_query_domain(r, "d1.com", check_row, &m, &stats) == 0 && stats.blocks == 0);
+    colstore_close(r);
+}
+
+static void test_truncated(void) {
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    CHECK(truncate(path, st.st_size - 1) == 0);
+    ColumnReader *r = colstore_open(path);
+    CHECK(r == NULL);
+    colstore_close(r);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/leak.sgc", dir);
+    test_round_trip();
+    test_empty();
+    test_truncated();
+    check_rmdir(dir);
+    return check_done("colstore");
+}
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "../combo.h"
+#include "check.h"
+
+// Records of one parse as [identity|secret|url] runs
+static char out[1 << 20];
+static size_t used;
+
+static void collect(void *ctx, const CredentialRecord *rec) {
+    (void)ctx;
+    used += (size_t)snprintf(out + used, sizeof(out) - used, "[%.*s|%.*s|%.*s]", (int)rec->identity_len, rec->identity,
+                             (int)rec->secret_len, rec->secret, (int)rec->url_len, rec->url);
+}
+
+// Parses in pieces of step bytes, so lines, delimiters and the 64-byte SIMD
+// chunks cross a piece boundary at some step
+static const char *parse(const char *in, size_t len, size_t step) {
+    static ComboParser cp;
+    used = 0;
+    out[0] = '\0';
+    combo_begin(&cp, "test.txt", collect, NULL);
+    for (size_t i = 0; i < len; i += step) combo_feed(&cp, in + i, len - i < step ? len - i : step);
+    combo_end(&cp);
+    return out;
+}
+
+static const size_t steps[] = {1, 3, 7, 63, 64, 65, 127, 128, 1 << 20};
+#define STEPS (sizeof(steps) / sizeof(steps[0]))
+
+static void check_all_steps(const char *in, const char *want) {
+    for (size_t i = 0; i < STEPS; i++) {
+        const char *got = parse(in, strlen(in), steps[i]);
+        if (strcmp(got, want) != 0) fprintf(stderr, "step %zu:\n", steps[i]);
+        CHECK_STR(got, want);
+    }
+}
+
+static void test_formats(void) {
+    check_all_steps("Alice@Example.COM:Secret1\n"
+                    "bob;pw;with;semis\n"
+                    "carol|pipe\n"
+                    "dave\ttabbed\n"
+                    "https://shop.example.com/login:erin@x.com:pw5\n"
+                    "www.site.org:frank:pw6\n",
+                    "[alice@example.com|Secret1|][bob|pw;with;semis|][carol|pipe|][dave|tabbed|]"
+                    "[erin@x.com|pw5|https://shop.example.com/login][frank|pw6|www.site.org]");
+}
+
+static void test_edges(void) {
+    // BOM on the first line only, CRLF, blank lines, no trailing newline
+    check_all_steps("\xef\xbb\xbf" "a@b.com:one\r\n\r\n\xef\xbb\xbf" "c:two\r\nd@e.com:last",
+                    "[a@b.com|one|][\xef\xbb\xbf" "c|two|][d@e.com|last|]");
+    // Banners, a missing secret or identity, and a URL without credentials are dropped
+    check_all_steps("Join our channel: t.me/leaks\nnosecret:\n:noid\nhttps://only.url/\nok:pw\n", "[ok|pw|]");
+    // A field longer than COMBO_MAX_FIELD is rejected, not cut
+    char in[1024];
+    int n = snprintf(in, sizeof(in), "a:");
+    memset(in + n, 'x', COMBO_MAX_FIELD + 1);
+    snprintf(in + n + COMBO_MAX_FIELD + 1, sizeof(in) - n - COMBO_MAX_FIELD - 1, "\nb:ok\n");
+    check_all_steps(in, "[b|ok|]");
+}
+
+// Lines of every length around the chunk size, with their first delimiter on
+// either side of a chunk boundary, parse the same at every step
+static void test_chunk_carry(void) {
+    static char in[1 << 16], want[1 << 16];
+    size_t len = 0, want_len = 0;
+    for (int id_len = 1; id_len < 140; id_len++) {
+        char id[160];
+        memset(id, 'u', id_len);
+        id[id_len] = '\0';
+        len += (size_t)snprintf(in + len, sizeof(in) - len, "%s:p%d\n", id, id_len);
+        want_len += (size_t)snprintf(want + want_len, sizeof(want) - want_len, "[%s|p%d|]", id, id_len);
+    }
+    check_all_steps(in, want);
+}
+
+// A line over COMBO_MAX_LINE is skipped whether it ends in the block it starts
+// in or is carried across blocks, and the line after it still parses
+static void test_long_lines(void) {
+    static char in[4 * COMBO_MAX_LINE];
+    size_t len = (size_t)snprintf(in, sizeof(in), "a:1\n");
+    memset(in + len, 'x', COMBO_MAX_LINE + 10);
+    in[len + 5] = ':';
+    len += COMBO_MAX_LINE + 10;
+    len += (size_t)snprintf(in + len, sizeof(in) - len, "\nb:2\n");
+    memset(in + len, 'y', COMBO_MAX_LINE + 10);
+    in[len + 1] = ':';
+    len += COMBO_MAX_LINE + 10;
+    len += (size_t)snprintf(in + len, sizeof(in) - len, "\nc:3");
+    check_all_steps(in, "[a|1|][b|2|][c|3|]");
+}
+
+int main(void) {
+    test_formats();
+    test_edges();
+    test_chunk_carry();
+    test_long_lines();
+    return check_done("combo");
+}
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../config.h"
+#include "check.h"
+
+static char dir[256], path[300];
+
+static void write_config(const char *text) {
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (!f) return;
+    fputs(text, f);
+    fclose(f);
+}
+
+// The watcher must not take the service's reference data for intake, however
+// the directories are spelled
+static void test_watch_dir(void) {
+    static const char *const refused[] = {
+        "intake = watch\nwatch_dir = resources\n",
+        "intake = both\nwatch_dir = ./resources/\n",
+        "intake = watch\nwatch_dir = .\n",
+        "intake = watch\nwatch_dir = extracted/..\n",
+        "intake = watch\nwatch_dir = extracted\nwatchlist_dir = extracted//lists\n",
+        "intake = watch\nwatch_dir = /\n",
+    };
+    for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+        write_config(refused[i]);
+        int rc = config_init();
+        if (rc != -1) fprintf(stderr, "accepted: %s", refused[i]);
+        CHECK(rc == -1);
+    }
+    write_config("intake = amqp\nwatch_dir = resources\n");  // Not watched
+    CHECK(config_init() == 0);
+    write_config("intake = watch\nwatch_dir = resources/../extracted/inbox\nwatchlist_dir = resources-old\n");
+    CHECK(config_init() == 0);
+    Config *cfg = config_acquire();
+    CHECK_STR(cfg->watch_dir, "resources/../extracted/inbox");
+    config_release(cfg);
+}
+
+// Each replica's queue under hash_exchange is named by replica_id, which has
+// no fallback
+static void test_replica_id(void) {
+    write_config("hash_exchange = file_hash\n");
+    CHECK(config_init() == -1);
+    setenv("FILEHANDLER_REPLICA_ID", "replica-1", 1);
+    CHECK(config_init() == 0);
+    Config *cfg = config_acquire();
+    CHECK_STR(cfg->replica_id, "replica-1");
+    config_release(cfg);
+    unsetenv("FILEHANDLER_REPLICA_ID");
+}
+
+// A reload keeps the frozen settings, derives from them and is validated as
+// it will run: a file that is only valid with a new consumer_channels is
+// rejected while the running one stays
+static void test_reload(void) {
+    write_config("consumer_channels = 1\nworkers = 10\nqueue_depth = 10\n");
+    CHECK(config_init() == 0);
+    Config *cfg = config_acquire();
+    CHECK(cfg->consumer_channels == 1 && cfg->channel_prefetch == 20);
+    config_release(cfg);
+
+    write_config("consumer_channels = 8\nworkers = 20\nqueue_depth = 10\n");
+    CHECK(config_reload() == 0);
+    cfg = config_acquire();
+    CHECK(cfg->consumer_channels == 1 && cfg->workers == 20 && cfg->channel_prefetch == 30);
+    config_release(cfg);
+
+    write_config("consumer_channels = 8\nworkers = 10\nchannel_prefetch = 2\n");
+    CHECK(config_reload() == -1);
+    cfg = config_acquire();
+    CHECK(cfg->workers == 20 && cfg->channel_prefetch == 30);
+    config_release(cfg);
+
+    write_config("consumer_channels = 1\nworkers = 10\nsort_records = 1\n");
+    CHECK(config_reload() == 0);
+    cfg = config_acquire();
+    CHECK(cfg->channel_prefetch == 20 && cfg->sqlite_staging == 0);
+    config_release(cfg);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/filehandler.conf", dir);
+    setenv("FILEHANDLER_CONFIG", path, 1);
+    test_watch_dir();
+    test_replica_id();
+    test_reload();
+    check_rmdir(dir);
+    return check_done("config");
+}
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "../csv.h"
+#include "check.h"
+
+// Records of one parse as [identity|secret|url] runs
+static char out[1 << 16];
+static size_t used;
+
+static void collect(void *ctx, const CredentialRecord *rec) {
+    (void)ctx;
+    used += (size_t)snprintf(out + used, sizeof(out) - used, "[%.*s|%.*s|%.*s]", (int)rec->identity_len, rec->identity,
+                             (int)rec->secret_len, rec->secret, (int)rec->url_len, rec->url);
+}
+
+// Parses in pieces of step bytes, so every field and quote state crosses a
+// piece boundary at some step
+static const char *parse(const char *in, size_t step) {
+    static CsvParser cp;
+    used = 0;
+    out[0] = '\0';
+    csv_begin(&cp, "test.csv", "email,username", "password,pass", "url", collect, NULL);
+    size_t len = strlen(in);
+    for (size_t i = 0; i < len; i += step) csv_feed(&cp, in + i, len - i < step ? len - i : step);
+    csv_end(&cp);
+    return out;
+}
+
+static const size_t steps[] = {1, 3, 7, 63, 64, 65, 1 << 20};
+#define STEPS (sizeof(steps) / sizeof(steps[0]))
+
+static void check_all_steps(const char *in, const char *want) {
+    for (size_t i = 0; i < STEPS; i++) {
+        const char *got = parse(in, steps[i]);
+        if (strcmp(got, want) != 0) fprintf(stderr, "step %zu:\n", steps[i]);
+        CHECK_STR(got, want);
+    }
+}
+
+static void test_projection(void) {
+    // Column order does not matter; the first listed name wins within a row
+    check_all_steps("id,username,url,password,email\n"
+                    "1,bob,https://a.com/login,hunter2,Bob@Example.com\n"
+                    "2,carol,,pw,\n"
+                    "3,,,,dave@x.com\n",
+                    "[bob@example.com|hunter2|https://a.com/login][carol|pw|]");
+}
+
+static void test_quoting(void) {
+    check_all_steps("id,email,name,password,x\n"
+                    "5,e@f.com,,pw\"5,\n"
+                    "6,g@h.com,,\"a,\"\"b\",\n"
+                    "7,i@j.com,a\"b\"\"c,p\"\"q,\n"
+                    "8,k@l.com,,\"multi\nline\",\n"
+                    "9,m@n.com,,12\" tall,z\n",
+                    "[e@f.com|pw\"5|][g@h.com|a,\"b|][i@j.com|p\"\"q|][k@l.com|multi\nline|][m@n.com|12\" tall|]");
+}
+
+static void test_delimiters(void) {
+    check_all_steps("email\tpassword\nx@y.com\ta,b\n", "[x@y.com|a,b|]");
+    check_all_steps("email;password\nx@y.com;s3cret\n", "[x@y.com|s3cret|]");
+    check_all_steps("\xef\xbb\xbf" "email|password\nx@y.com|s3cret\n", "[x@y.com|s3cret|]");
+}
+
+static void test_edges(void) {
+    // CRLF line ends, no trailing newline, blank lines and SQL NULLs
+    check_all_steps("email,password\r\na@b.com,one\r\n\r\nc@d.com,NULL\r\ne@f.com,\"NULL\"\r\ng@h.com,last",
+                    "[a@b.com|one|][e@f.com|NULL|][g@h.com|last|]");
+    // No secret column: nothing is projected
+    check_all_steps("email,name\na@b.com,x\n", "");
+    // Values longer than CSV_MAX_FIELD are dropped, not cut
+    char in[1024], want[64];
+    int n = snprintf(in, sizeof(in), "email,password\na@b.com,");
+    memset(in + n, 'x', CSV_MAX_FIELD + 1);
+    snprintf(in + n + CSV_MAX_FIELD + 1, sizeof(in) - n - CSV_MAX_FIELD - 1, "\nc@d.com,ok\n");
+    snprintf(want, sizeof(want), "[c@d.com|ok|]");
+    check_all_steps(in, want);
+
+    // A header line of CSV_MAX_HEADER bytes is mapped; a longer one leaves the
+    // entry unmapped rather than mapping its first columns
+    static char head[CSV_MAX_HEADER + 64];
+    n = snprintf(head, sizeof(head), "email,password,");
+    memset(head + n, 'x', CSV_MAX_HEADER - (size_t)n);
+    snprintf(head + CSV_MAX_HEADER, sizeof(head) - CSV_MAX_HEADER, "\na@b.com,pw,x\n");
+    check_all_steps(head, "[a@b.com|pw|]");
+    n = snprintf(head, sizeof(head), "email,password,");
+    memset(head + n, 'x', CSV_MAX_HEADER + 1 - (size_t)n);
+    snprintf(head + CSV_MAX_HEADER + 1, sizeof(head) - CSV_MAX_HEADER - 1, "\na@b.com,pw,x\n");
+    check_all_steps(head, "");
+}
+
+static void test_sniff(void) {
+    CHECK(csv_sniff("dump/users.CSV"));
+    CHECK(csv_sniff("a.tsv"));
+    CHECK(!csv_sniff(".csv"));
+    CHECK(!csv_sniff("users.csv.gz"));
+    CHECK(!csv_sniff(NULL));
+}
+
+int main(void) {
+    test_projection();
+    test_quoting();
+    test_delimiters();
+    test_edges();
+    test_sniff();
+    return check_done("csv");
+}
@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../dedup.h"
+#include "../filehandler.h"
+#include "check.h"
+
+#define SHARED 450000  // Per replica; two of them push the store past DEDUP_MAX_LOAD_PCT
+
+static char dir[256], path[300];
+
+// The service's mkdir_p lives in main.c; the store directory is one level deep
+int mkdir_p(const char *p, mode_t mode) {
+    return mkdir(p, mode) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Fingerprints of a numbered set; commit adds the new ones to the store.
+// Returns how many were new.
+static long add_set(unsigned set, long count, int commit) {
+    DedupBatch *b = dedup_batch_open();
+    CHECK(b != NULL);
+    if (!b) return -1;
+    long fresh = 0;
+    for (long i = 0; i < count; i++) {
+        uint64_t key = (uint64_t)set << 32 | (uint64_t)i, fp[2] = {mix(key), mix(~key)};
+        fresh += dedup_batch_add(b, fp);
+    }
+    if (commit) CHECK(dedup_batch_commit(b) == 0);
+    else dedup_batch_free(b);
+    return fresh;
+}
+
+// A replica: its own process opening the store the others have open
+static pid_t replica(unsigned set) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    CHECK(dedup_open(path, 1 << 20) == 0);
+    CHECK(add_set(0, 1000, 0) == 0);
+    CHECK(add_set(set, SHARED, 1) == SHARED);
+    _exit(check_failures ? 1 : 0);
+}
+
+static int replica_ok(pid_t pid) {
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/dedup/credentials.tbl", dir);
+    CHECK(dedup_open(path, 1 << 20) == 0);
+    CHECK(add_set(0, 1000, 1) == 1000);
+    CHECK(add_set(0, 1000, 0) == 0);
+
+    // Two replicas commit at once, and one of them grows the table under this process
+    pid_t a = replica(1), b = replica(2);
+    CHECK(replica_ok(a));
+    CHECK(replica_ok(b));
+    CHECK(add_set(1, SHARED, 0) == 0);
+    CHECK(add_set(2, SHARED, 0) == 0);
+    CHECK(add_set(0, 1000, 0) == 0);
+
+    // Commits to the grown table reach a replica started after them
+    CHECK(add_set(3, 1000, 1) == 1000);
+    pid_t pid = fork();
+    if (pid == 0) {
+        CHECK(dedup_open(path, 1 << 20) == 0);
+        CHECK(add_set(3, 1000, 0) == 0);
+        CHECK(add_set(4, 1000, 0) == 1000);
+        _exit(check_failures ? 1 : 0);
+    }
+    CHECK(replica_ok(pid));
+    check_rmdir(dir);
+    return check_done("dedup");
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../domindex.h"
+#include "check.h"
+
+static char dir[256];
+
+// Hits of every segment in dir as sorted "[dump/entry@offset]" runs; a merge
+// renumbers dumps, so posting order is not part of the result
+static char hit_names[64][300];
+static int hit_count;
+
+static void collect_hit(void *ctx, const DomainHit *hit) {
+    (void)ctx;
+    if (hit_count == 64) return;
+    snprintf(hit_names[hit_count++], sizeof(hit_names[0]), "[%.*s/%.*s@%llu]", (int)hit->dump_len, hit->dump,
+             (int)hit->entry_len, hit->entry, (unsigned long long)hit->offset);
+}
+
+static int segment_names(char names[][64], int max) {
+    DIR *d = opendir(dir);
+    int n = 0;
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len > 4 && len < 64 && strcmp(e->d_name + len - 4, ".dix") == 0 && n < max) strcpy(names[n++], e->d_name);
+    }
+    if (d) closedir(d);
+    return n;
+}
+
+static const char *query(const char *domain) {
+    static char hits[64 * 300];
+    char names[64][64];
+    int n = segment_names(names, 64);
+    hit_count = 0;
+    for (int i = 0; i < n; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%.63s", dir, names[i]);
+        DomainSegment *seg = domseg_open(path);
+        CHECK(seg != NULL);
+        if (!seg) continue;
+        CHECK(domseg_query(seg, domain, collect_hit, NULL) >= 0);
+        domseg_close(seg);
+    }
+    qsort(hit_names, (size_t)hit_count, sizeof(hit_names[0]), (int (*)(const void *, const void *))strcmp);
+    hits[0] = '\0';
+    for (int i = 0; i < hit_count; i++) strcat(hits, hit_names[i]);
+    return hits;
+}
+
+// One input with one entry per text, each scanned in blocks of step bytes
+static void collect(const char *dump, const char *const *entries, const char *const *texts, int n, size_t step) {
+    DomainCollector *c = domindex_collect_open(dump);
+    CHECK(c != NULL);
+    if (!c) return;
+    for (int i = 0; i < n; i++) {
+        domindex_collect_entry(c, entries[i]);
+        size_t len = strlen(texts[i]);
+        for (size_t o = 0; o < len; o += step) domindex_collect_scan(c, texts[i] + o, len - o < step ? len - o : step);
+    }
+    CHECK(domindex_collect_close(c, dir) == 0);
+}
+
+static void test_registrable(void) {
+    char out[DOMAIN_MAX_LEN + 1];
+    CHECK(domain_registrable("WWW.Example.COM", 15, out) == 11 && memcmp(out, "example.com", 11) == 0);
+    CHECK(domain_registrable("mail.corp.co.uk", 15, out) == 10 && memcmp(out, "corp.co.uk", 10) == 0);
+    CHECK(domain_registrable("example.com.", 12, out) == 11);
+    CHECK(domain_registrable("localhost", 9, out) == 0);
+    CHECK(domain_registrable("1.2.3.4", 7, out) == 0);
+    CHECK(domain_registrable("-bad.com", 8, out) == 0);
+}
+
+static const char *const entries[] = {"a/users.txt", "b/urls.txt"};
+static const char *const texts[] = {"bob@Corp.com:pw\nalice@other.org:x\ncarol@mail.corp.com:y\n",
+                                    "visit https://shop.corp.com/login and http://other.org\n"};
+
+static void test_round_trip(void) {
+    static const size_t steps[] = {1, 7, 4096};
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        // The same dump each time: a retry replaces the segment instead of adding one
+        collect("dump.zip", entries, texts, 2, steps[i]);
+        CHECK_STR(query("corp.com"), "[dump.zip/a/users.txt@4][dump.zip/b/urls.txt@14]");
+        CHECK_STR(query("www.other.org"), "[dump.zip/a/users.txt@22][dump.zip/b/urls.txt@45]");
+        CHECK_STR(query("absent.net"), "");
+        char names[64][64];
+        CHECK(segment_names(names, 64) == 1);
+    }
+    // Nothing found: no segment is written
+    static const char *const none[] = {"no domains here"};
+    collect("empty.zip", entries, none, 1, 64);
+    char names[64][64];
+    CHECK(segment_names(names, 64) == 1);
+}
+
+static void test_merge(void) {
+    static const char *const one[] = {"user@corp.com:pw\n"};
+    collect("second.zip", entries, one, 1, 64);
+    collect("third.zip", entries, one, 1, 64);
+    CHECK(domindex_merge(dir, 2) >= 1);
+    char names[64][64];
+    int n = segment_names(names, 64);
+    CHECK(n < 3);
+    CHECK_STR(query("corp.com"), "[dump.zip/a/users.txt@4][dump.zip/b/urls.txt@14][second.zip/a/users.txt@5]"
+                                 "[third.zip/a/users.txt@5]");
+
+    // A retry after its segment was merged: the newest write of the dump wins
+    // once the two are merged together
+    static const char *const retried[] = {"x\nuser@corp.com:new\n"};
+    collect("second.zip", entries, retried, 1, 64);
+    while (domindex_merge(dir, 2) > 0) {
+    }
+    CHECK(segment_names(names, 64) == 1);
+    CHECK_STR(query("corp.com"), "[dump.zip/a/users.txt@4][dump.zip/b/urls.txt@14][second.zip/a/users.txt@7]"
+                                 "[third.zip/a/users.txt@5]");
+    CHECK_STR(query("other.org"), "[dump.zip/a/users.txt@22][dump.zip/b/urls.txt@45]");
+}
+
+static void test_corrupt(void) {
+    char names[64][64], path[512];
+    CHECK(segment_names(names, 64) == 1);
+    snprintf(path, sizeof(path), "%s/%.63s", dir, names[0]);
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    CHECK(truncate(path, st.st_size / 2) == 0);
+    DomainSegment *seg = domseg_open(path);
+    CHECK(seg == NULL || domseg_query(seg, "corp.com", collect_hit, NULL) == -1);
+    domseg_close(seg);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_registrable();
+    test_round_trip();
+    test_merge();
+    test_corrupt();
+    check_rmdir(dir);
+    return check_done("domindex");
+}
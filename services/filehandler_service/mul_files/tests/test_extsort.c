@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../extsort.h"
+#include "../record.h"
+#include "check.h"
+
+static char dir[256];
+
+// Credential i is u<i>:p<i>; the source differs per input so only the fingerprint collapses them
+static void add_credential(RecordWriter *w, const char *source, unsigned i) {
+    char identity[16], secret[16];
+    CredentialRecord rec = {source, strlen(source), identity, (size_t)snprintf(identity, sizeof(identity), "u%u", i),
+                            secret, (size_t)snprintf(secret, sizeof(secret), "p%u", i), "", 0};
+    CHECK(record_writer_add(w, &rec) == 0);
+}
+
+static char *path_in(char *out, size_t size, const char *name) {
+    snprintf(out, size, "%s/%s", dir, name);
+    return out;
+}
+
+// Reads a sorted .rec file: every record must be u<i>:p<i> with i < n, in
+// strictly increasing fingerprint order; seen counts each i
+static uint64_t read_sorted(const char *path, unsigned n, uint8_t *seen) {
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    if (!f) return 0;
+    char magic[6];
+    CHECK(fread(magic, 1, 6, f) == 6 && memcmp(magic, RECORD_FILE_MAGIC, 6) == 0);
+
+    uint64_t count = 0, last[2] = {0, 0};
+    uint8_t lens[8];
+    char field[4][64];
+    while (fread(lens, 1, 8, f) == 8) {
+        size_t len[4];
+        for (int k = 0; k < 4; k++) {
+            len[k] = (size_t)(lens[2 * k] | lens[2 * k + 1] << 8);
+            CHECK(len[k] < sizeof(field[k]));
+            if (len[k] >= sizeof(field[k]) || fread(field[k], 1, len[k], f) != len[k]) goto done;
+            field[k][len[k]] = '\0';
+        }
+        CredentialRecord rec = {field[0], len[0], field[1], len[1], field[2], len[2], field[3], len[3]};
+        uint64_t fp[2];
+        record_fingerprint(&rec, fp);
+        CHECK(count == 0 || fp[0] > last[0] || (fp[0] == last[0] && fp[1] > last[1]));
+        last[0] = fp[0];
+        last[1] = fp[1];
+
+        unsigned i = (unsigned)atoi(field[1] + 1);
+        CHECK(field[1][0] == 'u' && i < n && field[2][0] == 'p' && (unsigned)atoi(field[2] + 1) == i);
+        if (i < n && seen[i] < 255) seen[i]++;
+        count++;
+    }
+done:
+    fclose(f);
+    return count;
+}
+
+// More runs than one merge takes, so an intermediate pass runs; each
+// credential sits in both inputs, in opposite orders, so its copies land in
+// different runs and only the merge can collapse them
+static void test_merge_passes(void) {
+    const unsigned n = 600000;
+    char a[512], b[512], out[512];
+    RecordWriter *wa = record_writer_open(path_in(a, sizeof(a), "a.rec"));
+    RecordWriter *wb = record_writer_open(path_in(b, sizeof(b), "b.rec"));
+    CHECK(wa && wb);
+    if (!wa || !wb) return;
+    for (unsigned i = 0; i < n; i++) {
+        add_credential(wa, "a", i);
+        add_credential(wb, "b", n - 1 - i);
+    }
+    add_credential(wa, "a", 7);  // A duplicate within one run too
+    CHECK(record_writer_close(wa) == 0);
+    CHECK(record_writer_close(wb) == 0);
+
+    // Many workers keep every job at its minimum size, so runs stay small
+    SortOptions opt = {EXTSORT_MIN_MEMORY, 32, dir};
+    SortStats stats;
+    const char *inputs[] = {a, b};
+    CHECK(extsort_records(inputs, 2, path_in(out, sizeof(out), "out.rec"), &opt, &stats) == 0);
+    CHECK(stats.records_in == 2ULL * n + 1);
+    CHECK(stats.records_out == n);
+    CHECK(stats.runs > 30);
+    CHECK(stats.merge_passes >= 2);
+
+    uint8_t *seen = calloc(n, 1);
+    CHECK(read_sorted(out, n, seen) == n);
+    unsigned once = 0;
+    for (unsigned i = 0; i < n; i++) once += seen[i] == 1;
+    CHECK(once == n);
+    free(seen);
+}
+
+// Sorting a file onto itself, an empty input, and a truncated last record
+static void test_small(void) {
+    char a[512], empty[512];
+    RecordWriter *w = record_writer_open(path_in(a, sizeof(a), "small.rec"));
+    CHECK(w != NULL);
+    if (!w) return;
+    for (unsigned i = 0; i < 100; i++) add_credential(w, "s", (i * 37) % 50);
+    CHECK(record_writer_close(w) == 0);
+    FILE *f = fopen(a, "ab");
+    fwrite("\x05\x00\x01\x00", 1, 4, f);  // Half a length header
+    fclose(f);
+    RecordWriter *e = record_writer_open(path_in(empty, sizeof(empty), "empty.rec"));
+    CHECK(e && record_writer_close(e) == 0);
+
+    SortOptions opt = {EXTSORT_MIN_MEMORY, 2, dir};
+    SortStats stats;
+    const char *inputs[] = {empty, a};
+    CHECK(extsort_records(inputs, 2, a, &opt, &stats) == 0);
+    CHECK(stats.records_in == 100 && stats.records_out == 50 && stats.runs == 1 && stats.merge_passes == 1);
+    uint8_t seen[50] = {0};
+    CHECK(read_sorted(a, 50, seen) == 50);
+    for (int i = 0; i < 50; i++) CHECK(seen[i] == 1);
+
+    const char *none[] = {empty};
+    CHECK(extsort_records(none, 1, a, &opt, &stats) == 0);
+    CHECK(stats.records_in == 0 && stats.records_out == 0 && stats.runs == 0);
+    CHECK(read_sorted(a, 50, seen) == 0);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_merge_passes();
+    test_small();
+    check_rmdir(dir);
+    return check_done("extsort");
+}
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../idindex.h"
+#include "check.h"
+
+#define FILES 10
+#define FACTOR 4
+
+static char dir[256];
+
+static int index_files(void) {
+    DIR *d = opendir(dir);
+    int n = 0;
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len > 4 && strcmp(e->d_name + len - 4, ".idx") == 0) n++;
+    }
+    if (d) closedir(d);
+    return n;
+}
+
+// The identity every file holds
+static int probe_found(void) {
+    uint64_t key;
+    uint8_t found = 0;
+    CHECK(idindex_key("probe", 5, &key));
+    IdIndexSet *set = idindex_acquire();
+    idindex_probe(set, &key, &found, 1);
+    if (set) idindex_release(set);
+    return found;
+}
+
+// File i holds identities user<i>_<k>@corp.com for k < 1000 * (i + 1), plus
+// the shared "probe"
+static void write_file(int i) {
+    static uint64_t keys[FILES * 1000 + 1];
+    size_t n = 0;
+    for (int k = 0; k < 1000 * (i + 1); k++) {
+        char identity[64];
+        int len = snprintf(identity, sizeof(identity), "User%d_%d@Corp.com", i, k);
+        CHECK(idindex_key(identity, (size_t)len, &keys[n++]));
+    }
+    CHECK(idindex_key(" probe ", 7, &keys[n++]));
+    char path[512];
+    snprintf(path, sizeof(path), "%s/dump%d.zip.0000000%d.idx", dir, i, i);
+    CHECK(idindex_write(path, keys, n) == 0);
+    CHECK(idindex_publish(path) == 0);
+}
+
+// Every identity written so far is found and a few that were not are not
+static void check_probes(int files) {
+    static uint64_t keys[FILES * 1000 + 2];
+    static uint8_t found[FILES * 1000 + 2];
+    for (int i = 0; i < files; i++) {
+        size_t n = 0;
+        for (int k = 0; k < 1000 * (i + 1); k++) {
+            char identity[64];
+            int len = snprintf(identity, sizeof(identity), "user%d_%d@corp.com", i, k);
+            idindex_key(identity, (size_t)len, &keys[n++]);
+        }
+        idindex_key("user0_999999@corp.com", 21, &keys[n++]);
+        IdIndexSet *set = idindex_acquire();
+        CHECK(set != NULL);
+        idindex_probe(set, keys, found, n);
+        if (set) idindex_release(set);
+        size_t hits = 0;
+        for (size_t k = 0; k + 1 < n; k++) hits += found[k];
+        CHECK(hits == n - 1 && found[n - 1] == 0);
+    }
+}
+
+static void test_merge(void) {
+    for (int i = 0; i < FILES; i++) write_file(i);
+    CHECK(index_files() == FILES);
+    CHECK(probe_found());
+    check_probes(FILES);
+
+    // Ten files: the four smallest, then the merged one and the three next
+    CHECK(idindex_merge(dir, FACTOR) == 3);
+    CHECK(index_files() == FILES - 3 * (FACTOR - 1));
+    check_probes(FILES);
+    CHECK(idindex_merge(dir, FACTOR) == 0);
+
+    // A reload sees only the files left on disk, and a new merge numbers on
+    CHECK(idindex_load(dir) == 0);
+    check_probes(FILES);
+    CHECK(idindex_merge(dir, 2) == FILES - 3 * (FACTOR - 1) - 1);
+    CHECK(index_files() == 1);
+    check_probes(FILES);
+}
+
+// A file rewritten after it was published is neither unlinked by a merge nor
+// dropped from the set
+static void test_rewritten(void) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/dump0.zip.00000000.idx", dir);
+    write_file(0);
+    uint64_t key;
+    idindex_key("fresh@corp.com", 14, &key);
+    CHECK(idindex_write(path, &key, 1) == 0);  // Rewritten, not published yet
+    CHECK(idindex_merge(dir, 2) == 1);
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    if (f) fclose(f);
+    CHECK(idindex_publish(path) == 0);
+    uint8_t found;
+    IdIndexSet *set = idindex_acquire();
+    idindex_probe(set, &key, &found, 1);
+    if (set) idindex_release(set);
+    CHECK(found == 1);
+    check_probes(FILES);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_merge();
+    test_rewritten();
+    check_rmdir(dir);
+    return check_done("idindex");
+}
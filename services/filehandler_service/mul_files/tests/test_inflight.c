@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../config.h"
+#include "../filehandler.h"
+#include "../inflight.h"
+#include "../retry.h"
+#include "../watcher.h"
+#include "check.h"
+
+static char dir[256];
+
+// Deliveries settled through complete_delivery, by delivery tag
+static struct {
+    DeliveryOutcome outcome;
+    int attempts;
+    char path[512];
+} settled[64];
+static unsigned long long settled_tags;
+
+// The service's mkdir_p, enqueue_file and complete_delivery live in main.c
+int mkdir_p(const char *p, mode_t mode) {
+    return mkdir(p, mode) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+int enqueue_file(const char *file_path, amqp_channel_t channel, uint64_t delivery_tag) {
+    (void)file_path, (void)channel, (void)delivery_tag;
+    return 0;
+}
+
+void complete_delivery(amqp_channel_t channel, uint64_t delivery_tag, const char *file_path,
+                       DeliveryOutcome outcome, int attempts, long delay_ms, const char *reason) {
+    (void)channel, (void)delay_ms, (void)reason;
+    CHECK(delivery_tag < 64 && !(settled_tags & 1ull << delivery_tag));
+    if (delivery_tag >= 64) return;
+    settled_tags |= 1ull << delivery_tag;
+    settled[delivery_tag].outcome = outcome;
+    settled[delivery_tag].attempts = attempts;
+    snprintf(settled[delivery_tag].path, sizeof(settled[0].path), "%s", file_path ? file_path : "");
+}
+
+// len bytes of a fixed pattern, except middle at len / 2
+static void write_file(char *path, size_t size, const char *name, size_t len, char middle) {
+    snprintf(path, size, "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    CHECK(f != NULL);
+    if (!f) return;
+    for (size_t i = 0; i < len; i++) fputc(i == len / 2 ? middle : (int)(i * 31 % 251), f);
+    fclose(f);
+}
+
+// Frees the waiters and returns their delivery tags as a bit set, checking
+// each carries the path it was requested under
+static unsigned settle(InflightWaiter *w, const char *const *paths) {
+    unsigned tags = 0;
+    while (w) {
+        InflightWaiter *next = w->next;
+        CHECK(w->delivery_tag < 32 && w->channel == w->delivery_tag % 3);
+        if (w->delivery_tag < 32) {
+            CHECK(!(tags & 1u << w->delivery_tag));
+            CHECK_STR(w->file_path, paths[w->delivery_tag]);
+            tags |= 1u << w->delivery_tag;
+        }
+        free(w->file_path);
+        free(w);
+        w = next;
+    }
+    return tags;
+}
+
+static int marked(const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, WATCH_STATE_DIR, name);
+    return access(path, F_OK) == 0;
+}
+
+// Starts primary and attaches by content a watched copy, a delivered copy
+// (tag + 1) and a second delivery of primary itself (tag + 2), then finishes
+// primary with outcome
+static void settle_copies(const char *prefix, unsigned tag, DeliveryOutcome outcome, const Config *cfg) {
+    char primary[512], watched[512], delivered[512], name[64];
+    uint64_t key;
+    snprintf(name, sizeof(name), "%s.zip", prefix);
+    write_file(primary, sizeof(primary), name, 1000, 'x');
+    snprintf(name, sizeof(name), "%s-watched.zip", prefix);
+    write_file(watched, sizeof(watched), name, 1000, 'x');
+    snprintf(name, sizeof(name), "%s-delivered.zip", prefix);
+    write_file(delivered, sizeof(delivered), name, 1000, 'x');
+
+    CHECK(inflight_begin(primary, 0, 0) == 0);
+    CHECK(fingerprint_file(primary, &key) == 0 && inflight_bind_content(primary, key, 0, 0) == 0);
+    CHECK(inflight_begin(watched, 0, 0) == 0);
+    CHECK(inflight_bind_content(watched, key, 0, 0) == 1);
+    CHECK(inflight_begin(delivered, 1, tag + 1) == 0);
+    CHECK(inflight_bind_content(delivered, key, 1, tag + 1) == 1);
+    CHECK(inflight_begin(primary, 2, tag + 2) == 1);
+
+    FileTask task = {primary, 0, 0, 0, "boom"};
+    settle_waiters(inflight_finish(primary), &task, outcome, cfg);
+    CHECK(settled_tags == (3ull << (tag + 1)));
+    CHECK(settled[tag + 2].outcome == (outcome == OUTCOME_DEAD ? OUTCOME_DEAD : OUTCOME_ACK));
+    CHECK(settled[tag + 1].outcome == outcome);
+    if (outcome != OUTCOME_ACK) CHECK_STR(settled[tag + 1].path, delivered);
+    settled_tags = 0;
+}
+
+// A copy attached by content is settled under its own path: a watched one gets
+// its own .processed marker, or its own failure count when the task is retried,
+// so a rescan or restart does not queue it again
+static void test_settle(void) {
+    setenv("FILEHANDLER_CONFIG", "/nonexistent/filehandler.conf", 1);
+    CHECK(config_init() == 0);
+    Config *cfg = config_acquire();
+
+    settle_copies("ok", 0, OUTCOME_ACK, cfg);
+    CHECK(marked("ok-watched.zip") && !marked("ok.zip") && !marked("ok-delivered.zip"));
+
+    settle_copies("retry", 8, OUTCOME_RETRY, cfg);
+    CHECK(!marked("retry-watched.zip"));
+    CHECK(settled[9].attempts == 1);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/retry-watched.zip", dir);
+    CHECK(failure_record(path) == 2);  // Counted once, for its own retry
+    snprintf(path, sizeof(path), "%s/retry.zip", dir);
+    CHECK(failure_record(path) == 1);  // The task's own count is the worker's
+
+    snprintf(path, sizeof(path), "%s/dead-watched.zip", dir);
+    CHECK(failure_record(path) == 1);
+    settle_copies("dead", 16, OUTCOME_DEAD, cfg);
+    CHECK(marked("dead-watched.zip"));
+    CHECK(failure_record(path) == 1);  // Cleared once settled
+    config_release(cfg);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    // a and b are identical; c has their size and ends, so their content key, but differs in the middle
+    char a[512], b[512], c[512], d[512];
+    size_t size = 3 * FINGERPRINT_SAMPLE;
+    write_file(a, sizeof(a), "a.zip", size, 'x');
+    write_file(b, sizeof(b), "b.zip", size, 'x');
+    write_file(c, sizeof(c), "c.zip", size, 'y');
+    write_file(d, sizeof(d), "d.zip", size - 1, 'x');
+    uint64_t ka, kb, kc, kd;
+    CHECK(fingerprint_file(a, &ka) == 0 && fingerprint_file(b, &kb) == 0 && fingerprint_file(c, &kc) == 0);
+    CHECK(fingerprint_file(d, &kd) == 0);
+    CHECK(ka != 0 && ka == kb && ka == kc && ka != kd);
+    CHECK(fingerprint_file("/nonexistent/e.zip", &kd) == -1);
+
+    // Tag t arrives on channel t % 3 (0: a local request) for paths[t]
+    const char *const paths[] = {a, a, b, b, b, c, c};
+    CHECK(inflight_begin(a, 0, 0) == 0);
+    CHECK(inflight_begin(a, 1, 1) == 1);  // Same path: parked on a
+    CHECK(inflight_begin(b, 2, 2) == 0);
+    CHECK(inflight_begin(b, 0, 3) == 1);  // Parked on b
+    CHECK(inflight_begin(c, 2, 5) == 0);
+
+    // Whichever is fingerprinted second is attached to the first, with what was parked on it
+    CHECK(inflight_bind_content(a, ka, 0, 0) == 0);
+    CHECK(inflight_bind_content(b, kb, 2, 2) == 1);
+    CHECK(inflight_begin(b, 1, 4) == 1);  // b is an alias now: parked on a
+    // Same key but different bytes: c stays a task of its own
+    CHECK(inflight_bind_content(c, kc, 2, 5) == 0);
+    CHECK(inflight_begin(c, 0, 6) == 1);
+    CHECK(inflight_bind_content("/nonexistent/e.zip", ka, 1, 7) == 0);
+
+    // Finishing a settles everything on it, including b's, and releases b
+    CHECK(settle(inflight_finish(a), paths) == (1u << 1 | 1u << 2 | 1u << 3 | 1u << 4));
+    CHECK(inflight_begin(b, 2, 2) == 0);
+    CHECK(settle(inflight_finish(b), paths) == 0);
+    CHECK(settle(inflight_finish(c), paths) == 1u << 6);
+    CHECK(inflight_finish(c) == NULL);
+
+    // With a gone, an identical b fingerprinted later owns its work again
+    CHECK(inflight_begin(a, 0, 0) == 0);
+    CHECK(inflight_bind_content(a, ka, 0, 0) == 0);
+    CHECK(settle(inflight_finish(a), paths) == 0);
+    CHECK(inflight_begin(b, 2, 2) == 0);
+    CHECK(inflight_bind_content(b, kb, 2, 2) == 0);
+    CHECK(settle(inflight_finish(b), paths) == 0);
+
+    test_settle();
+    check_rmdir(dir);
+    return check_done("inflight");
+}
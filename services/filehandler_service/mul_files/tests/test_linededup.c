@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../linededup.h"
+#include "check.h"
+
+static char dir[256];
+
+// Writes in pieces of step bytes, so lines continue across blocks at some step
+static int feed(LineDedup *d, const char *in, size_t len, size_t step) {
+    int rc = 0;
+    for (size_t i = 0; i < len && rc == 0; i += step) rc = linededup_write(d, in + i, len - i < step ? len - i : step);
+    return rc ? rc : linededup_end(d);
+}
+
+// One entry through a fresh filter; returns what reached the file
+static char *filter(const char *in, size_t len, size_t step, size_t *out_len) {
+    LineDedup *d = linededup_open(1 << 20);
+    char *out = NULL;
+    FILE *f = open_memstream(&out, out_len);
+    CHECK(d && f);
+    linededup_begin(d, f, 1);
+    CHECK(feed(d, in, len, step) == 0);
+    fclose(f);
+    linededup_close(d);
+    return out;
+}
+
+static const size_t steps[] = {1, 2, 7, 4096, LINEDEDUP_MAX_LINE / 2 + 1, 1 << 22};
+#define STEPS (sizeof(steps) / sizeof(steps[0]))
+
+static void check_all_steps(const char *in, size_t len, const char *want, size_t want_len) {
+    for (size_t i = 0; i < STEPS; i++) {
+        size_t got_len;
+        char *got = filter(in, len, steps[i], &got_len);
+        if (got_len != want_len || memcmp(got, want, want_len) != 0) {
+            fprintf(stderr, "step %zu: %zu bytes, want %zu\n", steps[i], got_len, want_len);
+        }
+        CHECK(got_len == want_len && memcmp(got, want, want_len) == 0);
+        free(got);
+    }
+}
+
+static void check_text(const char *in, const char *want) {
+    check_all_steps(in, strlen(in), want, strlen(want));
+}
+
+static void test_lines(void) {
+    check_text("a\nb\na\nc\nb\n\n\nd\nd", "a\nb\nc\n\nd\n");
+    check_text("x\r\nx\nx\r\n", "x\r\nx\n");
+    // A NUL in the first block marks a binary entry, which is written untouched
+    static const char binary[] = "a\n\0a\na\n";
+    size_t len;
+    char *got = filter(binary, sizeof(binary) - 1, sizeof(binary), &len);
+    CHECK(len == sizeof(binary) - 1 && memcmp(got, binary, len) == 0);
+    free(got);
+}
+
+// Lines are remembered across entries unless the next entry resets the filter
+static void test_entries(void) {
+    LineDedup *d = linededup_open(1 << 20);
+    char *out = NULL;
+    size_t out_len;
+    FILE *f = open_memstream(&out, &out_len);
+    linededup_begin(d, f, 1);
+    CHECK(feed(d, "a\nb\n", 4, 3) == 0);
+    linededup_begin(d, f, 0);
+    CHECK(feed(d, "b\nc\n", 4, 3) == 0);
+    CHECK(d->lines == 2 && d->dropped == 1);
+    linededup_begin(d, f, 1);
+    CHECK(feed(d, "a\nc\n", 4, 3) == 0);
+    fclose(f);
+    CHECK_STR(out, "a\nb\nc\na\nc\n");
+    free(out);
+    linededup_close(d);
+}
+
+// A line over LINEDEDUP_MAX_LINE that reaches the filter in pieces is passed
+// through unbuffered; the lines around it are still deduplicated, whether the
+// long line ends in a newline or the entry
+static void test_long_lines(void) {
+    size_t long_len = LINEDEDUP_MAX_LINE + 100;
+    char *in = malloc(2 * long_len + 64), *want = malloc(2 * long_len + 64);
+    size_t len = 0, want_len = 0;
+    len += (size_t)sprintf(in, "x\ny\n");
+    want_len += (size_t)sprintf(want, "x\ny\n");
+    memset(in + len, 'L', long_len);
+    memset(want + want_len, 'L', long_len);
+    len += long_len;
+    want_len += long_len;
+    len += (size_t)sprintf(in + len, "\nx\nz\ny\n");
+    want_len += (size_t)sprintf(want + want_len, "\nz\n");
+    memset(in + len, 'M', long_len);
+    memset(want + want_len, 'M', long_len);
+    len += long_len;
+    want_len += long_len;
+    check_all_steps(in, len, want, want_len);
+    free(in);
+    free(want);
+}
+
+// n distinct lines, the same again in another order, and an unterminated last line
+static void write_lines(FILE *f, unsigned n, int repeat) {
+    for (unsigned i = 0; i < n; i++) fprintf(f, "line %u\n", i);
+    for (unsigned i = 0; repeat && i < n; i++) fprintf(f, "line %u\n", (i * 7919) % n);
+    fprintf(f, "last");
+}
+
+static void check_file(const char *path, const char *want, size_t want_len) {
+    char *got = malloc(want_len + 1);
+    FILE *f = fopen(path, "r");
+    CHECK(f != NULL);
+    if (!f) return;
+    size_t len = fread(got, 1, want_len + 1, f);
+    fclose(f);
+    CHECK(len == want_len && memcmp(got, want, want_len) == 0);
+    free(got);
+}
+
+// With the table capped, the second copies get through and the entry is
+// flagged; compaction with a small buffer spills many sorted runs, merges
+// them, and leaves every line once, in first-seen order
+static void test_overflow_compact(void) {
+    const unsigned n = 100000;
+    char raw[512], path[512];
+    snprintf(raw, sizeof(raw), "%s/raw.txt", dir);
+    snprintf(path, sizeof(path), "%s/out.txt", dir);
+    FILE *f = fopen(raw, "w");
+    write_lines(f, n, 1);
+    fclose(f);
+
+    LineDedup *d = linededup_open(0);
+    FILE *in = fopen(raw, "r"), *out = fopen(path, "w");
+    CHECK(d && in && out);
+    linededup_begin(d, out, 1);
+    char block[5000];
+    size_t got;
+    while ((got = fread(block, 1, sizeof(block), in)) > 0) CHECK(linededup_write(d, block, got) == 0);
+    CHECK(linededup_end(d) == 0);
+    fclose(in);
+    fclose(out);
+    CHECK(d->overflowed);
+    CHECK(d->lines == 2ULL * n + 1);
+    CHECK(d->dropped > 0 && d->dropped < n);
+    linededup_close(d);
+
+    char *want = NULL;
+    size_t want_len;
+    FILE *w = open_memstream(&want, &want_len);
+    write_lines(w, n, 0);
+    fclose(w);
+    CHECK(linededup_compact(path, 0) == 0);
+    check_file(path, want, want_len);
+
+    // A buffer that holds every line sorts once in memory, with the same result
+    CHECK(linededup_compact(raw, 64 << 20) == 0);
+    check_file(raw, want, want_len);
+    free(want);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_lines();
+    test_entries();
+    test_long_lines();
+    test_overflow_compact();
+    check_rmdir(dir);
+    return check_done("linededup");
+}
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../linktab.h"
+#include "check.h"
+
+#define ONION_V3 "abcdefghijklmnopqrstuvwxyz234567abcdefghijklmnopqrstuvwx"
+
+static char dir[256];
+
+// want is the normalized link, or "" when the token is not taken
+static void check_link(const char *token, const char *want, LinkKind want_kind) {
+    char out[LINK_MAX_LEN + 1];
+    LinkKind kind = LINK_WEB;
+    size_t len = link_normalize(token, strlen(token), out, &kind);
+    out[len] = '\0';
+    if (strcmp(out, want) != 0) fprintf(stderr, "%s\n", token);
+    CHECK_STR(out, want);
+    if (len) CHECK(kind == want_kind);
+}
+
+static void test_normalize(void) {
+    check_link("https://WWW.Example.COM:443/Path?q=1#frag", "example.com/Path?q=1", LINK_WEB);
+    check_link("http://user:pw@Shop.Example.com:8080/", "shop.example.com:8080", LINK_WEB);
+    check_link("HTTP://example.com.:80", "example.com", LINK_WEB);
+    check_link("(https://example.com/a).", "", LINK_WEB);  // Brackets are token delimiters, not trimmed here
+    check_link("https://example.com/a).", "example.com/a", LINK_WEB);
+    check_link("example.com/login", "", LINK_WEB);  // Bare web hosts are file names and emails
+    check_link("https://localhost/admin", "", LINK_WEB);
+    check_link("https://exa^mple.com/", "", LINK_WEB);
+
+    check_link("https://t.me/s/DurovChannel/123", "t.me/durovchannel", LINK_TELEGRAM);
+    check_link("telegram.me/SecGram?start=1", "t.me/secgram", LINK_TELEGRAM);
+    check_link("t.me/joinchat/AbCdEf-123", "t.me/+AbCdEf-123", LINK_TELEGRAM);
+    check_link("https://t.me/+AbCd", "t.me/+AbCd", LINK_TELEGRAM);
+    check_link("tg://resolve?domain=SecGram&post=1", "t.me/secgram", LINK_TELEGRAM);
+    check_link("t.me/share", "", LINK_TELEGRAM);
+    check_link("t.me/abc", "", LINK_TELEGRAM);
+
+    check_link("http://www.forum." ONION_V3 ".onion/board#top", ONION_V3 ".onion/board", LINK_ONION);
+    check_link("ABCDEFGHIJKLMNOP.onion", "abcdefghijklmnop.onion", LINK_ONION);
+    check_link("notanaddress.onion", "", LINK_ONION);
+    check_link("http://" ONION_V3 "1.onion", "", LINK_ONION);
+}
+
+static int by_bytes(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Scans enough links to grow the set, many sharing their first 8 bytes and
+// many seen twice in different spellings, then checks the written table
+// holds each once, in byte order, with slots matching the text
+static void test_table(void) {
+    const unsigned n = 60000;
+    size_t cap = (size_t)n * 80 + 4096, len = 0;
+    char *text = malloc(cap);
+    for (unsigned i = 0; i < n; i++) {
+        len += (size_t)snprintf(text + len, cap - len, "see https://site%u.example.com/p, ", i);
+        if (i % 3 == 0) len += (size_t)snprintf(text + len, cap - len, "\"HTTP://WWW.SITE%u.EXAMPLE.COM/p#x\"\n", i);
+    }
+    len += (size_t)snprintf(text + len, cap - len, "join t.me/SecGram or t.me/secgram, mirror %s.onion/\n", ONION_V3);
+
+    LinkSet *set = linkset_open();
+    CHECK(set != NULL);
+    if (!set) return;
+    CHECK(linkset_scan(set, text, len) == n + (n + 2) / 3 + 3);
+    CHECK(linkset_count(set, LINK_WEB) == n);
+    CHECK(linkset_count(set, LINK_TELEGRAM) == 1);
+    CHECK(linkset_count(set, LINK_ONION) == 1);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/links.tab", dir);
+    CHECK(linkset_write(set, path) == 0);
+    linkset_close(set);
+
+    const char **want = malloc((n + 2) * sizeof(char *));
+    char *names = malloc((size_t)(n + 2) * 64);
+    for (unsigned i = 0; i < n; i++) {
+        want[i] = names + (size_t)i * 64;
+        snprintf(names + (size_t)i * 64, 64, "site%u.example.com/p", i);
+    }
+    want[n] = "t.me/secgram";
+    want[n + 1] = ONION_V3 ".onion";
+    qsort(want, n + 2, sizeof(char *), by_bytes);
+
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    LinkTableHeader header;
+    CHECK(f && fread(&header, sizeof(header), 1, f) == 1);
+    CHECK(memcmp(header.magic, LINKTAB_MAGIC, 8) == 0 && header.count == n + 2);
+    LinkSlot *slots = malloc((n + 2) * sizeof(LinkSlot));
+    char *links = malloc(header.text_bytes + 1);
+    CHECK(f && fread(slots, sizeof(LinkSlot), n + 2, f) == n + 2);
+    CHECK(f && fread(links, 1, header.text_bytes + 1, f) == header.text_bytes);
+    if (f) fclose(f);
+    int bad = 0;
+    for (unsigned i = 0; i < n + 2 && !bad; i++) {
+        const LinkSlot *s = &slots[i];
+        bad = s->len != strlen(want[i]) || memcmp(links + s->offset, want[i], s->len) != 0 ||
+              links[s->offset + s->len] != '\n' ||
+              s->kind != (want[i][0] == 't' ? LINK_TELEGRAM : want[i][0] == 'a' ? LINK_ONION : LINK_WEB);
+        if (bad) fprintf(stderr, "slot %u: %.*s, want %s\n", i, (int)s->len, links + s->offset, want[i]);
+    }
+    CHECK(!bad);
+    free(slots);
+    free(links);
+    free(want);
+    free(names);
+    free(text);
+
+    // An empty set still writes a valid table
+    set = linkset_open();
+    const char *plain = "no links here, just words.txt and a@b.com\n";
+    CHECK(linkset_scan(set, plain, strlen(plain)) == 0);
+    CHECK(linkset_write(set, path) == 0);
+    linkset_close(set);
+    f = fopen(path, "rb");
+    CHECK(f && fread(&header, sizeof(header), 1, f) == 1 && header.count == 0 && header.text_bytes == 0);
+    if (f) fclose(f);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_normalize();
+    test_table();
+    check_rmdir(dir);
+    return check_done("linktab");
+}
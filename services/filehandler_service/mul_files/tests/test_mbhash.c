@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "../mbhash.h"
+#include "check.h"
+
+// Plain one-message SHA-1 and MD4 to check every lane against
+
+static uint32_t rol(uint32_t x, int n) {
+    return x << n | x >> (32 - n);
+}
+
+// Padded message in 64-byte blocks; big-endian length for SHA-1, little for MD4
+static size_t pad(const uint8_t *msg, size_t len, uint8_t *out, int big_endian) {
+    size_t total = (len + 9 + 63) / 64 * 64;
+    memcpy(out, msg, len);
+    out[len] = 0x80;
+    memset(out + len + 1, 0, total - len - 1);
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) out[total - 8 + i] = (uint8_t)(big_endian ? bits >> (56 - 8 * i) : bits >> (8 * i));
+    return total;
+}
+
+static void sha1_ref(const uint8_t *msg, size_t len, uint8_t out[20]) {
+    static uint8_t buf[2048];
+    size_t total = pad(msg, len, buf, 1);
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    for (size_t off = 0; off < total; off += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *p = buf + off + 4 * i;
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) f = (b & c) | (~b & d), k = 0x5a827999;
+            else if (i < 40) f = b ^ c ^ d, k = 0x6ed9eba1;
+            else if (i < 60) f = (b & c) | (b & d) | (c & d), k = 0x8f1bbcdc;
+            else f = b ^ c ^ d, k = 0xca62c1d6;
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d, d = c, c = rol(b, 30), b = a, a = t;
+        }
+        h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+    }
+    for (int i = 0; i < 20; i++) out[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static void md4_ref(const uint8_t *msg, size_t len, uint8_t out[16]) {
+    static uint8_t buf[2048];
+    static const int order2[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+    static const int order3[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+    static const int shift[3][4] = {{3, 7, 11, 19}, {3, 5, 9, 13}, {3, 9, 11, 15}};
+    size_t total = pad(msg, len, buf, 0);
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    for (size_t off = 0; off < total; off += 64) {
+        uint32_t x[16], v[4] = {h[0], h[1], h[2], h[3]};
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *p = buf + off + 4 * i;
+            x[i] = (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+        }
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 16; i++) {
+                // v rotates so that v[0] is always the word being updated
+                uint32_t *a = &v[(16 - i) % 4], b = v[(17 - i) % 4], c = v[(18 - i) % 4], d = v[(19 - i) % 4];
+                uint32_t f;
+                int k;
+                if (round == 0) f = (b & c) | (~b & d), k = i;
+                else if (round == 1) f = ((b & c) | (b & d) | (c & d)) + 0x5a827999, k = order2[i];
+                else f = (b ^ c ^ d) + 0x6ed9eba1, k = order3[i];
+                *a = rol(*a + f + x[k], shift[round][i % 4]);
+            }
+        }
+        for (int i = 0; i < 4; i++) h[i] += v[i];
+    }
+    for (int i = 0; i < 16; i++) out[i] = (uint8_t)(h[i / 4] >> (8 * (i % 4)));
+}
+
+static void hex(const uint8_t *digest, size_t len, char *out) {
+    for (size_t i = 0; i < len; i++) sprintf(out + 2 * i, "%02x", digest[i]);
+}
+
+static void test_vectors(void) {
+    MbMessage msgs[3] = {{(const uint8_t *)"", 0}, {(const uint8_t *)"abc", 3}, {(const uint8_t *)"password", 8}};
+    uint8_t sha1[3][20], ntlm[3][16];
+    char text[41];
+    mbhash_sha1(msgs, 3, sha1);
+    hex(sha1[0], 20, text);
+    CHECK_STR(text, "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    hex(sha1[1], 20, text);
+    CHECK_STR(text, "a9993e364706816aba3e25717850c26c9cd0d89d");
+    hex(sha1[2], 20, text);
+    CHECK_STR(text, "5baa61e4c9b93f3f0682250b6cf8331b7ee68fd8");
+    mbhash_ntlm(msgs, 3, ntlm);
+    hex(ntlm[0], 16, text);
+    CHECK_STR(text, "31d6cfe0d16ae931b73c59d7e0c089c0");
+    hex(ntlm[2], 16, text);
+    CHECK_STR(text, "8846f7eaee8fb117ad06bdd830b7586c");
+}
+
+// Every length from 0 to 300 in one batch, so lanes of one call hold
+// messages of different block counts, against the reference one at a time
+static void test_lanes(void) {
+    enum { COUNT = 301 };
+    static uint8_t data[COUNT][COUNT];
+    static MbMessage msgs[COUNT];
+    static uint8_t sha1[COUNT][20], ntlm[COUNT][16];
+    for (int i = 0; i < COUNT; i++) {
+        for (int k = 0; k < i; k++) data[i][k] = (uint8_t)(' ' + (i * 7 + k) % 95);
+        msgs[i] = (MbMessage){data[i], (size_t)i};
+    }
+    mbhash_sha1(msgs, COUNT, sha1);
+    mbhash_ntlm(msgs, COUNT, ntlm);
+    static const uint8_t zero[16];
+    for (int i = 0; i < COUNT; i++) {
+        uint8_t want[20], wide[2 * COUNT];
+        sha1_ref(data[i], (size_t)i, want);
+        if (memcmp(sha1[i], want, 20) != 0) fprintf(stderr, "SHA-1 of length %d\n", i);
+        CHECK(memcmp(sha1[i], want, 20) == 0);
+        // ASCII: UTF-16LE is each byte followed by a zero
+        for (int k = 0; k < i; k++) wide[2 * k] = data[i][k], wide[2 * k + 1] = 0;
+        md4_ref(wide, 2 * (size_t)i, want);
+        if (i > MBHASH_MAX_NTLM) CHECK(memcmp(ntlm[i], zero, 16) == 0);  // Not hashed rather than cut
+        else CHECK(memcmp(ntlm[i], want, 16) == 0);
+    }
+    CHECK(mbhash_lanes() >= 1);
+}
+
+static void test_ntlm_utf8(void) {
+    // Two- and three-byte sequences, a four-byte one that becomes a surrogate
+    // pair, and a byte that is not UTF-8, which maps to the same code point
+    static const uint8_t utf8[] = "p\xc3\xa4sswo\xcc\x88rd\xf0\x9f\x94\x91 \xe9!";
+    static const uint8_t utf16[] = {'p', 0, 0xe4, 0, 's', 0, 's', 0, 'w', 0, 'o', 0, 0x08, 0x03, 'r', 0, 'd', 0,
+                                    0x3d, 0xd8, 0x11, 0xdd, ' ', 0, 0xe9, 0, '!', 0};
+    MbMessage msg = {utf8, sizeof(utf8) - 1};
+    uint8_t got[16], want[16];
+    mbhash_ntlm(&msg, 1, &got);
+    md4_ref(utf16, sizeof(utf16), want);
+    CHECK(memcmp(got, want, 16) == 0);
+}
+
+int main(void) {
+    test_vectors();
+    test_lanes();
+    test_ntlm_utf8();
+    return check_done("mbhash");
+}
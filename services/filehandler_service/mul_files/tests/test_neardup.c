@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../filehandler.h"
+#include "../neardup.h"
+#include "check.h"
+
+static char dir[256], path[300];
+
+// The service's mkdir_p lives in main.c; the store directory is one level deep
+int mkdir_p(const char *p, mode_t mode) {
+    return mkdir(p, mode) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// Sketch of lines first..last-1, fed in pieces of step bytes; odd steps
+// reverse the lines and add CRLF and trailing blanks, which must not matter
+static NearDupSketch *sketch(unsigned first, unsigned last, size_t step) {
+    static NearDupSketch s;
+    static char text[1 << 20];
+    size_t len = 0;
+    for (unsigned i = first; i < last; i++) {
+        unsigned n = step % 2 ? last - 1 - (i - first) : i;
+        len += (size_t)snprintf(text + len, sizeof(text) - len, step % 2 ? "user%u@example.com:pass%u \r\n\n"
+                                                                           : "user%u@example.com:pass%u\n", n, n);
+    }
+    neardup_begin(&s);
+    for (size_t i = 0; i < len; i += step) neardup_feed(&s, text + i, len - i < step ? len - i : step);
+    neardup_entry_end(&s);
+    return &s;
+}
+
+static int match(unsigned first, unsigned last, int threshold, const char *input, const char *want) {
+    char name[256] = "";
+    int pct = neardup_match(sketch(first, last, 1 << 20), threshold, input, name, sizeof(name));
+    if (want) CHECK_STR(name, want);
+    return pct;
+}
+
+// Estimated similarity of lines 0..999 and first..first+999 is within a few
+// bins of the true Jaccard index, down to where LSH stops finding candidates
+static void check_estimate(unsigned first) {
+    unsigned common = 1000 - first;
+    int jaccard = (int)(common * 100 / (2000 - common));
+    int pct = match(first, first + 1000, 1, "/in/b.txt", "/in/a.txt");
+    if (abs(pct - jaccard) > 12) fprintf(stderr, "shift %u: estimated %d%%, Jaccard %d%%\n", first, pct, jaccard);
+    CHECK(abs(pct - jaccard) <= 12);
+}
+
+// A replica started before this process opened the store; it opens it once
+// the store holds this process's first signature and a partial one after it
+static pid_t replica(int *go) {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t pid = fork();
+    if (pid != 0) {
+        close(fds[0]);
+        *go = fds[1];
+        return pid;
+    }
+    close(fds[1]);
+    char c;
+    CHECK(read(fds[0], &c, 1) == 1);
+    CHECK(neardup_open(path) == 0);
+    CHECK(match(0, 1000, 90, "/in/a2.txt", "/in/a.txt") == 100);
+    CHECK(neardup_add(sketch(5000, 6000, 1 << 20), "/in/r.zip") == 0);
+    _exit(check_failures ? 1 : 0);
+}
+
+static int replica_ok(pid_t pid) {
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/neardup/signatures.bin", dir);
+    CHECK(match(0, 1000, 1, "/in/a.txt", NULL) == 0);  // No store yet
+
+    int go;
+    pid_t r = replica(&go);
+    CHECK(neardup_open(path) == 0);
+    CHECK(neardup_open(path) == 0);
+    CHECK(neardup_add(sketch(0, 1000, 1 << 20), "/in/a.txt") == 0);
+    FILE *f = fopen(path, "ab");  // Left by a writer that crashed; the replica's open drops it
+    CHECK(f && fwrite("partial", 1, 7, f) == 7);
+    if (f) fclose(f);
+    CHECK(write(go, "x", 1) == 1);
+    close(go);
+    CHECK(replica_ok(r));
+
+    // The same lines in another order, split differently, with CRLF and trailing blanks
+    CHECK(neardup_match(sketch(0, 1000, 7), 90, "/in/a2.txt", (char[256]){0}, 256) == 100);
+    CHECK(match(0, 1000, 90, "/elsewhere/a.txt", "/in/a.txt") == 100);
+    // An input never matches its own signature, stored before a restart
+    CHECK(match(0, 1000, 1, "/in/a.txt", NULL) == 0);
+    // The replica's signature is picked up at the next match
+    CHECK(match(5000, 6000, 90, "/in/r2.zip", "/in/r.zip") == 100);
+
+    for (unsigned first = 50; first <= 250; first += 50) check_estimate(first);
+    CHECK(match(1000, 2000, 1, "/in/c.txt", NULL) == 0);  // Disjoint
+    CHECK(match(250, 1250, 90, "/in/c.txt", NULL) == 0);  // Below the threshold
+
+    // Too few lines to sketch: never matched or stored
+    CHECK(match(0, NEARDUP_MIN_LINES - 1, 1, "/in/small.txt", NULL) == 0);
+    CHECK(neardup_add(sketch(0, NEARDUP_MIN_LINES - 1, 1 << 20), "/in/small.txt") == 0);
+
+    check_rmdir(dir);
+    return check_done("neardup");
+}
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../filehandler.h"
+#include "../ranges.h"
+#include "check.h"
+
+#define SECRETS 600000  // More than two full buffers, so most hashes go through the spool
+
+static char dir[256];
+
+// The service's mkdir_p lives in main.c; the range type directories are one level deep
+int mkdir_p(const char *path, mode_t mode) {
+    return mkdir(path, mode) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+static int write_task(uint64_t task, int count, int commit) {
+    RangeWriter *w = range_writer_open(dir, task);
+    if (!w) return -1;
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) {
+        char secret[32];
+        int n = snprintf(secret, sizeof(secret), "pw%llu_%d", (unsigned long long)task, i);
+        rc = range_writer_add(w, secret, (size_t)n);
+    }
+    return range_writer_close(w, commit) != 0 || rc != 0 ? -1 : 0;
+}
+
+// Hashes in every partition file of a type; each must start with the file's digits
+static long long count_hashes(RangeType t) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, RANGE_TYPE_NAME(t));
+    DIR *d = opendir(path);
+    long long total = 0;
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        unsigned partition;
+        if (strlen(e->d_name) != 7 || strcmp(e->d_name + 3, ".bin") != 0 ||
+            sscanf(e->d_name, "%3X", &partition) != 1)
+            continue;
+        char file[600];
+        snprintf(file, sizeof(file), "%s/%.16s", path, e->d_name);
+        FILE *f = fopen(file, "rb");
+        uint8_t hash[20];
+        size_t size = RANGE_HASH_BYTES(t);
+        while (f && fread(hash, 1, size, f) == size) {
+            CHECK((unsigned)(hash[0] << 4 | hash[1] >> 4) == partition);
+            total++;
+        }
+        if (f) fclose(f);
+    }
+    if (d) closedir(d);
+    return total;
+}
+
+static void test_commit(void) {
+    // A failed attempt leaves nothing behind
+    CHECK(write_task(1, SECRETS, 0) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == 0 && count_hashes(RANGE_NTLM) == 0);
+    CHECK(write_task(1, SECRETS, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == SECRETS && count_hashes(RANGE_NTLM) == SECRETS);
+    // A retry of a task that already committed adds nothing
+    CHECK(write_task(1, SECRETS, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == SECRETS && count_hashes(RANGE_NTLM) == SECRETS);
+}
+
+// A retry after an interrupted commit appends only the files it had not reached
+static void test_partial_retry(void) {
+    snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/partial");
+    CHECK(mkdir(dir, 0777) == 0);
+    CHECK(write_task(2, 1000, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == 1000 && count_hashes(RANGE_NTLM) == 1000);
+
+    // As if the commit had stopped after the SHA-1 files: no NTLM file, nor its marker line
+    char path[600], kept[65536] = "";
+    snprintf(path, sizeof(path), "%s/.tasks/%016llx", dir, 2ULL);
+    FILE *f = fopen(path, "r");
+    unsigned file;
+    size_t used = 0;
+    while (f && fscanf(f, "%u", &file) == 1) {
+        if (file < 1u << RANGE_PARTITION_BITS) used += (size_t)snprintf(kept + used, sizeof(kept) - used, "%u\n", file);
+        else CHECK(used < sizeof(kept));
+    }
+    if (f) fclose(f);
+    f = fopen(path, "w");
+    CHECK(f && fputs(kept, f) >= 0);
+    if (f) fclose(f);
+    for (unsigned p = 0; p < 1u << RANGE_PARTITION_BITS; p++) {
+        snprintf(path, sizeof(path), "%s/ntlm/%03X.bin", dir, p);
+        remove(path);
+    }
+
+    CHECK(write_task(2, 1000, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == 1000 && count_hashes(RANGE_NTLM) == 1000);
+}
+
+// Known hashes land in the file of their first three hex digits; stored
+// hashes are skipped, and passwords too long for NTLM get only a SHA-1
+static void test_values(void) {
+    snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/values");
+    CHECK(mkdir(dir, 0777) == 0);
+    RangeWriter *w = range_writer_open(dir, 3);
+    CHECK(w != NULL);
+    if (!w) return;
+    static char long_secret[300];
+    memset(long_secret, 'x', sizeof(long_secret));
+    CHECK(range_writer_add(w, "password", 8) == 0);
+    CHECK(range_writer_add(w, "5baa61e4c9b93f3f0682250b6cf8331b7ee68fd8", 40) == 0);
+    CHECK(range_writer_add(w, "$2y$10$abcdefghijklmnopqrstuv", 27) == 0);
+    CHECK(range_writer_add(w, long_secret, sizeof(long_secret)) == 0);
+    CHECK(range_writer_close(w, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == 2 && count_hashes(RANGE_NTLM) == 1);
+
+    char path[600];
+    uint8_t hash[20];
+    snprintf(path, sizeof(path), "%s/sha1/5BA.bin", dir);
+    FILE *f = fopen(path, "rb");
+    CHECK(f && fread(hash, 1, 20, f) == 20 && memcmp(hash, "\x5b\xaa\x61\xe4", 4) == 0);
+    if (f) fclose(f);
+    snprintf(path, sizeof(path), "%s/ntlm/884.bin", dir);
+    f = fopen(path, "rb");
+    CHECK(f && fread(hash, 1, 20, f) == 16 && memcmp(hash, "\x88\x46\xf7\xea", 4) == 0);
+    if (f) fclose(f);
+}
+
+// Whether a partition file is sorted throughout and its sidecar says so
+static int partition_sorted(RangeType t, unsigned partition) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s/%03X.bin", dir, RANGE_TYPE_NAME(t), partition);
+    FILE *f = fopen(path, "rb");
+    size_t size = RANGE_HASH_BYTES(t);
+    uint8_t prev[20], hash[20];
+    long long bytes = 0;
+    int sorted = f != NULL;
+    while (f && fread(hash, 1, size, f) == size) {
+        if (bytes > 0 && memcmp(prev, hash, size) > 0) sorted = 0;
+        memcpy(prev, hash, size);
+        bytes += (long long)size;
+    }
+    if (f) fclose(f);
+    snprintf(path, sizeof(path), "%s/%s/%03X.sorted", dir, RANGE_TYPE_NAME(t), partition);
+    f = fopen(path, "r");
+    long long recorded = -1;
+    if (!f || fscanf(f, "%lld", &recorded) != 1) sorted = 0;
+    if (f) fclose(f);
+    return sorted && recorded == bytes;
+}
+
+// Compaction sorts each file's appended tail into its prefix and keeps every
+// hash; it prunes the markers of tasks long past any retry
+static void test_compact(void) {
+    snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/compact");
+    CHECK(mkdir(dir, 0777) == 0);
+    CHECK(write_task(4, 20000, 1) == 0);
+    // Below RANGE_COMPACT_MIN_BYTES only a forced compaction sorts
+    CHECK(range_compact(dir, RANGE_SHA1, 0x123, 0) == 0);
+    for (int t = 0; t < RANGE_TYPES; t++) {
+        for (unsigned p = 0; p < 1u << RANGE_PARTITION_BITS; p++) CHECK(range_compact(dir, t, p, 1) >= 0);
+    }
+    CHECK(range_compact(dir, RANGE_SHA1, 0x123, 1) == 0);
+    CHECK(partition_sorted(RANGE_SHA1, 0x123) && partition_sorted(RANGE_NTLM, 0xFFF));
+
+    // A second task appends unsorted after the sorted prefix, which a forced
+    // compaction merges
+    CHECK(write_task(5, 20000, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == 40000 && count_hashes(RANGE_NTLM) == 40000);
+    CHECK(!partition_sorted(RANGE_SHA1, 0x123));
+    CHECK(range_compact(dir, RANGE_SHA1, 0x123, 1) == 1);
+    CHECK(partition_sorted(RANGE_SHA1, 0x123));
+    CHECK(count_hashes(RANGE_SHA1) == 40000);
+
+    // A commit growing a file past the threshold compacts it unforced and
+    // prunes the old markers, not the recent ones
+    char path[600];
+    snprintf(path, sizeof(path), "%s/.tasks/%016llx", dir, 4ULL);
+    time_t aged = time(NULL) - RANGE_TASK_KEEP_SEC - 60;
+    struct timespec old[2] = {{.tv_sec = aged}, {.tv_sec = aged}};
+    CHECK(utimensat(AT_FDCWD, path, old, 0) == 0);
+    CHECK(write_task(6, 1500000, 1) == 0);
+    CHECK(count_hashes(RANGE_SHA1) == 1540000);
+    CHECK(partition_sorted(RANGE_SHA1, 0x123) && partition_sorted(RANGE_NTLM, 0x456));
+    CHECK(access(path, F_OK) != 0);
+    snprintf(path, sizeof(path), "%s/.tasks/%016llx", dir, 5ULL);
+    CHECK(access(path, F_OK) == 0);
+    CHECK(range_prune_tasks(dir, RANGE_TASK_KEEP_SEC) == 0);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_commit();
+    char root[256];
+    snprintf(root, sizeof(root), "%s", dir);
+    test_partial_retry();
+    test_values();
+    test_compact();
+    check_rmdir(root);
+    return check_done("ranges");
+}
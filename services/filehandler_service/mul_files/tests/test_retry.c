@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../filehandler.h"
+#include "../retry.h"
+#include "check.h"
+
+// Files the retry thread queued, in order, with when
+static pthread_mutex_t queued_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    char path[64];
+    long at_ms;
+} queued[64];
+static int queued_count;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// The service's mkdir_p, enqueue_file and complete_delivery live in main.c
+int mkdir_p(const char *p, mode_t mode) {
+    (void)p, (void)mode;
+    return -1;
+}
+
+void complete_delivery(amqp_channel_t channel, uint64_t delivery_tag, const char *file_path,
+                       DeliveryOutcome outcome, int attempts, long delay_ms, const char *reason) {
+    (void)channel, (void)delivery_tag, (void)file_path, (void)outcome, (void)attempts, (void)delay_ms, (void)reason;
+}
+
+int enqueue_file(const char *file_path, amqp_channel_t channel, uint64_t delivery_tag) {
+    CHECK(channel == 0 && delivery_tag == 0);
+    pthread_mutex_lock(&queued_mutex);
+    if (queued_count < 64) {
+        snprintf(queued[queued_count].path, sizeof(queued[0].path), "%s", file_path);
+        queued[queued_count++].at_ms = now_ms();
+    }
+    pthread_mutex_unlock(&queued_mutex);
+    return 0;
+}
+
+static int wait_queued(int count, long timeout_ms) {
+    for (long start = now_ms(); now_ms() - start < timeout_ms; sleep_ms(5)) {
+        pthread_mutex_lock(&queued_mutex);
+        int n = queued_count;
+        pthread_mutex_unlock(&queued_mutex);
+        if (n >= count) return 1;
+    }
+    return 0;
+}
+
+// Counts per path, across enough paths to chain in every bucket; settled
+// paths start over
+static void test_failures(void) {
+    char path[64];
+    for (int round = 1; round <= 3; round++) {
+        for (int i = 0; i < 3 * FAILURE_TABLE_BUCKETS; i++) {
+            snprintf(path, sizeof(path), "/watch/file%d.zip", i);
+            CHECK(failure_record(path) == round);
+        }
+    }
+    for (int i = 0; i < 3 * FAILURE_TABLE_BUCKETS; i += 2) {
+        snprintf(path, sizeof(path), "/watch/file%d.zip", i);
+        failure_clear(path);
+    }
+    for (int i = 0; i < 3 * FAILURE_TABLE_BUCKETS; i++) {
+        snprintf(path, sizeof(path), "/watch/file%d.zip", i);
+        CHECK(failure_record(path) == (i % 2 ? 4 : 1));
+        failure_clear(path);
+        failure_clear(path);
+    }
+    CHECK(failure_record("/watch/file0.zip") == 1);
+    failure_clear("/watch/file0.zip");
+}
+
+static void test_backoff(void) {
+    Config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.retry_base_delay_ms = 100;
+    cfg.retry_max_delay_ms = 1000;
+    static const long want[] = {100, 100, 200, 400, 800, 1000, 1000};
+    for (int attempts = 0; attempts < 7; attempts++) CHECK(retry_backoff_ms(&cfg, attempts) == want[attempts]);
+    CHECK(retry_backoff_ms(&cfg, 1000000) == 1000);
+    cfg.retry_base_delay_ms = cfg.retry_max_delay_ms = 5000;
+    CHECK(retry_backoff_ms(&cfg, 3) == 5000);
+}
+
+// Retries come back in due order, none early, whatever order they were
+// scheduled in; a retry due before the one being waited on wakes the thread
+static void test_schedule(void) {
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, retry_thread, NULL) == 0);
+    pthread_detach(thread);
+
+    static const struct {
+        const char *path;
+        long delay_ms;
+    } tasks[] = {{"/w/c", 300}, {"/w/a", 100}, {"/w/d", 0}, {"/w/b", 200}, {"/w/b2", 200}};
+    static const char *const order[] = {"/w/d", "/w/a", "/w/b", "/w/b2", "/w/c"};
+    long start = now_ms();
+    for (int i = 0; i < 5; i++) CHECK(retry_schedule(tasks[i].path, tasks[i].delay_ms) == 0);
+    CHECK(wait_queued(5, 3000));
+    for (int i = 0; i < 5; i++) {
+        CHECK_STR(queued[i].path, order[i]);
+        long due = 0;
+        for (int t = 0; t < 5; t++) {
+            if (strcmp(tasks[t].path, order[i]) == 0) due = start + tasks[t].delay_ms;
+        }
+        CHECK(queued[i].at_ms >= due);
+        CHECK(queued[i].at_ms < due + 200);
+    }
+
+    start = now_ms();
+    CHECK(retry_schedule("/w/late", 2000) == 0);
+    sleep_ms(50);
+    CHECK(retry_schedule("/w/early", 100) == 0);
+    CHECK(wait_queued(6, 1000));
+    CHECK_STR(queued[5].path, "/w/early");
+    CHECK(queued[5].at_ms - start < 400);
+}
+
+int main(void) {
+    test_failures();
+    test_backoff();
+    test_schedule();
+    return check_done("retry");
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../shards.h"
+#include "check.h"
+
+#define SHARDS 4
+#define WRITERS 6
+#define TASK_RECORDS 20000
+
+static char dir[256];
+
+static void make_record(int task, int i, CredentialRecord *rec, char *identity) {
+    int n = i % 50 == 0 ? snprintf(identity, 64, "user%d_%d", task, i)
+                        : snprintf(identity, 64, "user%d_%d@mail.d%d.com", task, i, i % 37);
+    *rec = (CredentialRecord){"src", 3, identity, (size_t)n, "pw", 2, "", 0};
+}
+
+static int write_task(int task, int count, int commit) {
+    ShardWriter *w = shard_writer_open(dir, SHARDS, 1000 + (uint64_t)task);
+    if (!w) return -1;
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) {
+        char identity[64];
+        CredentialRecord rec;
+        make_record(task, i, &rec, identity);
+        rc = shard_writer_add(w, &rec);
+    }
+    if (rc == 0) CHECK(shard_writer_count(w) == (uint64_t)count);
+    return shard_writer_close(w, commit) != 0 || rc != 0 ? -1 : 0;
+}
+
+// Records of every shard file; each must start with one magic and hold only
+// records of its own shard
+static long long count_records(void) {
+    long long total = 0;
+    for (uint32_t shard = 0; shard <= SHARDS; shard++) {
+        char path[512];
+        record_shard_path(path, sizeof(path), dir, shard, SHARDS);
+        FILE *f = fopen(path, "rb");
+        if (!f) continue;
+        static char data[64 << 20];
+        size_t len = fread(data, 1, sizeof(data), f);
+        fclose(f);
+        CHECK(len >= 6 && memcmp(data, RECORD_FILE_MAGIC, 6) == 0);
+        for (size_t pos = 6; pos < len;) {
+            uint16_t lens[4];
+            CHECK(pos + 8 <= len);
+            if (pos + 8 > len) break;
+            memcpy(lens, data + pos, 8);
+            pos += 8;
+            CredentialRecord rec = {data + pos, lens[0], data + pos + lens[0], lens[1],
+                                    data + pos + lens[0] + lens[1], lens[2], "", 0};
+            pos += (size_t)lens[0] + lens[1] + lens[2] + lens[3];
+            CHECK(pos <= len && lens[0] == 3 && memcmp(rec.source, "src", 3) == 0);
+            char domain[DOMAIN_MAX_LEN + 1];
+            size_t domain_len = record_domain(&rec, domain);
+            CHECK((domain_len ? record_shard_of(domain, domain_len, SHARDS) : SHARDS) == shard);
+            total++;
+        }
+    }
+    return total;
+}
+
+static void test_domains(void) {
+    char out[DOMAIN_MAX_LEN + 1];
+    CredentialRecord rec = {"s", 1, "Bob@Mail.Corp.co.uk", 19, "p", 1, "https://other.com/", 18};
+    CHECK(record_domain(&rec, out) == 10 && memcmp(out, "corp.co.uk", 10) == 0);
+    rec = (CredentialRecord){"s", 1, "\"a@b\"@corp.com", 14, "p", 1, "", 0};
+    CHECK(record_domain(&rec, out) == 8 && memcmp(out, "corp.com", 8) == 0);
+    // Without an email, the URL's host: userinfo, port and path are no part of it
+    rec = (CredentialRecord){"s", 1, "bob", 3, "p", 1, "https://u:p@www.shop.com:8443/login?x", 37};
+    CHECK(record_domain(&rec, out) == 8 && memcmp(out, "shop.com", 8) == 0);
+    rec = (CredentialRecord){"s", 1, "bob", 3, "p", 1, "login.site.org/path", 19};
+    CHECK(record_domain(&rec, out) == 8 && memcmp(out, "site.org", 8) == 0);
+    rec = (CredentialRecord){"s", 1, "bob", 3, "p", 1, "", 0};
+    CHECK(record_domain(&rec, out) == 0);
+
+    CHECK(record_shard_of("corp.com", 8, 64) == record_shard_of("corp.com", 8, 64));
+    CHECK(record_shard_of("corp.com", 8, 64) < 64);
+    char path[64];
+    record_shard_path(path, sizeof(path), "d", 3, 64);
+    CHECK_STR(path, "d/00003-of-00064.rec");
+    record_shard_path(path, sizeof(path), "d", 64, 64);
+    CHECK_STR(path, "d/nodomain.rec");
+}
+
+static void test_concurrent_writers(void) {
+    // Separate processes, as replicas sharing the directory, all creating the
+    // shard files at once
+    for (int task = 0; task < WRITERS; task++) {
+        pid_t pid = fork();
+        if (pid == 0) _exit(write_task(task, TASK_RECORDS, 1) == 0 ? 0 : 1);
+        CHECK(pid > 0);
+    }
+    int status, failed = 0;
+    while (wait(&status) > 0) failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    CHECK(!failed);
+    CHECK(count_records() == (long long)WRITERS * TASK_RECORDS);
+}
+
+static void test_retry(void) {
+    long long before = count_records();
+    // A retry of a committed task appends nothing
+    CHECK(write_task(0, TASK_RECORDS, 1) == 0);
+    CHECK(count_records() == before);
+    // A task that failed leaves the shards untouched, and its retry appends once
+    CHECK(write_task(WRITERS, TASK_RECORDS, 0) == 0);
+    CHECK(count_records() == before);
+    CHECK(write_task(WRITERS, TASK_RECORDS, 1) == 0);
+    CHECK(count_records() == before + TASK_RECORDS);
+
+    char marker[512];
+    snprintf(marker, sizeof(marker), "%s/.tasks/%016llx", dir, 1000ULL + WRITERS);
+    struct stat st;
+    CHECK(stat(marker, &st) == 0 && st.st_size > 0);
+    // A retry after only some shards were appended: the rest still follow
+    FILE *f = fopen(marker, "w");
+    if (f) {
+        fputs("0\n1\n", f);
+        fclose(f);
+    }
+    CHECK(write_task(WRITERS, TASK_RECORDS, 1) == 0);
+    long long shards_2_up = count_records() - before - TASK_RECORDS;
+    CHECK(shards_2_up > 0 && shards_2_up < TASK_RECORDS);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_domains();
+    test_concurrent_writers();
+    test_retry();
+    check_rmdir(dir);
+    return check_done("shards");
+}
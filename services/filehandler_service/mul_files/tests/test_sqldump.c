@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "../sqldump.h"
+#include "check.h"
+
+// Records of one parse as [source|identity|secret] runs
+static char out[1 << 16];
+static size_t used;
+
+static void collect(void *ctx, const CredentialRecord *rec) {
+    (void)ctx;
+    used += (size_t)snprintf(out + used, sizeof(out) - used, "[%.*s|%.*s|%.*s]", (int)rec->source_len, rec->source,
+                             (int)rec->identity_len, rec->identity, (int)rec->secret_len, rec->secret);
+}
+
+// Parses in pieces of step bytes, so every token and string crosses a piece
+// boundary at some step
+static const char *parse(const char *in, const char *tables, size_t step) {
+    static SqlParser sp;
+    used = 0;
+    out[0] = '\0';
+    sql_begin(&sp, "db.sql", "email,username", "password,passwd", tables, collect, NULL);
+    size_t len = strlen(in);
+    for (size_t i = 0; i < len; i += step) sql_feed(&sp, in + i, len - i < step ? len - i : step);
+    sql_end(&sp);
+    return out;
+}
+
+static void check_all_steps(const char *in, const char *tables, const char *want) {
+    static const size_t steps[] = {1, 2, 5, 64, 1 << 20};
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        const char *got = parse(in, tables, steps[i]);
+        if (strcmp(got, want) != 0) fprintf(stderr, "step %zu:\n", steps[i]);
+        CHECK_STR(got, want);
+    }
+}
+
+static const char mysql_dump[] =
+    "-- MySQL dump 10.13\n"
+    "/*!40101 SET NAMES utf8 */;\n"
+    "CREATE TABLE `users` (\n"
+    "  `id` int NOT NULL AUTO_INCREMENT,\n"
+    "  `username` varchar(64) DEFAULT NULL,\n"
+    "  `email` varchar(255) DEFAULT NULL,\n"
+    "  `created` datetime DEFAULT NULL,\n"
+    "  `password` varchar(255) NOT NULL,\n"
+    "  PRIMARY KEY (`id`),\n"
+    "  KEY `email` (`email`)\n"
+    ") ENGINE=InnoDB;\n"
+    "INSERT INTO `users` VALUES (1,'bob','Bob@Example.com',NOW(),'hunter2'),"
+    "(2,'carol',NULL,'2020-01-01','it\\'s;a ''pw'''),\n"
+    "(3,NULL,NULL,NULL,'orphan'),(4,'dave','',NULL,'p(a)ss,\\\\');\n"
+    "INSERT IGNORE INTO logs (msg, password) VALUES ('x@y.com','not mapped');\n";
+
+static void test_mysql(void) {
+    // The layout comes from CREATE TABLE; email outranks username
+    check_all_steps(mysql_dump, "",
+                    "[db.sql#users|bob@example.com|hunter2][db.sql#users|carol|it's;a 'pw']"
+                    "[db.sql#users|dave|p(a)ss,\\]");
+    check_all_steps(mysql_dump, "accounts", "");
+}
+
+static void test_column_list(void) {
+    check_all_steps("INSERT INTO accounts (passwd, login, email) VALUES\n"
+                    "  ('s3cret', 'ignored', 'a@b.com'),\n  ('two', 'x', \"c@d.com\");\n"
+                    "/* INSERT INTO accounts (passwd, email) VALUES ('no', 'no@no.com'); */\n"
+                    "-- INSERT INTO accounts (passwd, email) VALUES ('no', 'no@no.com');\n",
+                    "", "[db.sql#accounts|a@b.com|s3cret][db.sql#accounts|c@d.com|two]");
+}
+
+static void test_copy(void) {
+    // pg_dump: tab-separated rows up to "\.", \N for NULL, backslash escapes
+    check_all_steps("-- PostgreSQL database dump\n"
+                    "SET standard_conforming_strings = on;\n"
+                    "COPY public.users (id, email, password) FROM stdin;\n"
+                    "1\ta@b.com\tpw\\tone\n"
+                    "2\t\\N\tlost\n"
+                    "3\tc@d.com\tlast\n"
+                    "\\.\n"
+                    "INSERT INTO users (email, password) VALUES ('e@f.com', 'back\\slash');\n",
+                    "",
+                    "[db.sql#users|a@b.com|pw\tone][db.sql#users|c@d.com|last][db.sql#users|e@f.com|back\\slash]");
+    // The first column is not mapped: "\." inside it is data, and the
+    // terminator line after it still ends the block
+    check_all_steps("COPY users (id, email, password) FROM stdin;\n"
+                    "7\\.5\ta@b.com\tone\n"
+                    "8\tc@d.com\ttwo\n"
+                    "\\.\n"
+                    "INSERT INTO users (email, password) VALUES ('e@f.com', 'three');\n",
+                    "", "[db.sql#users|a@b.com|one][db.sql#users|c@d.com|two][db.sql#users|e@f.com|three]");
+    // A block cut off without its final newline keeps its last row
+    check_all_steps("COPY users (email, password) FROM stdin;\nz@z.com\tcut", "", "[db.sql#users|z@z.com|cut]");
+}
+
+static void test_sniff(void) {
+    CHECK(sql_sniff("backup.SQL", "", 0));
+    CHECK(sql_sniff("dump", "-- MySQL dump 10.13", 19));
+    CHECK(sql_sniff("dump", "\n\nINSERT INTO t VALUES (1);", 26));
+    CHECK(!sql_sniff("notes.txt", "user:pass\n", 10));
+}
+
+int main(void) {
+    test_mysql();
+    test_column_list();
+    test_copy();
+    test_sniff();
+    return check_done("sqldump");
+}
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../record.h"
+#include "../sqlload.h"
+#include "check.h"
+
+static char dir[256], rec_path[512], db_path[512];
+
+static const char *const rows[][3] = {
+    {"a@x.com", "p1", ""},
+    {"a@x.com", "p1", ""},  // Duplicate within the file, url NULL
+    {"b@shop.y.org", "p2", "http://y.org"},
+    {"b@shop.y.org", "p2", "http://y.org"},
+    {"b@shop.y.org", "p2", ""},  // Same but without the URL: another credential
+    {"carol", "p3", "https://login.z.net/"},  // Domain from the URL
+    {"dave", "p4", ""},  // No domain at all
+};
+#define ROWS (sizeof(rows) / sizeof(rows[0]))
+
+static void write_records(const char *path, size_t count) {
+    RecordWriter *w = record_writer_open(path);
+    CHECK(w != NULL);
+    if (!w) return;
+    for (size_t i = 0; i < count; i++) {
+        const char *const *r = rows[i % ROWS];
+        CredentialRecord rec = {"src", 3, r[0], strlen(r[0]), r[1], strlen(r[1]), r[2], strlen(r[2])};
+        CHECK(record_writer_add(w, &rec) == 0);
+    }
+    CHECK(record_writer_close(w) == 0);
+}
+
+static long long query_int(sqlite3 *db, const char *sql) {
+    sqlite3_stmt *st;
+    long long v = -1;
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) == SQLITE_OK && sqlite3_step(st) == SQLITE_ROW) {
+        v = sqlite3_column_int64(st, 0);
+    }
+    sqlite3_finalize(st);
+    return v;
+}
+
+static void check_database(void) {
+    sqlite3 *db;
+    CHECK(sqlite3_open(db_path, &db) == SQLITE_OK);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials") == 5);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials WHERE url IS NULL") == 3);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials WHERE domain = 'x.com'") == 1);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials WHERE domain = 'y.org'") == 2);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials WHERE domain = 'z.net' AND identity = 'carol'") == 1);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials WHERE domain IS NULL") == 1);
+    CHECK(query_int(db, "SELECT count(*) FROM credentials WHERE source <> 'src'") == 0);
+    // Deferred indexes are back after close
+    CHECK(query_int(db, "SELECT count(*) FROM sqlite_master WHERE type = 'index' AND name LIKE 'credentials_%'") == 3);
+    sqlite3_close(db);
+}
+
+static void test_load(int batch_rows, int staging, int defer_indexes) {
+    remove(db_path);
+    SqlLoadOptions opt = {batch_rows, staging, defer_indexes};
+    SqlLoader *l = sqlload_open(db_path, &opt);
+    CHECK(l != NULL);
+    if (!l) return;
+    CHECK(sqlload_file(l, rec_path) == (long long)ROWS);
+    CHECK(sqlload_file(l, rec_path) == (long long)ROWS);  // Loading it again adds nothing
+    CHECK(sqlload_close(l) == 0);
+    check_database();
+
+    // A later load into the same database still skips what is there
+    l = sqlload_open(db_path, &opt);
+    CHECK(l != NULL);
+    if (!l) return;
+    CHECK(sqlload_file(l, rec_path) == (long long)ROWS);
+    CHECK(sqlload_close(l) == 0);
+    check_database();
+}
+
+static long long index_count(void) {
+    sqlite3 *db;
+    CHECK(sqlite3_open(db_path, &db) == SQLITE_OK);
+    long long n = query_int(db, "SELECT count(*) FROM sqlite_master WHERE type = 'index' AND name LIKE 'credentials_%'");
+    sqlite3_close(db);
+    return n;
+}
+
+// Indexes are dropped for a load large next to the table, and kept for a
+// small one, whose rebuild would read the whole table
+static void test_defer_threshold(void) {
+    remove(db_path);
+    SqlLoadOptions opt = {1, 0, 1};  // Every row commits, so another connection sees the schema
+    SqlLoader *l = sqlload_open(db_path, &opt);
+    CHECK(l != NULL);
+    if (!l) return;
+    CHECK(sqlload_file(l, rec_path) == (long long)ROWS);
+    CHECK(index_count() == 1);  // Only the unique index the load needs
+    CHECK(sqlload_close(l) == 0);
+    CHECK(index_count() == 3);
+
+    sqlite3 *db;
+    CHECK(sqlite3_open(db_path, &db) == SQLITE_OK);
+    CHECK(sqlite3_exec(db,
+                       "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 1000) "
+                       "INSERT INTO credentials (fingerprint, identity, secret) SELECT i, 'u' || i, 'p' FROM n",
+                       NULL, NULL, NULL) == SQLITE_OK);
+    sqlite3_close(db);
+    l = sqlload_open(db_path, &opt);
+    CHECK(l != NULL);
+    if (!l) return;
+    CHECK(sqlload_file(l, rec_path) == (long long)ROWS);
+    CHECK(index_count() == 3);
+    CHECK(sqlload_close(l) == 0);
+    CHECK(index_count() == 3);
+}
+
+static void test_corrupt(void) {
+    char bad[600];
+    snprintf(bad, sizeof(bad), "%s/bad.rec", dir);
+    FILE *f = fopen(bad, "w");
+    fputs("not a record file", f);
+    fclose(f);
+    remove(db_path);
+    SqlLoadOptions opt = {1000, 0, 0};
+    SqlLoader *l = sqlload_open(db_path, &opt);
+    CHECK(l != NULL);
+    if (!l) return;
+    CHECK(sqlload_file(l, bad) == -1);
+    CHECK(sqlload_close(l) == -1);
+
+    // A record cut off by the end of the file, as by a crash while it was
+    // written: the records before it still load
+    write_records(bad, ROWS);
+    CHECK(truncate(bad, 6 + 20 + 10) == 0);  // Magic, the first record and part of the second
+    l = sqlload_open(db_path, &opt);
+    CHECK(l != NULL);
+    if (!l) return;
+    CHECK(sqlload_file(l, bad) == 1);
+    CHECK(sqlload_close(l) == 0);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    snprintf(rec_path, sizeof(rec_path), "%s/in.rec", dir);
+    snprintf(db_path, sizeof(db_path), "%s/data.db", dir);
+    write_records(rec_path, ROWS);
+    for (int staging = 0; staging <= 1; staging++) {
+        for (int defer = 0; defer <= 1; defer++) {
+            test_load(1, staging, defer);
+            test_load(1000, staging, defer);
+        }
+    }
+    test_defer_threshold();
+    test_corrupt();
+    check_rmdir(dir);
+    return check_done("sqlload");
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../stealer.h"
+#include "check.h"
+
+// Each sink and fallback call becomes one line; workers finish groups in any
+// order, so the lines are sorted before they are compared
+static char *lines[256];
+static int line_count;
+static pthread_mutex_t lines_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_line(char *line) {
+    pthread_mutex_lock(&lines_mutex);
+    if (line_count < 256) lines[line_count++] = line;
+    else free(line);
+    pthread_mutex_unlock(&lines_mutex);
+}
+
+static void sink(void *ctx, const StealerVictim *v, const CredentialRecord *recs, size_t count) {
+    (void)ctx;
+    char line[4096];
+    int n = snprintf(line, sizeof(line), "victim %s ip=%s computer=%s user=%s cookies=%u autofills=%u:", v->victim,
+                     v->ip, v->computer, v->user, v->cookie_files, v->autofill_files);
+    for (size_t i = 0; i < count && n < (int)sizeof(line); i++) {
+        n += snprintf(line + n, sizeof(line) - (size_t)n, " [%.*s|%.*s|%.*s|%.*s]", (int)recs[i].source_len,
+                      recs[i].source, (int)recs[i].url_len, recs[i].url, (int)recs[i].identity_len, recs[i].identity,
+                      (int)recs[i].secret_len, recs[i].secret);
+    }
+    add_line(strdup(line));
+}
+
+static void fallback(void *ctx, const CredentialRecord *rec) {
+    (void)ctx;
+    char line[1024];
+    snprintf(line, sizeof(line), "combo [%.*s|%.*s|%.*s]", (int)rec->source_len, rec->source, (int)rec->identity_len,
+             rec->identity, (int)rec->secret_len, rec->secret);
+    add_line(strdup(line));
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void feed(StealerPool *sp, const char *path, const char *data) {
+    size_t victim_len;
+    StealerKind kind = stealer_classify(path, &victim_len);
+    stealer_entry_begin(sp, path, kind, victim_len);
+    if (kind != STEALER_NONE) CHECK(stealer_entry_data(sp, data, strlen(data)) == 0);
+    stealer_entry_end(sp);
+}
+
+static void test_classify(void) {
+    size_t len;
+    CHECK(stealer_classify("US[ABC]/Passwords.txt", &len) == STEALER_PASSWORDS && len == 7);
+    CHECK(stealer_classify("logs/US[ABC]/All Passwords.txt", &len) == STEALER_PASSWORDS && len == 12);
+    CHECK(stealer_classify("US[ABC]/system.txt", &len) == STEALER_SYSTEM && len == 7);
+    CHECK(stealer_classify("US[ABC]/Browsers/Chrome/Passwords.txt", &len) == STEALER_BROWSER_PASSWORDS && len == 7);
+    CHECK(stealer_classify("US[ABC]/Cookies/Chrome_Default.txt", &len) == STEALER_COOKIES && len == 7);
+    CHECK(stealer_classify("US[ABC]/Autofills/Edge.txt", &len) == STEALER_AUTOFILL && len == 7);
+    CHECK(stealer_classify("US[ABC]/FileGrabber/Desktop/Passwords.txt", &len) == STEALER_NONE);
+    CHECK(stealer_classify("US[ABC]/Browsers/Chrome/History.txt", &len) == STEALER_NONE);
+    CHECK(stealer_classify("Passwords.txt", &len) == STEALER_PASSWORDS && len == 0);
+    CHECK(stealer_classify("readme.txt", &len) == STEALER_NONE);
+}
+
+static const char *const want[] = {
+    // Confirmed, but without URL/Username/Password blocks: the combo parser takes it
+    "combo [logs.zip/US[DEF]/Passwords.txt|x@d.com|pw4]",
+    // A password file alone is no stealer log
+    "combo [logs.zip/dump/Passwords.txt|x@y.com|pw2]",
+    "combo [logs.zip/dump/Passwords.txt|z@y.com|pw3]",
+    "victim US[ABC] ip=9.9.9.9 computer=PC user=Admin cookies=1 autofills=0: "
+    "[logs.zip/US[ABC]|https://a.com|u@a.com|pw1] [logs.zip/US[ABC]|b.com|root|p: w] "
+    "[logs.zip/US[ABC]||raccoon@c.com|pw3]",
+    "victim US[DEF] ip=1.2.3.4 computer= user= cookies=0 autofills=0:",
+    "victim US[JKL] ip= computer= user= cookies=0 autofills=0: [logs.zip/US[JKL]|j.com|j@j.com|pw7]",
+};
+
+static void run(int threads) {
+    line_count = 0;
+    StealerPool *sp = stealer_open(threads, "logs.zip", sink, fallback, NULL);
+    CHECK(sp != NULL);
+    if (!sp) return;
+    feed(sp, "US[ABC]/Passwords.txt",
+         "URL: https://a.com\r\nUsername: U@A.com\r\nPassword: pw1\r\n\r\n"
+         "Host: b.com\nLogin: root\nPass: p: w\n===============\n"
+         "USER: raccoon@c.com\nPASS: pw3\n"
+         "Password: orphan\n");
+    feed(sp, "US[ABC]/System.txt", "IP: 9.9.9.9\nComputer: PC\nUser: Admin\nIP: 1.1.1.1\n");
+    feed(sp, "US[ABC]/Cookies/Chrome.txt", "cookie");
+    feed(sp, "dump/Passwords.txt", "x@y.com:pw2\nz@y.com:pw3\n");
+    feed(sp, "US[DEF]/Passwords.txt", "x@d.com:pw4\n");
+    feed(sp, "US[DEF]/System.txt", "IP: 1.2.3.4\n");
+    feed(sp, "US[JKL]/Browsers/Chrome/Passwords.txt", "URL: j.com\nLogin: j@j.com\nPassword: pw7\n");
+    uint64_t groups = stealer_close(sp);
+    CHECK(groups == 3);
+
+    qsort(lines, (size_t)line_count, sizeof(char *), compare_lines);
+    CHECK(line_count == (int)(sizeof(want) / sizeof(want[0])));
+    for (int i = 0; i < line_count; i++) {
+        if (i < (int)(sizeof(want) / sizeof(want[0]))) CHECK_STR(lines[i], want[i]);
+        free(lines[i]);
+    }
+}
+
+static void test_oversized(void) {
+    StealerPool *sp = stealer_open(1, "logs.zip", sink, fallback, NULL);
+    CHECK(sp != NULL);
+    if (!sp) return;
+    size_t victim_len;
+    StealerKind kind = stealer_classify("US[BIG]/Passwords.txt", &victim_len);
+    stealer_entry_begin(sp, "US[BIG]/Passwords.txt", kind, victim_len);
+    char *block = calloc(1, 1 << 20);
+    int rc = 0;
+    for (int i = 0; i <= STEALER_MAX_FILE >> 20 && rc == 0; i++) rc = stealer_entry_data(sp, block, 1 << 20);
+    CHECK(rc == -1);  // Past STEALER_MAX_FILE the caller takes the entry back
+    size_t len;
+    char *data = stealer_entry_detach(sp, &len);
+    CHECK(data != NULL && len == STEALER_MAX_FILE);
+    free(data);
+    free(block);
+    stealer_entry_end(sp);
+    line_count = 0;
+    CHECK(stealer_close(sp) == 0);  // The group lost its only file
+    for (int i = 0; i < line_count; i++) free(lines[i]);
+}
+
+int main(void) {
+    test_classify();
+    run(1);
+    run(4);
+    test_oversized();
+    return check_done("stealer");
+}
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../filehandler.h"
+#include "../taskqueue.h"
+#include "check.h"
+
+// Stands in for the 30 s broker heartbeat: the queue stays full for longer
+// than this while the consumer must keep getting back to its connection
+#define HEARTBEAT_MS 1500
+#define PUMP_MS 10  // The consumer's poll interval
+
+static FileTask local[4], delivered[1024];
+static int local_pushed;
+static pthread_mutex_t pushed_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// A watcher queuing one more file than the queue holds
+static void *local_intake(void *arg) {
+    (void)arg;
+    CHECK(taskqueue_push(&local[2]) == 0);
+    pthread_mutex_lock(&pushed_mutex);
+    local_pushed = 1;
+    pthread_mutex_unlock(&pushed_mutex);
+    return NULL;
+}
+
+static int local_done(void) {
+    pthread_mutex_lock(&pushed_mutex);
+    int done = local_pushed;
+    pthread_mutex_unlock(&pushed_mutex);
+    return done;
+}
+
+static void *idle_worker(void *arg) {
+    (void)arg;
+    while (taskqueue_pop() != NULL) {
+    }
+    return NULL;
+}
+
+int main(void) {
+    for (int i = 0; i < 4; i++) local[i].channel = 0;
+    for (int i = 0; i < 1024; i++) {
+        delivered[i].channel = 1 + i % 4;
+        delivered[i].delivery_tag = i + 1;
+    }
+
+    // No workers yet: two local tasks fill the queue and a third waits
+    CHECK(taskqueue_resize(2) == 0);
+    CHECK(taskqueue_push(&local[0]) == 0);
+    CHECK(taskqueue_push(&local[1]) == 0);
+    pthread_t intake;
+    CHECK(pthread_create(&intake, NULL, local_intake, NULL) == 0);
+
+    // Deliveries keep arriving on a full queue, and a reload shrinks it meanwhile;
+    // no push may hold the consumer for anything near a heartbeat
+    long start = now_ms(), last = start, longest = 0;
+    int pushed = 0;
+    while (now_ms() - start < HEARTBEAT_MS) {
+        if (pushed < 1024) CHECK(taskqueue_push(&delivered[pushed++]) == 0);
+        if (pushed == 50) CHECK(taskqueue_resize(1) == 0);
+        sleep_ms(PUMP_MS);
+        long t = now_ms();
+        if (t - last > longest) longest = t - last;
+        last = t;
+    }
+    CHECK(longest < HEARTBEAT_MS / 4);
+    CHECK(pushed > 50);
+    CHECK(!local_done());
+
+    // Tasks come out in order; the local one is admitted once the queue drains below the limit
+    CHECK(taskqueue_pop() == &local[0]);
+    CHECK(taskqueue_pop() == &local[1]);
+    for (int i = 0; i < pushed; i++) {
+        FileTask *task = taskqueue_pop();
+        CHECK(task == &delivered[i]);
+    }
+    pthread_join(intake, NULL);
+    CHECK(local_done());
+    CHECK(taskqueue_pop() == &local[2]);
+
+    // The ring grows on its own past a raised depth
+    CHECK(taskqueue_resize(300) == 0);
+    for (int i = 0; i < 300; i++) CHECK(taskqueue_push(&delivered[i]) == 0);
+    for (int i = 0; i < 300; i++) CHECK(taskqueue_pop() == &delivered[i]);
+
+    // A shrunk pool retires its surplus workers; their pops return NULL
+    CHECK(taskqueue_resize_workers(3, idle_worker) == 0);
+    CHECK(taskqueue_resize_workers(0, idle_worker) == 0);
+    sleep_ms(100);
+    CHECK(taskqueue_push(&delivered[0]) == 0);
+    sleep_ms(100);
+    CHECK(taskqueue_pop() == &delivered[0]);
+    return check_done("taskqueue");
+}
@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../config.h"
+#include "../filehandler.h"
+#include "../watcher.h"
+#include "check.h"
+
+#define DEBOUNCE_MS 300
+#define MAX_DELAY_MS 1000
+
+static char dir[256];
+
+// Files the watcher queued, by name, with when
+static pthread_mutex_t queued_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    char name[64];
+    long at_ms;
+} queued[256];
+static int queued_count;
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// The service's mkdir_p and enqueue_file live in main.c
+int mkdir_p(const char *p, mode_t mode) {
+    return mkdir(p, mode) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+int enqueue_file(const char *file_path, amqp_channel_t channel, uint64_t delivery_tag) {
+    (void)channel, (void)delivery_tag;
+    const char *slash = strrchr(file_path, '/');
+    pthread_mutex_lock(&queued_mutex);
+    if (queued_count < 256) {
+        snprintf(queued[queued_count].name, sizeof(queued[0].name), "%s", slash ? slash + 1 : file_path);
+        queued[queued_count++].at_ms = now_ms();
+    }
+    pthread_mutex_unlock(&queued_mutex);
+    return 0;
+}
+
+static int times_queued(const char *name, long *first_ms) {
+    int count = 0;
+    pthread_mutex_lock(&queued_mutex);
+    for (int i = 0; i < queued_count; i++) {
+        if (strcmp(queued[i].name, name) != 0) continue;
+        if (count++ == 0 && first_ms) *first_ms = queued[i].at_ms;
+    }
+    pthread_mutex_unlock(&queued_mutex);
+    return count;
+}
+
+// When name was first queued, waiting up to timeout_ms for it; -1 if it was not
+static long wait_queued(const char *name, long timeout_ms) {
+    long at = -1;
+    for (long start = now_ms(); now_ms() - start < timeout_ms; sleep_ms(10)) {
+        if (times_queued(name, &at) > 0) return at;
+    }
+    return -1;
+}
+
+static void write_file(const char *name, const char *data) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "a");
+    CHECK(f != NULL);
+    if (!f) return;
+    fputs(data, f);
+    fclose(f);
+}
+
+static void *watch(void *arg) {
+    (void)arg;
+    watch_directory(dir);
+    return NULL;
+}
+
+// Files present at startup are queued unless marked processed since their
+// last change; hidden and partial downloads never are
+static void start_watcher(void) {
+    char path[512];
+    write_file("new.txt", "a:b\n");
+    write_file("done.txt", "a:b\n");
+    write_file("changed.txt", "a:b\n");
+    write_file(".hidden", "a:b\n");
+    write_file("big.zip.part", "a:b\n");
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    CHECK(mkdir(path, 0777) == 0);
+    snprintf(path, sizeof(path), "%s/done.txt", dir);
+    watch_mark_processed(path);
+    snprintf(path, sizeof(path), "%s/changed.txt", dir);
+    watch_mark_processed(path);
+    snprintf(path, sizeof(path), "%s/gone.txt", dir);
+    watch_mark_processed(path);  // Moved away before it was marked: no marker
+
+    // A marker carries the file's mtime; a later write makes the file new again
+    struct stat st, marker;
+    snprintf(path, sizeof(path), "%s/%s/done.txt", dir, WATCH_STATE_DIR);
+    CHECK(stat(path, &marker) == 0 && marker.st_size == 0);
+    snprintf(path, sizeof(path), "%s/done.txt", dir);
+    CHECK(stat(path, &st) == 0 && st.st_mtim.tv_sec == marker.st_mtim.tv_sec &&
+          st.st_mtim.tv_nsec == marker.st_mtim.tv_nsec);
+    snprintf(path, sizeof(path), "%s/%s/gone.txt", dir, WATCH_STATE_DIR);
+    CHECK(access(path, F_OK) != 0);
+    snprintf(path, sizeof(path), "%s/changed.txt", dir);
+    struct timespec later[2] = {{0, UTIME_OMIT}, {st.st_mtim.tv_sec + 5, 0}};
+    CHECK(utimensat(AT_FDCWD, path, later, 0) == 0);
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, watch, NULL) == 0);
+    pthread_detach(thread);
+    CHECK(wait_queued("new.txt", 2000) >= 0);
+    CHECK(wait_queued("changed.txt", 2000) >= 0);
+    sleep_ms(DEBOUNCE_MS);
+    CHECK(times_queued("done.txt", NULL) == 0);
+    CHECK(times_queued(".hidden", NULL) == 0);
+    CHECK(times_queued("big.zip.part", NULL) == 0);
+    CHECK(times_queued("sub", NULL) == 0);
+    CHECK(times_queued(WATCH_STATE_DIR, NULL) == 0);
+}
+
+// A file is queued once the directory has been quiet for the debounce window,
+// once however often it was written meanwhile; a download renamed into place
+// is queued under its final name
+static void test_debounce(void) {
+    long start = now_ms();
+    write_file("burst.txt", "1\n");
+    sleep_ms(DEBOUNCE_MS / 3);
+    write_file("burst.txt", "2\n");
+    sleep_ms(DEBOUNCE_MS / 3);
+    write_file("burst.txt", "3\n");
+    long last = now_ms();
+    long at = wait_queued("burst.txt", 3000);
+    CHECK(at >= last + DEBOUNCE_MS - 50);
+    CHECK(at - start < MAX_DELAY_MS + 200);
+    sleep_ms(DEBOUNCE_MS);
+    CHECK(times_queued("burst.txt", NULL) == 1);
+
+    char from[512], to[512];
+    write_file("dump.zip.part", "x");
+    snprintf(from, sizeof(from), "%s/dump.zip.part", dir);
+    snprintf(to, sizeof(to), "%s/dump.zip", dir);
+    CHECK(rename(from, to) == 0);
+    CHECK(wait_queued("dump.zip", 3000) >= 0);
+    CHECK(times_queued("dump.zip.part", NULL) == 0);
+}
+
+// Files arriving faster than the debounce window are not held back forever:
+// the first is queued watch_max_delay_ms after it arrived
+static void test_max_delay(void) {
+    long start = now_ms();
+    char name[32];
+    int written = 0;
+    while (now_ms() - start < 2 * MAX_DELAY_MS) {
+        snprintf(name, sizeof(name), "steady%d.txt", written++);
+        write_file(name, "a:b\n");
+        sleep_ms(DEBOUNCE_MS / 3);
+    }
+    long at = wait_queued("steady0.txt", 100);
+    CHECK(at >= start + MAX_DELAY_MS - 50);
+    CHECK(at <= start + MAX_DELAY_MS + DEBOUNCE_MS);
+    snprintf(name, sizeof(name), "steady%d.txt", written - 1);
+    CHECK(wait_queued(name, 3000) >= 0);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    char debounce[16], max_delay[16];
+    snprintf(debounce, sizeof(debounce), "%d", DEBOUNCE_MS);
+    snprintf(max_delay, sizeof(max_delay), "%d", MAX_DELAY_MS);
+    setenv("FILEHANDLER_CONFIG", "/nonexistent/filehandler.conf", 1);
+    setenv("FILEHANDLER_WATCH_DEBOUNCE_MS", debounce, 1);
+    setenv("FILEHANDLER_WATCH_MAX_DELAY_MS", max_delay, 1);
+    CHECK(config_init() == 0);
+
+    start_watcher();
+    test_debounce();
+    test_max_delay();
+    check_rmdir(dir);
+    return check_done("watcher");
+}
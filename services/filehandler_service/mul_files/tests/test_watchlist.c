@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../watchlist.h"
+#include "check.h"
+
+static char dir[256];
+
+// Matches of one scan as sorted "pattern@offset" keys
+#define MAX_HITS 4096
+static uint64_t hits[MAX_HITS];
+static size_t hit_count;
+
+static void collect(void *ctx, uint32_t pattern, uint64_t offset) {
+    (void)ctx;
+    if (hit_count < MAX_HITS) hits[hit_count++] = offset << 16 | pattern;
+}
+
+static int by_value(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void write_list(const char *name, const char *body) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (!f) return;
+    fputs(body, f);
+    fclose(f);
+}
+
+// Scans text in pieces of step bytes and checks every occurrence of every
+// pattern, found by brute force, is reported exactly once at its start
+static void check_scan(const char *const *patterns, size_t count, const char *text, size_t step) {
+    Watchlist *wl = watchlist_acquire();
+    CHECK(wl != NULL && watchlist_size(wl) == count);
+    if (!wl) return;
+    WatchScanner sc;
+    watch_scan_begin(&sc, wl);
+    hit_count = 0;
+    size_t len = strlen(text);
+    for (size_t i = 0; i < len; i += step) watch_scan(&sc, text + i, len - i < step ? len - i : step, collect, NULL);
+    watchlist_release(wl);
+
+    static uint64_t want[MAX_HITS];
+    size_t want_count = 0;
+    for (size_t p = 0; p < count; p++) {
+        size_t n = strlen(patterns[p]);
+        for (size_t i = 0; i + n <= len && want_count < MAX_HITS; i++) {
+            if (strncasecmp(text + i, patterns[p], n) == 0) want[want_count++] = (uint64_t)i << 16 | p;
+        }
+    }
+    qsort(hits, hit_count, sizeof(hits[0]), by_value);
+    qsort(want, want_count, sizeof(want[0]), by_value);
+    if (hit_count != want_count || memcmp(hits, want, hit_count * sizeof(hits[0])) != 0) {
+        fprintf(stderr, "step %zu: %zu hits, want %zu\n", step, hit_count, want_count);
+    }
+    CHECK(hit_count == want_count);
+    CHECK(memcmp(hits, want, (hit_count < want_count ? hit_count : want_count) * sizeof(hits[0])) == 0);
+}
+
+static const size_t steps[] = {1, 2, 5, 15, 16, 17, 1 << 20};
+#define STEPS (sizeof(steps) / sizeof(steps[0]))
+
+// Few start bytes, so the SSE2 prefilter runs; patterns overlap and nest
+static void test_overlapping(void) {
+    static const char *const patterns[] = {"acme.com", "acme", "me.co", "secretproject"};
+    write_list("corp.txt", "# Corp domains\nACME.com\n  acme  \n\nme.co\nSecretProject\n");
+    CHECK(watchlist_load(dir) == 0);
+    static char text[8192];
+    size_t len = 0;
+    for (int i = 0; len + 200 < sizeof(text); i++) {
+        len += (size_t)snprintf(text + len, sizeof(text) - len, "%*s%s", i % 23, "",
+                                i % 3 == 0 ? "user@AcMe.CoM:pw " : i % 3 == 1 ? "acmacme secretprojec" : "SECRETPROJECT\n");
+    }
+    for (size_t i = 0; i < STEPS; i++) check_scan(patterns, 4, text, steps[i]);
+}
+
+// More start bytes than the prefilter holds: the scalar skip takes over
+static void test_many_starts(void) {
+    static const char *const patterns[] = {"alpha", "bravo", "charlie", "delta", "echo",
+                                           "foxtrot", "golf", "hotel", "india", "juliet"};
+    write_list("corp.txt", "alpha\nbravo\ncharlie\ndelta\necho\nfoxtrot\ngolf\nhotel\nindia\njuliet\n");
+    CHECK(watchlist_load(dir) == 0);
+    const char *text = "xxAlphaBRAVOcharliedeltaechofoxtrotgolfhotelindiajuliet alph a bravo--juLIEThotelindia";
+    for (size_t i = 0; i < STEPS; i++) check_scan(patterns, 10, text, steps[i]);
+}
+
+static void test_reports(void) {
+    write_list("corp.txt", "acme.com\n");
+    write_list("people.txt", "john.doe@acme.com\n");
+    CHECK(watchlist_load(dir) == 0);
+    Watchlist *wl = watchlist_acquire();
+    CHECK(wl != NULL && watchlist_size(wl) == 2);
+    if (!wl) return;
+
+    watchlist_enable_publish();
+    WatchScanner sc;
+    watch_scan_begin(&sc, wl);
+    hit_count = 0;
+    watch_scan(&sc, "login: John.Doe@", 16, collect, NULL);
+    watch_scan(&sc, "ACME.com\n", 9, collect, NULL);  // Both matches span the two calls
+    CHECK(hit_count == 2);
+    for (size_t i = 0; i < hit_count; i++) {
+        watchlist_report(wl, (uint32_t)(hits[i] & 0xffff), "dump.zip/a\"b.txt", hits[i] >> 16);
+    }
+    watchlist_release(wl);
+
+    int corp = 0, people = 0;
+    WatchHit *hit = watchlist_take_hits();
+    while (hit) {
+        corp += strcmp(hit->body, "{\"list\":\"corp\",\"pattern\":\"acme.com\",\"source\":\"dump.zip/a\\\"b.txt\","
+                                  "\"offset\":16}") == 0;
+        people += strcmp(hit->body, "{\"list\":\"people\",\"pattern\":\"john.doe@acme.com\","
+                                    "\"source\":\"dump.zip/a\\\"b.txt\",\"offset\":7}") == 0;
+        WatchHit *next = hit->next;
+        free(hit->body);
+        free(hit);
+        hit = next;
+    }
+    CHECK(corp == 1);
+    CHECK(people == 1);
+    CHECK(watchlist_take_hits() == NULL);
+}
+
+int main(void) {
+    check_tmpdir(dir, sizeof(dir));
+    test_overlapping();
+    test_many_starts();
+    test_reports();
+
+    // Without patterns, or without the directory, scanning is off
+    write_list("corp.txt", "# nothing yet\n");
+    write_list("people.txt", "\n");
+    CHECK(watchlist_load(dir) == 0);
+    CHECK(watchlist_acquire() == NULL);
+    check_rmdir(dir);
+    CHECK(watchlist_load(dir) == 0);
+    CHECK(watchlist_acquire() == NULL);
+    return check_done("watchlist");
+}
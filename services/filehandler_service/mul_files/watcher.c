@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+#include "filehandler.h"
+#include "watcher.h"
+
+// Layout of the records returned by getdents64 (not exported by glibc headers)
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    char *names[WATCH_BATCH_MAX];
+    int count;
+    struct timespec first;  // When the oldest pending file arrived
+} WatchBatch;
+
+// Skip hidden files and the usual in-progress download suffixes; the writer
+// renames them into place, which arrives as IN_MOVED_TO
+static int is_ignored_name(const char *name) {
+    if (name[0] == '.') return 1;
+    const char *ext = strrchr(name, '.');
+    if (ext && (strcmp(ext, ".part") == 0 || strcmp(ext, ".tmp") == 0 || strcmp(ext, ".crdownload") == 0)) {
+        return 1;
+    }
+    return 0;
+}
+
+static void enqueue_entry(const char *dir, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (enqueue_file(path, 0, 0) != 0) {
+        log_error("Failed to enqueue watched file %s", path);
+    }
+}
+
+void watch_mark_processed(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return;  // Moved away meanwhile
+    const char *slash = strrchr(path, '/');
+    char marker[PATH_MAX];
+    if (slash) snprintf(marker, sizeof(marker), "%.*s/%s", (int)(slash - path), path, WATCH_STATE_DIR);
+    else snprintf(marker, sizeof(marker), "%s", WATCH_STATE_DIR);
+    if (mkdir(marker, 0777) == -1 && errno != EEXIST) {
+        log_warning("Failed to create %s: %s", marker, strerror(errno));
+        return;
+    }
+    size_t len = strlen(marker);
+    snprintf(marker + len, sizeof(marker) - len, "/%s", slash ? slash + 1 : path);
+    int fd = open(marker, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    struct timespec times[2] = {st.st_mtim, st.st_mtim};
+    if (fd == -1 || futimens(fd, times) != 0) log_warning("Failed to mark %s as processed: %s", path, strerror(errno));
+    if (fd != -1) close(fd);
+}
+
+// Whether name has a marker with its current mtime
+static int is_processed(int dir_fd, int state_fd, const char *name) {
+    struct stat st, marker;
+    if (state_fd == -1 || fstatat(dir_fd, name, &st, 0) != 0 || fstatat(state_fd, name, &marker, 0) != 0) return 0;
+    return marker.st_mtim.tv_sec == st.st_mtim.tv_sec && marker.st_mtim.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+// Enqueue the regular files already present, reading the directory with large
+// getdents64 calls instead of one readdir round trip per entry
+static int initial_scan(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        log_error("Failed to open watch directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    int state_fd = openat(fd, WATCH_STATE_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    char buffer[65536] __attribute__((aligned(8)));
+    int queued = 0, skipped = 0;
+    long nread;
+    while ((nread = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buffer + pos);
+            pos += d->d_reclen;
+
+            if (is_ignored_name(d->d_name)) continue;
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode)) {
+                    type = DT_REG;
+                }
+            }
+            if (type != DT_REG) continue;
+            if (is_processed(fd, state_fd, d->d_name)) {
+                skipped++;
+                continue;
+            }
+
+            enqueue_entry(dir, d->d_name);
+            queued++;
+        }
+    }
+    if (nread == -1) {
+        log_error("Failed to read watch directory %s: %s", dir, strerror(errno));
+    }
+    if (state_fd != -1) close(state_fd);
+    close(fd);
+
+    log_info("Initial scan of %s queued %d files (%d already processed)", dir, queued, skipped);
+    return nread == -1 ? -1 : 0;
+}
+
+static void batch_add(WatchBatch *batch, const char *name) {
+    for (int i = 0; i < batch->count; i++) {
+        if (strcmp(batch->names[i], name) == 0) return;
+    }
+    char *copy = strdup(name);
+    if (!copy) {
+        log_error("Failed to allocate watch event for %s", name);
+        return;
+    }
+    if (batch->count == 0) clock_gettime(CLOCK_MONOTONIC, &batch->first);
+    batch->names[batch->count++] = copy;
+}
+
+static void batch_flush(WatchBatch *batch, const char *dir) {
+    for (int i = 0; i < batch->count; i++) {
+        enqueue_entry(dir, batch->names[i]);
+        free(batch->names[i]);
+    }
+    if (batch->count > 0) {
+        log_info("Queued %d watched files from %s", batch->count, dir);
+    }
+    batch->count = 0;
+}
+
+int watch_directory(const char *dir) {
+    if (mkdir_p(dir, 0777) == -1) {
+        log_error("Failed to create watch directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    // Register the watch before scanning so nothing written in between is missed
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd == -1) {
+        log_error("Failed to initialise inotify: %s", strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        log_error("Failed to watch %s: %s", dir, strerror(errno));
+        close(ifd);
+        return -1;
+    }
+
+    initial_scan(dir);
+    log_info("Watching %s for new files", dir);
+
+    WatchBatch batch = {0};
+    char events[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = {ifd, POLLIN, 0};
+
+    while (1) {
+        // Block indefinitely while idle; once events are pending wait for the debounce
+        // window, but no longer than watch_max_delay_ms after the first of them
+        int debounce_ms = -1;
+        if (batch.count > 0) {
+            Config *cfg = config_acquire();
+            debounce_ms = cfg->watch_debounce_ms;
+            int max_delay_ms = cfg->watch_max_delay_ms;
+            config_release(cfg);
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long waited_ms = (long long)(now.tv_sec - batch.first.tv_sec) * 1000 +
+                                  (now.tv_nsec - batch.first.tv_nsec) / 1000000;
+            if (max_delay_ms > 0 && waited_ms >= max_delay_ms) {
+                batch_flush(&batch, dir);
+                continue;
+            }
+            if (max_delay_ms > 0 && waited_ms + debounce_ms > max_delay_ms) debounce_ms = (int)(max_delay_ms - waited_ms);
+        }
+        int ready = poll(&pfd, 1, debounce_ms);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            log_error("Failed to poll inotify: %s", strerror(errno));
+            break;
+        }
+        if (ready == 0) {
+            batch_flush(&batch, dir);
+            continue;
+        }
+
+        ssize_t len = read(ifd, events, sizeof(events));
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR) continue;
+            log_error("Failed to read inotify events: %s", strerror(errno));
+            break;
+        }
+
+        for (char *p = events; p < events + len;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                log_warning("inotify queue overflowed, rescanning %s", dir);
+                batch_flush(&batch, dir);
+                initial_scan(dir);
+                continue;
+            }
+            if (event->len == 0 || (event->mask & IN_ISDIR) || is_ignored_name(event->name)) continue;
+
+            batch_add(&batch, event->name);
+            if (batch.count == WATCH_BATCH_MAX) {
+                batch_flush(&batch, dir);
+            }
+        }
+    }
+
+    batch_flush(&batch, dir);
+    close(ifd);
+    return -1;
+}
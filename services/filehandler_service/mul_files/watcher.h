@@ -0,0 +1,16 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#define WATCH_BATCH_MAX 256  // Flush early once this many distinct files are pending
+#define WATCH_STATE_DIR ".processed"  // Markers of processed files, inside the watched directory
+
+// Broker-less intake: enqueue every regular file already in dir that has not
+// been processed since it last changed, then every file closed after writing
+// or moved into it. Blocks; returns -1 on setup failure.
+int watch_directory(const char *dir);
+
+// Record that a watched file was processed (or quarantined): an empty marker
+// in WATCH_STATE_DIR with the file's mtime, so a restart does not queue it again
+void watch_mark_processed(const char *path);
+
+#endif
@@ -0,0 +1,408 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "filehandler.h"
+#include "json.h"
+#include "watchlist.h"
+
+#define MATCH_FLAG 0x80000000u  // Set on transitions into a state where some pattern ends
+#define STATE_MASK 0x7fffffffu
+#define NO_PATTERN UINT32_MAX
+#define WATCHLIST_REPORT_FIELD 1024  // Longer lists, patterns and sources are cut in published hits
+
+struct Watchlist {
+    int refs;
+    uint32_t states;
+    uint32_t classes;
+    uint8_t class_of[256];  // Bytes that occur in no pattern share class 0, letters fold case
+    uint32_t *next;  // Complete DFA, states x classes
+    uint32_t *pattern_at;  // Pattern ending exactly at each state
+    uint32_t *dict_link;  // Nearest proper suffix state where a pattern ends, 0 for none
+
+    uint32_t pattern_count;
+    char **patterns;
+    uint32_t *pattern_len;
+    uint32_t *pattern_list;
+    char **lists;
+    uint32_t list_count;
+
+    uint8_t is_start[256];  // Bytes that leave the root state
+    int start_count;  // Distinct start bytes with the case bit folded in
+#ifdef __SSE2__
+    __m128i start_vec[WATCHLIST_SIMD_STARTS];
+#endif
+};
+
+static pthread_mutex_t watchlist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Watchlist *current = NULL;
+
+static pthread_mutex_t outbox_mutex = PTHREAD_MUTEX_INITIALIZER;
+static WatchHit *outbox_head = NULL;
+static WatchHit *outbox_tail = NULL;
+static int outbox_size = 0;
+static int publish_enabled = 0;
+
+static void watchlist_free(Watchlist *wl) {
+    for (uint32_t i = 0; i < wl->pattern_count; i++) free(wl->patterns[i]);
+    for (uint32_t i = 0; i < wl->list_count; i++) free(wl->lists[i]);
+    free(wl->patterns);
+    free(wl->pattern_len);
+    free(wl->pattern_list);
+    free(wl->lists);
+    free(wl->next);
+    free(wl->pattern_at);
+    free(wl->dict_link);
+    free(wl);
+}
+
+static int add_pattern(Watchlist *wl, uint32_t *capacity, const char *pattern, size_t len) {
+    if (wl->pattern_count == *capacity) {
+        uint32_t grown = *capacity ? *capacity * 2 : 256;
+        char **patterns = realloc(wl->patterns, grown * sizeof(char *));
+        if (patterns) wl->patterns = patterns;
+        uint32_t *lens = realloc(wl->pattern_len, grown * sizeof(uint32_t));
+        if (lens) wl->pattern_len = lens;
+        uint32_t *lists = realloc(wl->pattern_list, grown * sizeof(uint32_t));
+        if (lists) wl->pattern_list = lists;
+        if (!patterns || !lens || !lists) return -1;
+        *capacity = grown;
+    }
+    char *copy = strndup(pattern, len);
+    if (!copy) return -1;
+    wl->patterns[wl->pattern_count] = copy;
+    wl->pattern_len[wl->pattern_count] = (uint32_t)len;
+    wl->pattern_list[wl->pattern_count] = wl->list_count - 1;
+    wl->pattern_count++;
+    return 0;
+}
+
+static int load_list(Watchlist *wl, uint32_t *capacity, const char *dir, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        log_error("Failed to open watchlist %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char **lists = realloc(wl->lists, (wl->list_count + 1) * sizeof(char *));
+    if (!lists || !(lists[wl->list_count] = strndup(name, strlen(name) - 4))) {
+        if (lists) wl->lists = lists;
+        log_error("Failed to allocate watchlist %s", path);
+        fclose(f);
+        return -1;
+    }
+    wl->lists = lists;
+    wl->list_count++;
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    int line_no = 0, rc = 0;
+    while ((n = getline(&line, &line_cap, f)) != -1) {
+        line_no++;
+        char *s = line;
+        while (isspace((unsigned char)*s)) s++;
+        char *end = line + n;
+        while (end > s && isspace((unsigned char)end[-1])) end--;
+        if (end == s || *s == '#') continue;
+        if (end - s > WATCHLIST_MAX_PATTERN) {
+            log_warning("Skipping watchlist pattern at %s:%d: longer than %d bytes", path, line_no,
+                        WATCHLIST_MAX_PATTERN);
+            continue;
+        }
+        for (char *c = s; c < end; c++) *c = (char)tolower((unsigned char)*c);
+        if (add_pattern(wl, capacity, s, end - s) != 0) {
+            log_error("Failed to allocate watchlist patterns from %s", path);
+            rc = -1;
+            break;
+        }
+    }
+    if (rc == 0 && ferror(f)) {
+        log_error("Failed to read watchlist %s: %s", path, strerror(errno));
+        rc = -1;
+    }
+    free(line);
+    fclose(f);
+    return rc;
+}
+
+// Build the goto trie, then complete it into a DFA in BFS order so every
+// state's failure state already has its full row when the state is visited
+static int compile(Watchlist *wl) {
+    wl->classes = 1;
+    for (uint32_t p = 0; p < wl->pattern_count; p++) {
+        for (uint32_t i = 0; i < wl->pattern_len[p]; i++) {
+            uint8_t b = (uint8_t)wl->patterns[p][i];
+            if (wl->class_of[b]) continue;
+            wl->class_of[b] = (uint8_t)wl->classes;
+            if (b >= 'a' && b <= 'z') wl->class_of[b - 32] = (uint8_t)wl->classes;
+            wl->classes++;
+        }
+    }
+
+    size_t max_states = 1;
+    for (uint32_t p = 0; p < wl->pattern_count; p++) max_states += wl->pattern_len[p];
+    const uint32_t C = wl->classes;
+    wl->next = calloc(max_states * C, sizeof(uint32_t));
+    wl->pattern_at = malloc(max_states * sizeof(uint32_t));
+    wl->dict_link = calloc(max_states, sizeof(uint32_t));
+    uint32_t *fail = calloc(max_states, sizeof(uint32_t));
+    uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+    if (!wl->next || !wl->pattern_at || !wl->dict_link || !fail || !queue) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+    for (size_t s = 0; s < max_states; s++) wl->pattern_at[s] = NO_PATTERN;
+
+    wl->states = 1;
+    for (uint32_t p = 0; p < wl->pattern_count; p++) {
+        uint32_t s = 0;
+        for (uint32_t i = 0; i < wl->pattern_len[p]; i++) {
+            uint32_t *edge = &wl->next[(size_t)s * C + wl->class_of[(uint8_t)wl->patterns[p][i]]];
+            if (!*edge) *edge = wl->states++;
+            s = *edge;
+        }
+        if (wl->pattern_at[s] == NO_PATTERN) wl->pattern_at[s] = p;  // Duplicates report once
+    }
+
+    size_t head = 0, tail = 0;
+    for (uint32_t c = 0; c < C; c++) {
+        if (wl->next[c]) queue[tail++] = wl->next[c];
+    }
+    while (head < tail) {
+        uint32_t s = queue[head++];
+        for (uint32_t c = 0; c < C; c++) {
+            uint32_t *edge = &wl->next[(size_t)s * C + c];
+            uint32_t f = wl->next[(size_t)fail[s] * C + c];
+            if (*edge) {
+                uint32_t t = *edge;
+                fail[t] = f;
+                wl->dict_link[t] = wl->pattern_at[f] != NO_PATTERN ? f : wl->dict_link[f];
+                queue[tail++] = t;
+            } else {
+                *edge = f;
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+
+    for (size_t i = 0; i < (size_t)wl->states * C; i++) {
+        uint32_t t = wl->next[i];
+        if (wl->pattern_at[t] != NO_PATTERN || wl->dict_link[t]) wl->next[i] = t | MATCH_FLAG;
+    }
+
+    uint8_t folded[256] = {0};
+    for (int b = 0; b < 256; b++) {
+        if (!wl->next[wl->class_of[b]]) continue;
+        wl->is_start[b] = 1;
+        if (!folded[b | 0x20]) {
+            folded[b | 0x20] = 1;
+#ifdef __SSE2__
+            if (wl->start_count < WATCHLIST_SIMD_STARTS) wl->start_vec[wl->start_count] = _mm_set1_epi8((char)(b | 0x20));
+#endif
+            wl->start_count++;
+        }
+    }
+    return 0;
+}
+
+// Make wl (or no watchlist) current; tasks holding the old one keep it until they release it
+static void install(Watchlist *wl) {
+    pthread_mutex_lock(&watchlist_mutex);
+    Watchlist *old = current;
+    current = wl;
+    if (old && --old->refs == 0) watchlist_free(old);
+    pthread_mutex_unlock(&watchlist_mutex);
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t n = strlen(name), s = strlen(suffix);
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+int watchlist_load(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        if (errno != ENOENT) {
+            log_error("Failed to open watchlist directory %s: %s", dir, strerror(errno));
+            return -1;
+        }
+        log_info("No watchlist directory %s; watchlist scanning disabled", dir);
+        install(NULL);
+        return 0;
+    }
+
+    Watchlist *wl = calloc(1, sizeof(Watchlist));
+    if (!wl) {
+        closedir(d);
+        log_error("Failed to allocate watchlist");
+        return -1;
+    }
+    uint32_t capacity = 0;
+    int rc = 0;
+    struct dirent *e;
+    while (rc == 0 && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.' || !has_suffix(e->d_name, ".txt")) continue;
+        rc = load_list(wl, &capacity, dir, e->d_name);
+    }
+    closedir(d);
+
+    if (rc == 0 && wl->pattern_count > 0 && compile(wl) != 0) {
+        log_error("Failed to compile watchlist from %s", dir);
+        rc = -1;
+    }
+    if (rc != 0) {
+        watchlist_free(wl);
+        return -1;
+    }
+
+    if (wl->pattern_count == 0) {
+        log_info("Watchlist directory %s has no patterns; watchlist scanning disabled", dir);
+        watchlist_free(wl);
+        install(NULL);
+        return 0;
+    }
+    wl->refs = 1;  // Held by `current`
+    log_info("Loaded %u watchlist patterns from %u lists in %s (%u DFA states)", wl->pattern_count, wl->list_count,
+             dir, wl->states);
+    install(wl);
+    return 0;
+}
+
+Watchlist *watchlist_acquire(void) {
+    pthread_mutex_lock(&watchlist_mutex);
+    Watchlist *wl = current;
+    if (wl) wl->refs++;
+    pthread_mutex_unlock(&watchlist_mutex);
+    return wl;
+}
+
+void watchlist_release(Watchlist *wl) {
+    pthread_mutex_lock(&watchlist_mutex);
+    if (--wl->refs == 0) watchlist_free(wl);
+    pthread_mutex_unlock(&watchlist_mutex);
+}
+
+uint32_t watchlist_size(const Watchlist *wl) {
+    return wl->pattern_count;
+}
+
+void watch_scan_begin(WatchScanner *sc, const Watchlist *wl) {
+    sc->wl = wl;
+    sc->state = 0;
+    sc->offset = 0;
+}
+
+// From the root state only a start byte can make progress, so jump to the next
+// candidate. With few distinct start bytes this compares 16 bytes at a time
+// (case bit folded in, so the odd false candidate just steps back to root).
+static size_t skip_to_start(const Watchlist *wl, const uint8_t *data, size_t i, size_t len) {
+#ifdef __SSE2__
+    if (wl->start_count <= WATCHLIST_SIMD_STARTS) {
+        const __m128i fold = _mm_set1_epi8(0x20);
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i)), fold);
+            __m128i hit = _mm_cmpeq_epi8(v, wl->start_vec[0]);
+            for (int k = 1; k < wl->start_count; k++) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, wl->start_vec[k]));
+            int mask = _mm_movemask_epi8(hit);
+            if (mask) return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (i < len && !wl->is_start[data[i]]) i++;
+    return i;
+}
+
+void watch_scan(WatchScanner *sc, const void *data, size_t len, watch_match_fn match, void *ctx) {
+    const Watchlist *wl = sc->wl;
+    const uint8_t *bytes = data;
+    const uint32_t *next = wl->next;
+    const uint32_t C = wl->classes;
+    uint32_t state = sc->state;
+
+    size_t i = 0;
+    while (i < len) {
+        if (state == 0) {
+            i = skip_to_start(wl, bytes, i, len);
+            if (i == len) break;
+        }
+        uint32_t t = next[(size_t)state * C + wl->class_of[bytes[i++]]];
+        state = t & STATE_MASK;
+        if (!(t & MATCH_FLAG)) continue;
+
+        uint64_t end = sc->offset + i;
+        uint32_t s = wl->pattern_at[state] != NO_PATTERN ? state : wl->dict_link[state];
+        while (s) {
+            uint32_t p = wl->pattern_at[s];
+            match(ctx, p, end - wl->pattern_len[p]);
+            s = wl->dict_link[s];
+        }
+    }
+    sc->state = state;
+    sc->offset += len;
+}
+
+void watchlist_report(const Watchlist *wl, uint32_t pattern, const char *source, uint64_t offset) {
+    const char *list = wl->lists[wl->pattern_list[pattern]];
+    log_warning("Watchlist hit: %s (%s) in %s at offset %llu", wl->patterns[pattern], list, source,
+                (unsigned long long)offset);
+
+    pthread_mutex_lock(&outbox_mutex);
+    int queue = publish_enabled && outbox_size < WATCHLIST_OUTBOX_MAX;
+    pthread_mutex_unlock(&outbox_mutex);
+    if (!queue) return;
+
+    char body[3 * WATCHLIST_REPORT_FIELD * 6 + 128];
+    size_t used = 0;
+    size_t pattern_len = wl->pattern_len[pattern] < WATCHLIST_REPORT_FIELD ? wl->pattern_len[pattern]
+                                                                           : WATCHLIST_REPORT_FIELD;
+    json_appendf(body, sizeof(body), &used, "{\"list\":");
+    json_append_string(body, sizeof(body), &used, list, strnlen(list, WATCHLIST_REPORT_FIELD));
+    json_appendf(body, sizeof(body), &used, ",\"pattern\":");
+    json_append_string(body, sizeof(body), &used, wl->patterns[pattern], pattern_len);
+    json_appendf(body, sizeof(body), &used, ",\"source\":");
+    json_append_string(body, sizeof(body), &used, source, strnlen(source, WATCHLIST_REPORT_FIELD));
+    json_appendf(body, sizeof(body), &used, ",\"offset\":%llu}", (unsigned long long)offset);
+
+    WatchHit *hit = malloc(sizeof(WatchHit));
+    if (!hit || !(hit->body = strdup(body))) {
+        free(hit);
+        log_error("Failed to queue watchlist hit for %s", source);
+        return;
+    }
+    hit->next = NULL;
+    pthread_mutex_lock(&outbox_mutex);
+    if (outbox_tail) outbox_tail->next = hit;
+    else outbox_head = hit;
+    outbox_tail = hit;
+    outbox_size++;
+    pthread_mutex_unlock(&outbox_mutex);
+}
+
+void watchlist_enable_publish(void) {
+    pthread_mutex_lock(&outbox_mutex);
+    publish_enabled = 1;
+    pthread_mutex_unlock(&outbox_mutex);
+}
+
+WatchHit *watchlist_take_hits(void) {
+    pthread_mutex_lock(&outbox_mutex);
+    WatchHit *hits = outbox_head;
+    outbox_head = outbox_tail = NULL;
+    outbox_size = 0;
+    pthread_mutex_unlock(&outbox_mutex);
+    return hits;
+}
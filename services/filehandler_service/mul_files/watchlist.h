@@ -0,0 +1,53 @@
+#ifndef WATCHLIST_H
+#define WATCHLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WATCHLIST_MAX_PATTERN 256
+#define WATCHLIST_SIMD_STARTS 8  // Distinct start bytes the SSE2 prefilter can compare against
+#define WATCHLIST_OUTBOX_MAX 4096  // Unpublished hits kept before new ones are only logged
+#define WATCHLIST_HITS_QUEUE "watchlist_hits"
+
+// Case-insensitive Aho-Corasick automaton compiled from every *.txt file in the
+// watchlist directory: one pattern per line, '#' starts a comment line, and the
+// file name (without .txt) is reported as the pattern's list.
+typedef struct Watchlist Watchlist;
+
+// Compile dir and make it the current watchlist. A missing directory or one
+// without patterns clears it; on a read error the current watchlist is kept.
+int watchlist_load(const char *dir);
+
+// Pin the current watchlist (NULL when none is loaded); pair with a release
+Watchlist *watchlist_acquire(void);
+void watchlist_release(Watchlist *wl);
+uint32_t watchlist_size(const Watchlist *wl);
+
+typedef void (*watch_match_fn)(void *ctx, uint32_t pattern, uint64_t offset);
+
+// Streaming matcher state for one entry; matches spanning calls are found
+// because the automaton state carries over
+typedef struct {
+    const Watchlist *wl;
+    uint32_t state;
+    uint64_t offset;  // Bytes of the entry scanned so far
+} WatchScanner;
+
+void watch_scan_begin(WatchScanner *sc, const Watchlist *wl);
+// Calls match with the entry offset where each occurrence starts
+void watch_scan(WatchScanner *sc, const void *data, size_t len, watch_match_fn match, void *ctx);
+
+// Log a hit and, once publishing is enabled, queue it as a JSON message
+void watchlist_report(const Watchlist *wl, uint32_t pattern, const char *source, uint64_t offset);
+
+// Hits queued for the consumer thread, which owns the broker connection
+typedef struct WatchHit {
+    char *body;
+    struct WatchHit *next;
+} WatchHit;
+
+void watchlist_enable_publish(void);
+// Detach every queued hit, oldest first; the caller frees body and node
+WatchHit *watchlist_take_hits(void);
+
+#endif